@@ -76,11 +76,10 @@ using socket_t = SOCKET;
 #include <netinet/in.h>
 #ifdef __linux__
 #include <resolv.h>
+#include <sys/epoll.h>
 #endif
 #include <netinet/tcp.h>
-#ifdef CPPHTTPLIB_USE_POLL
 #include <poll.h>
-#endif
 #include <csignal>
 #include <pthread.h>
 #include <sys/select.h>
@@ -102,6 +101,7 @@ using socket_t = int;
 #include <climits>
 #include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <errno.h>
 #include <fcntl.h>
 #include <fstream>
@@ -112,6 +112,7 @@ using socket_t = int;
 #include <map>
 #include <memory>
 #include <mutex>
+#include <queue>
 #include <random>
 #include <regex>
 #include <set>
@@ -119,6 +120,7 @@ using socket_t = int;
 #include <string>
 #include <sys/stat.h>
 #include <thread>
+#include <unordered_map>
 #include "model.h"
 
 long long _GetCurrentTime() {
@@ -166,429 +168,860 @@ struct APIConfig {
     fastllm::DataType atype = fastllm::DataType::FLOAT32;
     int groupCnt = -1;
 
+    int workers = 4; // 处理请求(分词, 解码)的线程数
+    int maxConnections = 10000; // 最大连接数
+    int maxPending = 1024; // 最多排队的请求数, 超出后返回503
+
     std::map <std::string, int> devices;
 };
 APIConfig config;
 
-void ToNext(char * &cur, const std::string &target, std::string &v) {
-    v = "";
-    while (*cur != 0) {
-        bool stop = true;
-        for (int i = 0; i < target.size(); i++) {
-            if (cur[i] != target[i]) {
-                stop = false;
-                break;
-            }
-        }
-        if (stop && target.size() > 0) {
-            cur += target.size();
-            break;
-        } else {
-            v += *(cur++);
-        }
-    }
-}
+static const size_t maxRequestBytes = 16 * 1024 * 1024; // 单个请求的最大长度
+static const size_t outputHighWater = 1024 * 1024; // 输出缓冲超过这个值时暂停取token
+static const size_t outputLowWater = 64 * 1024; // 输出缓冲低于这个值时恢复取token
 
 struct HttpRequest {
     std::string method;
     std::string route;
     std::string type;
-    std::unordered_map <std::string, std::string> headers;
+    std::unordered_map <std::string, std::string> headers; // key为小写
     std::string body;
 
-    void Init (char *buffer) {
-        char *old = buffer;
+    // 尝试从buffer开头解析一个完整的请求, 返回消耗的字节数, 0代表还不完整, -1代表请求非法
+    long long Parse(const std::string &buffer) {
+        size_t headerEnd = buffer.find("\r\n\r\n");
+        if (headerEnd == std::string::npos) {
+            return buffer.size() > maxRequestBytes ? -1 : 0;
+        }
+        size_t lineEnd = buffer.find("\r\n");
+        std::string line = buffer.substr(0, lineEnd);
+        size_t s0 = line.find(' '), s1 = (s0 == std::string::npos ? std::string::npos : line.find(' ', s0 + 1));
+        if (s1 == std::string::npos) {
+            return -1;
+        }
+        method = line.substr(0, s0);
+        route = line.substr(s0 + 1, s1 - s0 - 1);
+        type = line.substr(s1 + 1);
         headers.clear();
-        ToNext(buffer, " ", method);
-        ToNext(buffer, " ", route);
-        ToNext(buffer, "\r\n", type);
-        while (true) {
-            if (buffer[0] == 0 || ((long long)(buffer - old)) > 1024 * 1024) {
-                break;
+        for (size_t cur = lineEnd + 2; cur < headerEnd; ) {
+            size_t next = buffer.find("\r\n", cur);
+            std::string kv = buffer.substr(cur, next - cur);
+            cur = next + 2;
+            size_t colon = kv.find(':');
+            if (colon == std::string::npos) {
+                continue;
             }
-            if (buffer[0] == '\r' && buffer[1] == '\n') {
-                buffer += 2;
-                ToNext(buffer, "", body);
-                break;
-            } else {
-                std::string key;
-                ToNext(buffer, ":", key);
-                ToNext(buffer, "\r\n", headers[key]);
+            std::string key = kv.substr(0, colon), value = kv.substr(colon + 1);
+            for (auto &c : key) {
+                c = tolower(c);
             }
+            while (value.size() > 0 && value[0] == ' ') {
+                value.erase(value.begin());
+            }
+            headers[key] = value;
+        }
+        long long contentLength = 0;
+        if (headers.find("content-length") != headers.end()) {
+            contentLength = atoll(headers["content-length"].c_str());
+        }
+        if (contentLength < 0 || contentLength > (long long)maxRequestBytes) {
+            return -1;
+        }
+        if (buffer.size() < headerEnd + 4 + contentLength) {
+            return 0;
         }
+        body = buffer.substr(headerEnd + 4, contentLength);
+        return headerEnd + 4 + contentLength;
     }
 
-    bool IsValid (char *buffer, int size) {
-        char *old = buffer;
-        headers.clear();
-        ToNext(buffer, " ", method);
-        ToNext(buffer, " ", route);
-        ToNext(buffer, "\r\n", type);
-        while (true) {
-            if (buffer[0] == 0 || ((long long)(buffer - old)) > 1024 * 1024) {
-                break;
+    bool KeepAlive() {
+        std::string connection = headers.find("connection") != headers.end() ? headers["connection"] : "";
+        for (auto &c : connection) {
+            c = tolower(c);
+        }
+        if (type == "HTTP/1.0") {
+            return connection == "keep-alive";
+        }
+        return connection != "close";
+    }
+};
+
+// epoll (linux) / poll 的简单封装, key用来找到对应的连接
+struct PollEvent {
+    long long key;
+    bool readable, writable;
+};
+
+#ifdef __linux__
+struct Poller {
+    int epfd = epoll_create1(0);
+    std::vector <epoll_event> events = std::vector <epoll_event> (1024);
+
+    void Set(int op, int fd, long long key, bool wantWrite) {
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | (wantWrite ? EPOLLOUT : 0);
+        ev.data.u64 = (uint64_t)key;
+        epoll_ctl(epfd, op, fd, &ev);
+    }
+
+    void Add(int fd, long long key, bool wantWrite) {
+        Set(EPOLL_CTL_ADD, fd, key, wantWrite);
+    }
+
+    void Modify(int fd, long long key, bool wantWrite) {
+        Set(EPOLL_CTL_MOD, fd, key, wantWrite);
+    }
+
+    void Remove(int fd) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void Wait(std::vector <PollEvent> &ret, int timeoutMs) {
+        ret.clear();
+        int n = epoll_wait(epfd, events.data(), events.size(), timeoutMs);
+        for (int i = 0; i < n; i++) {
+            bool error = (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+            ret.push_back(PollEvent {(long long)events[i].data.u64,
+                                     (events[i].events & EPOLLIN) != 0 || error, (events[i].events & EPOLLOUT) != 0});
+        }
+    }
+};
+#else
+struct Poller {
+    std::map <int, std::pair <long long, bool> > fds;
+
+    void Add(int fd, long long key, bool wantWrite) {
+        fds[fd] = std::make_pair(key, wantWrite);
+    }
+
+    void Modify(int fd, long long key, bool wantWrite) {
+        fds[fd] = std::make_pair(key, wantWrite);
+    }
+
+    void Remove(int fd) {
+        fds.erase(fd);
+    }
+
+    void Wait(std::vector <PollEvent> &ret, int timeoutMs) {
+        ret.clear();
+        std::vector <pollfd> pfds;
+        std::vector <long long> keys;
+        for (auto &it : fds) {
+            pfds.push_back(pollfd {it.first, (short)(POLLIN | (it.second.second ? POLLOUT : 0)), 0});
+            keys.push_back(it.second.first);
+        }
+        int n = poll(pfds.data(), pfds.size(), timeoutMs);
+        for (int i = 0; i < pfds.size() && n > 0; i++) {
+            if (pfds[i].revents != 0) {
+                bool error = (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+                ret.push_back(PollEvent {keys[i], (pfds[i].revents & POLLIN) != 0 || error, (pfds[i].revents & POLLOUT) != 0});
             }
-            if (buffer[0] == '\r' && buffer[1] == '\n') {
-                if (headers.find("Content-Length") != headers.end()) {
-                    if (size - ((long long)(buffer - old)) - 2 >= atoi(headers["Content-Length"].c_str())) {
-                        return true;
-                    } else {
-                        return false;
+        }
+    }
+};
+#endif
+
+// 固定大小的线程池, 处理分词 / 解码等耗时操作, 不在事件循环中做
+struct TaskPool {
+    std::mutex locker;
+    std::condition_variable cv;
+    std::queue <std::function <void()> > tasks;
+    std::vector <std::thread*> threads;
+
+    void Start(int n) {
+        for (int i = 0; i < n; i++) {
+            threads.push_back(new std::thread([this]() {
+                while (true) {
+                    std::function <void()> task;
+                    {
+                        std::unique_lock <std::mutex> lock(locker);
+                        cv.wait(lock, [this]() { return !tasks.empty(); });
+                        task = std::move(tasks.front());
+                        tasks.pop();
                     }
+                    task();
                 }
-            } else {
-                std::string key;
-                ToNext(buffer, ":", key);
-                ToNext(buffer, "\r\n", headers[key]);
-            }
+            }));
         }
-        return false;
     }
 
-    void Print() {
-        for (auto &it : headers) {
-            printf("%s: %s\n", it.first.c_str(), it.second.c_str());
+    void Push(std::function <void()> task) {
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            tasks.push(std::move(task));
         }
-        printf("body: %s\n", body.c_str());
+        cv.notify_one();
     }
-} httpChecker;
+};
+
+enum RouteType {
+    RouteGenerate = 0, RouteChatCompletions = 1
+};
 
-struct WorkNode {
-    int client;
+struct Connection {
+    long long id;
+    int fd;
+    std::string inBuffer; // 只在事件循环中访问
+
+    std::mutex locker; // 保护以下成员
+    std::string outBuffer;
+    bool busy = false; // 正在处理一个请求, keep-alive连接上的后续请求需要等待
+    bool closed = false;
+    bool keepAlive = true;
+    bool closeAfterWrite = false;
+    bool wantWrite = false;
+    bool draining = false, needDrain = false, throttled = false;
+    bool active = false; // 占用了一个生成位置
+
+    // 当前请求的生成状态
     HttpRequest request;
-    json11::Json config;
-    std::string error;
+    json11::Json body;
+    RouteType route;
+    int handleId = -1;
+    bool isStream = false;
+    std::string curId;
+    long long createTime = 0;
+    int promptTokens = 0, outputTokens = 0;
+    std::string output;
+};
 
-    void Init(char *buffer, int client) {
-        this->client = client;
-        request.Init(buffer);
-        config = json11::Json::parse(request.body, this->error);
+static void AppendChunk(std::string &out, const std::string &data) {
+    char chunkHeader[32];
+    snprintf(chunkHeader, sizeof(chunkHeader), "%zx\r\n", data.size());
+    out += chunkHeader;
+    out += data;
+    out += "\r\n";
+}
+
+static std::string MakeHttpHeader(const std::string &status, const std::string &contentType, bool keepAlive, long long contentLength) {
+    std::string message = "";
+    message += "HTTP/1.1 " + status + "\r\n";
+    message += "Content-Type: " + contentType + "\r\n";
+    message += "server: fastllm api server\r\n";
+    message += std::string("Connection: ") + (keepAlive ? "keep-alive" : "close") + "\r\n";
+    if (contentLength >= 0) {
+        message += "Content-Length: " + std::to_string(contentLength) + "\r\n";
+    } else {
+        message += "Transfer-Encoding: chunked\r\n";
     }
-};
+    message += "\r\n";
+    return message;
+}
 
-struct WorkQueue {
+static json11::Json MakeChunkResult(Connection *conn, const json11::Json::object &delta) {
+    return json11::Json::object {
+        {"id", conn->curId},
+        {"object", "chat.completion.chunk"},
+        {"created", conn->createTime},
+        {"model", ::config.modelName},
+        {"choices", json11::Json::array {
+            json11::Json::object {
+                {"index", 0},
+                {"delta", delta},
+                {"logprobs", nullptr},
+                {"finish_reason", nullptr},
+                {"stop_reason", nullptr}
+            }
+        }}
+    };
+}
+
+struct ApiServer {
     std::unique_ptr<fastllm::basellm> model;
+    TaskPool workers;
+    Poller poller;
+    int listenFd = -1;
+    int wakeFds[2];
     int maxActivateQueryNumber = 256;
+    long long totalQueryNumber = 0;
+
+    std::mutex locker; // 保护以下成员, 持有时不能调用model的接口
+    long long lastConnectionId = 0;
+    std::map <long long, std::shared_ptr <Connection> > conns;
+    std::map <int, std::shared_ptr <Connection> > handleConns;
+    std::deque <std::shared_ptr <Connection> > waiting; // 等待空闲位置的生成请求
+    std::vector <int> readyHandles;
+    std::vector <long long> dirtyConns;
     int activateQueryNumber = 0;
-    int totalQueryNumber = 0;
-    std::mutex locker;
-    std::condition_variable cv;
-    std::queue <WorkNode*> q;
-    std::thread *loop;
 
-    void Push(char *buffer, int client) {
-        locker.lock();
-        q.push(new WorkNode());
-        q.back()->Init(buffer, client);
-        locker.unlock();
+    void Wake() {
+        char c = 1;
+        if (write(wakeFds[1], &c, 1) < 0) {
+            // 管道已满时事件循环一定会被唤醒, 可以忽略
+        }
+    }
 
-        cv.notify_all();
+    // 模型主循环中调用
+    void OnResponseReady(int handleId) {
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            readyHandles.push_back(handleId);
+        }
+        Wake();
+    }
+
+    // 工作线程中调用, 通知事件循环这个连接有数据要写
+    void MarkDirty(const std::shared_ptr <Connection> &conn) {
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            dirtyConns.push_back(conn->id);
+        }
+        Wake();
+    }
+
+    void Respond(const std::shared_ptr <Connection> &conn, const std::string &status, const std::string &contentType, const std::string &body) {
+        {
+            std::lock_guard <std::mutex> guard(conn->locker);
+            conn->outBuffer += MakeHttpHeader(status, contentType, conn->keepAlive, body.size()) + body;
+            conn->closeAfterWrite |= !conn->keepAlive;
+            conn->busy = false;
+        }
+        MarkDirty(conn);
     }
 
     void Start() {
-        loop = new std::thread ([] (WorkQueue *ts) {
-            while (true) {
-                std::unique_lock <std::mutex> lock(ts->locker);
-                if (ts->activateQueryNumber >= ts->maxActivateQueryNumber) {
-                    fastllm::MySleep(0);
-                    continue;
-                }
-                if (ts->q.empty()) {
-                    ts->cv.wait(lock);
-                }
+        if (pipe(wakeFds) != 0) {
+            std::cout << "pipe error!" << std::endl;
+            exit(-1);
+        }
+        fcntl(wakeFds[0], F_SETFL, fcntl(wakeFds[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(wakeFds[1], F_SETFL, fcntl(wakeFds[1], F_GETFL, 0) | O_NONBLOCK);
+        model->responseNotifier = [this](int handleId) {
+            this->OnResponseReady(handleId);
+        };
+        workers.Start(std::max(1, config.workers));
+    }
 
-                while (ts->activateQueryNumber < ts->maxActivateQueryNumber && !ts->q.empty()) {
-                    WorkNode *now = ts->q.front();
-                    ts->q.pop();
-                    ts->activateQueryNumber++;
-
-                    ts->totalQueryNumber++;
-                    printf("totalQueryNumber = %d\n", ts->totalQueryNumber);
-//printf("activate = %d, q.size() = %d\n", ts->activateQueryNumber, (int) ts->q.size());
-
-                    std::thread *t = new std::thread([](WorkQueue *ts, WorkNode *now) {
-                        ts->Deal(now);
-                        printf("Response client %d finish\n", now->client);
-                        ts->locker.lock();
-                        ts->activateQueryNumber--;
-                        ts->locker.unlock();
-                    }, ts, now);
+    // 工作线程: 解析请求, 分词并启动生成
+    void StartGeneration(std::shared_ptr <Connection> conn) {
+        auto &body = conn->body;
+        fastllm::ChatMessages chatMessages;
+        std::string error = "";
+        if (conn->route == RouteGenerate) {
+            if (body["prompt"].is_null()) {
+                error = "prompt is empty!";
+            } else {
+                chatMessages.push_back({"user", body["prompt"].string_value()});
+            }
+        } else {
+            if (body["messages"].is_array()) {
+                for (auto &it : body["messages"].array_items()) {
+                    chatMessages.push_back({it["role"].string_value(), it["content"].string_value()});
                 }
+            } else if (body["prompt"].is_string()) {
+                chatMessages.push_back({"user", body["prompt"].string_value()});
+            } else {
+                error = "no input.\n";
             }
-        }, this);
-    }
+            if (body["model"].string_value() != ::config.modelName) {
+                error = "The model `" + body["model"].string_value() + "` does not exist.";
+            }
+        }
+        if (error != "") {
+            printf("error body = %s, error = %s\n", conn->request.body.c_str(), error.c_str());
+            ReleaseGeneration(conn);
+            Respond(conn, "400 Bad Request", "application/json", json11::Json(json11::Json::object {{"error", error}}).dump());
+            return;
+        }
 
-    void Deal(WorkNode *node) {
-        auto *req = &node->request;
-        if ((req->route == "/generate" || req->route == "/generate/") && req->method == "POST") {
-            std::string message = "";
-            message += "HTTP/1.1 200 OK\r\n";
-            message += "Content-Type:application/json\r\n";
-            message += "server:fastllm api server\r\n";
-            message += "\r\n";
+        auto prompt = model->ApplyChatTemplate(chatMessages);
+        auto inputs = model->weight.tokenizer.Encode(prompt);
+        std::vector<int> tokens;
+        for (int i = 0; i < inputs.Count(0); i++) {
+            tokens.push_back(((float *) inputs.cpuData)[i]);
+        }
+
+        fastllm::GenerationConfig config;
+        if (conn->route == RouteGenerate) {
+            config.output_token_limit = body["max_tokens"].is_null() ? 200 : body["max_tokens"].int_value();
+        } else {
+            config.output_token_limit = !body["max_tokens"].is_number() ? 256 : body["max_tokens"].int_value();
+            if (body["frequency_penalty"].is_number()) {
+                config.repeat_penalty = body["frequency_penalty"].number_value();
+            }
+            if (body["temperature"].is_number()) {
+                config.temperature = body["temperature"].number_value();
+            }
+            if (body["top_p"].is_number()) {
+                config.top_p = body["top_p"].number_value();
+            }
+            if (body["top_k"].is_number()) {
+                config.top_k = body["top_k"].number_value();
+            }
+        }
 
-            if (node->error == "") {
-                if (node->config["prompt"].is_null()) {
-                    node->error = "prompt is empty!";
+        {
+            std::lock_guard <std::mutex> guard(conn->locker);
+            conn->isStream = (conn->route == RouteGenerate) || (body["stream"].is_bool() && body["stream"].bool_value());
+            conn->curId = "fastllm-" + GenerateRandomID();
+            conn->createTime = _GetCurrentTime();
+            conn->promptTokens = tokens.size();
+            conn->outputTokens = 0;
+            conn->output = "";
+            if (conn->isStream) {
+                if (conn->route == RouteGenerate) {
+                    conn->outBuffer += MakeHttpHeader("200 OK", "text/plain; charset=utf-8", conn->keepAlive, -1);
+                } else {
+                    conn->outBuffer += MakeHttpHeader("200 OK", "text/event-stream", conn->keepAlive, -1);
+                    AppendChunk(conn->outBuffer, "data: " + MakeChunkResult(conn.get(), json11::Json::object {{"role", "assistant"}}).dump() + "\n\n");
                 }
             }
-            if (node->error != "") {
-                printf("error body = %s, prompt = %s, error = %s\n", node->request.body.c_str(), node->config["prompt"].string_value().c_str(), node->error.c_str());
-                message += node->error;
-                int ret = write(node->client, message.c_str(), message.length()); //返回error
-                close(node->client);
+        }
+        MarkDirty(conn);
+
+        int handleId = model->LaunchResponseTokens(tokens, config);
+        bool closed = false;
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            std::lock_guard <std::mutex> connGuard(conn->locker);
+            closed = conn->closed;
+            if (!closed) {
+                conn->handleId = handleId;
+                handleConns[handleId] = conn;
+            }
+        }
+        if (closed) {
+            model->AbortResponse(handleId);
+            return;
+        }
+        // 启动前就产生的通知找不到连接, 这里主动取一次
+        ScheduleDrain(conn);
+    }
+
+    void ScheduleDrain(std::shared_ptr <Connection> conn) {
+        {
+            std::lock_guard <std::mutex> guard(conn->locker);
+            if (conn->closed || conn->handleId == -1) {
                 return;
             }
+            if (conn->draining) {
+                conn->needDrain = true;
+                return;
+            }
+            conn->draining = true;
+        }
+        workers.Push([this, conn]() {
+            this->Drain(conn);
+        });
+    }
 
-            std::string output = "";
-            fastllm::ChatMessages messages;
-            messages.push_back({"user", node->config["prompt"].string_value()});
-            auto prompt = model->ApplyChatTemplate(messages);
-            auto inputs = model->weight.tokenizer.Encode(prompt);
-            std::vector<int> tokens;
-            for (int i = 0; i < inputs.Count(0); i++) {
-                tokens.push_back(((float *) inputs.cpuData)[i]);
-            }
-            fastllm::GenerationConfig config;
-            config.output_token_limit = node->config["max_tokens"].is_null() ? 200 : node->config["max_tokens"].int_value();
-            int handleId = model->LaunchResponseTokens(tokens, config);
-            std::vector<float> results;
-            while (true) {
+    // 工作线程: 取出已经生成的token, 写入输出缓冲
+    void Drain(std::shared_ptr <Connection> conn) {
+        while (true) {
+            int handleId;
+            {
+                std::lock_guard <std::mutex> guard(conn->locker);
+                conn->needDrain = false;
+                if (conn->closed || conn->handleId == -1) {
+                    conn->draining = false;
+                    return;
+                }
+                if (conn->outBuffer.size() > outputHighWater) {
+                    // 客户端读得太慢, 先不取token, 等缓冲区写出去之后再继续
+                    conn->throttled = true;
+                    conn->draining = false;
+                    return;
+                }
+                handleId = conn->handleId;
+            }
+
+            std::vector <float> results;
+            bool finished = false;
+            while (results.size() < 64 && model->CanFetchResponse(handleId)) {
                 int result = model->FetchResponseTokens(handleId);
-                if (result == -1) {
+                if (result < 0) {
+                    finished = true;
                     break;
-                } else {
-                    results.clear();
-                    results.push_back(result);
-                    output += model->weight.tokenizer.Decode(fastllm::Data (fastllm::DataType::FLOAT32, {(int)results.size()}, results));
+                }
+                results.push_back(result);
+            }
 
-                    std::string cur = (message + output);
-                    int ret = write(node->client, cur.c_str(), cur.length()); //返回message
+            std::string now = "";
+            if (results.size() > 0) {
+                now = model->weight.tokenizer.Decode(fastllm::Data (fastllm::DataType::FLOAT32, {(int)results.size()}, results));
+            }
+            {
+                std::lock_guard <std::mutex> guard(conn->locker);
+                conn->outputTokens += results.size();
+                if (conn->isStream) {
+                    if (now != "") {
+                        if (conn->route == RouteGenerate) {
+                            AppendChunk(conn->outBuffer, now);
+                        } else {
+                            AppendChunk(conn->outBuffer, "data: " + MakeChunkResult(conn.get(), json11::Json::object {{"content", now}}).dump() + "\n\n");
+                        }
+                    }
+                } else {
+                    conn->output += now;
+                }
+                if (finished) {
+                    FinishResponse(conn.get());
+                }
+            }
+            if (finished) {
+                // 先释放位置再允许处理下一个请求
+                ReleaseGeneration(conn);
+                {
+                    std::lock_guard <std::mutex> guard(conn->locker);
+                    conn->busy = false;
+                    conn->draining = false;
                 }
+                MarkDirty(conn);
+                return;
+            }
+            if (results.size() > 0) {
+                MarkDirty(conn);
             }
 
-            message += output;
-            int ret = write(node->client, message.c_str(), message.length()); //返回message
+            // 不能持有conn->locker调用模型接口; 这之后到达的通知会设置needDrain
+            bool more = model->CanFetchResponse(handleId);
+            std::lock_guard <std::mutex> guard(conn->locker);
+            if (!more && !conn->needDrain) {
+                conn->draining = false;
+                return;
+            }
+        }
+    }
 
-            close(node->client);
-        } else if ((req->route == "/v1/chat/completions" || req->route == "/v1/chat/completions/") && req->method == "POST") {
-            std::string message = "";
-            message += "HTTP/1.1 200 OK\r\n";
-            message += "Content-Type:application/json\r\n";
-            message += "server:fastllm api server\r\n";
-            message += "\r\n";
+    // 持有conn->locker时调用
+    void FinishResponse(Connection *conn) {
+        json11::Json::object usage = {
+            {"prompt_tokens", conn->promptTokens},
+            {"total_tokens", conn->promptTokens + conn->outputTokens},
+            {"completion_tokens", conn->outputTokens}
+        };
+        if (conn->isStream) {
+            if (conn->route == RouteChatCompletions) {
+                json11::Json::object last = MakeChunkResult(conn, json11::Json::object {{"content", ""}}).object_items();
+                last["usage"] = usage;
+                AppendChunk(conn->outBuffer, "data: " + json11::Json(last).dump() + "\n\n");
+                AppendChunk(conn->outBuffer, "data: [DONE]\n\n");
+            }
+            conn->outBuffer += "0\r\n\r\n";
+        } else {
+            json11::Json result = json11::Json::object {
+                {"id", conn->curId},
+                {"object", "chat.completion"},
+                {"created", conn->createTime},
+                {"model", ::config.modelName},
+                {"choices", json11::Json::array {
+                    json11::Json::object {
+                        {"index", 0},
+                        {"message", json11::Json::object {
+                            {"role", "assistant"},
+                            {"content", conn->output}
+                        }},
+                        {"logprobs", nullptr},
+                        {"finish_reason", nullptr},
+                        {"stop_reason", nullptr}
+                    }
+                }},
+                {"usage", usage}
+            };
+            std::string body = result.dump();
+            conn->outBuffer += MakeHttpHeader("200 OK", "application/json", conn->keepAlive, body.size()) + body;
+        }
+        conn->closeAfterWrite |= !conn->keepAlive;
+    }
 
-            fastllm::ChatMessages chatMessages;
-            if (node->config["messages"].is_array()) {
-                for (auto &it : node->config["messages"].array_items()) {
-                    chatMessages.push_back({it["role"].string_value(), it["content"].string_value()});
+    // 释放一个生成位置, 并启动排队中的请求. 返回这个连接之前是否占用了位置
+    bool ReleaseGeneration(const std::shared_ptr <Connection> &conn) {
+        std::vector <std::shared_ptr <Connection> > starts;
+        bool released = false;
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            std::lock_guard <std::mutex> connGuard(conn->locker);
+            if (conn->handleId != -1) {
+                handleConns.erase(conn->handleId);
+                conn->handleId = -1;
+            }
+            if (conn->active) {
+                conn->active = false;
+                activateQueryNumber--;
+                released = true;
+            }
+            while (activateQueryNumber < maxActivateQueryNumber && !waiting.empty()) {
+                auto next = waiting.front();
+                waiting.pop_front();
+                if (next->closed) {
+                    continue;
                 }
-            } else if (node->config["prompt"].is_string()) {
-                chatMessages.push_back({"user", node->config["prompt"].string_value()});
+                activateQueryNumber++;
+                next->active = true;
+                starts.push_back(next);
+            }
+        }
+        for (auto &next : starts) {
+            workers.Push([this, next]() {
+                this->StartGeneration(next);
+            });
+        }
+        return released;
+    }
+
+    // 事件循环: 尝试从输入缓冲中解析并处理下一个请求
+    void TryDispatch(const std::shared_ptr <Connection> &conn) {
+        HttpRequest request;
+        {
+            std::lock_guard <std::mutex> guard(conn->locker);
+            if (conn->busy || conn->closed || conn->closeAfterWrite) {
+                return;
+            }
+            long long len = request.Parse(conn->inBuffer);
+            if (len == 0) {
+                return;
+            }
+            if (len < 0) {
+                conn->keepAlive = false;
+                conn->busy = true;
             } else {
-                node->error = "no input.\n";
+                conn->inBuffer.erase(0, len);
+                conn->keepAlive = request.KeepAlive();
+                conn->busy = true;
+                conn->request = request;
+            }
+            if (len < 0) {
+                request.method = "";
             }
+        }
+        if (request.method == "") {
+            Respond(conn, "400 Bad Request", "text/plain", "bad request");
+            return;
+        }
+
+        std::string route = request.route;
+        if (route.size() > 1 && route.back() == '/') {
+            route.pop_back();
+        }
+        if (route == "/metrics" && request.method == "GET") {
+            Respond(conn, "200 OK", "text/plain; version=0.0.4", model->GetMetrics());
+            return;
+        }
+        RouteType routeType;
+        if (route == "/generate" && request.method == "POST") {
+            routeType = RouteGenerate;
+        } else if (route == "/v1/chat/completions" && request.method == "POST") {
+            routeType = RouteChatCompletions;
+        } else {
+            Respond(conn, "404 Not Found", "text/plain", "not found");
+            return;
+        }
+
+        std::string error;
+        json11::Json body = json11::Json::parse(request.body, error);
+        if (error != "") {
+            Respond(conn, "400 Bad Request", "application/json", json11::Json(json11::Json::object {{"error", error}}).dump());
+            return;
+        }
 
-            if (node->config["model"].string_value() != ::config.modelName) {
-                node->error = "The model `" + node->config["model"].string_value() + "` does not exist.";
+        bool start = false, reject = false;
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            std::lock_guard <std::mutex> connGuard(conn->locker);
+            conn->body = body;
+            conn->route = routeType;
+            totalQueryNumber++;
+            if (activateQueryNumber < maxActivateQueryNumber) {
+                activateQueryNumber++;
+                conn->active = true;
+                start = true;
+            } else if ((int)waiting.size() < config.maxPending) {
+                waiting.push_back(conn);
+            } else {
+                reject = true;
             }
+        }
+        if (reject) {
+            Respond(conn, "503 Service Unavailable", "application/json", json11::Json(json11::Json::object {{"error", "server is busy."}}).dump());
+        } else if (start) {
+            workers.Push([this, conn]() {
+                this->StartGeneration(conn);
+            });
+        }
+    }
 
-            if (node->error != "") {                
-                message += node->error;
-                int ret = write(node->client, message.c_str(), message.length()); //返回error
-                close(node->client);
+    // 事件循环: 把输出缓冲写到socket
+    void Flush(const std::shared_ptr <Connection> &conn) {
+        bool needClose = false, resume = false;
+        {
+            std::lock_guard <std::mutex> guard(conn->locker);
+            if (conn->closed) {
                 return;
             }
-
-            auto prompt = model->ApplyChatTemplate(chatMessages);
-            auto inputs = model->weight.tokenizer.Encode(prompt);
-            std::vector<int> tokens;
-            for (int i = 0; i < inputs.Count(0); i++) {
-                tokens.push_back(((float *) inputs.cpuData)[i]);
-            }
-
-            fastllm::GenerationConfig config;
-            config.output_token_limit = !node->config["max_tokens"].is_number() ? 256 : node->config["max_tokens"].int_value();
-            if (node->config["frequency_penalty"].is_number()) {
-                config.repeat_penalty = node->config["frequency_penalty"].number_value();
-            }
-            if (node->config["temperature"].is_number()) {
-                config.temperature = node->config["temperature"].number_value();
-            }
-            if (node->config["top_p"].is_number()) {
-                config.top_p = node->config["top_p"].number_value();
-            }
-            if (node->config["top_k"].is_number()) {
-                config.top_k = node->config["top_k"].number_value();
-            }
-
-            std::string output = "";
-            int handleId = model->LaunchResponseTokens(tokens, config);
-            bool isStream = false;
-            if (node->config["stream"].is_bool() && node->config["stream"].bool_value()) {
-                isStream = true;
-            }
-
-            std::string curId = "fastllm-" + GenerateRandomID();
-            auto createTime = _GetCurrentTime();
-
-            if (isStream) {
-                message = "";
-                message += "HTTP/1.1 200 OK\r\n";
-                message += "Content-Type:application/json\r\n";
-                message += "server:fastllm api server\r\n";
-                message += "Transfer-Encoding: chunked\r\n";
-                message += "\r\n";
-                int ret = write(node->client, message.c_str(), message.length()); //返回初始信息
-            
-                json11::Json startResult = json11::Json::object {
-                    {"id", curId},
-                    {"object", "chat.completion.chunk"},
-                    {"created", createTime},
-                    {"model", ::config.modelName},
-                    {"choices", json11::Json::array {
-                        json11::Json::object {
-                            {"index", 0},
-                            {"delta", json11::Json::object {
-                                {"role", "assistant"}
-                            }},
-                            {"logprobs", nullptr},
-                            {"finish_reason", nullptr},
-                            {"stop_reason", nullptr}
-                        }
-                    }}
-                };
-                std::string cur = ("data: " + startResult.dump() + "\r\n");
-
-                char chunk_header[50];
-                sprintf(chunk_header, "%zx\r\n", cur.size());
-                ret = write(node->client, chunk_header, strlen(chunk_header));
-                ret = write(node->client, cur.data(), cur.size());
-                ret = write(node->client, "\r\n", 2);
-
-                int outputTokens = 0;
-                std::vector<float> results;
-                while (true) {
-                    int result = model->FetchResponseTokens(handleId);
-                    if (result == -1) {
-                        json11::Json partResult = json11::Json::object {
-                            {"id", curId},
-                            {"object", "chat.completion.chunk"},
-                            {"created", createTime},
-                            {"model", ::config.modelName},
-                            {"choices", json11::Json::array {
-                                json11::Json::object {
-                                    {"index", 0},
-                                    {"delta", json11::Json::object {
-                                        {"content", ""}
-                                    }},
-                                    {"logprobs", nullptr},
-                                    {"finish_reason", nullptr},
-                                    {"stop_reason", nullptr}
-                                }
-                            }},
-                            {"usage", json11::Json::object {
-                                {"prompt_tokens", (int)tokens.size()},
-                                {"total_tokens", (int)tokens.size() + outputTokens},
-                                {"completion_tokens", outputTokens}
-                            }}
-                        };
-
-                        std::string cur = ("data: " + partResult.dump() + "\r\n");
-                        sprintf(chunk_header, "%zx\r\n", cur.size());
-                        ret = write(node->client, chunk_header, strlen(chunk_header));
-                        ret = write(node->client, cur.data(), cur.size());
-                        ret = write(node->client, "\r\n", 2);
-                        break;
-                    } else {
-                        outputTokens++;
-                        results.clear();
-                        results.push_back(result);
-                        std::string now = model->weight.tokenizer.Decode(fastllm::Data (fastllm::DataType::FLOAT32, {(int)results.size()}, results));
-                        json11::Json partResult = json11::Json::object {
-                            {"id", curId},
-                            {"object", "chat.completion.chunk"},
-                            {"created", createTime},
-                            {"model", ::config.modelName},
-                            {"choices", json11::Json::array {
-                                json11::Json::object {
-                                    {"index", 0},
-                                    {"delta", json11::Json::object {
-                                        {"content", now}
-                                    }},
-                                    {"logprobs", nullptr},
-                                    {"finish_reason", nullptr},
-                                    {"stop_reason", nullptr}
-                                }
-                            }}
-                        };
-
-                        std::string cur = ("data: " + partResult.dump() + "\r\n");
-                        sprintf(chunk_header, "%zx\r\n", cur.size());
-                        ret = write(node->client, chunk_header, strlen(chunk_header));
-                        ret = write(node->client, cur.data(), cur.size());
-                        ret = write(node->client, "\r\n", 2);
-                    }
+            size_t pos = 0;
+            while (pos < conn->outBuffer.size()) {
+                ssize_t ret = send(conn->fd, conn->outBuffer.data() + pos, conn->outBuffer.size() - pos, MSG_NOSIGNAL);
+                if (ret > 0) {
+                    pos += ret;
+                } else if (ret < 0 && errno == EINTR) {
+                    continue;
+                } else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                } else {
+                    needClose = true;
+                    break;
+                }
+            }
+            conn->outBuffer.erase(0, pos);
+            if (!needClose) {
+                bool wantWrite = !conn->outBuffer.empty();
+                if (wantWrite != conn->wantWrite) {
+                    conn->wantWrite = wantWrite;
+                    poller.Modify(conn->fd, conn->id, wantWrite);
+                }
+                needClose = (conn->outBuffer.empty() && conn->closeAfterWrite);
+                if (conn->throttled && conn->outBuffer.size() < outputLowWater) {
+                    conn->throttled = false;
+                    resume = true;
                 }
+            }
+        }
+        if (needClose) {
+            Close(conn);
+        } else if (resume) {
+            ScheduleDrain(conn);
+        }
+    }
 
-                cur = ("data: [DONE]");
-                sprintf(chunk_header, "%zx\r\n", cur.size());
-                ret = write(node->client, chunk_header, strlen(chunk_header));
-                ret = write(node->client, cur.data(), cur.size());
-                ret = write(node->client, "\r\n", 2);
+    // 事件循环: 关闭连接, 未完成的生成请求会被中断
+    void Close(const std::shared_ptr <Connection> &conn) {
+        int handleId = -1;
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            std::lock_guard <std::mutex> connGuard(conn->locker);
+            if (conn->closed) {
+                return;
+            }
+            conn->closed = true;
+            handleId = conn->handleId;
+            conns.erase(conn->id);
+        }
+        poller.Remove(conn->fd);
+        close(conn->fd);
+        if (ReleaseGeneration(conn) && handleId != -1) {
+            model->AbortResponse(handleId);
+        }
+    }
 
-                ret = write(node->client, "0\r\n\r\n", 5);
-                close(node->client);
+    void OnReadable(const std::shared_ptr <Connection> &conn) {
+        char buffer[64 * 1024];
+        while (true) {
+            ssize_t ret = recv(conn->fd, buffer, sizeof(buffer), 0);
+            if (ret > 0) {
+                std::lock_guard <std::mutex> guard(conn->locker);
+                conn->inBuffer.append(buffer, ret);
+                if (conn->inBuffer.size() > 2 * maxRequestBytes) {
+                    // 客户端只发不收, 直接断开
+                    ret = 0;
+                }
+            }
+            if (ret > 0) {
+                continue;
+            } else if (ret < 0 && errno == EINTR) {
+                continue;
+            } else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
             } else {
-                int outputTokens = 0;
-                std::vector<float> results;
-                while (true) {
-                    int result = model->FetchResponseTokens(handleId);
-                    if (result == -1) {
-                        break;
-                    } else {
-                        results.clear();
-                        results.push_back(result);
-                        output += model->weight.tokenizer.Decode(fastllm::Data (fastllm::DataType::FLOAT32, {(int)results.size()}, results));
-                        outputTokens++;
-                    }
+                Close(conn);
+                return;
+            }
+        }
+        TryDispatch(conn);
+    }
+
+    void Accept() {
+        while (true) {
+            struct sockaddr_in client_addr;
+            socklen_t len = sizeof(client_addr);
+            int client = accept(listenFd, (struct sockaddr *) &client_addr, &len);
+            if (client == -1) {
+                return;
+            }
+            auto conn = std::make_shared <Connection> ();
+            {
+                std::lock_guard <std::mutex> guard(locker);
+                if ((int)conns.size() >= config.maxConnections) {
+                    close(client);
+                    continue;
                 }
+                conn->id = ++lastConnectionId;
+                conn->fd = client;
+                conns[conn->id] = conn;
+            }
+            fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
+            int one = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            poller.Add(client, conn->id, false);
+        }
+    }
 
-                json11::Json result = json11::Json::object {
-                    {"id", curId},
-                    {"object", "chat.completion"},
-                    {"created", createTime},
-                    {"model", ::config.modelName},
-                    {"choices", json11::Json::array {
-                        json11::Json::object {
-                            {"index", 0},
-                            {"message", json11::Json::object {
-                                {"role", "assistant"},
-                                {"content", output}
-                            }},
-                            {"logprobs", nullptr},
-                            {"finish_reason", nullptr},
-                            {"stop_reason", nullptr}
+    // 处理其它线程发来的通知
+    void ProcessNotifications() {
+        std::vector <int> handles;
+        std::vector <long long> dirtys;
+        std::vector <std::shared_ptr <Connection> > drains, flushes;
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            handles.swap(readyHandles);
+            dirtys.swap(dirtyConns);
+            for (int handleId : handles) {
+                auto it = handleConns.find(handleId);
+                if (it != handleConns.end()) {
+                    drains.push_back(it->second);
+                }
+            }
+            for (long long id : dirtys) {
+                auto it = conns.find(id);
+                if (it != conns.end()) {
+                    flushes.push_back(it->second);
+                }
+            }
+        }
+        for (auto &conn : drains) {
+            ScheduleDrain(conn);
+        }
+        for (auto &conn : flushes) {
+            Flush(conn);
+            TryDispatch(conn);
+        }
+    }
+
+    void Loop() {
+        fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL, 0) | O_NONBLOCK);
+        poller.Add(listenFd, -1, false);
+        poller.Add(wakeFds[0], -2, false);
+
+        std::vector <PollEvent> events;
+        while (true) {
+            poller.Wait(events, 1000);
+            for (auto &event : events) {
+                if (event.key == -1) {
+                    Accept();
+                } else if (event.key == -2) {
+                    char buffer[1024];
+                    while (read(wakeFds[0], buffer, sizeof(buffer)) > 0);
+                } else {
+                    std::shared_ptr <Connection> conn;
+                    {
+                        std::lock_guard <std::mutex> guard(locker);
+                        auto it = conns.find(event.key);
+                        if (it == conns.end()) {
+                            continue;
                         }
-                    }},
-                    {"usage", json11::Json::object {
-                        {"prompt_tokens", (int)tokens.size()},
-                        {"total_tokens", (int)tokens.size() + outputTokens},
-                        {"completion_tokens", outputTokens}
-                    }}
-                };
-
-                message += result.dump();
-                int ret = write(node->client, message.c_str(), message.length()); //返回message
-                close(node->client);
+                        conn = it->second;
+                    }
+                    if (event.writable) {
+                        Flush(conn);
+                    }
+                    if (event.readable) {
+                        OnReadable(conn);
+                    }
+                }
             }
-            return;
-        } else {
-            close(node->client);
-            return;
+            ProcessNotifications();
         }
     }
-} workQueue;
+} server;
 
 void Usage() {
     std::cout << "Usage:" << std::endl;
@@ -604,6 +1037,9 @@ void Usage() {
     std::cout << "<--port> <args>:              网页端口号" << std::endl;
     std::cout << "<--cuda_embedding>:           使用cuda来执行embedding" << std::endl;
     std::cout << "<--device>:                   执行设备" << std::endl;
+    std::cout << "<--workers> <args>:           处理请求的线程数" << std::endl;
+    std::cout << "<--max_connections> <args>:   最大连接数" << std::endl;
+    std::cout << "<--max_pending> <args>:       最多排队的请求数, 超出后返回503" << std::endl;
 }
 
 void ParseArgs(int argc, char **argv, APIConfig &config) {
@@ -647,6 +1083,12 @@ void ParseArgs(int argc, char **argv, APIConfig &config) {
             config.modelName = sargv[++i];
         } else if (sargv[i] == "--device") {
             config.devices[sargv[++i]] = 1;
+        } else if (sargv[i] == "--workers") {
+            config.workers = atoi(sargv[++i].c_str());
+        } else if (sargv[i] == "--max_connections") {
+            config.maxConnections = atoi(sargv[++i].c_str());
+        } else if (sargv[i] == "--max_pending") {
+            config.maxPending = atoi(sargv[++i].c_str());
         } else {
             Usage();
             exit(-1);
@@ -654,10 +1096,6 @@ void ParseArgs(int argc, char **argv, APIConfig &config) {
     }
 }
 
-char buff[1024 * 1024] = {0};
-std::string url = "generate";
-std::mutex locker;
-
 int main(int argc, char** argv) {
     ParseArgs(argc, argv, config);
 
@@ -672,19 +1110,22 @@ int main(int argc, char** argv) {
         exit(0);
     }
     bool isHFDir = fastllm::FileExists(config.path + "/config.json") || fastllm::FileExists(config.path + "config.json");
-    workQueue.model = isHFDir ? fastllm::CreateLLMModelFromHF(config.path, config.dtype, config.groupCnt)
+    server.model = isHFDir ? fastllm::CreateLLMModelFromHF(config.path, config.dtype, config.groupCnt)
         : fastllm::CreateLLMModelFromFile(config.path);
-    workQueue.model->tokensLimit = config.tokens;
-    workQueue.model->SetDataType(config.atype);
-    workQueue.maxActivateQueryNumber = std::max(1, std::min(256, config.batch));
-    workQueue.Start();
+    server.model->tokensLimit = config.tokens;
+    server.model->SetDataType(config.atype);
+    server.maxActivateQueryNumber = std::max(1, std::min(256, config.batch));
+    server.Start();
 
+    signal(SIGPIPE, SIG_IGN);
     int local_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (local_fd == -1) {
         std::cout << "socket error!" << std::endl;
         exit(-1);
     }
     std::cout << "socket ready!" << std::endl;
+    int reuse = 1;
+    setsockopt(local_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     struct sockaddr_in local_addr;
     local_addr.sin_family = AF_INET;
@@ -698,34 +1139,11 @@ int main(int argc, char** argv) {
         exit(-1);
     }
     std::cout << "bind ready!" << std::endl;
-    listen(local_fd, 2000);    
+    listen(local_fd, 2000);
     printf("start...\n");
-    int queuePos = 0;
-    while (true) { //循环接收客户端的请求
-        //5.创建一个sockaddr_in结构体，用来存储客户机的地址
-        struct sockaddr_in client_addr;
-        socklen_t len = sizeof(client_addr);
-        //6.accept()函数：阻塞运行，直到收到某一客户机的连接请求，并返回客户机的描述符
-        int client = accept(local_fd, (struct sockaddr *) &client_addr, &len);
-        if (client == -1) {
-            exit(-1);
-        }
-
-        int size = 0;
-        while (true) {
-            int cur = read(client, buff + size, sizeof(buff) - size);
-            size += cur;
-            if (httpChecker.IsValid(buff, size)) {
-                break;
-            }
-        }
-        buff[size] = 0;
-
-        while (workQueue.q.size() > workQueue.maxActivateQueryNumber) {
-            fastllm::MySleep(0);
-        }
-        workQueue.Push(buff, client);
-    }
 
+    // 单线程事件循环处理所有连接的读写, 分词 / 解码在工作线程中完成, token由模型主循环通知
+    server.listenFd = local_fd;
+    server.Loop();
     return 0;
 }
@@ -7,12 +7,18 @@
 
 #include <thread>
 #include <vector>
+#include <functional>
+#include <new>
+#include <type_traits>
 #if defined(_WIN32) || defined(_WIN64)
 #include <Windows.h>
 #else
 #include <unistd.h>
 #endif
 #include <cstring>
+#include <typeinfo>
+
+#include "trace.h"
 
 namespace fastllm {
     static void barrier() {
@@ -51,10 +57,22 @@ namespace fastllm {
         void operator()() {
             int cnt = 0;
             auto lastRunTime = std::chrono::system_clock::now();
+            bool traceNamed = false;
             while (true) {
                 barrier();
                 if (task->signal == 1) {
-                    task->op->Run();
+                    if (TraceEnabled()) {
+                        if (!traceNamed) {
+                            SetTraceThreadName("alive_thread_" + std::to_string(id));
+                            traceNamed = true;
+                        }
+                        MultiThreadBaseOp *op = task->op;
+                        long long st = TraceNowUs();
+                        op->Run();
+                        TraceAddSpan("task", typeid(*op).name(), "", st, TraceNowUs() - st, "", true);
+                    } else {
+                        task->op->Run();
+                    }
                     task->signal = 0;
                     barrier();
                     lastRunTime = std::chrono::system_clock::now();
@@ -93,11 +111,101 @@ namespace fastllm {
         }
     };
 
+    // 线程池任务的分配区, 每个调度线程一份, 按栈的方式分配和释放, 避免每次调用都new / delete任务
+    struct MultiThreadOpArena {
+        std::vector <std::pair <uint8_t*, size_t> > blocks;
+        int curBlock = 0;
+        size_t offset = 0;
+        std::vector <std::pair <void*, void (*)(void*)> > destructors; // 需要析构的任务
+
+        void *Alloc(size_t size, size_t align) {
+            while (true) {
+                if (curBlock < (int)blocks.size()) {
+                    uintptr_t base = (uintptr_t)blocks[curBlock].first;
+                    size_t st = ((base + offset + align - 1) & ~(uintptr_t)(align - 1)) - base;
+                    if (st + size <= blocks[curBlock].second) {
+                        offset = st + size;
+                        return blocks[curBlock].first + st;
+                    }
+                    curBlock++;
+                    offset = 0;
+                    continue;
+                }
+                size_t len = std::max((size_t)64 * 1024, size + align);
+                blocks.push_back(std::make_pair(new uint8_t[len], len));
+            }
+        }
+
+        ~MultiThreadOpArena() {
+            for (auto &it : blocks) {
+                delete[] it.first;
+            }
+        }
+    };
+
+    inline MultiThreadOpArena &GetThreadOpArena() {
+        static thread_local MultiThreadOpArena arena;
+        return arena;
+    }
+
+    // 在当前线程的分配区中创建任务, 离开作用域时统一析构并释放, 需要保证这之前已经Wait了所有任务
+    struct MultiThreadOpScope {
+        MultiThreadOpArena &arena;
+        int block;
+        size_t offset, destructorCnt;
+
+        MultiThreadOpScope () : arena(GetThreadOpArena()) {
+            block = arena.curBlock;
+            offset = arena.offset;
+            destructorCnt = arena.destructors.size();
+        }
+
+        template <typename T, typename... Args>
+        T *New(Args&&... args) {
+            T *ret = new (arena.Alloc(sizeof(T), alignof(T))) T(std::forward <Args>(args)...);
+            if (!std::is_trivially_destructible <T>::value) {
+                arena.destructors.push_back(std::make_pair((void*)ret, [](void *p) {((T*)p)->~T();}));
+            }
+            return ret;
+        }
+
+        ~MultiThreadOpScope() {
+            while (arena.destructors.size() > destructorCnt) {
+                arena.destructors.back().second(arena.destructors.back().first);
+                arena.destructors.pop_back();
+            }
+            arena.curBlock = block;
+            arena.offset = offset;
+        }
+    };
+
+    // 当前线程正在运行的op stream分到的线程区间, first < 0 代表不在op stream中
+    inline std::pair <int, int> &CurStreamThreadInterval() {
+        static thread_local std::pair <int, int> interval = std::make_pair(-1, -1);
+        return interval;
+    }
+
     struct AliveThreadPool {
         std::pair <int, int> curActivateThreadInterval; // 设定当前激活 [curActivateThreadInterval.first, curActivateThreadInterval.second) 的线程  
 
         std::vector <AliveThreadLoop*> loops;
         std::vector <std::thread*> threads;
+
+        std::vector <AliveThreadLoop*> streamLoops; // 调度op stream的线程, 不参与计算
+        std::vector <std::thread*> streamThreads;
+
+        // 当前可以使用的线程区间, 在op stream中时为这个stream分到的线程
+        std::pair <int, int> GetActivateThreadInterval() {
+            auto &interval = CurStreamThreadInterval();
+            return interval.first >= 0 ? interval : curActivateThreadInterval;
+        }
+
+        void ResizeStreamThreads(int streamNum) {
+            for (int i = this->streamThreads.size(); i < streamNum; i++) {
+                this->streamLoops.push_back(new AliveThreadLoop(-1 - i));
+                this->streamThreads.push_back(new std::thread(*(this->streamLoops[i])));
+            }
+        }
         
         AliveThreadPool (int threadNum) {
             for (int i = 0; i < threadNum; i++) {
@@ -132,8 +240,68 @@ namespace fastllm {
         }
     };
 
+    struct MultiThreadStreamOp : MultiThreadBaseOp {
+        std::function <void ()> *func;
+        std::pair <int, int> interval;
+
+        MultiThreadStreamOp (std::function <void ()> *func, std::pair <int, int> interval) : func(func), interval(interval) {}
+
+        void Run() {
+            auto &cur = CurStreamThreadInterval();
+            auto old = cur;
+            cur = interval;
+            (*func)();
+            cur = old;
+        }
+    };
+
+    // 把若干个互相独立的op stream放在不相交的线程区间上同时运行, 线程数按costs的比例分配 (每个stream至少1个线程)
+    // stream中的计算需要通过pool->GetActivateThreadInterval()确定使用哪些线程
+    static void RunMultiThreadStreams(std::vector <std::function <void ()> > &streams, const std::vector <float> &costs, AliveThreadPool *pool) {
+        auto interval = pool->GetActivateThreadInterval();
+        int n = streams.size(), threadNum = interval.second - interval.first;
+        if (n <= 1 || threadNum < n || CurStreamThreadInterval().first >= 0) {
+            // 线程不够分, 或者已经在stream中 (不支持嵌套), 顺序执行
+            for (int i = 0; i < n; i++) {
+                streams[i]();
+            }
+            return;
+        }
+
+        // 每次把一个线程分给当前 cost / 线程数 最大的stream
+        std::vector <int> streamThreads(n, 1);
+        for (int t = n; t < threadNum; t++) {
+            int sel = 0;
+            for (int i = 1; i < n; i++) {
+                if (costs[i] * streamThreads[sel] > costs[sel] * streamThreads[i]) {
+                    sel = i;
+                }
+            }
+            streamThreads[sel]++;
+        }
+
+        pool->ResizeStreamThreads(n - 1);
+        MultiThreadOpScope opScope;
+        std::vector <MultiThreadStreamOp*> ops;
+        int cur = interval.first;
+        for (int i = 0; i < n; i++) {
+            ops.push_back(opScope.New<MultiThreadStreamOp>(&streams[i], std::make_pair(cur, cur + streamThreads[i])));
+            cur += streamThreads[i];
+        }
+        for (int i = 1; i < n; i++) {
+            pool->streamLoops[i - 1]->PushOp(ops[i]);
+        }
+        ops[0]->Run();
+        for (int i = 1; i < n; i++) {
+            pool->streamLoops[i - 1]->Wait();
+        }
+    }
+
     struct MultiThreadMultiOps : MultiThreadBaseOp {
         std::vector <MultiThreadBaseOp*> ops;
+        bool ownOps; // 子任务由MultiThreadOpScope分配时为false, 由scope负责释放
+
+        MultiThreadMultiOps (bool ownOps = true) : ownOps(ownOps) {}
 
         void Run() {
             for (int i = 0; i < ops.size(); i++) {
@@ -142,7 +310,7 @@ namespace fastllm {
         }
 
         ~MultiThreadMultiOps() {
-            for (int i = 0; i < ops.size(); i++) {
+            for (int i = 0; ownOps && i < ops.size(); i++) {
                 delete[] ops[i];
             }
         }
@@ -169,10 +337,11 @@ namespace fastllm {
 
         int per = len / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadMemcpyOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? len : cur + per + (cur + per * (threadNum - i) < len));
-            ops.push_back(new MultiThreadMemcpyOp(output + cur, input + cur, end - cur));
+            ops.push_back(opScope.New<MultiThreadMemcpyOp>(output + cur, input + cur, end - cur));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
@@ -180,7 +349,6 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(i);
-            delete ops[i];
         }
     }
 
@@ -224,23 +392,24 @@ namespace fastllm {
     };
 
     static void RunMultiThreadMemcpyMultiLines(std::vector <MultiThreadMemcpyMultiLinesTask> &tasks, AliveThreadPool *pool) {
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int n = tasks.size();
-        int per = n / pool->threads.size();
+        int per = n / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadMemcpyMultiLinesOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? n : cur + per + (cur + per * (threadNum - i) < n));
-            ops.push_back(new MultiThreadMemcpyMultiLinesOp(
+            ops.push_back(opScope.New<MultiThreadMemcpyMultiLinesOp>(
                 tasks.data(), cur, end));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -269,23 +438,24 @@ namespace fastllm {
 
     static void RunMultiThreadReduce(int inputLen, float **inputs, float *values, 
                                 float *output, float *lastOutput, int dim, AliveThreadPool *pool) {
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         threadNum = std::min(threadNum, 8);
 
         int per = dim / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadReduceOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? dim : cur + per + (cur + per * (threadNum - i) < dim));
-            ops.push_back(new MultiThreadReduceOp(inputLen, inputs, values, output, lastOutput, cur, end));
+            ops.push_back(opScope.New<MultiThreadReduceOp>(inputLen, inputs, values, output, lastOutput, cur, end));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -315,24 +485,25 @@ namespace fastllm {
 
     static void RunMultiThreadMoeReduce(std::vector <std::pair <int, float> > *task, 
                                         std::vector <float> *tempResult, float *curOutput, int dim, AliveThreadPool *pool) {
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         threadNum = std::min(threadNum, 8);
 
         int n = task->size();
         int per = n / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadMoeReduceOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? n : cur + per + (cur + per * (threadNum - i) < n));
-            ops.push_back(new MultiThreadMoeReduceOp(task, tempResult, curOutput, dim, cur, end));
+            ops.push_back(opScope.New<MultiThreadMoeReduceOp>(task, tempResult, curOutput, dim, cur, end));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -358,22 +529,23 @@ namespace fastllm {
             memcpy(output, input, len);
             return;
         }*/
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int len = n * m;
-        int per = len / pool->threads.size();
+        int per = len / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadTransposeByLineOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? len : cur + per + (cur + per * (threadNum - i) < len));
-            ops.push_back(new MultiThreadTransposeByLineOp(output, input, n, m, k, cur, end));
+            ops.push_back(opScope.New<MultiThreadTransposeByLineOp>(output, input, n, m, k, cur, end));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 }
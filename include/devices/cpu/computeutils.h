@@ -170,6 +170,22 @@ namespace fastllm {
         void Run();
     };
 
+    // 分块GEMM (prefill规模), 计算output[rowSt : rowEnd, colSt : colEnd], 权重为FP16或BF16
+    struct MultiThreadLinearFloat32HalfBlockedOp : MultiThreadBaseOp {
+        float *inputData;
+        uint16_t *weightData;
+        float *biasData, *outputData;
+        int n, m, k, rowSt, rowEnd, colSt, colEnd;
+        bool isBF16;
+
+        MultiThreadLinearFloat32HalfBlockedOp(float *inputData, uint16_t *weightData, float *biasData, float *outputData,
+                           int n, int m, int k, int rowSt, int rowEnd, int colSt, int colEnd, bool isBF16) : 
+            inputData(inputData), weightData(weightData), biasData(biasData), outputData(outputData),
+            n(n), m(m), k(k), rowSt(rowSt), rowEnd(rowEnd), colSt(colSt), colEnd(colEnd), isBF16(isBF16) {}
+
+        void Run();
+    };
+
     struct MultiThreadLinearBFloat16BFloat16Op : MultiThreadBaseOp {
         uint16_t *inputData;
         uint16_t *weightData;
@@ -262,20 +278,20 @@ namespace fastllm {
 
     void LaunchLinearQ8KGGUF(uint8_t *a, uint8_t *b, float *c, float *bias, Data *weight, 
                             int n, int m, int k,
-                            std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
+                            MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
     void LaunchLinearInt8Int8(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, 
         int *weightSums, int *weightZeros, float *scales, float *bias,
         float *inputSums, float *iscales, float *izeros,
-        std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
+        MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
     void LaunchLinearBFloat16FP8E4M3(uint16_t *inputData, Data &weight, float *outputData, float *biasData, 
                                 int n, int m, int k, 
-                                std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
+                                MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
     void LaunchLinearBFloat16BFloat16(uint16_t *inputData, Data &weight, float *outputData, float *biasData, 
                                 int n, int m, int k, 
-                                std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
+                                MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
     void LaunchLinearFloat32Float16(float *inputData, Data &weight, float *outputData, float *biasData, 
                                 int n, int m, int k, 
-                                std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
+                                MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum);
 
     void RunLinearFloat32Float32(float *inputData, float *weightData, float *outputData, float *biasData, 
                                 int n, int m, int k, 
@@ -289,6 +305,14 @@ namespace fastllm {
     void RunLinearFloat32BFloat16(float *inputData, uint16_t *weightData, float *outputData, float *biasData, 
                                 int n, int m, int k, 
                                 AliveThreadPool *pool, int startTid, int threadNum);
+    // 是否对这个形状的FP16 / BF16权重Linear使用分块GEMM
+    bool UseLinearHalfBlocked(int n, int m, int k, DataType weightDataType);
+    void RunLinearFloat32HalfBlocked(float *inputData, uint16_t *weightData, bool isBF16, float *outputData, float *biasData, 
+                                int n, int m, int k, 
+                                AliveThreadPool *pool, int startTid, int threadNum);
+    void RunLinearFloat16HalfBlocked(uint16_t *inputData, uint16_t *weightData, bool isBF16, uint16_t *outputData, float *biasData, 
+                                int n, int m, int k, 
+                                AliveThreadPool *pool, int startTid, int threadNum);
     void RunLinearBFloat16BFloat16(uint16_t *inputData, uint16_t *weightData, float *outputData, float *biasData, 
                                 int n, int m, int k, 
                                 AliveThreadPool *pool, int startTid, int threadNum);
@@ -302,16 +326,19 @@ namespace fastllm {
                                 AliveThreadPool *pool, int startTid, int threadNum);
     void RunLinearFloat32Int8(float *inputData, Data &weight, float *outputData, float *biasData, 
                             int n, int m, int k, 
-                            AliveThreadPool *pool, int startTid, int threadNum);
+                            AliveThreadPool *pool, int startTid, int threadNum, QuantizedActivation *quantized = nullptr);
     void RunLinearFloat32FP8E4M3(float *inputData, Data &weight, float *outputData, float *biasData, 
                             int n, int m, int k, 
                             AliveThreadPool *pool, int startTid, int threadNum);
     void RunLinearFloat32Int4Group(float *inputData, Data &weight, float *outputData, float *biasData, 
                             int n, int m, int k, int group, int groupCnt,
-                            AliveThreadPool *pool, int startTid, int threadNum);
+                            AliveThreadPool *pool, int startTid, int threadNum, QuantizedActivation *quantized = nullptr);
     void RunLinearFloat32Int2Group(float *inputData, Data &weight, float *outputData, float *biasData, 
                             int n, int m, int k, int group, int groupCnt,
                             AliveThreadPool *pool, int startTid, int threadNum);
+    void RunLinearFloat32Base3Group(float *inputData, Data &weight, float *outputData, float *biasData, 
+                            int n, int m, int k, int group, int groupCnt,
+                            AliveThreadPool *pool, int startTid, int threadNum);
     void RunLinearFloat32GGUF(float *inputData, uint8_t *weightData, float *outputData, float *biasData, 
                             Data *weight, int n, int m, int k, 
                             AliveThreadPool *pool, int startTid, int threadNum);
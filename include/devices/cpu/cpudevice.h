@@ -17,6 +17,8 @@ namespace fastllm {
     
     void DoCpuCatDirect(Data &input0, Data &input1, int axis);
 
+    void QuantizationAll(float *fValue, uint8_t *uValue, int len, LowBitConfig *config);
+
     struct MultiThreadFloat32ToBFloat16Op : MultiThreadBaseOp {
         float *input;
         uint16_t *output;
@@ -180,7 +182,7 @@ namespace fastllm {
         int *weightSums, float *weightMins, float *scales, float *bias,
         std::vector <float> &inputSums, std::vector <float> &iscales, std::vector <float> &izeros,
         std::vector <LowBitConfig> &configs, int startTid, int threadNum, int group, int groupCnt,
-        std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool);
+        MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool);
 
 
     class CpuDevice : BaseDevice {
@@ -223,6 +225,16 @@ namespace fastllm {
         void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
     };
 
+    class CpuAttentionVarlenOp : BaseOperator {
+        void Reshape(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
+        void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
+    };
+
+    class CpuSegmentLoraOp : BaseOperator {
+        void Reshape(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
+        void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
+    };
+
     class CpuMergeMOE : BaseOperator {
     protected:
         void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
@@ -250,6 +262,11 @@ namespace fastllm {
         void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
     };
 
+    class CpuAddRMSNormQuantOp : BaseOperator {
+        bool CanRun(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
+        void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
+    };
+
     class CpuLinearOp : BaseOperator {
         void Reshape(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
         bool CanRun(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
@@ -378,6 +395,11 @@ namespace fastllm {
         void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
     };
 
+    class CpuChunkGatedDeltaRuleOp : BaseOperator {
+        void Reshape(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
+        void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
+    };
+
     class CpuCausalMaskOp : BaseOperator {
         void Run(const std::string &opType, const DataDict &datas, const FloatDict &floatParams, const IntDict &intParams);
     };
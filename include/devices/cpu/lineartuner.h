@@ -0,0 +1,75 @@
+//
+// Linear kernel的注册表与自动调优
+//
+
+#ifndef FASTLLM_LINEARTUNER_H
+#define FASTLLM_LINEARTUNER_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fastllm.h"
+
+namespace fastllm {
+    // 计算output = input * weight^T + bias, 使用[threadSt, threadSt + threadLen)这些线程
+    typedef std::function <void (Data &input, Data &weight, const Data &bias, Data &output,
+                                int n, int m, int k, int threadSt, int threadLen)> LinearKernelFunc;
+
+    struct LinearKernelVariant {
+        std::string name; // 同一个key下唯一, 写入调优文件
+        LinearKernelFunc run;
+    };
+
+    struct LinearTuneResult {
+        std::string variant;
+        int threads; // 使用的线程数
+        float spend; // 调优时测得的耗时 (秒)
+    };
+
+    // kernel注册表按 (输入类型, 权重类型, 指令集) 组织, 每个key下可以有多个分块 / 实现的变体
+    // 调优数据库按 (指令集, 输入类型, 权重类型, 线程数, n所在区间, m, k) 记录最快的 (变体, 线程数)
+    // 环境变量:
+    //   FASTLLM_TUNING_FILE=文件名: 启动时加载调优结果, 有新结果时在进程退出时写回
+    //   FASTLLM_LINEAR_TUNE=ON: 在线调优, 遇到没有记录的形状时逐个计时所有候选并记录
+    class LinearTuner {
+    public:
+        std::mutex locker;
+        std::map <std::string, std::vector <LinearKernelVariant> > registry;
+        std::map <std::string, LinearTuneResult> db;
+        std::atomic <bool> online {false};
+        std::atomic <bool> hasResults {false}; // db中是否有调优结果, 加载或记录时置位
+        bool dirty = false; // db是否有未保存的新结果
+        std::string fileName;
+
+        // isa为变体需要的指令集: "base", "avx2", "avx512f", "avx512vnni", "avx512bf16"
+        void Register(DataType inputType, DataType weightType, const std::string &isa, const LinearKernelVariant &variant);
+
+        // 没有调优结果也不在线调优时, 调用者可以跳过Run, 不为每次Linear构造key和候选列表
+        bool IsActive() const {
+            return online.load(std::memory_order_relaxed) || hasResults.load(std::memory_order_relaxed);
+        }
+
+        // 按调优结果运行, 没有可用的结果时返回false, 由调用者使用默认的kernel
+        // defaultKernel为调用者的默认kernel, 在线调优时和注册的变体一起计时, 没有更快的变体时记录为"default"
+        bool Run(Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen,
+                 const LinearKernelFunc &defaultKernel);
+
+        bool Load(const std::string &fileName);
+        bool Save(const std::string &fileName);
+    private:
+        std::vector <LinearKernelVariant*> GetCandidates(DataType inputType, DataType weightType);
+    };
+
+    LinearTuner *GetLinearTuner();
+
+    // 注册CPU上的Linear kernel (cpudevice.cpp)
+    void RegisterCpuLinearKernels();
+
+    bool IsCpuIsaSupported(const std::string &isa);
+}
+
+#endif //FASTLLM_LINEARTUNER_H
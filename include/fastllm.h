@@ -102,7 +102,9 @@ namespace fastllm {
         bool output_logits = false; // 是否返回logits
         bool enable_hash_id = false; // 给会话添加hash id
         bool add_special_tokens = true; // prompt添加special tokens（chatglm模型生效）
+        std::string adapter_name = ""; // 使用的LoRA adapter (由AddLoraAdapter加载), 为空代表只用基座模型
         std::multiset <int> stop_token_ids;
+        std::set <int> allowed_token_ids; // 非空时只允许生成其中的token, lm_head也只在这些token上计算
 
         bool IsSimpleGreedy() const {
             if (fabs(repeat_penalty - 1) > 1e-8) {
@@ -226,6 +228,15 @@ namespace fastllm {
         }
     };
 
+    // 激活值的在线量化结果, 由AddRMSNormQuant产生, 后续同样量化方式的Linear可以直接使用
+    struct QuantizedActivation {
+        void *source = nullptr; // 对应的float数据地址, 为nullptr或与数据地址不一致时无效
+        int n = 0, m = 0, group = 0, groupCnt = 0, permuteType = 0;
+        std::vector <uint8_t> uinput;
+        std::vector <LowBitConfig> configs;
+        std::vector <float> inputSums, iscales, izeros;
+    };
+
     enum DataType {
         FLOAT32 = 0, BFLOAT16 = 1, INT16 = 2, INT8 = 3, INT4 = 4, INT2 = 5, BIT = 6, FLOAT16 = 7,
         INT4_NOZERO = 8, // 不用zeroPoint的int4, floatValue = min + uint4Value * scale
@@ -318,6 +329,7 @@ namespace fastllm {
         long long cacheUid = 0; // 用来标注Cache id
         bool isKVCache = false; // 是否是KV Cache TODO: 做一些KVCache的管理
         bool isLinearAttention = false; // 是否是线性attention的缓存（永远保持同样的形状）
+        int slidingWindow = 0; // 滑动窗口attention的环形KV Cache的窗口大小，位置p的token保存在p % slidingWindow处（0代表普通KV Cache）
 
         bool lockInCPU = false; // 如果lock在CPU上，那么不允许移动到其余设备
         WeightType weightType = WeightType::NONE; // 权重类型，NONE代表非权重（或未知权重）
@@ -380,6 +392,8 @@ namespace fastllm {
         bool IsRepacked = false;
 
         std::vector <uint8_t*> numasData; // numa数据
+
+        std::shared_ptr <QuantizedActivation> quantizedActivation; // 预先量化好的激活值, Allocate或者被Linear以外的op使用时失效
         
         Data () {};
 
@@ -610,10 +624,18 @@ namespace fastllm {
 
         std::set <std::string> linearNames;
 
+        long long changeVersion = 0; // 权重表每次增删/替换权重时加一, 缓存了Data指针的地方据此判断是否需要重建
+
+        void MarkChanged() { changeVersion++; } // 直接修改weight后需要调用
+
         void LoadFromFile(const std::string &fileName); // 从文件读取
 
         void SaveLowBitModel(const std::string &fileName, int bit); // 存储成量化模型, bit = 0代表直接存
 
+        void SaveGroupLowBitModel(const std::string &fileName, int bit, int groupCnt); // 存储成分组量化模型 (bit = 4 / 2), 有校准数据时使用校准结果
+
+        void SaveQuantizedModel(const std::string &fileName, int bit, int groupCnt); // groupCnt > 0 时Linear权重按组量化
+
         void AddTokenizerWord(const std::string &key, int value, float score); // 增加一个词
 
         void AddDict(const std::string &key, const std::string &value); // 插入一个词条
@@ -651,6 +673,17 @@ namespace fastllm {
     int LLMSampling(Data &logits, int outerOffset,
                     const GenerationConfig &config, const LastTokensUnit &tokens); // 对logits里[outerOffset * vocabSize, (outerOffset + 1) * vocabSize]做Sampling
 
+    // 计算LLMSampling实际采样所用的概率分布 (只保留概率非0的token), logits长度为vocabSize
+    void LLMSamplingProbs(const float *logits, int vocabSize, const GenerationConfig &config,
+                          const LastTokensUnit &tokens, std::vector <std::pair <int, float> > &probs);
+
+    int SamplingFromProbs(const std::vector <std::pair <int, float> > &probs); // 按概率分布采样
+
+    // 投机解码的接受判定: 以min(1, p(token) / q(token))的概率接受草稿token, 返回-1
+    // 否则从norm(max(0, p - q))中重新采样并返回; target = p, draft = q
+    int SpeculativeAccept(int token, const std::vector <std::pair <int, float> > &target,
+                          const std::vector <std::pair <int, float> > &draft);
+
     void ToDataType(const Data &input, DataType dataType);
     void ToDataType(const Data &input, Data &output, DataType dataType);
 
@@ -669,6 +702,12 @@ namespace fastllm {
     void AttentionBatch(std::vector <Data*> &q, std::vector <Data*> &k, std::vector <Data*> &v,
                         std::vector <Data*> &mask, std::vector <Data*> &output,
                         int group, float scale, int attentionType);
+
+    // 变长(无padding)的双向attention, 多个序列拼接在一起, 每个序列只和自己做attention (块对角, 不需要mask)
+    // q: [total, heads, dim], k, v: [total, kvHeads, dim], seqLens[i]为第i个序列的长度, sum(seqLens) = total
+    bool CanRunAttentionVarlen();
+
+    void AttentionVarlen(const Data &q, const Data &k, const Data &v, const std::vector <int> &seqLens, Data &output, float scale);
     
     void Conv1DPerChannel(const Data &input, Data &weight, Data &bias, int inputChannels, int outputChannels, 
             int kernel, int stride, int pad, Data &output);
@@ -679,6 +718,12 @@ namespace fastllm {
 
     void RMSNorm(const Data &input, const Data &weight, float eps, Data &output);
 
+    // 融合的 hidden += add; output = RMSNorm(hidden), 并按linearWeight的量化方式把output量化好, 供紧接着的Linear使用
+    // add和output可以是同一个Data, 但不能是hidden
+    bool CanRunAddRMSNormQuant(const Data &hidden, const Data &linearWeight);
+
+    void AddRMSNormQuant(Data &hidden, const Data &add, const Data &weight, float eps, const Data &linearWeight, Data &output);
+
     void LayerNorm(Data &input, Data &gamma, Data &beta, int axis, Data &output);
 
     void Linear(Data &input, Data &weight, const Data &bias, Data &output);
@@ -756,6 +801,13 @@ namespace fastllm {
     void RecurrentGatedDeltaRule(Data &q, Data &k, Data &v, Data &g, Data &b, 
                                 Data &last_recurrent_state, Data &core_attn_out);
 
+    // 分块并行的gated delta rule (prefill用), q, k: [batch, kHeads, seq, kDim], v: [batch, heads, seq, vDim], g, b: [batch, heads, seq]
+    // last_recurrent_state: [batch, heads, kDim, vDim], 原地更新; q需要提前乘好scale
+    bool CanRunChunkGatedDeltaRule();
+
+    void ChunkGatedDeltaRule(Data &q, Data &k, Data &v, Data &g, Data &b, 
+                            Data &last_recurrent_state, Data &core_attn_out, int chunkSize = 64);
+
     void AddTo(Data &input0, const Data &input1, float alpha = 1.0); // input0 += input1 * alpha
 
     void AttentionMask(Data &input, const Data &mask, float maskValue); // 把input里对应位置mask中为1的部分变成maskValue
@@ -807,6 +859,11 @@ namespace fastllm {
 
     void IA3Layer(Data &input, Data &weight, Data &ia3_l, Data &bias, Data &output,
                   std::map <std::string, std::string> ia3Config);
+
+    // 分段LoRA (同一个batch中不同请求使用不同的adapter): 基座Linear的结果output已经算好, 对第s段的行叠加 loraBs[s]^T * (loraAs[s] * input)
+    // loraAs[s]: [r, in], loraBs[s]: [r, out] (已乘scaling), 都为float32; loraAs[s] = nullptr代表这一段不使用adapter
+    void SegmentLora(const Data &input, std::vector <Data*> &loraAs, std::vector <Data*> &loraBs,
+                     const std::vector <int> &segLens, Data &output);
 }
 
 #endif //TEST_FASTLLM_H
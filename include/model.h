@@ -43,6 +43,17 @@ namespace fastllm {
     
     std::unique_ptr<basellm> CreateLLMTokenizerFromHF(const std::string &modelPath);
 
+    // 从HF (peft) 格式的目录 (adapter_config.json, adapter_model.safetensors) 给model加载一个名为name的LoRA adapter
+    void AddLoraAdapterFromHF(basellm *model, const std::string &name, const std::string &loraPath);
+
+    // 读取dtype config (json数组, 每项为 {"key": 正则, "dtype": 类型名, "embedding": 是否用于embedding}) 中的规则
+    void ParseDtypeRules(const std::string &dtypeConfigString, std::vector <std::pair <std::string, std::string> > &dtypeRules,
+                         std::vector <std::pair <std::string, std::string> > &embeddingDtypeRules);
+
+    // 按dtype config的规则 (正则, 类型名) 解析weightName的类型, 没有匹配的规则时dataType不变
+    void ParseDataType(std::string weightName, std::vector <std::pair <std::string, std::string> > &dtypeRules,
+                       DataType &dataType, int &groupCnt, int &ggmlType);
+
     struct ModelMetaInfo {
         DataType autoAtype = fastllm::DataType::FLOAT32; // 当atype设置为auto时采用的atype
         bool autoSaveHistoryChat = false; // 默认是否开启前缀缓存（一般moe模型会开启）
@@ -28,6 +28,19 @@ namespace fastllm {
 
     class basellm;
 
+    // prompt lookup投机解码的索引: 记录每个n-gram最后一次出现的位置, 用末尾的n-gram在已有token中查找可以复制的后续token
+    struct PromptLookupIndex {
+        int maxNgram = 3;
+        int indexed = 0; // tokens的前indexed个位置已经加入索引
+        std::vector <std::unordered_map <uint64_t, int> > lasts; // lasts[n][hash] = 以这个n-gram结尾的最后位置
+
+        // 把tokens中除最后一个之外的位置加入索引 (tokens只会在末尾追加)
+        void Update(const std::vector <int> &tokens);
+
+        // 从最长的n-gram开始匹配, 返回最多k个提议的token, 找不到时返回空
+        std::vector <int> Propose(const std::vector <int> &tokens, int k);
+    };
+
     struct ResponseContext {
         bool isEnding = false; // 代表这个请求已经处理完成了，不需要再forward了，但生成的token可能还没有被fetch
         bool isAbort = false; // 代表这个请求被中断了，也就是说不会再有人来fetch它了，那么推理完之后就可以删除这个请求了
@@ -48,8 +61,19 @@ namespace fastllm {
 
         int cacheLen = 0;
 
+        int pendingTruncateLen = -1; // TruncateKV记录的回滚长度, 调度循环在下一步开始前应用, -1代表没有
+
+        // 投机解码时草稿模型的KV Cache, 其中保存了allTokens的前draftLen个token
+        std::vector <std::pair <Data, Data> > draftPastKeyValues;
+        int draftLen = 0;
+        PromptLookupIndex lookupIndex;
+
+        // prefill过程中线性attention状态的快照, 结束时随前缀缓存一起保存
+        std::map <int, std::vector <std::pair <Data, Data> > > stateCheckpoints;
+
         void Init(int blocks, DataType dataType);
         void TryRecord(basellm *model);
+        void SaveStateCheckpoint(int tokens, int maxCheckpoints); // 保存当前(前tokens个token)线性attention状态的快照
     };
 
     struct ResponseContextDict {
@@ -69,6 +93,9 @@ namespace fastllm {
         int recordTimes = 0;
         long long flushTime;
         std::vector<std::pair<Data, Data> > kv;
+        // 线性attention等只能整体保存的状态在前缀中若干位置的快照, key为快照对应的token数
+        // 每个快照和kv等长, 其中只有需要整体保存的层是有数据的
+        std::map <int, std::vector <std::pair <Data, Data> > > checkpoints;
 
         PastKVCacheMemory () {}
 
@@ -78,25 +105,83 @@ namespace fastllm {
     struct PastKVCacheManager {
         std::mutex locker;
         int maxRecordNum = 5;
+        int checkpointInterval = 1024; // prefill时每隔多少个token给线性attention的状态做一次快照, 0代表不做
+        int maxCheckpoints = 8; // 每条记录最多保存的快照数
         long long flushTime = 0;
         std::map <std::vector <int>, PastKVCacheMemory*> memorys;
 
         // 设置最多保存的记录条数
         void SetMaxRecordNum(int maxRecordNum);
 
+        // 设置线性attention状态快照的间隔
+        void SetCheckpointInterval(int checkpointInterval);
+
         // 插入一条记录，若已存在则增加引用计数
-        void Record(const std::vector <int> &inputToken, int tokens, std::vector<std::pair<Data, Data> > *kv);
+        // checkpoints为prefill过程中记录的状态快照, 其中的内容会被移走
+        void Record(const std::vector <int> &inputToken, int tokens, std::vector<std::pair<Data, Data> > *kv,
+                    std::map <int, std::vector <std::pair <Data, Data> > > *checkpoints = nullptr);
 
         // 尝试删除一条记录，若引用计数非0不会真的删除
         void Remove(const std::vector <int> &inputToken);
 
         // 获取最长匹配的Memory，并加锁
+        // 对于线性attention的模型, 返回的长度如果小于Memory的tokens, 需要从checkpoints中对应长度的快照恢复状态
         std::pair <PastKVCacheMemory*, int> Get(const std::vector <int> &inputToken);
 
         // 解锁
         void Unlock();
     };
 
+    // Prometheus格式的直方图, counts[i]代表 <= bounds[i] 的次数 (累计), counts.back()代表 +Inf
+    struct MetricsHistogram {
+        std::vector <double> bounds;
+        std::vector <long long> counts;
+        double sum = 0.0;
+
+        MetricsHistogram (const std::vector <double> &bounds);
+
+        void Observe(double value);
+
+        void Dump(std::string &out, const std::string &name, const std::string &labels) const;
+    };
+
+    // 调度循环的统计信息, 由主循环更新, 用ToPrometheus导出
+    struct ServingMetrics {
+        std::mutex locker;
+
+        // gauge
+        int runningRequests = 0; // 已经完成prefill, 正在decode的请求数
+        int waitingRequests = 0; // 排队等待prefill的请求数
+        long long kvCacheBytesUsed = 0;
+        long long kvCacheBytesLimit = 0;
+        int batchLimit = 0;
+
+        // counter
+        long long requests = 0;
+        long long abortedRequests = 0;
+        long long promptTooLongRequests = 0;
+        long long prefillTokens = 0;
+        long long decodeTokens = 0;
+        long long generatedTokens = 0;
+        long long prefixCacheHitTokens = 0;
+        long long prefillSteps = 0, decodeSteps = 0;
+        long long speculativeSteps = 0;
+        long long draftTokens = 0; // 草稿模型提出的token数
+        long long acceptedDraftTokens = 0; // 被目标模型接受的草稿token数
+
+        // histogram
+        MetricsHistogram prefillStepLatency = MetricsHistogram({0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30});
+        MetricsHistogram decodeStepLatency = MetricsHistogram({0.005, 0.01, 0.02, 0.03, 0.05, 0.075, 0.1, 0.2, 0.5, 1});
+        MetricsHistogram stepBatchSize = MetricsHistogram({1, 2, 4, 8, 16, 32, 64, 128, 256, 512});
+        MetricsHistogram stepPrefillTokens = MetricsHistogram({16, 64, 256, 512, 1024, 2048, 4096, 8192});
+        MetricsHistogram stepDecodeTokens = MetricsHistogram({1, 2, 4, 8, 16, 32, 64, 128, 256, 512});
+
+        // 记录一次forward
+        void RecordStep(double seconds, int batch, int prefill, int decode);
+
+        std::string ToPrometheus();
+    };
+
     enum RoPEType { // 位置编码外推类型
         BASE = 0,
         LINEAR_SCALE = 1,
@@ -130,6 +215,27 @@ namespace fastllm {
         }
     };
 
+    // 常见decoder层 (llama结构) 用到的权重, 不存在的权重为nullptr
+    struct DecoderLayerWeights {
+        Data *inputNorm = nullptr, *postNorm = nullptr;
+        Data *q = nullptr, *qBias = nullptr, *k = nullptr, *kBias = nullptr, *v = nullptr, *vBias = nullptr;
+        Data *wPack = nullptr, *mergeQkv = nullptr, *mergeQkvBias = nullptr;
+        Data *o = nullptr, *oBias = nullptr;
+        Data *qNorm = nullptr, *kNorm = nullptr;
+        Data *gateUp = nullptr, *gate = nullptr, *up = nullptr, *down = nullptr;
+    };
+
+    // LoRA权重: output += loraB^T * (loraA * input)
+    struct LoraWeight {
+        Data loraA; // [r, in], float32
+        Data loraB; // [r, out], float32, 已乘scaling
+    };
+
+    // 一个LoRA adapter, 按基座模型Linear权重的指针索引; 合并过的权重 (如mergeqkv) 对应按行拼接的loraA和块对角的loraB
+    struct LoraAdapter {
+        std::unordered_map <Data*, LoraWeight> weights;
+    };
+
     class basellm {
     public:
         basellm() {};
@@ -225,8 +331,70 @@ namespace fastllm {
 
         virtual void WarmUp() {}; // 预热
 
+        void BuildDecoderLayerWeights(); // 按llama结构的权重名建立layerWeights
+
+        // 模型的Forward是否会通过GetLoraAdapters / ApplyLora使用多LoRA, 不支持的模型拒绝带adapter_name的请求
+        virtual bool SupportLoraAdapter() { return false; }
+
+        // 加载一个LoRA adapter, 之后请求可以通过GenerationConfig.adapter_name选择, 同一个batch中的请求可以使用不同的adapter
+        // loras: 基座权重名 -> (loraA [r, in], loraB [out, r]), 即HF的布局, float32, 未乘scaling
+        void AddLoraAdapter(const std::string &name, std::map <std::string, std::pair <Data, Data> > &loras, float scaling);
+
+        // 找到每个请求使用的adapter (不使用为nullptr); 没有任何请求使用adapter时返回false, 且adapters为空
+        bool GetLoraAdapters(const std::vector <GenerationConfig> &generationConfigs, std::vector <LoraAdapter*> &adapters);
+
+        // 在基座Linear的结果output上叠加每个请求的LoRA, segLens[i]为第i个请求的行数
+        void ApplyLora(const Data &input, Data *baseWeight, Data &output,
+                       const std::vector <LoraAdapter*> &adapters, const std::vector <int> &segLens);
+
         virtual void AddPromptCache(const std::vector <int> &inputTokens);
 
+        std::string GetMetrics(); // 获取Prometheus格式的调度统计信息
+
+        // 设置投机解码的草稿模型, 每步由草稿模型提出tokens个token, 目标模型一次forward验证; draft = nullptr代表关闭
+        // 草稿模型需要和当前模型使用同一个tokenizer (词表大小一致)
+        void SetDraftModel(basellm *draft, int tokens = 4);
+
+        // 设置prompt lookup投机解码 (不需要草稿模型, 从prompt和已生成的内容中复制), 每步最多提出tokens个token; tokens = 0代表关闭
+        void SetPromptLookup(int tokens, int maxNgram = 3);
+
+        // 对单个decode请求用草稿模型做一步投机解码, 返回这一步产生的token (至少一个), 调用时需要持有forwardLocker
+        std::vector <int> SpeculativeStep(ResponseContext *context);
+
+        // 根据目标模型在 [当前token, 草稿token...] 上的logits做接受判定, 回滚被拒绝位置的KV, 返回这一步产生的token
+        // config需要是目标模型Forward之后的配置 (有的模型会在Forward中修改采样参数)
+        std::vector <int> VerifySpeculative(ResponseContext *context, const std::vector <int> &proposals,
+                                            const std::vector <std::vector <std::pair <int, float> > > &draftProbs,
+                                            const std::vector <float> &logits, const GenerationConfig &config);
+
+        // 把handleId的序列回滚到前len个token (len不小于prompt长度), 之后生成的token (包括还没有被fetch的) 都会丢弃, 从第len个token之后重新生成
+        // 调用时这个请求可能正在forward, 这里只做记录, 由调度循环在下一步开始前应用; 多次调用时取最短的长度
+        virtual void TruncateKV(int handleId, int len);
+
+        // 第b个请求 (输入长度为seqLen) 需要返回logits的位置数
+        int GetLogitsTail(int b, int seqLen);
+
+        // 使用outputLogitsTails时的采样: logits中依次是每个请求最后GetLogitsTail个位置的logits, 用每个请求的最后一个位置采样
+        std::vector <int> SampleTailLogits(int batch, const std::vector <int> &seqLens, Data &logits,
+                                           std::vector <std::pair <Data*, Data*> > &pastKeyValues,
+                                           const std::vector <GenerationConfig> &generationConfigs,
+                                           const LastTokensManager &lastTokens, std::vector <std::vector <float>*> *retLogits);
+
+        // 设置两阶段的lm_head: 先用proxyType量化的lm_head为每个位置选出得分最高的candidates个token, 再只在这些token上计算精确的logits
+        // 只对贪婪和top_k <= candidates的采样生效, 其余请求仍计算完整的lm_head; candidates = 0代表关闭
+        void SetLMHeadShortlist(int candidates, DataType proxyType = DataType::INT4_GROUP);
+
+        // 模型是否通过ComputeLMHead计算logits (只有这样才会处理allowed_token_ids), 不支持的模型拒绝带allowed_token_ids的请求
+        virtual bool SupportAllowedTokenIds() { return false; }
+
+        // logits = hiddenStates * lmHead^T (float32), 没有计算的token为-inf; 处理allowed_token_ids和两阶段的lm_head
+        // 只有一个配置时所有行都属于这个请求, 否则第b个请求有GetLogitsTail(b, seqLens[b])行或seqLens[b]行 (seqLens为空时每个请求一行)
+        void ComputeLMHead(Data &hiddenStates, Data &lmHead, Data &logits,
+                           const std::vector <GenerationConfig> &generationConfigs, const std::vector <int> &seqLens);
+
+        // 用低比特的lm_head选出hiddenStates每一行的候选token (合并后排序), 无法生成低比特的lm_head时返回空
+        std::vector <int> SelectLMHeadCandidates(Data &hiddenStates, Data &lmHead, const std::vector <GenerationConfig> &generationConfigs);
+
         virtual std::string MakeInput(const std::string &history, int round, const std::string &input) = 0; // 根据历史信息和当前输入生成prompt
 
         virtual std::string MakeHistory(const std::string &history, int round, const std::string &input, const std::string &output) = 0; // 根据当前回复更新history
@@ -294,6 +462,14 @@ namespace fastllm {
         std::vector<std::vector<float> > sin, cos;
 
         WeightMap weight; // 权重
+        // 每层权重的指针表, 避免forward时每步拼接字符串查表; 在第一次forward时(权重合并之后)建立
+        std::vector <DecoderLayerWeights> layerWeights;
+        long long layerWeightsVersion = -1; // 建立layerWeights时weight.changeVersion的值, 不一致时需要重建
+        Data emptyLayerBias; // layerWeights中不存在的bias指向这里
+
+        bool LayerWeightsExpired() { // layerWeights是否需要(重新)建立
+            return layerWeights.size() != block_cnt || layerWeightsVersion != weight.changeVersion;
+        }
 
         Data sinData, cosData;
         std::map <std::string, Data*> deviceSinDatas, deviceCosDatas; // deviceSinDatas[xxx]代表xxx设备上的sinData
@@ -308,11 +484,17 @@ namespace fastllm {
         std::map <std::string, int> moeDeviceMap;
 
         std::string adapterName;
+        std::map <std::string, LoraAdapter> loraAdapters; // 多LoRA服务的adapter, 按名字索引
+        std::mutex loraLocker; // 保护loraAdapters
+        std::map <std::string, std::vector <std::pair <std::string, int> > > mergedWeightParts; // 合并后的权重名 -> [(合并前的权重名, 行数)]
 
         int tokensLimit = -1;
         int promptLimit = -1;
 
         PastKVCacheManager pastKVCacheManager;
+        ServingMetrics metrics;
+        // 某个handle有新的输出或者结束时, 由主循环调用 (此时持有dictLocker, 回调中不能再调用basellm的接口)
+        std::function <void(int handleId)> responseNotifier = nullptr;
         bool saveHistoryChat = false;
 
         std::string lastPrompt = "";
@@ -329,6 +511,21 @@ namespace fastllm {
 
         int kvCacheId = 0; // 最早使用kv_cache的层编号 （因为有一些混合架构的模型，其中一些block是线性attention）
         bool canDoBatchForward = true; // 是否支持batch推理
+        bool canDoSpeculative = false; // 是否支持投机解码 (Forward / ForwardBatch会按照outputLogitsTails返回最后若干个位置的logits)
+        std::vector <int> outputLogitsTails; // 第b个请求返回最后outputLogitsTails[b]个位置的logits, 为空时只返回最后一个位置
+
+        basellm *draftModel = nullptr; // 投机解码的草稿模型
+        int speculativeTokens = 4; // 每步草稿模型提出的token数
+        int promptLookupTokens = 0; // prompt lookup每步最多提出的token数, 0代表关闭 (设置了草稿模型时优先使用草稿模型)
+        int promptLookupNgram = 3;
+
+        int lmHeadCandidates = 0; // 两阶段lm_head每个位置的候选token数, 0代表关闭
+        DataType lmHeadProxyType = DataType::INT4_GROUP;
+        Data lmHeadProxy; // 低比特的lm_head, 用于选出候选token
+        uint8_t *lmHeadProxySource = nullptr; // lmHeadProxy由哪个lm_head生成, lm_head变化时重新生成
+        std::vector <int> lmHeadSubTokens; // allowed_token_ids对应的lm_head行, 多次请求使用同样的集合时复用lmHeadSub
+        uint8_t *lmHeadSubSource = nullptr;
+        Data lmHeadSub;
     };
 }
 
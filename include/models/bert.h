@@ -5,7 +5,18 @@
 #include "basellm.h"
 #include "fastllm.h"
 
+#include <deque>
+#include <future>
+
 namespace fastllm {
+    // 异步的embedding请求, 由BertModel的批处理循环合并推理
+    struct EmbeddingRequest {
+        std::vector <int> tokens;
+        bool normalize;
+        std::chrono::system_clock::time_point arriveTime;
+        std::promise <std::vector <float> > result;
+    };
+
     // 类BERT类大模型基础类
     // 支持Compute-Score，计算两个token序列的相似程度（用于reranker)
     // 支持Embedding，生成token序列的向量
@@ -14,6 +25,7 @@ namespace fastllm {
         BertModel() {};
 
         ~BertModel() {
+            StopEmbeddingLoop();
             this->weight.ReleaseWeight();
         };
 
@@ -42,6 +54,28 @@ namespace fastllm {
         virtual void FillBertInputsBatch(const std::vector <std::vector <int> > &tokens,
                                 Data &inputIds, Data &attentionMask, Data &tokenTypeIds, Data &positionIds);
 
+        // 变长推理的输入: 所有序列拼接成[1, total], 不需要padding和mask
+        virtual void FillBertInputsVarlen(const std::vector <std::vector <int> > &tokens,
+                                Data &inputIds, Data &tokenTypeIds, Data &positionIds);
+
+        // 变长(无padding)推理, attention按序列分块计算 (AttentionVarlen)
+        virtual std::vector <std::vector <float> > ForwardVarlen(const std::vector <std::vector <int> > &tokens, bool normalize);
+
+        // 按长度排序后分桶(每桶最多maxBatchTokens个token), 支持变长推理时用ForwardVarlen, 否则padding到桶内最长后用ForwardAll
+        // 返回值的顺序和tokens一致
+        std::vector <std::vector <float> > ForwardTokens(const std::vector <std::vector <int> > &tokens, bool normalize);
+
+        // 提交一个embedding请求, 返回的future在推理完成后可用
+        // 请求进入队列后由批处理循环和其它并发请求合并成batch (按maxBatchTokens限制token数) 推理
+        std::future <std::vector <float> > LaunchEmbedding(const std::vector <int> &tokens, bool normalize);
+
+        // 凑batch的最长等待时间(毫秒), 0代表空闲时有请求就立刻推理 (推理过程中到达的请求会合并到下一个batch)
+        void SetEmbeddingBatchWait(int ms);
+
+        void StopEmbeddingLoop(); // 结束批处理循环, 未完成的请求会先处理完
+
+        void EmbeddingLoop(); // 批处理循环, 在单独的线程中运行
+
         // 计算相似分数
         // tokens: 输入tokens， tokens[i]代表第i个输入的token序列
         // ret: ret[i]代表第i个输入的相似度
@@ -73,6 +107,16 @@ namespace fastllm {
         int max_positions = 32768;
         int block_cnt = 12;
 
+        bool useVarlen = true; // 是否使用变长推理
+        int maxBatchTokens = 16384; // 分桶时每个batch最多的token数 (padding路径按桶内最长的长度计算)
+
+        std::thread *embeddingLoop = nullptr;
+        std::mutex embeddingLocker;
+        std::condition_variable embeddingCV;
+        std::deque <EmbeddingRequest*> embeddingQueue;
+        bool stopEmbeddingLoop = false;
+        int maxBatchWaitMs = 0;
+
         std::map <std::string, int> deviceMap;
     };
 }
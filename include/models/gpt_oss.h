@@ -13,6 +13,14 @@
 #include <iostream>
 
 namespace fastllm {
+    // 滑动窗口层使用环形KV Cache: 位置为p的token保存在p % window处, cache中最多只保留最近的window个token
+    // cur的维度为[heads, len, headDim], pos为cur中第一个token的位置
+    void RingKVCacheWrite(Data &cache, Data &cur, int pos, int window);
+
+    // 生成[seqLen, cacheLen + seqLen]的mask (1代表不可见), 前cacheLen列对应cache中的token, 之后是当前输入, pos为当前输入第一个token的位置
+    // window > 0时cache是环形的, 每个位置只能看到最近的window个token; window = 0时就是普通的causal mask
+    Data SlidingWindowMask(int pos, int cacheLen, int seqLen, int window);
+
     class GptOssModel : public basellm {
     public:
         GptOssModel (); // 构造函数
@@ -80,6 +88,9 @@ namespace fastllm {
         bool mergeQKV = false;
         bool mergeSwiglu = false;
 
+        int sliding_window = 0; // 滑动窗口层的窗口大小, 0代表所有层都是full attention
+        std::vector <bool> isSlidingLayer; // 每一层是否是滑动窗口层 (KV Cache使用大小为sliding_window的环形缓冲)
+
         std::vector <std::vector <Data*> > weights;
         std::vector <std::vector <Data*> > biass;
 
@@ -18,6 +18,10 @@ namespace fastllm {
 
         virtual void InitParams(); // 初始化参数信息
 
+        virtual bool SupportLoraAdapter() { return false; } // 使用自己的Forward, 没有接入多LoRA
+
+        virtual bool SupportAllowedTokenIds() { return false; } // 使用自己的Forward, 没有通过ComputeLMHead计算logits
+
         // 推理
         virtual int Forward(
                 const Data &inputIds,
@@ -58,6 +58,10 @@ namespace fastllm {
 
         virtual void WarmUp(); // 预热
 
+        virtual bool SupportLoraAdapter() { return true; }
+
+        virtual bool SupportAllowedTokenIds() { return true; }
+
         virtual std::string MakeInput(const std::string &history, int round, const std::string &input); // 根据历史信息和当前输入生成prompt
 
         virtual std::string MakeHistory(const std::string &history, int round, const std::string &input, const std::string &output); // 根据当前回复更新history
@@ -12,6 +12,7 @@ namespace fastllm {
         XlmRobertaModel();
 
         ~XlmRobertaModel() {
+            StopEmbeddingLoop();
             this->weight.ReleaseWeight();
         };
 
@@ -20,6 +21,9 @@ namespace fastllm {
         void FillBertInputsBatch(const std::vector <std::vector <int> > &tokens,
                                 Data &inputIds, Data &attentionMask, Data &tokenTypeIds, Data &positionIds);
 
+        void FillBertInputsVarlen(const std::vector <std::vector <int> > &tokens,
+                                Data &inputIds, Data &tokenTypeIds, Data &positionIds);
+
         // 推理
         std::vector <std::vector <float> > ForwardAll(
                 const Data &inputIds,
@@ -28,6 +32,8 @@ namespace fastllm {
                 const Data &positionIds,
                 bool normalize);
 
+        std::vector <std::vector <float> > ForwardVarlen(const std::vector <std::vector <int> > &tokens, bool normalize);
+
         std::string model_type;
 
         float layer_norm_eps = 1e-12;
@@ -0,0 +1,82 @@
+//
+// 量化校准: 运行校准文本时统计每个Linear输入的激活, 用于分组低比特量化 (INT4_GROUP / INT2_GROUP)
+//
+
+// 1. 激活感知的截断: 按每个输入通道的 E[x^2] 加权量化误差, 搜索每组的截断比例 (AWQ的clip搜索)
+// 2. 误差补偿取整: 用组内的 Hessian H = E[x x^T] 按GPTQ的方式逐列取整并把误差补偿到后面的列
+//    Hessian只保留组内的块 (groupCnt * groupCnt), 内存为 m * groupCnt, 误差只在组内传播
+
+#ifndef FASTLLM_CALIBRATION_H
+#define FASTLLM_CALIBRATION_H
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "fastllm.h"
+
+namespace fastllm {
+    struct LinearCalibrationStats {
+        int m = 0, groupCnt = 0;
+        long long tokens = 0;
+        std::vector <double> sqrSum; // 每个输入通道 x^2 的累加
+        std::vector <float> hessian; // 每组 groupCnt * groupCnt 的 Σ x x^T (只存上三角)
+        std::vector <float> samples; // 蓄水池采样保留的输入行, 用于测量各类型的输出误差
+        int sampleRows = 0;
+    };
+
+    // 一个Linear权重转换成某种类型后的测量结果
+    struct LinearDtypeProfile {
+        std::string dtype; // dtype config中的类型名, 例如 "int4g", "int8", "float16"
+        double bytes = 0.0; // 权重 (含量化参数) 的字节数
+        double seconds = 0.0; // 单个token (n = 1) 的Linear耗时
+        double error = 0.0; // 采样输入上的相对输出误差 ||Y' - Y||^2 / ||Y||^2, Y为float32权重的输出
+    };
+
+    // 混合精度计划中的一组权重 (使用加载后的权重名) 和为它选中的类型
+    struct DtypePlanEntry {
+        std::vector <std::string> names;
+        std::string dtype;
+        std::string comment;
+    };
+
+    extern std::atomic <bool> calibrationEnabled;
+
+    static inline bool CalibrationEnabled() {
+        return calibrationEnabled.load(std::memory_order_relaxed);
+    }
+
+    // 开始收集, 之后运行的Linear (float32输入, CPU上) 都会累加统计; sampleRows > 0 时每个权重额外保留这么多行输入
+    void StartCalibration(int groupCnt, int sampleRows = 0);
+
+    void StopCalibration(); // 停止收集, 已有的统计保留
+
+    void ClearCalibration(); // 清空统计
+
+    void CollectLinearCalibration(Data &input, Data &weight); // 由Executor在运行Linear前调用
+
+    const LinearCalibrationStats *GetLinearCalibrationStats(const std::string &weightName); // 没有统计时返回nullptr
+
+    // 分组量化 [k, m] 的float权重, bit = 2 / 4, 输出的打包方式与INT2_GROUP / INT4_GROUP一致
+    // stats为nullptr时等价于按组min / max取整; configs输出每组的量化参数 (k * group个)
+    void QuantizeGroupWithCalibration(float *weight, int k, int m, int bit, int groupCnt,
+                                      const LinearCalibrationStats *stats, uint8_t *output, LowBitConfig *configs);
+
+    // 用校准时采样的输入测量float32权重转换成每种候选类型后的误差和耗时, 无法从float32转换的类型会被跳过
+    std::vector <LinearDtypeProfile> ProfileLinearDtypes(Data &weight, const std::vector <std::string> &dtypes);
+
+    // 在预算内为每组权重选择类型, 使误差之和尽量小; profiles[i]为第i组的候选 (组内权重的测量值已经累加)
+    // budgetBytes / budgetSeconds <= 0 代表不限制, 预算不够时选择代价最小的候选; 返回每组选中的候选下标
+    std::vector <int> PlanLinearDtypes(const std::vector <std::vector <LinearDtypeProfile> > &profiles,
+                                       double budgetBytes, double budgetSeconds);
+
+    // 把计划写成dtype config (json). 加载时按合并前的原始权重名匹配规则, 所以合并出来的权重 (mergedWeightParts中的) 展开为各部分的规则;
+    // 其余不在loaderNames (加载器能看到的权重名) 中的权重无法通过dtype config指定, 不生成规则并放入skipped
+    std::string DtypePlanToConfig(const std::vector <DtypePlanEntry> &entries,
+                                  const std::map <std::string, std::vector <std::pair <std::string, int> > > &mergedWeightParts,
+                                  const std::set <std::string> &loaderNames, std::vector <std::string> &skipped);
+}
+
+#endif //FASTLLM_CALIBRATION_H
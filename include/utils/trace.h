@@ -0,0 +1,81 @@
+//
+// 耗时区间追踪的接口与宏
+//
+
+// 热路径追踪: 每个线程一个环形缓冲区记录耗时区间, 可导出为Chrome trace json (chrome://tracing 或 ui.perfetto.dev 打开)
+// 运行时开关: SetTraceEnable / 环境变量 FASTLLM_TRACE=输出文件 (进程退出时自动导出)
+// 编译期开关: 定义 FASTLLM_NO_TRACE 后所有追踪代码被编译掉
+
+#ifndef FASTLLM_TRACE_H
+#define FASTLLM_TRACE_H
+
+#include <atomic>
+#include <string>
+
+namespace fastllm {
+#ifdef FASTLLM_NO_TRACE
+    static inline bool TraceEnabled() {
+        return false;
+    }
+#else
+    extern std::atomic <bool> traceEnabled;
+
+    static inline bool TraceEnabled() {
+        return traceEnabled.load(std::memory_order_relaxed);
+    }
+#endif
+
+    void SetTraceEnable(bool enable); // 打开 / 关闭追踪
+
+    void SetTraceBufferSize(int eventsPerThread); // 设置每个线程最多保留的事件数 (超出后覆盖最旧的事件)
+
+    void SetTraceThreadName(const std::string &name); // 设置当前线程在trace中显示的名字
+
+    void ClearTrace(); // 清空已记录的事件
+
+    bool ExportTrace(const std::string &fileName); // 导出为Chrome trace json
+
+    long long TraceNowUs(); // 当前时间戳(微秒)
+
+    // 记录一个区间, category / staticName 必须是静态字符串; staticName为nullptr时使用name
+    // demangle为true时staticName视为typeid().name(), 导出时再做还原
+    void TraceAddSpan(const char *category, const char *staticName, const std::string &name,
+                      long long st, long long dur, const std::string &args, bool demangle = false);
+
+    // 作用域追踪, 未开启时只有一次原子读的开销
+    struct TraceScope {
+        const char *category;
+        const char *staticName;
+        std::string name;
+        std::string args; // json对象内部的键值对, 例如 "\"batch\":4"
+        long long st;
+        bool active;
+
+        TraceScope (const char *category, const char *staticName) {
+            this->active = TraceEnabled();
+            if (this->active) {
+                this->category = category;
+                this->staticName = staticName;
+                this->st = TraceNowUs();
+            }
+        }
+
+        TraceScope (const char *category, const std::string &name) {
+            this->active = TraceEnabled();
+            if (this->active) {
+                this->category = category;
+                this->staticName = nullptr;
+                this->name = name;
+                this->st = TraceNowUs();
+            }
+        }
+
+        ~TraceScope () {
+            if (this->active) {
+                TraceAddSpan(category, staticName, name, st, TraceNowUs() - st, args);
+            }
+        }
+    };
+}
+
+#endif //FASTLLM_TRACE_H
@@ -13,6 +13,7 @@
 #include <string>
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <thread>
 #include <vector>
 #include <deque>
@@ -370,6 +371,41 @@ namespace fastllm {
         return sum;
     }
 #endif
+
+#ifdef __AVX2__
+    // BASE3_GROUP的每个字节存5个三值 (b = t0 + 3t1 + 9t2 + 27t3 + 81t4), 转成8位定点小数 q = ceil(b * 256 / 243) 后,
+    // 每次 q *= 3 溢出的部分就是从t4到t0的一位. ceil(b * 256 / 243) - b只有0~13, 按b的高4位用pshufb查出这个差值和低4位的进位阈值
+    // 返回 q - 128 (按有符号数比较), 因为 3 * 128 - 128 = 256, 这个偏移在 q *= 3 之后保持不变
+    static inline __m256i Base3ToFixedPoint(__m256i w) {
+        const __m256i lowMask = _mm256_set1_epi8(0xf);
+        const __m256i offsetTable = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 6, 7, 8, 9, 10, 11, 12, 12, 13,
+                                                     0, 1, 2, 3, 4, 5, 6, 6, 7, 8, 9, 10, 11, 12, 12, 13);
+        const __m256i thresholdTable = _mm256_setr_epi8(0, 2, 5, 8, 10, 13, 15, 0, 2, 5, 8, 10, 13, 15, 0, 3,
+                                                        0, 2, 5, 8, 10, 13, 15, 0, 2, 5, 8, 10, 13, 15, 0, 3);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(w, 4), lowMask);
+        __m256i lo = _mm256_and_si256(w, lowMask);
+        __m256i carry = _mm256_cmpgt_epi8(lo, _mm256_shuffle_epi8(thresholdTable, hi));
+        __m256i q = _mm256_sub_epi8(_mm256_add_epi8(w, _mm256_shuffle_epi8(offsetTable, hi)), carry);
+        return _mm256_xor_si256(q, _mm256_set1_epi8((char)0x80));
+    }
+
+    // BASE3_GROUP一组权重按32个字节分块读取, 最后一块可能超出权重的末尾, 这时先拷贝出来
+    static inline __m256i LoadBase3Block(const uint8_t *w, const uint8_t *wEnd) {
+        if (w + 32 <= wEnd) {
+            return _mm256_loadu_si256((const __m256i *) w);
+        }
+        uint8_t temp[32] = {0};
+        memcpy(temp, w, wEnd - w);
+        return _mm256_loadu_si256((const __m256i *) temp);
+    }
+
+    // 取出q当前的最高位三值t, 返回-t (0, -1, -2), 并把q移到下一位
+    static inline __m256i Base3NextTrit(__m256i &q) {
+        __m256i t = _mm256_add_epi8(_mm256_cmpgt_epi8(q, _mm256_set1_epi8(85 - 128)), _mm256_cmpgt_epi8(q, _mm256_set1_epi8(170 - 128)));
+        q = _mm256_add_epi8(_mm256_add_epi8(q, q), q);
+        return t;
+    }
+#endif
 }
 
 #endif //FASTLLM_UTILS_H
@@ -0,0 +1,547 @@
+//
+// 量化校准: 激活统计与GPTQ / AWQ风格的分组量化
+//
+
+#include "calibration.h"
+#include "model.h"
+#include "utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+namespace fastllm {
+    std::atomic <bool> calibrationEnabled(false);
+
+    static std::mutex calibrationLocker;
+    static std::map <std::string, LinearCalibrationStats> calibrationStats;
+    static int calibrationGroupCnt = 128, calibrationSampleRows = 0;
+    static bool calibrationWarned = false;
+    static uint64_t calibrationRandom = 0;
+
+    void StartCalibration(int groupCnt, int sampleRows) {
+        std::lock_guard <std::mutex> guard(calibrationLocker);
+        calibrationGroupCnt = groupCnt;
+        calibrationSampleRows = sampleRows;
+        calibrationEnabled = true;
+    }
+
+    void StopCalibration() {
+        calibrationEnabled = false;
+    }
+
+    void ClearCalibration() {
+        std::lock_guard <std::mutex> guard(calibrationLocker);
+        calibrationStats.clear();
+    }
+
+    const LinearCalibrationStats *GetLinearCalibrationStats(const std::string &weightName) {
+        std::lock_guard <std::mutex> guard(calibrationLocker);
+        auto it = calibrationStats.find(weightName);
+        return (it == calibrationStats.end() || it->second.tokens == 0) ? nullptr : &it->second;
+    }
+
+    static void RunOpsOnPool(std::vector <MultiThreadBaseOp*> &ops) {
+        auto *pool = GetAlivePool();
+        for (int i = 0; i < ops.size(); i++) {
+            pool->PushOp(i, ops[i]);
+        }
+        for (int i = 0; i < ops.size(); i++) {
+            pool->Wait(i);
+        }
+    }
+
+    // 累加 [gst, gend) 这些组的 Σ x x^T 和每个通道的 Σ x^2
+    struct MultiThreadCalibrationCollectOp : MultiThreadBaseOp {
+        float *input;
+        int n, m, gst, gend;
+        LinearCalibrationStats *stats;
+
+        MultiThreadCalibrationCollectOp(float *input, int n, int m, int gst, int gend, LinearCalibrationStats *stats) :
+            input(input), n(n), m(m), gst(gst), gend(gend), stats(stats) {}
+
+        void Run() {
+            int gc = stats->groupCnt;
+            for (int g = gst; g < gend; g++) {
+                int st = g * gc, len = std::min(m, st + gc) - st;
+                float *hessian = stats->hessian.data() + (size_t)g * gc * gc;
+                for (int i = 0; i < n; i++) {
+                    float *x = input + (size_t)i * m + st;
+                    for (int a = 0; a < len; a++) {
+                        stats->sqrSum[st + a] += (double)x[a] * x[a];
+                        float xa = x[a];
+                        if (xa == 0.0f) {
+                            continue;
+                        }
+                        float *h = hessian + a * gc;
+                        for (int b = a; b < len; b++) {
+                            h[b] += xa * x[b];
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    void CollectLinearCalibration(Data &input, Data &weight) {
+        if (weight.name == "" || weight.dims.size() != 2 || weight.weightType == WeightType::EMBEDDING) {
+            return;
+        }
+        if (input.dataDevice != DataDevice::CPU || input.dataType != DataType::FLOAT32) {
+            if (!calibrationWarned) {
+                calibrationWarned = true;
+                printf("Warning: calibration only collects float32 inputs on cpu, skip \"%s\".\n", weight.name.c_str());
+            }
+            return;
+        }
+        int m = weight.dims[1];
+        if (input.dims.size() == 0 || input.dims.back() != m) {
+            return;
+        }
+        int n = input.Count(0) / m;
+
+        std::lock_guard <std::mutex> guard(calibrationLocker);
+        auto &stats = calibrationStats[weight.name];
+        if (stats.m == 0) {
+            stats.m = m;
+            stats.groupCnt = calibrationGroupCnt;
+            stats.sqrSum.resize(m, 0.0);
+            int group = (m - 1) / stats.groupCnt + 1;
+            stats.hessian.resize((size_t)group * stats.groupCnt * stats.groupCnt, 0.0f);
+        }
+        int group = (m - 1) / stats.groupCnt + 1;
+        int threadNum = std::min((int)GetAlivePool()->threads.size(), group);
+        int per = group / threadNum, cur = 0;
+        MultiThreadOpScope opScope;
+        std::vector <MultiThreadBaseOp*> ops;
+        for (int i = 0; i < threadNum; i++) {
+            int end = (i == threadNum - 1 ? group : cur + per);
+            ops.push_back(opScope.New <MultiThreadCalibrationCollectOp> ((float*)input.cpuData, n, m, cur, end, &stats));
+            cur = end;
+        }
+        RunOpsOnPool(ops);
+
+        // 蓄水池采样, 固定的随机序列保证结果可复现
+        for (int i = 0; i < n && calibrationSampleRows > 0; i++) {
+            float *row = (float*)input.cpuData + (size_t)i * m;
+            if (stats.sampleRows < calibrationSampleRows) {
+                stats.samples.insert(stats.samples.end(), row, row + m);
+                stats.sampleRows++;
+            } else {
+                calibrationRandom = calibrationRandom * 6364136223846793005ULL + 1442695040888963407ULL;
+                long long id = (calibrationRandom >> 17) % (stats.tokens + i + 1);
+                if (id < stats.sampleRows) {
+                    memcpy(stats.samples.data() + id * m, row, m * sizeof(float));
+                }
+            }
+        }
+        stats.tokens += n;
+    }
+
+    // 原地做Cholesky分解 a = L L^T (下三角), 非正定时返回false
+    static bool CholeskyLower(std::vector <double> &a, int n) {
+        for (int j = 0; j < n; j++) {
+            double sum = a[j * n + j];
+            for (int l = 0; l < j; l++) {
+                sum -= a[j * n + l] * a[j * n + l];
+            }
+            if (sum <= 0.0) {
+                return false;
+            }
+            double diag = sqrt(sum);
+            a[j * n + j] = diag;
+            for (int i = j + 1; i < n; i++) {
+                double v = a[i * n + j];
+                for (int l = 0; l < j; l++) {
+                    v -= a[i * n + l] * a[j * n + l];
+                }
+                a[i * n + j] = v / diag;
+            }
+            for (int i = 0; i < j; i++) {
+                a[i * n + j] = 0.0;
+            }
+        }
+        return true;
+    }
+
+    // 计算 H^-1 的上三角Cholesky因子U (H^-1 = U^T U), GPTQ逐列取整时用U的第j行把误差补偿到后面的列
+    // 失败时返回false, 这一组退化成普通取整
+    static bool GetGPTQFactor(const LinearCalibrationStats &stats, int g, int len, std::vector <float> &u) {
+        int gc = stats.groupCnt;
+        const float *hessian = stats.hessian.data() + (size_t)g * gc * gc;
+        std::vector <double> h(len * len);
+        double diagMean = 0.0;
+        for (int a = 0; a < len; a++) {
+            for (int b = a; b < len; b++) {
+                h[a * len + b] = h[b * len + a] = (double)hessian[a * gc + b] / stats.tokens;
+            }
+            if (h[a * len + a] == 0.0) {
+                // 没有激活过的通道, 误差不影响输出
+                h[a * len + a] = 1.0;
+            }
+            diagMean += h[a * len + a];
+        }
+        diagMean /= len;
+
+        std::vector <double> l;
+        bool ok = false;
+        for (double damp = 0.01; damp < 10.0 && !ok; damp *= 10.0) {
+            l = h;
+            for (int a = 0; a < len; a++) {
+                l[a * len + a] += damp * diagMean;
+            }
+            ok = CholeskyLower(l, len);
+        }
+        if (!ok) {
+            return false;
+        }
+
+        // H^-1 = L^-T L^-1
+        std::vector <double> linv(len * len, 0.0);
+        for (int i = 0; i < len; i++) {
+            linv[i * len + i] = 1.0 / l[i * len + i];
+            for (int j = i + 1; j < len; j++) {
+                double sum = 0.0;
+                for (int t = i; t < j; t++) {
+                    sum -= l[j * len + t] * linv[t * len + i];
+                }
+                linv[j * len + i] = sum / l[j * len + j];
+            }
+        }
+        std::vector <double> hinv(len * len);
+        for (int i = 0; i < len; i++) {
+            for (int j = i; j < len; j++) {
+                double sum = 0.0;
+                for (int t = j; t < len; t++) {
+                    sum += linv[t * len + i] * linv[t * len + j];
+                }
+                hinv[i * len + j] = hinv[j * len + i] = sum;
+            }
+        }
+        if (!CholeskyLower(hinv, len)) {
+            return false;
+        }
+        u.resize(len * len);
+        for (int i = 0; i < len; i++) {
+            for (int j = 0; j < len; j++) {
+                u[i * len + j] = (j >= i ? (float)hinv[j * len + i] : 0.0f);
+            }
+        }
+        return true;
+    }
+
+    struct MultiThreadGPTQFactorOp : MultiThreadBaseOp {
+        const LinearCalibrationStats *stats;
+        int m, gst, gend;
+        std::vector <std::vector <float> > *factors;
+
+        MultiThreadGPTQFactorOp(const LinearCalibrationStats *stats, int m, int gst, int gend, std::vector <std::vector <float> > *factors) :
+            stats(stats), m(m), gst(gst), gend(gend), factors(factors) {}
+
+        void Run() {
+            for (int g = gst; g < gend; g++) {
+                int st = g * stats->groupCnt, len = std::min(m, st + stats->groupCnt) - st;
+                if (!GetGPTQFactor(*stats, g, len, (*factors)[g])) {
+                    (*factors)[g].clear();
+                }
+            }
+        }
+    };
+
+    static inline uint8_t QuantizeValue(float value, const LowBitConfig &config, int qmax) {
+        float q = (value - config.min) / config.scale + 0.5f;
+        return (uint8_t)std::max(0.0f, std::min((float)qmax, q));
+    }
+
+    struct MultiThreadCalibratedGroupQuantizationOp : MultiThreadBaseOp {
+        float *weight;
+        int st, end, m, bit, groupCnt;
+        const LinearCalibrationStats *stats;
+        std::vector <std::vector <float> > *factors;
+        uint8_t *output;
+        LowBitConfig *configs;
+
+        MultiThreadCalibratedGroupQuantizationOp(float *weight, int st, int end, int m, int bit, int groupCnt,
+                                                 const LinearCalibrationStats *stats, std::vector <std::vector <float> > *factors,
+                                                 uint8_t *output, LowBitConfig *configs) :
+            weight(weight), st(st), end(end), m(m), bit(bit), groupCnt(groupCnt), stats(stats), factors(factors),
+            output(output), configs(configs) {}
+
+        void Run() {
+            int group = (m - 1) / groupCnt + 1, qmax = (1 << bit) - 1;
+            std::vector <float> w(groupCnt), d(groupCnt, 1.0f);
+            std::vector <uint8_t> q(groupCnt);
+            for (int i = st; i < end; i++) {
+                for (int g = 0; g < group; g++) {
+                    int gs = g * groupCnt, len = std::min(m, gs + groupCnt) - gs;
+                    float minValue = 1e9, maxValue = -1e9;
+                    for (int j = 0; j < len; j++) {
+                        w[j] = weight[(size_t)i * m + gs + j];
+                        minValue = std::min(minValue, w[j]);
+                        maxValue = std::max(maxValue, w[j]);
+                        if (stats != nullptr) {
+                            d[j] = (float)(stats->sqrSum[gs + j] / stats->tokens) + 1e-8f;
+                        }
+                    }
+
+                    // 按激活加权的误差搜索截断比例, 没有校准数据时只用 ratio = 1
+                    LowBitConfig config = LowBitConfig(minValue, maxValue, bit, 1);
+                    if (stats != nullptr) {
+                        float bestError = 1e30f;
+                        for (int step = 0; step < 10; step++) {
+                            float ratio = 1.0f - step * 0.05f;
+                            LowBitConfig cur = LowBitConfig(minValue * ratio, maxValue * ratio, bit, 1);
+                            float error = 0.0f;
+                            for (int j = 0; j < len; j++) {
+                                float diff = w[j] - (cur.min + cur.scale * QuantizeValue(w[j], cur, qmax));
+                                error += d[j] * diff * diff;
+                            }
+                            if (error < bestError) {
+                                bestError = error, config = cur;
+                            }
+                        }
+                    }
+                    configs[i * group + g] = config;
+
+                    std::vector <float> *u = (stats != nullptr && !(*factors)[g].empty()) ? &(*factors)[g] : nullptr;
+                    for (int j = 0; j < len; j++) {
+                        q[j] = QuantizeValue(w[j], config, qmax);
+                        if (u != nullptr) {
+                            float *row = u->data() + j * len;
+                            float error = (w[j] - (config.min + config.scale * q[j])) / row[j];
+                            for (int l = j + 1; l < len; l++) {
+                                w[l] -= error * row[l];
+                            }
+                        }
+                    }
+
+                    for (int j = 0; j < len; j++) {
+                        size_t id = (size_t)i * m + gs + j;
+                        if (bit == 4) {
+                            if (id % 2) {
+                                output[id / 2] = (output[id / 2] & 0xF0) | q[j];
+                            } else {
+                                output[id / 2] = (output[id / 2] & 0xF) | (q[j] << 4);
+                            }
+                        } else {
+                            int shift = (3 - id % 4) * 2;
+                            output[id / 4] = (output[id / 4] & ~(3 << shift)) | (q[j] << shift);
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    void QuantizeGroupWithCalibration(float *weight, int k, int m, int bit, int groupCnt,
+                                      const LinearCalibrationStats *stats, uint8_t *output, LowBitConfig *configs) {
+        AssertInFastLLM(bit == 2 || bit == 4, "QuantizeGroupWithCalibration error: only support 2 bit or 4 bit.\n");
+        if (stats != nullptr && (stats->m != m || stats->groupCnt != groupCnt)) {
+            stats = nullptr;
+        }
+        int group = (m - 1) / groupCnt + 1;
+        int threadNum = GetAlivePool()->threads.size();
+        std::vector <std::vector <float> > factors(group);
+        MultiThreadOpScope opScope;
+        std::vector <MultiThreadBaseOp*> ops;
+        if (stats != nullptr) {
+            int threads = std::min(threadNum, group), per = group / threads, cur = 0;
+            for (int i = 0; i < threads; i++) {
+                int end = (i == threads - 1 ? group : cur + per);
+                ops.push_back(opScope.New <MultiThreadGPTQFactorOp> (stats, m, cur, end, &factors));
+                cur = end;
+            }
+            RunOpsOnPool(ops);
+            ops.clear();
+        }
+
+        // 按行切分时保证每个线程写的字节不重叠
+        int align = (bit == 4 ? 2 : 4);
+        int threads = std::max(1, std::min(threadNum, k)), per = k / threads / align * align, cur = 0;
+        for (int i = 0; i < threads; i++) {
+            int end = (i == threads - 1 ? k : cur + per);
+            ops.push_back(opScope.New <MultiThreadCalibratedGroupQuantizationOp> (weight, cur, end, m, bit, groupCnt,
+                                                                                stats, &factors, output, configs));
+            cur = end;
+        }
+        RunOpsOnPool(ops);
+    }
+
+    std::vector <LinearDtypeProfile> ProfileLinearDtypes(Data &weight, const std::vector <std::string> &dtypes) {
+        std::vector <LinearDtypeProfile> ret;
+        const LinearCalibrationStats *stats = GetLinearCalibrationStats(weight.name);
+        if (stats == nullptr || stats->sampleRows == 0) {
+            return ret;
+        }
+        AssertInFastLLM(weight.dataType == DataType::FLOAT32 && weight.dims.size() == 2,
+                        "ProfileLinearDtypes error: weight should be a float32 matrix.\n");
+        int k = weight.dims[0], m = weight.dims[1];
+        Data input = Data(DataType::FLOAT32, {stats->sampleRows, m}, stats->samples);
+        Data one = Data(DataType::FLOAT32, {1, m}, std::vector <float> (stats->samples.begin(), stats->samples.begin() + m));
+        Data reference, output;
+        Linear(input, weight, Data(), reference);
+        reference.ToDevice(DataDevice::CPU);
+        double norm = 1e-30;
+        for (int i = 0; i < reference.Count(0); i++) {
+            norm += (double)((float*)reference.cpuData)[i] * ((float*)reference.cpuData)[i];
+        }
+
+        static std::set <DataType> convertibleTypes = {
+            DataType::FLOAT32, DataType::FLOAT16, DataType::INT8, DataType::INT4_NOZERO,
+            DataType::INT4_GROUP, DataType::INT2_GROUP, DataType::BASE3_GROUP
+        };
+        for (auto &dtype : dtypes) {
+            DataType dataType = DataType::DATA_AUTO_LINEAR;
+            int groupCnt = -1, ggmlType = -1;
+            std::vector <std::pair <std::string, std::string> > rules = {std::make_pair(std::string(".*"), dtype)};
+            ParseDataType(weight.name, rules, dataType, groupCnt, ggmlType);
+            if (convertibleTypes.find(dataType) == convertibleTypes.end()) {
+                continue;
+            }
+            if (dataType == DataType::INT2_GROUP && m % 4 != 0) {
+                continue;
+            }
+
+            Data cur = Data(dataType, {k, m});
+            if (dataType == DataType::FLOAT32) {
+                cur.CopyFrom(weight);
+            } else {
+                cur.CreateFromOriData(WeightType::LINEAR, DataType::FLOAT32, weight.cpuData, nullptr, nullptr, groupCnt);
+            }
+            LinearDtypeProfile profile;
+            profile.dtype = dtype;
+            profile.bytes = (double)cur.GetBytes() + (cur.mins.size() + cur.scales.size()) * sizeof(float) +
+                            cur.halfScales.size() * sizeof(uint16_t);
+
+            Linear(input, cur, Data(), output);
+            output.ToDevice(DataDevice::CPU);
+            double diff = 0.0;
+            for (int i = 0; i < output.Count(0); i++) {
+                double d = (double)((float*)output.cpuData)[i] - ((float*)reference.cpuData)[i];
+                diff += d * d;
+            }
+            profile.error = diff / norm;
+
+            // 第一次运行包含权重预处理, 不计时
+            Linear(one, cur, Data(), output);
+            profile.seconds = 1e30;
+            for (int rep = 0; rep < 5; rep++) {
+                auto st = std::chrono::system_clock::now();
+                Linear(one, cur, Data(), output);
+                profile.seconds = std::min(profile.seconds, (double)GetSpan(st, std::chrono::system_clock::now()));
+            }
+            ret.push_back(profile);
+        }
+        return ret;
+    }
+
+    std::vector <int> PlanLinearDtypes(const std::vector <std::vector <LinearDtypeProfile> > &profiles,
+                                       double budgetBytes, double budgetSeconds) {
+        int units = profiles.size();
+        std::vector <int> choice(units, 0);
+        // 代价按预算归一化, 两种预算都有时相加
+        auto cost = [&](const LinearDtypeProfile &p) {
+            if (budgetBytes <= 0 && budgetSeconds <= 0) {
+                return p.bytes;
+            }
+            return (budgetBytes > 0 ? p.bytes / budgetBytes : 0.0) + (budgetSeconds > 0 ? p.seconds / budgetSeconds : 0.0);
+        };
+        double totalBytes = 0.0, totalSeconds = 0.0;
+        for (int i = 0; i < units; i++) {
+            AssertInFastLLM(profiles[i].size() > 0, "PlanLinearDtypes error: empty candidates.\n");
+            for (int j = 1; j < profiles[i].size(); j++) {
+                bool better;
+                if (budgetBytes <= 0 && budgetSeconds <= 0) {
+                    better = profiles[i][j].error < profiles[i][choice[i]].error;
+                } else {
+                    double a = cost(profiles[i][j]), b = cost(profiles[i][choice[i]]);
+                    better = (a < b || (a == b && profiles[i][j].error < profiles[i][choice[i]].error));
+                }
+                if (better) {
+                    choice[i] = j;
+                }
+            }
+            totalBytes += profiles[i][choice[i]].bytes;
+            totalSeconds += profiles[i][choice[i]].seconds;
+        }
+        if (budgetBytes <= 0 && budgetSeconds <= 0) {
+            return choice;
+        }
+
+        // 贪心: 每次在预算内选择单位代价上误差下降最多的升级, 每次升级都会让某一组的误差严格下降, 所以一定会结束
+        while (true) {
+            int bestUnit = -1, bestOption = -1;
+            double bestRatio = -1.0;
+            for (int i = 0; i < units; i++) {
+                auto &now = profiles[i][choice[i]];
+                for (int j = 0; j < profiles[i].size(); j++) {
+                    auto &next = profiles[i][j];
+                    if (next.error >= now.error) {
+                        continue;
+                    }
+                    if ((budgetBytes > 0 && totalBytes - now.bytes + next.bytes > budgetBytes) ||
+                        (budgetSeconds > 0 && totalSeconds - now.seconds + next.seconds > budgetSeconds)) {
+                        continue;
+                    }
+                    double delta = cost(next) - cost(now);
+                    double ratio = (delta <= 0 ? 1e300 : (now.error - next.error) / delta);
+                    if (ratio > bestRatio) {
+                        bestRatio = ratio, bestUnit = i, bestOption = j;
+                    }
+                }
+            }
+            if (bestUnit == -1) {
+                break;
+            }
+            totalBytes += profiles[bestUnit][bestOption].bytes - profiles[bestUnit][choice[bestUnit]].bytes;
+            totalSeconds += profiles[bestUnit][bestOption].seconds - profiles[bestUnit][choice[bestUnit]].seconds;
+            choice[bestUnit] = bestOption;
+        }
+        return choice;
+    }
+
+    // 转义正则中的特殊字符, 写入json时反斜杠本身也要转义
+    static std::string EscapeDtypeRuleKey(const std::string &s) {
+        std::string ret = "";
+        for (char c : s) {
+            if (std::string(".^$|()[]{}*+?\\").find(c) != std::string::npos) {
+                ret += "\\\\";
+            }
+            ret += c;
+        }
+        return ret;
+    }
+
+    std::string DtypePlanToConfig(const std::vector <DtypePlanEntry> &entries,
+                                  const std::map <std::string, std::vector <std::pair <std::string, int> > > &mergedWeightParts,
+                                  const std::set <std::string> &loaderNames, std::vector <std::string> &skipped) {
+        std::string ret = "[\n";
+        bool first = true;
+        for (auto &entry : entries) {
+            std::vector <std::string> names;
+            for (auto &name : entry.names) {
+                auto merged = mergedWeightParts.find(name);
+                if (merged != mergedWeightParts.end()) {
+                    for (auto &part : merged->second) {
+                        names.push_back(part.first);
+                    }
+                } else if (loaderNames.find(name) != loaderNames.end()) {
+                    names.push_back(name);
+                } else {
+                    skipped.push_back(name);
+                }
+            }
+            for (auto &name : names) {
+                ret += std::string(first ? "" : ",\n") + "    {\n";
+                ret += "        \"key\" : \"^" + EscapeDtypeRuleKey(name) + "$\",\n";
+                ret += "        \"dtype\" : \"" + entry.dtype + "\",\n";
+                ret += "        \"comment\": \"" + entry.comment + "\"\n";
+                ret += "    }";
+                first = false;
+            }
+        }
+        ret += "\n]\n";
+        return ret;
+    }
+}
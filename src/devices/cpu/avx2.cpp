@@ -1064,6 +1064,285 @@ namespace fastllm {
 #endif
     }
 
+#ifdef __AVX2__
+    // int8 x int4分组矩阵乘法的寄存器分块kernel, 一次计算MR行输入 x NR行权重
+    // 每组内用int32累加, 减去零点部分 (izero * weightSum) 后乘上 iscale * scale 累加到float
+    template <int MR, int NR>
+    static inline void MatMulInt8Int4GroupTile_AVX2(uint8_t *a, uint8_t *b, float *c, int m, int k,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums) {
+        const __m256i lowMask = _mm256_set1_epi8(0xf);
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256 sums[MR][NR];
+        for (int r = 0; r < MR; r++) {
+            for (int t = 0; t < NR; t++) {
+                sums[r][t] = _mm256_setzero_ps();
+            }
+        }
+        for (int g = 0; g < realGroup; g++) {
+            int st = g * groupCnt, end = std::min(m, (g + 1) * groupCnt);
+            __m256i acc[MR][NR];
+            for (int r = 0; r < MR; r++) {
+                for (int t = 0; t < NR; t++) {
+                    acc[r][t] = _mm256_setzero_si256();
+                }
+            }
+            for (int j = st; j < end; j += 32) {
+                __m256i bx[NR];
+                for (int t = 0; t < NR; t++) {
+                    __m128i orix = _mm_loadu_si128((const __m128i *) (b + ((size_t)t * m + j) / 2));
+                    bx[t] = _mm256_and_si256(lowMask, _mm256_set_m128i(_mm_srli_epi16(orix, 4), orix));
+                }
+                for (int r = 0; r < MR; r++) {
+                    __m256i by = _mm256_loadu_si256((const __m256i *) (a + (size_t)r * m + j));
+                    for (int t = 0; t < NR; t++) {
+                        acc[r][t] = _mm256_add_epi32(acc[r][t], _mm256_madd_epi16(_mm256_maddubs_epi16(by, bx[t]), ones));
+                    }
+                }
+            }
+            for (int r = 0; r < MR; r++) {
+                const int iid = r * group + g;
+                for (int t = 0; t < NR; t++) {
+                    const int gid = t * group + g;
+                    __m256i zero = _mm256_setr_epi32((int)izeros[iid] * weightSums[gid], 0, 0, 0, 0, 0, 0, 0);
+                    sums[r][t] = _mm256_add_ps(sums[r][t], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(acc[r][t], zero)), 
+                                                                        _mm256_set1_ps(iscales[iid] * scales[gid])));
+                }
+            }
+        }
+        for (int r = 0; r < MR; r++) {
+            for (int t = 0; t < NR; t++) {
+                c[(size_t)r * k + t] = Floatsum(sums[r][t]);
+            }
+        }
+    }
+#endif
+
+    // int8和int4分组的矩阵乘法 (多行输入), 按 [权重列块] x [4行输入] x [2行权重] 分块
+    // a: [n * m]的uint8矩阵 (已按32个一组重排), 每组的零点为izeros, 缩放为iscales
+    // b: [k * m]的int4分组矩阵
+    // c: [n * k]的float32结果, 不包含weightMins和bias部分
+    // 要求m和groupCnt都是32的倍数, 否则返回false
+    bool MatMulInt8Int4GroupTiled_AVX2(uint8_t *a, uint8_t *b, float *c, int n, int m, int k,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums) {
+#ifdef __AVX2__
+        if (m % 32 != 0 || groupCnt % 32 != 0) {
+            return false;
+        }
+        // 一个列块的权重大约256KB, 在处理所有输入行时留在L2中
+        int kBlock = std::max(2, (1 << 19) / m) / 2 * 2;
+        for (int i0 = 0; i0 < k; i0 += kBlock) {
+            int i1 = std::min(k, i0 + kBlock);
+            int block = 0;
+            for (; block < n; block += 4) {
+                int rows = std::min(4, n - block);
+                uint8_t *curA = a + (size_t)block * m;
+                float *curIscales = iscales + block * group, *curIzeros = izeros + block * group;
+                for (int i = i0; i < i1; i += 2) {
+                    uint8_t *curB = b + (size_t)i * m / 2;
+                    float *curC = c + (size_t)block * k + i;
+                    float *curScales = scales + i * group;
+                    int *curWeightSums = weightSums + i * group;
+                    if (rows == 4 && i + 1 < i1) {
+                        MatMulInt8Int4GroupTile_AVX2 <4, 2> (curA, curB, curC, m, k, group, realGroup, groupCnt, curIscales, curIzeros, curScales, curWeightSums);
+                    } else {
+                        for (int r = 0; r < rows; r++) {
+                            if (i + 1 < i1) {
+                                MatMulInt8Int4GroupTile_AVX2 <1, 2> (curA + (size_t)r * m, curB, curC + (size_t)r * k, m, k, group, realGroup, groupCnt,
+                                    curIscales + r * group, curIzeros + r * group, curScales, curWeightSums);
+                            } else {
+                                MatMulInt8Int4GroupTile_AVX2 <1, 1> (curA + (size_t)r * m, curB, curC + (size_t)r * k, m, k, group, realGroup, groupCnt,
+                                    curIscales + r * group, curIzeros + r * group, curScales, curWeightSums);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#ifdef __AVX2__
+    // int8 x int2分组矩阵乘法的寄存器分块kernel, 一次计算MR行输入 x 1行权重
+    // 输入按Int2InputPermute重排, 每32个字节的权重移位取出4个平面后被MR行输入复用
+    template <int MR>
+    static inline void MatMulInt8Int2GroupTile_AVX2(uint8_t *a, uint8_t *b, float *c, int m, int k,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums) {
+        const __m256i mask = _mm256_set1_epi8(3);
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256 sums[MR];
+        for (int r = 0; r < MR; r++) {
+            sums[r] = _mm256_setzero_ps();
+        }
+        for (int g = 0; g < realGroup; g++) {
+            int st = g * groupCnt, end = std::min(m, (g + 1) * groupCnt);
+            __m256i acc[MR];
+            for (int r = 0; r < MR; r++) {
+                acc[r] = _mm256_setzero_si256();
+            }
+            for (int j = st; j < end; j += 128) {
+                __m256i w = _mm256_loadu_si256((const __m256i *) (b + j / 4));
+                // 4个平面的乘积最大为4 * 2 * 255 * 3, 可以先用int16累加
+                __m256i part[MR];
+                for (int r = 0; r < MR; r++) {
+                    part[r] = _mm256_setzero_si256();
+                }
+                for (int p = 0; p < 4; p++) {
+                    __m256i plane = _mm256_and_si256(_mm256_srli_epi16(w, 6 - 2 * p), mask);
+                    for (int r = 0; r < MR; r++) {
+                        __m256i x = _mm256_loadu_si256((const __m256i *) (a + (size_t)r * m + j + p * 32));
+                        part[r] = _mm256_add_epi16(part[r], _mm256_maddubs_epi16(x, plane));
+                    }
+                }
+                for (int r = 0; r < MR; r++) {
+                    acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(part[r], ones));
+                }
+            }
+            for (int r = 0; r < MR; r++) {
+                const int iid = r * group + g;
+                __m256i zero = _mm256_setr_epi32((int)izeros[iid] * weightSums[g], 0, 0, 0, 0, 0, 0, 0);
+                sums[r] = _mm256_add_ps(sums[r], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(acc[r], zero)),
+                                                               _mm256_set1_ps(iscales[iid] * scales[g])));
+            }
+        }
+        for (int r = 0; r < MR; r++) {
+            c[(size_t)r * k] = Floatsum(sums[r]);
+        }
+    }
+#endif
+
+    // int8和int2分组的矩阵乘法, 计算c的第[st, end)列, 按 [权重列块] x [4行输入] 分块
+    // a: [n * m]的uint8矩阵 (已按Int2InputPermute重排), 每组的零点为izeros, 缩放为iscales
+    // b: [k * m]的int2分组矩阵
+    // c: [n * k]的float32结果, 不包含mins和bias部分
+    // 要求m和groupCnt都是128的倍数, 否则返回false
+    bool MatMulInt8Int2GroupTiled_AVX2(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, int st, int end,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums) {
+#ifdef __AVX2__
+        if (m % 128 != 0 || groupCnt % 128 != 0) {
+            return false;
+        }
+        // 一个列块的权重大约256KB, 在处理所有输入行时留在L2中
+        int kBlock = std::max(1, (1 << 20) / m);
+        for (int i0 = st; i0 < end; i0 += kBlock) {
+            int i1 = std::min(end, i0 + kBlock);
+            for (int block = 0; block < n; block += 4) {
+                int rows = std::min(4, n - block);
+                uint8_t *curA = a + (size_t)block * m;
+                float *curIscales = iscales + block * group, *curIzeros = izeros + block * group;
+                for (int i = i0; i < i1; i++) {
+                    uint8_t *curB = b + (size_t)i * m / 4;
+                    float *curC = c + (size_t)block * k + i;
+                    if (rows == 4) {
+                        MatMulInt8Int2GroupTile_AVX2 <4> (curA, curB, curC, m, k, group, realGroup, groupCnt,
+                            curIscales, curIzeros, scales + i * group, weightSums + i * group);
+                    } else {
+                        for (int r = 0; r < rows; r++) {
+                            MatMulInt8Int2GroupTile_AVX2 <1> (curA + (size_t)r * m, curB, curC + (size_t)r * k, m, k, group, realGroup, groupCnt,
+                                curIscales + r * group, curIzeros + r * group, scales + i * group, weightSums + i * group);
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#ifdef __AVX2__
+    // int8 x base3分组矩阵乘法的寄存器分块kernel, 一次计算MR行输入 x 1行权重
+    // 每块权重解出的5个平面 (-t) 被MR行输入复用, 输入已按Base3InputExpand展开
+    // 组内 sum(x * (t - 1)) = -sum(x * (-t)) - inputSum, 再减去零点部分 izero * weightSum
+    template <int MR>
+    static inline void MatMulInt8Base3GroupTile_AVX2(uint8_t *a, size_t lda, uint8_t *b, uint8_t *bEnd, float *c, int k,
+        int group, int realGroup, int groupCnt, float *inputSums, float *iscales, float *izeros, uint16_t *halfScales, int *weightSums) {
+        const int bytesPerGroup = (groupCnt - 1) / 5 + 1, blocks = (bytesPerGroup - 1) / 32 + 1;
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256 sums[MR];
+        for (int r = 0; r < MR; r++) {
+            sums[r] = _mm256_setzero_ps();
+        }
+        for (int g = 0; g < realGroup; g++) {
+            __m256i acc[MR];
+            for (int r = 0; r < MR; r++) {
+                acc[r] = _mm256_setzero_si256();
+            }
+            for (int blk = 0; blk < blocks; blk++) {
+                __m256i q = Base3ToFixedPoint(LoadBase3Block(b + g * bytesPerGroup + blk * 32, bEnd));
+                uint8_t *x = a + ((size_t)g * blocks + blk) * 160;
+                // 5个平面的乘积最大为5 * 2 * 255 * 2, 可以先用int16累加
+                __m256i part[MR];
+                for (int r = 0; r < MR; r++) {
+                    part[r] = _mm256_setzero_si256();
+                }
+                for (int p = 0; p < 5; p++) {
+                    __m256i t = Base3NextTrit(q);
+                    for (int r = 0; r < MR; r++) {
+                        __m256i xr = _mm256_loadu_si256((const __m256i *) (x + r * lda + p * 32));
+                        part[r] = _mm256_add_epi16(part[r], _mm256_maddubs_epi16(xr, t));
+                    }
+                }
+                for (int r = 0; r < MR; r++) {
+                    acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(part[r], ones));
+                }
+            }
+            float scale = _cvtsh_ss(halfScales[g]);
+            for (int r = 0; r < MR; r++) {
+                const int iid = r * group + g;
+                __m256i corr = _mm256_setr_epi32(-(int)inputSums[iid] - (int)izeros[iid] * weightSums[g], 0, 0, 0, 0, 0, 0, 0);
+                sums[r] = _mm256_add_ps(sums[r], _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(corr, acc[r])),
+                                                               _mm256_set1_ps(iscales[iid] * scale)));
+            }
+        }
+        for (int r = 0; r < MR; r++) {
+            c[(size_t)r * k] = Floatsum(sums[r]);
+        }
+    }
+#endif
+
+    // int8和base3分组的矩阵乘法, 计算c的第[st, end)列, 按 [权重列块] x [4行输入] 分块
+    // a: 按Base3InputExpand展开的uint8输入, 每组的和为inputSums, 零点为izeros, 缩放为iscales
+    // b: [k * group * bytesPerGroup]的base3分组矩阵
+    // c: [n * k]的float32结果, 不包含bias部分
+    bool MatMulInt8Base3GroupTiled_AVX2(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, int st, int end,
+        int group, int realGroup, int groupCnt, float *inputSums, float *iscales, float *izeros, uint16_t *halfScales, int *weightSums) {
+#ifdef __AVX2__
+        const int bytesPerGroup = (groupCnt - 1) / 5 + 1, blocks = (bytesPerGroup - 1) / 32 + 1;
+        const size_t rowBytes = (size_t)group * bytesPerGroup, lda = (size_t)group * blocks * 160;
+        uint8_t *bEnd = b + rowBytes * k;
+        int kBlock = std::max(1, (int)((1 << 18) / rowBytes));
+        for (int i0 = st; i0 < end; i0 += kBlock) {
+            int i1 = std::min(end, i0 + kBlock);
+            for (int block = 0; block < n; block += 4) {
+                int rows = std::min(4, n - block);
+                uint8_t *curA = a + (size_t)block * lda;
+                int offset = block * group;
+                for (int i = i0; i < i1; i++) {
+                    uint8_t *curB = b + (size_t)i * rowBytes;
+                    float *curC = c + (size_t)block * k + i;
+                    if (rows == 4) {
+                        MatMulInt8Base3GroupTile_AVX2 <4> (curA, lda, curB, bEnd, curC, k, group, realGroup, groupCnt,
+                            inputSums + offset, iscales + offset, izeros + offset, halfScales + i * group, weightSums + i * group);
+                    } else {
+                        for (int r = 0; r < rows; r++) {
+                            int rOffset = offset + r * group;
+                            MatMulInt8Base3GroupTile_AVX2 <1> (curA + r * lda, lda, curB, bEnd, curC + (size_t)r * k, k, group, realGroup, groupCnt,
+                                inputSums + rOffset, iscales + rOffset, izeros + rOffset, halfScales + i * group, weightSums + i * group);
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
     template <int BROW, int AROW>
     void mul_mat_f16_f32_direct_avx2(
         int n,
@@ -1214,4 +1493,47 @@ namespace fastllm {
         AddBiasAVX2(outputData, biasData, n, k, st, end);
         return true;
     }
+
+    // 分块GEMM的微内核: c[6, 16] (+)= a * b
+    // a为打包好的6行输入 (a[l * 6 + r]), b为打包好的16列权重 (b[l * 16 + j]), 12个累加寄存器在整个kc循环中不落回内存
+    bool GemmFloat32_6x16_AVX2_Kernel(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+#ifdef __AVX2__
+        __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+        __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+        __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+        __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+        __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+        __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+        for (int l = 0; l < kc; l++) {
+            __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8);
+            __m256 va = _mm256_broadcast_ss(a);
+            c00 = _mm256_fmadd_ps(va, b0, c00); c01 = _mm256_fmadd_ps(va, b1, c01);
+            va = _mm256_broadcast_ss(a + 1);
+            c10 = _mm256_fmadd_ps(va, b0, c10); c11 = _mm256_fmadd_ps(va, b1, c11);
+            va = _mm256_broadcast_ss(a + 2);
+            c20 = _mm256_fmadd_ps(va, b0, c20); c21 = _mm256_fmadd_ps(va, b1, c21);
+            va = _mm256_broadcast_ss(a + 3);
+            c30 = _mm256_fmadd_ps(va, b0, c30); c31 = _mm256_fmadd_ps(va, b1, c31);
+            va = _mm256_broadcast_ss(a + 4);
+            c40 = _mm256_fmadd_ps(va, b0, c40); c41 = _mm256_fmadd_ps(va, b1, c41);
+            va = _mm256_broadcast_ss(a + 5);
+            c50 = _mm256_fmadd_ps(va, b0, c50); c51 = _mm256_fmadd_ps(va, b1, c51);
+            a += 6;
+            b += 16;
+        }
+        __m256 rows[6][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+        for (int r = 0; r < 6; r++) {
+            float *cr = c + r * ldc;
+            if (accumulate) {
+                rows[r][0] = _mm256_add_ps(rows[r][0], _mm256_loadu_ps(cr));
+                rows[r][1] = _mm256_add_ps(rows[r][1], _mm256_loadu_ps(cr + 8));
+            }
+            _mm256_storeu_ps(cr, rows[r][0]);
+            _mm256_storeu_ps(cr + 8, rows[r][1]);
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
 }
\ No newline at end of file
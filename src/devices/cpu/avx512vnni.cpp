@@ -6,6 +6,7 @@
 #include <algorithm>
 
 #include "fastllm.h"
+#include "utils.h"
 #ifdef __AVX2__
 #include "immintrin.h"
 #endif
@@ -355,6 +356,272 @@ namespace fastllm {
 #endif
     }
 
+#ifdef __AVX512VNNI__
+    // 寄存器分块: 一次计算MR行输入 x NR行权重, 组内int32累加, 零点部分用weightSums修正
+    template <int MR, int NR>
+    static inline void MatMulInt8Int4GroupTile_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int m, int k,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums) {
+        const __m512i lowMask = _mm512_set1_epi8(0xf);
+        __m512 sums[MR][NR];
+        for (int r = 0; r < MR; r++) {
+            for (int t = 0; t < NR; t++) {
+                sums[r][t] = _mm512_setzero_ps();
+            }
+        }
+        for (int g = 0; g < realGroup; g++) {
+            int st = g * groupCnt, end = std::min(m, (g + 1) * groupCnt);
+            __m512i acc[MR][NR];
+            for (int r = 0; r < MR; r++) {
+                for (int t = 0; t < NR; t++) {
+                    acc[r][t] = _mm512_setzero_si512();
+                }
+            }
+            for (int j = st; j < end; j += 64) {
+                __m512i bx[NR];
+                for (int t = 0; t < NR; t++) {
+                    __m256i orix = _mm256_loadu_si256((const __m256i *) (b + ((size_t)t * m + j) / 2));
+                    bx[t] = _mm512_and_si512(lowMask, _mm512_inserti64x4(_mm512_castsi256_si512(orix), _mm256_srli_epi16(orix, 4), 1));
+                }
+                for (int r = 0; r < MR; r++) {
+                    __m512i by = _mm512_loadu_si512((const __m512i *) (a + (size_t)r * m + j));
+                    for (int t = 0; t < NR; t++) {
+                        acc[r][t] = _mm512_dpbusd_epi32(acc[r][t], by, bx[t]);
+                    }
+                }
+            }
+            for (int r = 0; r < MR; r++) {
+                const int iid = r * group + g;
+                for (int t = 0; t < NR; t++) {
+                    const int gid = t * group + g;
+                    // 零点部分在int32下从第0个lane中减去, 和逐行的kernel一样没有精度损失
+                    __m512i zero = _mm512_maskz_set1_epi32(1, (int)izeros[iid] * weightSums[gid]);
+                    sums[r][t] = _mm512_add_ps(sums[r][t], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(acc[r][t], zero)), 
+                                                                        _mm512_set1_ps(iscales[iid] * scales[gid])));
+                }
+            }
+        }
+        for (int r = 0; r < MR; r++) {
+            for (int t = 0; t < NR; t++) {
+                c[(size_t)r * k + t] = _mm512_reduce_add_ps(sums[r][t]);
+            }
+        }
+    }
+#endif
+
+    // int8和int4分组的矩阵乘法 (多行输入), 按 [权重列块] x [4行输入] x [4行权重] 分块
+    // a: [n * m]的int8矩阵 (已按64个一组重排)
+    // b: [k * m]的int4g矩阵
+    // c: [n * k]的float32的结果矩阵, 不包含weightMins和bias部分
+    // 要求m和groupCnt都是64的倍数, 否则返回false
+    bool MatMulInt8Int4GroupTiled_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int n, int m, int k,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums) {
+#ifdef __AVX512VNNI__
+        if (m % 64 != 0 || groupCnt % 64 != 0) {
+            return false;
+        }
+        int kBlock = std::max(4, (1 << 19) / m) / 4 * 4;
+        for (int i0 = 0; i0 < k; i0 += kBlock) {
+            int i1 = std::min(k, i0 + kBlock);
+            for (int block = 0; block < n; block += 4) {
+                int rows = std::min(4, n - block);
+                uint8_t *curA = a + (size_t)block * m;
+                float *curIscales = iscales + block * group, *curIzeros = izeros + block * group;
+                for (int i = i0; i < i1; ) {
+                    uint8_t *curB = b + (size_t)i * m / 2;
+                    float *curC = c + (size_t)block * k + i;
+                    float *curScales = scales + i * group;
+                    int *curWeightSums = weightSums + i * group;
+                    if (rows == 4 && i + 3 < i1) {
+                        MatMulInt8Int4GroupTile_AVX512VNNI <4, 4> (curA, curB, curC, m, k, group, realGroup, groupCnt, curIscales, curIzeros, curScales, curWeightSums);
+                        i += 4;
+                    } else {
+                        for (int r = 0; r < rows; r++) {
+                            MatMulInt8Int4GroupTile_AVX512VNNI <1, 1> (curA + (size_t)r * m, curB, curC + (size_t)r * k, m, k, group, realGroup, groupCnt,
+                                curIscales + r * group, curIzeros + r * group, curScales, curWeightSums);
+                        }
+                        i++;
+                    }
+                }
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#ifdef __AVX512VNNI__
+    // int8 x int2分组: 32个字节的权重广播到512位后, 两半分别移位, 一次取出两个平面, 对应输入中连续的64个元素
+    template <int MR, int NR>
+    static inline void MatMulInt8Int2GroupTile_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int m, int k,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums) {
+        const __m512i mask = _mm512_set1_epi8(3);
+        const __m512i shift01 = _mm512_setr_epi32(6, 6, 6, 6, 6, 6, 6, 6, 4, 4, 4, 4, 4, 4, 4, 4);
+        const __m512i shift23 = _mm512_setr_epi32(2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+        __m512 sums[MR][NR];
+        for (int r = 0; r < MR; r++) {
+            for (int t = 0; t < NR; t++) {
+                sums[r][t] = _mm512_setzero_ps();
+            }
+        }
+        for (int g = 0; g < realGroup; g++) {
+            int st = g * groupCnt, end = std::min(m, (g + 1) * groupCnt);
+            __m512i acc[MR][NR];
+            for (int r = 0; r < MR; r++) {
+                for (int t = 0; t < NR; t++) {
+                    acc[r][t] = _mm512_setzero_si512();
+                }
+            }
+            for (int j = st; j < end; j += 128) {
+                __m512i p01[NR], p23[NR];
+                for (int t = 0; t < NR; t++) {
+                    __m512i w = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i *) (b + ((size_t)t * m + j) / 4)));
+                    p01[t] = _mm512_and_si512(_mm512_srlv_epi32(w, shift01), mask);
+                    p23[t] = _mm512_and_si512(_mm512_srlv_epi32(w, shift23), mask);
+                }
+                for (int r = 0; r < MR; r++) {
+                    __m512i x01 = _mm512_loadu_si512((const __m512i *) (a + (size_t)r * m + j));
+                    __m512i x23 = _mm512_loadu_si512((const __m512i *) (a + (size_t)r * m + j + 64));
+                    for (int t = 0; t < NR; t++) {
+                        acc[r][t] = _mm512_dpbusd_epi32(_mm512_dpbusd_epi32(acc[r][t], x01, p01[t]), x23, p23[t]);
+                    }
+                }
+            }
+            for (int r = 0; r < MR; r++) {
+                const int iid = r * group + g;
+                for (int t = 0; t < NR; t++) {
+                    const int gid = t * group + g;
+                    __m512i zero = _mm512_maskz_set1_epi32(1, (int)izeros[iid] * weightSums[gid]);
+                    sums[r][t] = _mm512_add_ps(sums[r][t], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(acc[r][t], zero)), 
+                                                                        _mm512_set1_ps(iscales[iid] * scales[gid])));
+                }
+            }
+        }
+        for (int r = 0; r < MR; r++) {
+            for (int t = 0; t < NR; t++) {
+                c[(size_t)r * k + t] = _mm512_reduce_add_ps(sums[r][t]);
+            }
+        }
+    }
+#endif
+
+    // int8和int2分组的矩阵乘法, 计算c的第[st, end)列, 输入的重排方式和参数同MatMulInt8Int2GroupTiled_AVX2
+    bool MatMulInt8Int2GroupTiled_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, int st, int end,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums) {
+#ifdef __AVX512VNNI__
+        if (m % 128 != 0 || groupCnt % 128 != 0) {
+            return false;
+        }
+        int kBlock = std::max(4, (1 << 20) / m) / 4 * 4;
+        for (int i0 = st; i0 < end; i0 += kBlock) {
+            int i1 = std::min(end, i0 + kBlock);
+            for (int block = 0; block < n; block += 4) {
+                int rows = std::min(4, n - block);
+                uint8_t *curA = a + (size_t)block * m;
+                float *curIscales = iscales + block * group, *curIzeros = izeros + block * group;
+                for (int i = i0; i < i1; ) {
+                    uint8_t *curB = b + (size_t)i * m / 4;
+                    float *curC = c + (size_t)block * k + i;
+                    float *curScales = scales + i * group;
+                    int *curWeightSums = weightSums + i * group;
+                    if (rows == 4 && i + 3 < i1) {
+                        MatMulInt8Int2GroupTile_AVX512VNNI <4, 4> (curA, curB, curC, m, k, group, realGroup, groupCnt, curIscales, curIzeros, curScales, curWeightSums);
+                        i += 4;
+                    } else {
+                        for (int r = 0; r < rows; r++) {
+                            MatMulInt8Int2GroupTile_AVX512VNNI <1, 1> (curA + (size_t)r * m, curB, curC + (size_t)r * k, m, k, group, realGroup, groupCnt,
+                                curIscales + r * group, curIzeros + r * group, curScales, curWeightSums);
+                        }
+                        i++;
+                    }
+                }
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+#ifdef __AVX512VNNI__
+    // int8 x base3分组: 三值平面用AVX2解出 (见Base3ToFixedPoint), 每两个平面拼成512位后和输入做dpbusd
+    template <int MR>
+    static inline void MatMulInt8Base3GroupTile_AVX512VNNI(uint8_t *a, size_t lda, uint8_t *b, uint8_t *bEnd, float *c, int k,
+        int group, int realGroup, int groupCnt, float *inputSums, float *iscales, float *izeros, uint16_t *halfScales, int *weightSums) {
+        const int bytesPerGroup = (groupCnt - 1) / 5 + 1, blocks = (bytesPerGroup - 1) / 32 + 1;
+        __m512 sums[MR];
+        for (int r = 0; r < MR; r++) {
+            sums[r] = _mm512_setzero_ps();
+        }
+        for (int g = 0; g < realGroup; g++) {
+            __m512i acc[MR];
+            for (int r = 0; r < MR; r++) {
+                acc[r] = _mm512_setzero_si512();
+            }
+            for (int blk = 0; blk < blocks; blk++) {
+                __m256i q = Base3ToFixedPoint(LoadBase3Block(b + g * bytesPerGroup + blk * 32, bEnd));
+                __m256i t0 = Base3NextTrit(q), t1 = Base3NextTrit(q), t2 = Base3NextTrit(q), t3 = Base3NextTrit(q), t4 = Base3NextTrit(q);
+                __m512i t01 = _mm512_inserti64x4(_mm512_castsi256_si512(t0), t1, 1);
+                __m512i t23 = _mm512_inserti64x4(_mm512_castsi256_si512(t2), t3, 1);
+                __m512i t44 = _mm512_zextsi256_si512(t4);
+                uint8_t *x = a + ((size_t)g * blocks + blk) * 160;
+                for (int r = 0; r < MR; r++) {
+                    uint8_t *xr = x + r * lda;
+                    acc[r] = _mm512_dpbusd_epi32(acc[r], _mm512_loadu_si512((const __m512i *) xr), t01);
+                    acc[r] = _mm512_dpbusd_epi32(acc[r], _mm512_loadu_si512((const __m512i *) (xr + 64)), t23);
+                    acc[r] = _mm512_dpbusd_epi32(acc[r], _mm512_castsi256_si512(_mm256_loadu_si256((const __m256i *) (xr + 128))), t44);
+                }
+            }
+            float scale = _cvtsh_ss(halfScales[g]);
+            for (int r = 0; r < MR; r++) {
+                const int iid = r * group + g;
+                __m512i corr = _mm512_maskz_set1_epi32(1, -(int)inputSums[iid] - (int)izeros[iid] * weightSums[g]);
+                sums[r] = _mm512_add_ps(sums[r], _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(corr, acc[r])),
+                                                               _mm512_set1_ps(iscales[iid] * scale)));
+            }
+        }
+        for (int r = 0; r < MR; r++) {
+            c[(size_t)r * k] = _mm512_reduce_add_ps(sums[r]);
+        }
+    }
+#endif
+
+    // int8和base3分组的矩阵乘法, 计算c的第[st, end)列, 输入的展开方式和参数同MatMulInt8Base3GroupTiled_AVX2
+    bool MatMulInt8Base3GroupTiled_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, int st, int end,
+        int group, int realGroup, int groupCnt, float *inputSums, float *iscales, float *izeros, uint16_t *halfScales, int *weightSums) {
+#ifdef __AVX512VNNI__
+        const int bytesPerGroup = (groupCnt - 1) / 5 + 1, blocks = (bytesPerGroup - 1) / 32 + 1;
+        const size_t rowBytes = (size_t)group * bytesPerGroup, lda = (size_t)group * blocks * 160;
+        uint8_t *bEnd = b + rowBytes * k;
+        int kBlock = std::max(1, (int)((1 << 18) / rowBytes));
+        for (int i0 = st; i0 < end; i0 += kBlock) {
+            int i1 = std::min(end, i0 + kBlock);
+            for (int block = 0; block < n; block += 4) {
+                int rows = std::min(4, n - block);
+                uint8_t *curA = a + (size_t)block * lda;
+                int offset = block * group;
+                for (int i = i0; i < i1; i++) {
+                    uint8_t *curB = b + (size_t)i * rowBytes;
+                    float *curC = c + (size_t)block * k + i;
+                    if (rows == 4) {
+                        MatMulInt8Base3GroupTile_AVX512VNNI <4> (curA, lda, curB, bEnd, curC, k, group, realGroup, groupCnt,
+                            inputSums + offset, iscales + offset, izeros + offset, halfScales + i * group, weightSums + i * group);
+                    } else {
+                        for (int r = 0; r < rows; r++) {
+                            int rOffset = offset + r * group;
+                            MatMulInt8Base3GroupTile_AVX512VNNI <1> (curA + r * lda, lda, curB, bEnd, curC + (size_t)r * k, k, group, realGroup, groupCnt,
+                                inputSums + rOffset, iscales + rOffset, izeros + rOffset, halfScales + i * group, weightSums + i * group);
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
     extern void AddBiasAVX512(float *outputData, float *biasData, int n, int k, int st, int end);
 
     template <int BROW, int AROW>
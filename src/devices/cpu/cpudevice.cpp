@@ -5,6 +5,7 @@
 #define _USE_MATH_DEFINES
 #include "devices/cpu/cpudevice.h"
 #include "devices/cpu/computeutils.h"
+#include "devices/cpu/lineartuner.h"
 
 #include <cstring>
 #include <thread>
@@ -12,6 +13,7 @@
 #include <cfloat>
 #include <cmath>
 #include <atomic>
+#include <array>
 
 #ifdef __aarch64__
 #include <arm_neon.h>
@@ -34,12 +36,15 @@ namespace fastllm {
         this->ops["ConvertToFloat32"] = (BaseOperator*)(new CpuConvertToFloat32());
 
         this->ops["Attention"] = (BaseOperator*)(new CpuAttention());
+        this->ops["AttentionVarlen"] = (BaseOperator*)(new CpuAttentionVarlenOp());
+        this->ops["SegmentLora"] = (BaseOperator*)(new CpuSegmentLoraOp());
         this->ops["MergeMOE"] = (BaseOperator*)(new CpuMergeMOE());
         this->ops["MergeMLA"] = (BaseOperator*)(new CpuMergeMLA());
         this->ops["CopyKVCache"] = (BaseOperator*)(new CpuCopyKVCacheOp());
         this->ops["Embedding"] = (BaseOperator*)(new CpuEmbedding());
         this->ops["LayerNorm"] = (BaseOperator*)(new CpuLayerNormOp());
         this->ops["RMSNorm"] = (BaseOperator*)(new CpuRMSNormOp());
+        this->ops["AddRMSNormQuant"] = (BaseOperator*)(new CpuAddRMSNormQuantOp());
         this->ops["Linear"] = (BaseOperator*)(new CpuLinearOp());
         this->ops["Conv1DPerChannel"] = (BaseOperator*)(new CpuConv1DPerChannel());
         this->ops["Conv2D"] = (BaseOperator*)(new CpuConv2DOp());
@@ -70,6 +75,7 @@ namespace fastllm {
         this->ops["AlibiMask"] = (BaseOperator*)(new CpuAlibiMaskOp());
         this->ops["TransferAttn"] = (BaseOperator*)(new CpuTransferAttnOp());
         this->ops["RecurrentGatedDeltaRule"] = (BaseOperator*)(new CpuRecurrentGatedDeltaRuleOp());
+        this->ops["ChunkGatedDeltaRule"] = (BaseOperator*)(new CpuChunkGatedDeltaRuleOp());
         this->ops["CausalMask"] = (BaseOperator*)(new CpuCausalMaskOp());
         this->ops["TopK"] = (BaseOperator*)(new CpuTopKOp());
         this->ops["Permute"] = (BaseOperator*)(new CpuPermuteOp());
@@ -92,6 +98,9 @@ namespace fastllm {
         this->ops["CatDirectBatch"] = (BaseOperator*)(new CpuCatDirectBatchOp());
         this->ops["AppendKVCachebatch"] = (BaseOperator*)(new CpuAppendKVCacheBatchOp());
         this->ops["AttentionBatch"] = (BaseOperator*)(new CpuAttentionBatchOp());
+
+        static std::once_flag linearKernelsFlag;
+        std::call_once(linearKernelsFlag, RegisterCpuLinearKernels);
     }
 
     bool CpuDevice::Malloc(void **ret, size_t size) {
@@ -510,19 +519,21 @@ namespace fastllm {
             std::fill(od, od + output.Count(0), 0.0f);
 
             auto *pool = GetAlivePool();
-            int threads = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threads = interval.second - interval.first;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadSingleAttentionOp*> ops;
             for (int o = 0; o < q0; o++) {
-                ops.push_back(new MultiThreadSingleAttentionOp(qd + o * q.strides[0], kd + (o / group) * k.strides[0], vd + (o / group) * v.strides[0],
+                ops.push_back(opScope.New<MultiThreadSingleAttentionOp>(qd + o * q.strides[0], kd + (o / group) * k.strides[0], vd + (o / group) * v.strides[0],
                                 maskd + (o / (q0 / batch)) * maskStride, od + o * output.strides[0], scale,
                                 q1, q2, k1, v2));
             }
             for (int st = 0; st < ops.size(); st += threads) {
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->PushOp(i - st, ops[i]);
+                    pool->PushOp(threadSt + i - st, ops[i]);
                 }
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->Wait(i - st);
+                    pool->Wait(threadSt + i - st);
                 }
             }
         } else if (q.dataType == DataType::FLOAT16) {
@@ -537,19 +548,21 @@ namespace fastllm {
             std::fill(od, od + output.Count(0), float_to_half(0.0f));
 
             auto *pool = GetAlivePool();
-            int threads = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threads = interval.second - interval.first;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadSingleAttentionFloat16Op*> ops;
             for (int o = 0; o < q0; o++) {
-                ops.push_back(new MultiThreadSingleAttentionFloat16Op(qd + o * q.strides[0], kd + (o / group) * k.strides[0], vd + (o / group) * v.strides[0],
+                ops.push_back(opScope.New<MultiThreadSingleAttentionFloat16Op>(qd + o * q.strides[0], kd + (o / group) * k.strides[0], vd + (o / group) * v.strides[0],
                                 maskd + (o / (q0 / batch)) * maskStride, od + o * output.strides[0], scale,
                                 q1, q2, k1, v2));
             }
             for (int st = 0; st < ops.size(); st += threads) {
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->PushOp(i - st, ops[i]);
+                    pool->PushOp(threadSt + i - st, ops[i]);
                 }
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->Wait(i - st);
+                    pool->Wait(threadSt + i - st);
                 }
             }
         } else {
@@ -571,24 +584,25 @@ namespace fastllm {
 
         if (n > 1) {
             auto pool = GetAlivePool();
-            int threadNum = pool->threads.size();
-            int per = n / pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threadNum = interval.second - interval.first;
+            int per = n / threadNum;
             int cur = 0;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadOnlineQuantizationOp*> ops;
             for (int i = 0; i < threadNum; i++) {
                 int end = (i == threadNum - 1 ? n : cur + per + (cur + per * (threadNum - i) < n));
-                ops.push_back(new MultiThreadOnlineQuantizationOp(
+                ops.push_back(opScope.New<MultiThreadOnlineQuantizationOp>(
                                 inputData + cur * m, uinput.data() + cur * m, inputConfigs.data() + cur * group,
                                 end - cur, m, group, groupCnt,
                                 inputSums.data() + cur * group, iscales.data() + cur * group, izeros.data() + cur * group, permuteType));
                 cur = end;
             }
             for (int i = 0; i < threadNum; i++) {
-                pool->PushOp(i, ops[i]);
+                pool->PushOp(threadSt + i, ops[i]);
             }
             for (int i = 0; i < threadNum; i++) {
-                pool->Wait(i);
-                delete ops[i];
+                pool->Wait(threadSt + i);
             }
         } else {
             MultiThreadOnlineQuantizationOp(inputData, uinput.data(), inputConfigs.data(), n, m, group, groupCnt,
@@ -1095,7 +1109,8 @@ namespace fastllm {
                     int *pos, int bsz, int k,
                     int hidden_size) {
         auto *pool = GetAlivePool();
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         
         // 决定如何划分：尝试创建一个接近正方形的网格
         int batch_blocks = 1, hidden_blocks = threadNum;
@@ -1114,6 +1129,7 @@ namespace fastllm {
             }
         }
         
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadReduceBatchOp*> ops;
         ops.reserve(threadNum);
         
@@ -1129,7 +1145,7 @@ namespace fastllm {
                 int hidden_st = h * hidden_per;
                 int hidden_end = (h == hidden_blocks - 1) ? hidden_size : (h + 1) * hidden_per;
                 
-                ops.push_back(new MultiThreadReduceBatchOp(
+                ops.push_back(opScope.New<MultiThreadReduceBatchOp>(
                     downOutData, downOutDataType,
                     weights, lastOutput,
                     pos, bsz, k,
@@ -1137,13 +1153,12 @@ namespace fastllm {
                     batch_st, batch_end,
                     hidden_st, hidden_end));
                 
-                pool->PushOp(op_idx++, ops.back());
+                pool->PushOp(threadSt + op_idx++, ops.back());
             }
         }
         
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -1258,7 +1273,8 @@ namespace fastllm {
             return;
         }
         
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         threadNum = std::min(threadNum, (int)rows);  // 线程数不超过行数
         
         // 如果行数太少，减少线程数
@@ -1270,21 +1286,21 @@ namespace fastllm {
         size_t rowsPerThread = rows / threadNum;
         size_t curRow = 0;
         
+        MultiThreadOpScope opScope;
         std::vector<MultiThreadConvertFromFloat32Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             size_t endRow = (i == threadNum - 1) ? rows : curRow + rowsPerThread;
-            ops.push_back(new MultiThreadConvertFromFloat32Op(
+            ops.push_back(opScope.New<MultiThreadConvertFromFloat32Op>(
                 dstData, dstDataType, floatData, columns, curRow, endRow));
             curRow = endRow;
         }
         
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
         
@@ -1421,7 +1437,6 @@ namespace fastllm {
 
     void CpuMergeMOE::Run(const std::string &opType, const fastllm::DataDict &datas,
                     const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
-        fastllm::BaseOperator *op = (fastllm::BaseOperator*)(new CpuLinearOp());
  // auto ttt = std::chrono::system_clock::now();
  // std::vector <std::pair <std::string, float> > record;
         Data &input = *(datas.find("input")->second);
@@ -1447,24 +1462,25 @@ namespace fastllm {
             int len = channels * 2;
             
             auto *pool = GetAlivePool();
-            int threadNum = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threadNum = interval.second - interval.first;
             int per = len / threadNum;
             int cur = 0;            
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadRepackWeightsOp*> ops;
             for (int i = 0; i < threadNum; i++) {
                 int end = cur + per;
                 if (i == threadNum - 1) {
                     end = len;
                 }
-                ops.push_back(new MultiThreadRepackWeightsOp(weights, cur, end));
+                ops.push_back(opScope.New<MultiThreadRepackWeightsOp>(weights, cur, end));
                 cur = end;
             }
             for (int i = 0; i < ops.size(); i++) {
-                pool->PushOp(i, ops[i]);
+                pool->PushOp(threadSt + i, ops[i]);
             }
             for (int i = 0; i < ops.size(); i++) {
-                pool->Wait(i);
-                delete ops[i];
+                pool->Wait(threadSt + i);
             }
         }
 
@@ -1587,6 +1603,7 @@ namespace fastllm {
                 izerosDown.resize(v.size());
  // record.push_back(std::make_pair("prepare", GetSpan(ttt, std::chrono::system_clock::now())));
                 for (int st = 0; st < v.size(); st++) {
+                    MultiThreadOpScope opScope; // 这一组专家的任务都从这里分配, 等待完成后在循环体结束时释放
                     int k = weights[v[st].first * 2]->dims[0];
                     int end = st, selSum = 1; // 一共处理selSum * k个输出
 
@@ -1618,18 +1635,17 @@ namespace fastllm {
                             LaunchLinearInt8Int8(uinput.data(), weightData, outputData, 1, m, curK,
                                                 weight->weightSum.data(), weight->zeros.data(), weight->scales.data(), biasData, 
                                                 inputSums.data(), iscales.data(), izeros.data(), 
-                                                ops, pool, threadSt, curThread);
+                                                opScope, ops, pool, threadSt, curThread);
                         } else {
                             MultiplyInt4GroupMultiThreadLaunch(uinput.data(), weightData, outputData, 1, m, curK,
                                                 weight->weightSum.data(), weight->mins.data(), weight->scales.data(), biasData, 
                                                 inputSums, iscales, izeros,
-                                                inputConfigs, threadSt, curThread, group, groupCnt, ops, pool);
+                                                inputConfigs, threadSt, curThread, group, groupCnt, opScope, ops, pool);
                         }
                         threadSt += curThread;
                     }
                     for (int j = 0; j < ops.size(); j++) {
                         pool->Wait(j);
-                        delete ops[j];
                     }
 // record.push_back(std::make_pair("mul0", GetSpan(ttt, std::chrono::system_clock::now())));
 // float spend = record.back().second - record[record.size() - 2].second;
@@ -1641,8 +1657,8 @@ namespace fastllm {
                         int spatial = weights[idx * 2]->dims[0], mid = spatial / 2;
                         float *outputData = middles[l].data();
                         int curK = weights[idx * 2]->dims[0];
-                        ops[l - st] = new fastllm::MultiThreadMultiOps();
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadSwigluOp(outputData, mid, mid, outputData, 1, spatial, spatial));
+                        ops[l - st] = opScope.New<fastllm::MultiThreadMultiOps>(false);
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadSwigluOp>(outputData, mid, mid, outputData, 1, spatial, spatial));
                         Data *weightDown = weights[idx * 2 + 1];
                         int groupDown = weightDown->group, groupCntDown = weightDown->groupCnt;
                         if (weightDown->dataType != DataType::INT4_GROUP) {
@@ -1660,7 +1676,7 @@ namespace fastllm {
                         iscales.resize(n * groupDown);
                         izeros.resize(n * groupDown);
 
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new MultiThreadOnlineQuantizationOp(
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<MultiThreadOnlineQuantizationOp>(
                                     middles[l].data(), uinputDown.data(), inputConfigs.data(),
                                     1, mid, groupDown, groupCntDown,
                                     inputSums.data(), iscales.data(), izeros.data(), permuteType));
@@ -1668,7 +1684,6 @@ namespace fastllm {
                     }
                     for (int l = st; l <= end; l++) {
                         pool->Wait(l - st);
-                        delete ops[l - st];
                     }
 // record.push_back(std::make_pair("swiglu", GetSpan(ttt, std::chrono::system_clock::now())));
  // record.push_back(std::make_pair("quant", GetSpan(ttt, std::chrono::system_clock::now())));
@@ -1693,19 +1708,18 @@ namespace fastllm {
                             LaunchLinearInt8Int8(uinputDown.data(), (uint8_t*)weightDown->cpuData, results[l].data(), 1, mid, m,
                                                     weightDown->weightSum.data(), weightDown->zeros.data(), weightDown->scales.data(), nullptr, 
                                                     inputSums.data(), iscales.data(), izeros.data(),
-                                                    ops, pool, threadSt, curThread);
+                                                    opScope, ops, pool, threadSt, curThread);
                         } else {
                             MultiplyInt4GroupMultiThreadLaunch(uinputDown.data(), (uint8_t*)weightDown->cpuData, results[l].data(), 1, mid, m,
                                                     weightDown->weightSum.data(), weightDown->mins.data(), weightDown->scales.data(), nullptr, 
                                                     inputSums, iscales, izeros,
-                                                    inputConfigs, threadSt, curThread, groupDown, groupCntDown, ops, pool);
+                                                    inputConfigs, threadSt, curThread, groupDown, groupCntDown, opScope, ops, pool);
                         }
                         threadSt += curThread;               
                     }
 
                     for (int j = 0; j < ops.size(); j++) {
                         pool->Wait(j);
-                        delete ops[j];
                     }
  // record.push_back(std::make_pair("mul1", GetSpan(ttt, std::chrono::system_clock::now())));
                     st = end;
@@ -1862,6 +1876,7 @@ namespace fastllm {
                 q8kInputsDown.resize(v.size());
 
                 for (int st = 0; st < v.size(); st++) {
+                    MultiThreadOpScope opScope;
                     int k = weights[v[st].first * 2]->dims[0];
                     int end = st, selSum = 1; // 一共处理selSum * k个输出
 
@@ -1889,12 +1904,11 @@ namespace fastllm {
                         int curThread = (curK / k) * base;
                         
                         LaunchLinearQ8KGGUF(q8kInputs.data(), weightData, outputData, biasData, weight, 
-                            1, m, curK, ops, pool, threadSt, curThread);
+                            1, m, curK, opScope, ops, pool, threadSt, curThread);
                         threadSt += curThread;
                     }
                     for (int j = 0; j < ops.size(); j++) {
                         pool->Wait(j);
-                        delete ops[j];
                     }
 
                     // swiglu
@@ -1908,9 +1922,9 @@ namespace fastllm {
                         int rowCount = mid / QK_K; // 每行有多少个block
                         uinputDown.resize(ggml_row_size(ggml_type_vec_dot_type((ggml_type)weights[idx * 2 + 1]->ggmlType), m));
 
-                        ops[l - st] = new fastllm::MultiThreadMultiOps();
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadSwigluOp(outputData, mid, mid, outputData, 1, spatial, spatial)); 
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadFloat32ToQ8KOp(middles[l].data(), (uint8_t*)uinputDown.data(), mid, (ggml_type)weights[idx * 2 + 1]->ggmlType));
+                        ops[l - st] = opScope.New<fastllm::MultiThreadMultiOps>(false);
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadSwigluOp>(outputData, mid, mid, outputData, 1, spatial, spatial)); 
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadFloat32ToQ8KOp>(middles[l].data(), (uint8_t*)uinputDown.data(), mid, (ggml_type)weights[idx * 2 + 1]->ggmlType));
                         /* ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new MultiThreadOnlineQuantizationOp(
                                     middles[l].data(), uinputDown.data(), inputConfigs.data(),
                                     1, mid, groupDown, groupCntDown,
@@ -1919,7 +1933,6 @@ namespace fastllm {
                     }
                     for (int l = st; l <= end; l++) {
                         pool->Wait(l - st);
-                        delete ops[l - st];
                     }
 /*
                     for (int l = st; l <= end; l++) {
@@ -1948,13 +1961,12 @@ namespace fastllm {
                         int curThread = (curK / k) * base;
 
                         LaunchLinearQ8KGGUF(uinputDown.data(), weightDown->cpuData, results[l].data(), nullptr, weightDown, 
-                            1, mid, m, ops, pool, threadSt, curThread);
+                            1, mid, m, opScope, ops, pool, threadSt, curThread);
                         threadSt += curThread;               
                     }
 
                     for (int j = 0; j < ops.size(); j++) {
                         pool->Wait(j);
-                        delete ops[j];
                     }
                     st = end;
                 }
@@ -2083,6 +2095,7 @@ namespace fastllm {
                 ops.resize(threads);
 
                 for (int st = 0; st < v.size(); st++) {
+                    MultiThreadOpScope opScope;
                     int k = weights[v[st].first * 2]->dims[0];
                     int end = st, selSum = 1; // 一共处理selSum * k个输出
 
@@ -2107,12 +2120,11 @@ namespace fastllm {
                         float *biasData = nullptr;
                         int curK = weight->dims[0];
                         int curThread = (curK / k) * base;
-                        LaunchLinearFloat32Float16(inputData, *weight, outputData, biasData, 1, m, curK, ops, pool, threadSt, curThread);
+                        LaunchLinearFloat32Float16(inputData, *weight, outputData, biasData, 1, m, curK, opScope, ops, pool, threadSt, curThread);
                         threadSt += curThread;
                     }
                     for (int j = 0; j < ops.size(); j++) {
                         pool->Wait(j);
-                        delete ops[j];
                     }
 
                     // swiglu
@@ -2122,13 +2134,12 @@ namespace fastllm {
                         int spatial = weights[idx * 2]->dims[0], mid = spatial / 2;
                         float *outputData = middles[l].data();
                         int curK = weights[idx * 2]->dims[0];
-                        ops[l - st] = new fastllm::MultiThreadMultiOps();
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadSwigluOp(outputData, mid, mid, outputData, 1, spatial, spatial));
+                        ops[l - st] = opScope.New<fastllm::MultiThreadMultiOps>(false);
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadSwigluOp>(outputData, mid, mid, outputData, 1, spatial, spatial));
                         pool->PushOp(l - st, ops[l - st]);
                     }
                     for (int l = st; l <= end; l++) {
                         pool->Wait(l - st);
-                        delete ops[l - st];
                     }
 
                     threadSt = 0;
@@ -2138,13 +2149,12 @@ namespace fastllm {
                         int curK = weights[idx * 2]->dims[0];
                         Data *weightDown = weights[idx * 2 + 1];
                         int curThread = (curK / k) * base;
-                        LaunchLinearFloat32Float16((float*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, ops, pool, threadSt, curThread);
+                        LaunchLinearFloat32Float16((float*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, opScope, ops, pool, threadSt, curThread);
                         threadSt += curThread;               
                     }
 
                     for (int j = 0; j < ops.size(); j++) {
                         pool->Wait(j);
-                        delete ops[j];
                     }
                     st = end;
                 }
@@ -2270,6 +2280,7 @@ namespace fastllm {
                 ops.resize(threads);
 
                 for (int st = 0; st < v.size(); st++) {
+                    MultiThreadOpScope opScope;
                     int k = weights[v[st].first * 2]->dims[0];
                     int end = st, selSum = 1; // 一共处理selSum * k个输出
 
@@ -2295,9 +2306,9 @@ namespace fastllm {
                         int curK = weight->dims[0];
                         int curThread = (curK / k) * base;
                         if (weight->dataType == DataType::FP8_E4M3) {                            
-                            LaunchLinearBFloat16FP8E4M3(bf16Input.data(), *weight, outputData, biasData, 1, m, curK, ops, pool, threadSt, curThread);
+                            LaunchLinearBFloat16FP8E4M3(bf16Input.data(), *weight, outputData, biasData, 1, m, curK, opScope, ops, pool, threadSt, curThread);
                         } if (weight->dataType == DataType::BFLOAT16) {
-                            LaunchLinearBFloat16BFloat16(bf16Input.data(), *weight, outputData, biasData, 1, m, curK, ops, pool, threadSt, curThread);
+                            LaunchLinearBFloat16BFloat16(bf16Input.data(), *weight, outputData, biasData, 1, m, curK, opScope, ops, pool, threadSt, curThread);
                         } else {
                             // TODO: other
                         }
@@ -2305,7 +2316,6 @@ namespace fastllm {
                     }
                     for (int j = 0; j < ops.size(); j++) {
                         pool->Wait(j);
-                        delete ops[j];
                     }
 
                     // swiglu
@@ -2315,14 +2325,13 @@ namespace fastllm {
                         int spatial = weights[idx * 2]->dims[0], mid = spatial / 2;
                         float *outputData = middles[l].data();
                         int curK = weights[idx * 2]->dims[0];
-                        ops[l - st] = new fastllm::MultiThreadMultiOps();
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadSwigluOp(outputData, mid, mid, outputData, 1, spatial, spatial));
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadFloat32ToBFloat16Op(middles[l].data(), (uint16_t*)middles[l].data(), mid));
+                        ops[l - st] = opScope.New<fastllm::MultiThreadMultiOps>(false);
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadSwigluOp>(outputData, mid, mid, outputData, 1, spatial, spatial));
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadFloat32ToBFloat16Op>(middles[l].data(), (uint16_t*)middles[l].data(), mid));
                         pool->PushOp(l - st, ops[l - st]);
                     }
                     for (int l = st; l <= end; l++) {
                         pool->Wait(l - st);
-                        delete ops[l - st];
                     }
 
                     threadSt = 0;
@@ -2333,9 +2342,9 @@ namespace fastllm {
                         Data *weightDown = weights[idx * 2 + 1];
                         int curThread = (curK / k) * base;
                         if (weightDown->dataType == DataType::FP8_E4M3) {
-                            LaunchLinearBFloat16FP8E4M3((uint16_t*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, ops, pool, threadSt, curThread);
+                            LaunchLinearBFloat16FP8E4M3((uint16_t*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, opScope, ops, pool, threadSt, curThread);
                         } else if (weightDown->dataType == DataType::BFLOAT16) {
-                            LaunchLinearBFloat16BFloat16((uint16_t*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, ops, pool, threadSt, curThread);
+                            LaunchLinearBFloat16BFloat16((uint16_t*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, opScope, ops, pool, threadSt, curThread);
                         } else {
                             // TODO: other
                         }
@@ -2344,7 +2353,6 @@ namespace fastllm {
 
                     for (int j = 0; j < ops.size(); j++) {
                         pool->Wait(j);
-                        delete ops[j];
                     }
                     st = end;
                 }
@@ -2767,54 +2775,99 @@ ops += (long long)lines * inputDim * interDim * 2;
                     }
                 }
   // cnt["prepare"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
-                for (int e = 0; e < expertTasks.size(); e++) {
-                    auto &task = expertTasks[e];
-                    if (task.size() == 0) {
-                        continue;
-                    }
-                    if (weights[e * 2] == nullptr) {
-                        continue;
-                    }
+                // 计算专家[eSt, eEnd)并累加到result中, 使用的临时变量由调用者提供, 以便不同的专家组并发执行
+                auto runExperts = [&](int eSt, int eEnd, std::vector <float> &tempResult, std::vector <float> &middleResult,
+                                      Data &tempInput, Data &w1, Data &w3) {
+                    for (int e = eSt; e < eEnd; e++) {
+                        auto &task = expertTasks[e];
+                        if (task.size() == 0) {
+                            continue;
+                        }
+                        if (weights[e * 2] == nullptr) {
+                            continue;
+                        }
 
-                    tempInput.Resize({(int)task.size(), inputDim});
-                    tempInput.Allocate();
+                        tempInput.Resize({(int)task.size(), inputDim});
+                        tempInput.Allocate();
 
-                    std::vector <MultiThreadMemcpyMultiLinesTask> memcpyTasks;
-                    for (int i = 0; i < (int)task.size(); i++) {
-                        memcpyTasks.push_back(MultiThreadMemcpyMultiLinesTask(tempInput.cpuData + i * inputDim * input.unitSize, input.cpuData + task[i].first * inputDim * input.unitSize, inputDim * input.unitSize));
+                        std::vector <MultiThreadMemcpyMultiLinesTask> memcpyTasks;
+                        for (int i = 0; i < (int)task.size(); i++) {
+                            memcpyTasks.push_back(MultiThreadMemcpyMultiLinesTask(tempInput.cpuData + i * inputDim * input.unitSize, input.cpuData + task[i].first * inputDim * input.unitSize, inputDim * input.unitSize));
+                        }
+                        RunMultiThreadMemcpyMultiLines(memcpyTasks, GetAlivePool());
+                        DoCpuLinearReshape(tempInput, *weights[e * 2], w3);
+     // cnt["linear 0 prepare"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
+                        DoCpuLinear(tempInput, *weights[e * 2], Data(), w3);
+     // cnt["linear 0"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();                    
+                        int mid = w3.dims[1] / 2;
+                        w1.Resize({w3.dims[0], mid});
+                        w1.dataType = w3.dataType;
+                        w1.Allocate();
+
+                        if (w3.dataType == DataType::FLOAT32) {
+                            SwigluMultiThread((float *) w3.cpuData, mid, mid, ((float *) w1.cpuData),
+                                        w3.dims[0], w3.dims[1], mid, GetAlivePool());
+                        } else {
+                            SwigluMultiThreadFloat16((uint16_t *) w3.cpuData, mid, mid, ((uint16_t *) w1.cpuData),
+                                        w3.dims[0], w3.dims[1], mid, GetAlivePool());
+                        }
+      // cnt["swiglu"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
+                        DoCpuLinearReshape(w1, *weights[e * 2 + 1], w3);
+      // cnt["linear 1 prepare"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
+                        DoCpuLinear(w1, *weights[e * 2 + 1], Data(), w3);
+      // cnt["linear 1"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();                    
+                        float *curOutput;
+                        if (w3.dataType == DataType::FLOAT32) {
+                            curOutput = (float*)w3.cpuData;
+                        } else if (w3.dataType == DataType::FLOAT16) {
+                            Float16ToFloat32((uint16_t*)w3.cpuData, middleResult.data(), w3.Count(0));
+                            curOutput = middleResult.data();
+                        }
+
+                        RunMultiThreadMoeReduce(&task, &tempResult, curOutput, dim, GetAlivePool());
+      // cnt["reduce"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
                     }
-                    RunMultiThreadMemcpyMultiLines(memcpyTasks, GetAlivePool());
-                    DoCpuLinearReshape(tempInput, *weights[e * 2], w3);
- // cnt["linear 0 prepare"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
-                    DoCpuLinear(tempInput, *weights[e * 2], Data(), w3);
- // cnt["linear 0"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();                    
-                    int mid = w3.dims[1] / 2;
-                    w1.Resize({w3.dims[0], mid});
-                    w1.dataType = w3.dataType;
-                    w1.Allocate();
+                };
 
-                    if (w3.dataType == DataType::FLOAT32) {
-                        SwigluMultiThread((float *) w3.cpuData, mid, mid, ((float *) w1.cpuData),
-                                    w3.dims[0], w3.dims[1], mid, GetAlivePool());
-                    } else {
-                        SwigluMultiThreadFloat16((uint16_t *) w3.cpuData, mid, mid, ((uint16_t *) w1.cpuData),
-                                    w3.dims[0], w3.dims[1], mid, GetAlivePool());
+                // 共享专家和路由专家互相独立, 按估计的计算量把线程分成两部分同时计算 (单个专家的行数较少时扩展不到所有线程)
+                // INT4的Linear会占用全部线程, 不能放在stream中; 每个参与计算的专家都要检查
+                bool useStreams = expertTasks[0].size() > 0 && weights[0] != nullptr;
+                for (int e = 0; e < expertTasks.size() && useStreams; e++) {
+                    if (expertTasks[e].size() == 0 || weights[e * 2] == nullptr) {
+                        continue;
                     }
-  // cnt["swiglu"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
-                    DoCpuLinearReshape(w1, *weights[e * 2 + 1], w3);
-  // cnt["linear 1 prepare"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
-                    DoCpuLinear(w1, *weights[e * 2 + 1], Data(), w3);
-  // cnt["linear 1"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();                    
-                    float *curOutput;
-                    if (w3.dataType == DataType::FLOAT32) {
-                        curOutput = (float*)w3.cpuData;
-                    } else if (w3.dataType == DataType::FLOAT16) {
-                        Float16ToFloat32((uint16_t*)w3.cpuData, middleResult.data(), w3.Count(0));
-                        curOutput = middleResult.data();
+                    for (int j = e * 2; j < e * 2 + 2; j++) {
+                        if (weights[j] == nullptr || weights[j]->dataType == DataType::INT4) {
+                            useStreams = false;
+                        }
+                    }
+                }
+                if (useStreams) {
+                    // 行数较少时受限于读权重, 估计的计算量和参数量成正比
+                    auto expertCost = [&](int e) {
+                        return (float)(weights[e * 2]->Count(0) + weights[e * 2 + 1]->Count(0)) * std::max(1.0f, expertTasks[e].size() / 16.0f);
+                    };
+                    std::vector <float> costs = {0.0f, expertCost(0)};
+                    for (int e = 1; e < expertTasks.size(); e++) {
+                        if (expertTasks[e].size() > 0 && weights[e * 2] != nullptr) {
+                            costs[0] += expertCost(e);
+                        }
                     }
 
-                    RunMultiThreadMoeReduce(&task, &tempResult, curOutput, dim, GetAlivePool());
-  // cnt["reduce"] += GetSpan(st, std::chrono::system_clock::now()); st = std::chrono::system_clock::now();
+                    Data sharedInput(tempInput.dataType), sharedW1, sharedW3;
+                    std::vector <float> sharedResult, sharedMiddleResult;
+                    sharedResult.resize(bs * dim, 0.0f);
+                    sharedMiddleResult.resize(bs * dim, 0.0f);
+                    std::vector <std::function <void ()> > streams = {
+                        [&]() { runExperts(1, expertTasks.size(), tempResult, middleResult, tempInput, w1, w3); },
+                        [&]() { runExperts(0, 1, sharedResult, sharedMiddleResult, sharedInput, sharedW1, sharedW3); }
+                    };
+                    RunMultiThreadStreams(streams, costs, GetAlivePool());
+                    for (int i = 0; i < bs * dim; i++) {
+                        tempResult[i] += sharedResult[i];
+                    }
+                } else {
+                    runExperts(0, expertTasks.size(), tempResult, middleResult, tempInput, w1, w3);
                 }
                 if (output.dataType == DataType::FLOAT32) {
                     memcpy(output.cpuData, tempResult.data(), output.GetBytes());
@@ -2944,6 +2997,39 @@ ops += (long long)lines * inputDim * interDim * 2;
         }
     }
 
+    // 从量化的词表中取出第token行并反量化到output (embSize个float)
+    static void EmbeddingDequantRow(Data &weight, int token, int embSize, float *output) {
+        if (weight.dataType == DataType::INT8) {
+            uint8_t *row = weight.cpuData + (uint64_t)token * embSize;
+            float scale = weight.scales[token];
+            float zero = weight.zeros[token];
+            for (int j = 0; j < embSize; j++) {
+                output[j] = ((float)row[j] - zero) * scale;
+            }
+        } else if (weight.dataType == DataType::INT4_GROUP) {
+            int group = weight.group, groupCnt = weight.groupCnt;
+            uint8_t *row = weight.cpuData + (uint64_t)token * embSize / 2;
+            float *mins = weight.mins.data() + (uint64_t)token * group;
+            float *scales = weight.scales.data() + (uint64_t)token * group;
+            for (int j = 0; j < embSize; j += 2) {
+                int g = j / groupCnt;
+                output[j] = mins[g] + scales[g] * (row[j / 2] >> 4);
+                output[j + 1] = mins[g] + scales[g] * (row[j / 2] & 15);
+            }
+        } else if (weight.dataType == DataType::DATA_GGUF_FORMAT) {
+            ggml_type type = (ggml_type)weight.ggmlType;
+            uint8_t *row = weight.cpuData + (uint64_t)token * ggml_row_size(type, embSize);
+            ggml_type_to_float(type)(row, output, embSize);
+        } else if (weight.dataType == DataType::FLOAT16) {
+            uint16_t *row = (uint16_t*)weight.cpuData + (uint64_t)token * embSize;
+            for (int j = 0; j < embSize; j++) {
+                output[j] = half_to_float(row[j]);
+            }
+        } else {
+            ErrorInFastLLM("Embedding error: unsupport weight dataType.\n");
+        }
+    }
+
     void CpuEmbedding::Reshape(const std::string &opType, const fastllm::DataDict &datas,
                                const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
         Data &input = *(datas.find("input")->second);
@@ -2953,7 +3039,16 @@ ops += (long long)lines * inputDim * interDim * 2;
         AssertInFastLLM(weight.dims.size() == 2, "Embedding's weight's dim should be 2.\n");
         AssertInFastLLM(weight.dataType == DataType::FLOAT32 ||
                         weight.dataType == DataType::FLOAT16 ||
-                        weight.dataType == DataType::BFLOAT16, "Embedding's weight's type should be float32 or float16 or bfloat16.\n");
+                        weight.dataType == DataType::BFLOAT16 ||
+                        weight.dataType == DataType::INT8 ||
+                        weight.dataType == DataType::INT4_GROUP ||
+                        weight.dataType == DataType::DATA_GGUF_FORMAT, 
+                        "Embedding's weight's type should be float32, float16, bfloat16, int8, int4g or gguf.\n");
+        if (weight.dataType == DataType::DATA_GGUF_FORMAT) {
+            AssertInFastLLM(!weight.IsRepacked && ggml_type_to_float((ggml_type)weight.ggmlType) != nullptr,
+                            "Embedding error: can't read rows from gguf weight (type " + 
+                            std::string(ggml_type_name((ggml_type)weight.ggmlType)) + ").\n");
+        }
         AssertInFastLLM(input.dataType == DataType::FLOAT32 ||
                         input.dataType == DataType::FLOAT16, 
                         "Embedding's input's type should be float32 or float16.\n");
@@ -2985,11 +3080,13 @@ ops += (long long)lines * inputDim * interDim * 2;
         float *dstOutputData = (float*)output.cpuData;
 
         std::vector <float> tempInputData, tempOutputData;
+        if (output.dataType != DataType::FLOAT32) {
+            tempOutputData.resize(inputLen * embSize);
+            dstOutputData = tempOutputData.data();
+        }
         if (input.dataType != DataType::FLOAT32) {
             tempInputData.resize(inputLen);
-            tempOutputData.resize(inputLen * embSize);
             inputData = tempInputData.data();
-            dstOutputData = tempOutputData.data();
 
             if (input.dataType == DataType::FLOAT16) {
                 for (int i = 0; i < inputLen; i++) {
@@ -3000,7 +3097,7 @@ ops += (long long)lines * inputDim * interDim * 2;
             }
         }
 
-        if (GetLowMemMode()) {
+        if (GetLowMemMode() && weight.cpuData == nullptr) {
             FILE *fi = fopen(weight.fileName.c_str(), "rb");
             if (weight.dataType == DataType::FLOAT32) {
                 float *outputData = (float *) dstOutputData;
@@ -3024,6 +3121,12 @@ ops += (long long)lines * inputDim * interDim * 2;
                     fseek(fi, (long long)token * embSize * sizeof(uint16_t) + weight.filePos, 0);
 #endif
                     int ret = fread(weightData, sizeof(uint16_t), embSize, fi);
+                    if (weight.dataType == DataType::FLOAT16) {
+                        for (int j = 0; j < embSize; j++) {
+                            dstOutputData[i * embSize + j] = half_to_float(weightData[j]);
+                        }
+                        continue;
+                    }
                     for (int j = 0; j < embSize; j++) {
                         outputData[i * embSize * 2 + j * 2] = 0;
                         outputData[i * embSize * 2 + j * 2 + 1] = weightData[j];
@@ -3040,6 +3143,12 @@ ops += (long long)lines * inputDim * interDim * 2;
                     int token = (int) (inputData[i] + 1e-9);
                     memcpy(outputData + i * embSize, weightData + token * embSize, embSize * sizeof(float));
                 }
+            } else if (weight.dataType != DataType::BFLOAT16) {
+                // 量化 (或float16) 的词表: 只反量化用到的行
+                for (int i = 0; i < inputLen; i++) {
+                    int token = (int) (inputData[i] + 1e-9);
+                    EmbeddingDequantRow(weight, token, embSize, dstOutputData + i * embSize);
+                }
             } else {
                 uint16_t *outputData = (uint16_t *) dstOutputData;
                 uint16_t *weightData = (uint16_t *) weight.cpuData;
@@ -3241,21 +3350,22 @@ ops += (long long)lines * inputDim * interDim * 2;
             (MultiThreadRMSNormFloatOp(output, input, weight, outer, channels, eps)).Run();
             return;
         }
-        int threadNum = pool->threads.size();
-        int per = outer / pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
+        int per = outer / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadRMSNormFloatOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? outer : cur + per + (cur + per * (threadNum - i) < outer));
-            ops.push_back(new MultiThreadRMSNormFloatOp(output + cur * channels, input + cur * channels, weight, end - cur, channels, eps));
+            ops.push_back(opScope.New<MultiThreadRMSNormFloatOp>(output + cur * channels, input + cur * channels, weight, end - cur, channels, eps));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -3303,6 +3413,180 @@ ops += (long long)lines * inputDim * interDim * 2;
         }
     }
 
+    // 按Linear权重的类型确定输入的在线量化方式, 需要和DoCpuLinear中保持一致
+    static bool GetOnlineQuantizationType(int weightDataType, int weightGroup, int weightGroupCnt, int m, 
+                                          int &group, int &groupCnt, int &permuteType) {
+        if (weightDataType == DataType::INT8) {
+            group = 1, groupCnt = m, permuteType = 0;
+            return true;
+        } else if (weightDataType == DataType::INT4_NOZERO) {
+            group = 1, groupCnt = m, permuteType = 1;
+            return true;
+        } else if (weightDataType == DataType::INT4_GROUP) {
+            group = weightGroup, groupCnt = weightGroupCnt, permuteType = 1;
+            return group > 0 && groupCnt > 0;
+        }
+        return false;
+    }
+
+    // input已经由AddRMSNormQuant按同样的方式量化过时, 返回量化结果
+    static QuantizedActivation *GetPreQuantizedInput(const Data &input, int n, int m, int group, int groupCnt, int permuteType) {
+        QuantizedActivation *quantized = input.quantizedActivation.get();
+        if (quantized != nullptr && quantized->source != nullptr && quantized->source == (void*)input.cpuData &&
+            quantized->n == n && quantized->m == m && quantized->group == group &&
+            quantized->groupCnt == groupCnt && quantized->permuteType == permuteType) {
+            return quantized;
+        }
+        return nullptr;
+    }
+
+    struct MultiThreadAddRMSNormQuantOp : MultiThreadBaseOp {
+        float *hidden, *add, *weight, *output;
+        QuantizedActivation *quantized;
+        int st, end, channels;
+        float eps;
+
+        MultiThreadAddRMSNormQuantOp (float *hidden, float *add, float *weight, float *output, QuantizedActivation *quantized,
+                                      int st, int end, int channels, float eps) : 
+            hidden(hidden), add(add), weight(weight), output(output), quantized(quantized), 
+            st(st), end(end), channels(channels), eps(eps) {}
+
+        void Run() {
+            int group = quantized->group;
+            for (int i = st; i < end; i++) {
+                float *h = hidden + (long long)i * channels;
+                float *a = add + (long long)i * channels;
+                float *o = output + (long long)i * channels;
+                float mean = 0.f;
+                int j = 0;
+#ifdef __aarch64__
+                float32x4_t sums = vdupq_n_f32(0.0);
+                for (; j + 3 < channels; j += 4) {
+                    float32x4_t vi = vaddq_f32(vld1q_f32(h + j), vld1q_f32(a + j));
+                    vst1q_f32(h + j, vi);
+                    sums = vaddq_f32(sums, vmulq_f32(vi, vi));
+                }
+                mean = sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+#ifdef __AVX2__
+                __m256 vsums = _mm256_setzero_ps();
+                for (; j + 7 < channels; j += 8) {
+                    __m256 vi = _mm256_add_ps(_mm256_loadu_ps(h + j), _mm256_loadu_ps(a + j));
+                    _mm256_storeu_ps(h + j, vi);
+                    vsums = _mm256_fmadd_ps(vi, vi, vsums);
+                }
+                mean = Floatsum(vsums);
+#endif
+                for (; j < channels; j++) {
+                    h[j] += a[j];
+                    mean += h[j] * h[j];
+                }
+                float scale = 1.0 / sqrt(mean / channels + eps);
+                j = 0;
+#ifdef __aarch64__
+                float32x4_t vscale = vdupq_n_f32(scale);
+                for (; j + 3 < channels; j += 4) {
+                    vst1q_f32(o + j, vmulq_f32(vmulq_f32(vld1q_f32(h + j), vscale), vld1q_f32(weight + j)));
+                }
+#endif
+#ifdef __AVX2__
+                __m256 vscale = _mm256_set1_ps(scale);
+                for (; j + 7 < channels; j += 8) {
+                    _mm256_storeu_ps(o + j, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(h + j), vscale), _mm256_loadu_ps(weight + j)));
+                }
+#endif
+                for (; j < channels; j++) {
+                    o[j] = h[j] * scale * weight[j];
+                }
+
+                // 这一行还在缓存里, 直接量化
+                MultiThreadOnlineQuantizationOp(o, quantized->uinput.data() + (long long)i * channels, quantized->configs.data() + i * group,
+                                                1, channels, group, quantized->groupCnt, 
+                                                quantized->inputSums.data() + i * group, quantized->iscales.data() + i * group, 
+                                                quantized->izeros.data() + i * group, quantized->permuteType).Run();
+            }
+        }
+    };
+
+    bool CpuAddRMSNormQuantOp::CanRun(const std::string &opType, const fastllm::DataDict &datas,
+                                      const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
+        auto input = datas.find("input");
+        if (input == datas.end() || input->second == nullptr || input->second->dataType != DataType::FLOAT32) {
+            return false;
+        }
+        auto linearDataType = intParams.find("linearDataType");
+        if (linearDataType == intParams.end()) {
+            return false;
+        }
+        int type = linearDataType->second;
+        return type == DataType::INT8 || type == DataType::INT4_NOZERO || type == DataType::INT4_GROUP;
+    }
+
+    void CpuAddRMSNormQuantOp::Run(const std::string &opType, const fastllm::DataDict &datas,
+                                   const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
+        Data &input = *(datas.find("input")->second);
+        Data &add = *(datas.find("add")->second);
+        Data &weight = *(datas.find("weight")->second);
+        Data &output = *(datas.find("output")->second);
+        AssertInFastLLM(&input != &output, "AddRMSNormQuant: output can't be input.\n");
+        AssertInFastLLM(input.dataType == DataType::FLOAT32 && add.dataType == DataType::FLOAT32 && weight.dataType == DataType::FLOAT32,
+                        "AddRMSNormQuant error: unsupport dataType.\n");
+        AssertInFastLLM(input.Count(0) == add.Count(0), "AddRMSNormQuant error: input and add's shape should be same.\n");
+        output.Allocate();
+
+        float eps = floatParams.find("eps") != floatParams.end() ? floatParams.find("eps")->second : 1e-5;
+        int linearDataType = intParams.find("linearDataType")->second;
+        int linearGroup = intParams.find("linearGroup") != intParams.end() ? intParams.find("linearGroup")->second : -1;
+        int linearGroupCnt = intParams.find("linearGroupCnt") != intParams.end() ? intParams.find("linearGroupCnt")->second : -1;
+        int channels = input.dims.back();
+        int outer = input.Count(0) / channels;
+
+        if (output.quantizedActivation == nullptr) {
+            output.quantizedActivation = std::make_shared <QuantizedActivation> ();
+        }
+        QuantizedActivation &quantized = *output.quantizedActivation;
+        AssertInFastLLM(GetOnlineQuantizationType(linearDataType, linearGroup, linearGroupCnt, channels, 
+                        quantized.group, quantized.groupCnt, quantized.permuteType), 
+                        "AddRMSNormQuant error: unsupport linear weight's dataType.\n");
+        quantized.n = outer;
+        quantized.m = channels;
+        if (quantized.uinput.size() < (size_t)outer * channels) {
+            quantized.uinput.resize((size_t)outer * channels);
+        }
+        quantized.configs.resize(outer * quantized.group);
+        quantized.inputSums.resize(outer * quantized.group);
+        quantized.iscales.resize(outer * quantized.group);
+        quantized.izeros.resize(outer * quantized.group);
+
+        float *hiddenData = (float *) input.cpuData;
+        float *addData = (float *) add.cpuData;
+        float *weightData = (float *) weight.cpuData;
+        float *outputData = (float *) output.cpuData;
+        auto *pool = GetAlivePool();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = std::min(interval.second - interval.first, outer);
+        if (threadNum <= 1) {
+            MultiThreadAddRMSNormQuantOp(hiddenData, addData, weightData, outputData, &quantized, 0, outer, channels, eps).Run();
+        } else {
+            int per = outer / threadNum;
+            int cur = 0;
+            MultiThreadOpScope opScope;
+            std::vector<fastllm::MultiThreadAddRMSNormQuantOp*> ops;
+            for (int i = 0; i < threadNum; i++) {
+                int end = (i == threadNum - 1 ? outer : cur + per + (cur + per * (threadNum - i) < outer));
+                ops.push_back(opScope.New<MultiThreadAddRMSNormQuantOp>(hiddenData, addData, weightData, outputData, &quantized, cur, end, channels, eps));
+                cur = end;
+            }
+            for (int i = 0; i < threadNum; i++) {
+                pool->PushOp(threadSt + i, ops[i]);
+            }
+            for (int i = 0; i < threadNum; i++) {
+                pool->Wait(threadSt + i);
+            }
+        }
+        quantized.source = output.cpuData;
+    }
+
     bool CpuConv1DPerChannel::CanRun(const std::string &opType, const fastllm::DataDict &datas,
                           const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
         return true;
@@ -3614,39 +3898,6 @@ ops += (long long)lines * inputDim * interDim * 2;
         }
     }
 
-    struct MultiThreadBase3GroupLinearOp : MultiThreadBaseOp {
-        float *inputData;
-        uint8_t *weightData;
-        float *biasData, *outputData;
-        int n, m, k, st, end, group, groupCnt;
-        uint16_t *halfScales;
-
-        MultiThreadBase3GroupLinearOp(float *inputData, uint8_t *weightData, float *biasData, float *outputData,
-                           int n, int m, int k, int st, int end, int group, int groupCnt, uint16_t *halfScales) : 
-            inputData(inputData), weightData(weightData), biasData(biasData), outputData(outputData),
-            n(n), m(m), k(k), st(st), end(end), group(group), groupCnt(groupCnt), halfScales(halfScales) {}
-
-        void Run() {
-            std::vector <uint8_t> base = {1, 3, 9, 27, 81};
-            int bytesPerGroup = ((groupCnt - 1) / 5) + 1;   
-            for (int i = 0; i < n; i++) {
-                for (int j = st; j < end; j++) {
-                    float now = biasData ? biasData[j] : 0.0f;
-                    for (int g = 0; g < group; g++) {
-                        uint8_t *cur = weightData + j * group * bytesPerGroup + g * bytesPerGroup;
-                        float sum = 0.0;
-                        int l = 0;
-                        for (; l < groupCnt && g * groupCnt + l < m; l++) {
-                            sum += inputData[i * m + g * groupCnt + l] * (cur[l / 5] / base[l % 5] % 3 - 1);
-                        }
-                        now += sum * fp16tofp32.dict[halfScales[j * group + g]];
-                    }
-                    outputData[i * k + j] = now;
-                }
-            }
-        }
-    };
-
     // float的input, int8的weight, 直接计算得到float的output
     void Int8LinearPart(float *inputData, uint8_t *weightData, float *biasData, float *outputData,
                         LowBitConfig *configs, int n, int m, int k, int st, int end) {
@@ -3922,10 +4173,11 @@ ops += (long long)lines * inputDim * interDim * 2;
                          weightSums + cur, weightZeros + cur, scales + cur,
                          (bias == nullptr ? (float*)nullptr : bias + cur), configs.data(), inputSums.data()).Run();
         } else {
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadLinearInt4Op*> ops;
             for (int i = 0; i < threadNum; i++) {
                 int end = (i == threadNum - 1 ? k : cur + per + (cur + per * (threadNum - i) < k));
-                ops.push_back(new MultiThreadLinearInt4Op(a, b + cur * m / 2, c + cur, n, m, end - cur, k,
+                ops.push_back(opScope.New<MultiThreadLinearInt4Op>(a, b + cur * m / 2, c + cur, n, m, end - cur, k,
                                                weightSums + cur, weightZeros + cur, scales + cur,
                                                (bias == nullptr ? (float *) nullptr : bias + cur), configs.data(),
                                                inputSums.data()));
@@ -3936,7 +4188,6 @@ ops += (long long)lines * inputDim * interDim * 2;
             }
             for (int i = 0; i < threadNum; i++) {
                 pool->Wait(i);
-                delete ops[i];
             }
         }
     }
@@ -3946,7 +4197,7 @@ ops += (long long)lines * inputDim * interDim * 2;
                                  int *weightSums, float *weightMins, float *scales, float *bias,
                                  std::vector <float> &inputSums, std::vector <float> &iscales, std::vector <float> &izeros,
                                  std::vector <LowBitConfig> &configs, int startTid, int threadNum, int group, int groupCnt,
-                                 std::vector<fastllm::MultiThreadBaseOp*> &ops, 
+                                 MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, 
                                  AliveThreadPool *pool) {
         int per = k / threadNum;
         int cur = 0;
@@ -3954,12 +4205,12 @@ ops += (long long)lines * inputDim * interDim * 2;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? k : cur + per + (cur + per * (threadNum - i) < k));
             if (group > 1) {
-                ops[startTid + i] = new MultiThreadLinearInt8Int4GroupOp(a, b + cur * m / 2, c + cur, n, m, end - cur, k,
+                ops[startTid + i] = opScope.New<MultiThreadLinearInt8Int4GroupOp>(a, b + cur * m / 2, c + cur, n, m, end - cur, k,
                                            weightSums + cur * group, weightMins + cur * group, scales + cur * group,
                                            (bias == nullptr ? (float *) nullptr : bias + cur), iscales.data(), izeros.data(),
                                            inputSums.data(), group, groupCnt);
             } else {
-                ops[startTid + i] = new MultiThreadLinearInt4NoZeroOp(a, b + cur * m / 2, (int32_t*)c + cur, n, m, end - cur, k,
+                ops[startTid + i] = opScope.New<MultiThreadLinearInt4NoZeroOp>(a, b + cur * m / 2, (int32_t*)c + cur, n, m, end - cur, k,
                                            weightSums + cur * group, weightMins + cur * group, scales + cur * group,
                                            (bias == nullptr ? (float *) nullptr : bias + cur), configs.data(), inputSums.data());
             }
@@ -4057,7 +4308,7 @@ ops += (long long)lines * inputDim * interDim * 2;
             __m256 vClampedHigh = _mm256_min_ps(vClampedLow, vMax);
             
             // Convert to int32 (truncate)
-            __m256i vInt32 = _mm256_cvtps_epi32(vClampedHigh);
+            __m256i vInt32 = _mm256_cvttps_epi32(vClampedHigh);
             
             // Pack into 16-bit integers
             __m128i vInt16 = _mm_packus_epi32(
@@ -4076,6 +4327,22 @@ ops += (long long)lines * inputDim * interDim * 2;
         }
     }
 
+    // INT2权重每个字节存4个元素 (第一个元素在最高位), 把输入每128个元素重排成4个平面,
+    // 第s个平面是下标为4p+s的元素, 这样从32个字节的权重中移位取出的每个平面都能和输入直接相乘
+    void Int2InputPermute(uint8_t* output, int n, int m) {
+        uint8_t temp[128];
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j + 127 < m; j += 128) {
+                memcpy(temp, output + (size_t)i * m + j, 128);
+                for (int p = 0; p < 32; p++) {
+                    for (int s = 0; s < 4; s++) {
+                        output[(size_t)i * m + j + s * 32 + p] = temp[p * 4 + s];
+                    }
+                }
+            }
+        }
+    }
+
 #ifdef __AVX2__
     void Avx2InputPermute(uint8_t* output, int n, int m) {
          if (cpuInstructInfo.hasAVX512VNNI) {
@@ -4182,6 +4449,11 @@ ops += (long long)lines * inputDim * interDim * 2;
 #endif
         }
 
+        if (permuteType == 2) {
+            // for INT8 * INT2
+            Int2InputPermute(output, n, m);
+        }
+
         if (inputSums != nullptr) {
             for (int i = 0; i < n; i++) {
                 for (int g = 0; g < realGroup; g++) {
@@ -4225,19 +4497,73 @@ ops += (long long)lines * inputDim * interDim * 2;
         return true;
     }
 
-    void DoCpuLinear(Data &input, Data &weight, const Data &bias, Data &output) {
-//auto st = std::chrono::system_clock::now();
-        output.Allocate();
-        int n = input.Count(0) / input.dims.back();
-        int m = input.dims.back();
-        int k = output.dims.back();
-        int threadSt = GetAlivePool()->curActivateThreadInterval.first;
-        int threadLen = GetAlivePool()->curActivateThreadInterval.second - GetAlivePool()->curActivateThreadInterval.first;
+    // 注册可以被自动调优的Linear kernel, 没有调优结果时DoCpuLinear仍然按数据类型选择默认的kernel
+    void RegisterCpuLinearKernels() {
+        LinearTuner *tuner = GetLinearTuner();
+        tuner->Register(DataType::FLOAT32, DataType::FLOAT32, "base", {"direct",
+            [](Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen) {
+                RunLinearFloat32Float32((float*)input.cpuData, (float*)weight.cpuData, (float*)output.cpuData, 
+                    bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+            }});
+        tuner->Register(DataType::FLOAT32, DataType::FLOAT16, "base", {"direct",
+            [](Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen) {
+                RunLinearFloat32Float16((float*)input.cpuData, (uint16_t*)weight.cpuData, (float*)output.cpuData, 
+                    bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+            }});
+        tuner->Register(DataType::FLOAT32, DataType::BFLOAT16, "base", {"direct",
+            [](Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen) {
+                RunLinearFloat32BFloat16((float*)input.cpuData, (uint16_t*)weight.cpuData, (float*)output.cpuData, 
+                    bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+            }});
+        for (auto weightType : {DataType::FLOAT16, DataType::BFLOAT16}) {
+            tuner->Register(DataType::FLOAT32, weightType, "avx2", {"blocked",
+                [](Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen) {
+                    RunLinearFloat32HalfBlocked((float*)input.cpuData, (uint16_t*)weight.cpuData, weight.dataType == DataType::BFLOAT16,
+                        (float*)output.cpuData, bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+                }});
+        }
+        tuner->Register(DataType::FLOAT32, DataType::INT8, "base", {"direct",
+            [](Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen) {
+                RunLinearFloat32Int8((float*)input.cpuData, weight, (float*)output.cpuData, 
+                    bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen,
+                    GetPreQuantizedInput(input, n, m, 1, m, 0));
+            }});
+        for (auto weightType : {DataType::INT4_GROUP, DataType::INT4_NOZERO}) {
+            tuner->Register(DataType::FLOAT32, weightType, "base", {"direct",
+                [](Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen) {
+                    int group = weight.group, groupCnt = weight.groupCnt;
+                    if (weight.dataType == DataType::INT4_NOZERO) {
+                        group = 1, groupCnt = m;
+                    }
+                    RunLinearFloat32Int4Group((float*)input.cpuData, weight, (float*)output.cpuData, 
+                                            bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, group, groupCnt,
+                                            GetAlivePool(), threadSt, threadLen, GetPreQuantizedInput(input, n, m, group, groupCnt, 1));
+                }});
+        }
+        tuner->Register(DataType::FLOAT16, DataType::FLOAT16, "base", {"direct",
+            [](Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen) {
+                RunLinearFloat16Float16((uint16_t*)input.cpuData, (uint16_t*)weight.cpuData, (uint16_t*)output.cpuData, 
+                    bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+            }});
+        tuner->Register(DataType::FLOAT16, DataType::FLOAT16, "avx2", {"blocked",
+            [](Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen) {
+                RunLinearFloat16HalfBlocked((uint16_t*)input.cpuData, (uint16_t*)weight.cpuData, false,
+                    (uint16_t*)output.cpuData, bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+            }});
+    }
 
+    // 按数据类型选择的默认kernel, 没有调优结果时使用, 在线调优时也作为候选之一
+    static void DoCpuLinearDefault(Data &input, Data &weight, const Data &bias, Data &output,
+                                   int n, int m, int k, int threadSt, int threadLen) {
+//auto st = std::chrono::system_clock::now();
         if (input.dataType == DataType::FLOAT32 && output.dataType == DataType::FLOAT32) {
             if (weight.dataType == DataType::FLOAT32) {
                 RunLinearFloat32Float32((float*)input.cpuData, (float*)weight.cpuData, (float*)output.cpuData, 
                     bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+            } else if (UseLinearHalfBlocked(n, m, k, weight.dataType)) {
+                // prefill规模的FP16 / BF16权重使用分块GEMM
+                RunLinearFloat32HalfBlocked((float*)input.cpuData, (uint16_t*)weight.cpuData, weight.dataType == DataType::BFLOAT16,
+                    (float*)output.cpuData, bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
             } else if (weight.dataType == DataType::BFLOAT16) {
                 RunLinearFloat32BFloat16((float*)input.cpuData, (uint16_t*)weight.cpuData, (float*)output.cpuData, 
                     bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
@@ -4246,7 +4572,8 @@ ops += (long long)lines * inputDim * interDim * 2;
                     bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
             } else if (weight.dataType == DataType::INT8) {
                 RunLinearFloat32Int8((float*)input.cpuData, weight, (float*)output.cpuData, 
-                    bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+                    bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen,
+                    GetPreQuantizedInput(input, n, m, 1, m, 0));
             } else if (weight.dataType == DataType::INT4_GROUP || weight.dataType == DataType::INT4_NOZERO) {
                 int group = weight.group, groupCnt = weight.groupCnt;
                 if (weight.dataType == DataType::INT4_NOZERO) {
@@ -4254,40 +4581,16 @@ ops += (long long)lines * inputDim * interDim * 2;
                 }
                 RunLinearFloat32Int4Group((float*)input.cpuData, weight, (float*)output.cpuData, 
                                         bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, group, groupCnt,
-                                        GetAlivePool(), threadSt, threadLen);
+                                        GetAlivePool(), threadSt, threadLen, GetPreQuantizedInput(input, n, m, group, groupCnt, 1));
             } else if (weight.dataType == DataType::INT2_GROUP) {
                 int group = weight.group, groupCnt = weight.groupCnt;
                 RunLinearFloat32Int2Group((float*)input.cpuData, weight, (float*)output.cpuData, 
                                         bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, group, groupCnt,
                                         GetAlivePool(), threadSt, threadLen);
             } else if (weight.dataType == DataType::BASE3_GROUP) {
-                std::vector <uint8_t> base = {1, 3, 9, 27, 81};
-                float *inputData = (float *) input.cpuData;
-                uint8_t *weightData = (uint8_t *) weight.cpuData;
-                float *outputData = (float *) output.cpuData;
-                float *biasData = bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr;
-                
-                auto pool = GetAlivePool();
-                int threadNum = pool->threads.size();
-                int per = k / threadNum;
-                int cur = 0;
-                std::vector<fastllm::MultiThreadBase3GroupLinearOp*> ops;
-                for (int i = 0; i < threadNum; i++) {
-                    int end = cur + per + (cur + per * (threadNum - i) < k);
-                    if (i == threadNum - 1) {
-                        end = k;
-                    }
-                    ops.push_back(new MultiThreadBase3GroupLinearOp(inputData, weightData, biasData, outputData,
-                                                   n, m, k, cur, end, weight.group, weight.groupCnt, weight.halfScales.data()));
-                    cur = end;
-                }
-                for (int i = 0; i < threadNum; i++) {
-                    pool->PushOp(i, ops[i]);
-                }
-                for (int i = 0; i < threadNum; i++) {
-                    pool->Wait(i);
-                    delete ops[i];
-                }
+                RunLinearFloat32Base3Group((float*)input.cpuData, weight, (float*)output.cpuData, 
+                                        bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, weight.group, weight.groupCnt,
+                                        GetAlivePool(), threadSt, threadLen);
             } else if (weight.dataType == DataType::INT4) {
                 // 目前已经不用这种数据类型了
                 float *inputData = (float *) input.cpuData;
@@ -4317,6 +4620,9 @@ ops += (long long)lines * inputDim * interDim * 2;
             if (weight.dataType == DataType::FLOAT32) {
                 RunLinearFloat16Float32((uint16_t*)input.cpuData, (float*)weight.cpuData, (uint16_t*)output.cpuData, 
                     bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
+            } else if (UseLinearHalfBlocked(n, m, k, weight.dataType)) {
+                RunLinearFloat16HalfBlocked((uint16_t*)input.cpuData, (uint16_t*)weight.cpuData, weight.dataType == DataType::BFLOAT16,
+                    (uint16_t*)output.cpuData, bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
             } else if (weight.dataType == DataType::FLOAT16) {
                 RunLinearFloat16Float16((uint16_t*)input.cpuData, (uint16_t*)weight.cpuData, (uint16_t*)output.cpuData, 
                     bias.dims.size() > 0 ? (float *) bias.cpuData : nullptr, n, m, k, GetAlivePool(), threadSt, threadLen);
@@ -4348,6 +4654,23 @@ ops += (long long)lines * inputDim * interDim * 2;
 //printf("n = %d, m = %d, k = %d, spend %f s, gops = %f\n", n, m, k, spend, gops);
     }
 
+    void DoCpuLinear(Data &input, Data &weight, const Data &bias, Data &output) {
+        output.Allocate();
+        int n = input.Count(0) / input.dims.back();
+        int m = input.dims.back();
+        int k = output.dims.back();
+        auto threadInterval = GetAlivePool()->GetActivateThreadInterval();
+        int threadSt = threadInterval.first;
+        int threadLen = threadInterval.second - threadInterval.first;
+
+        LinearTuner *tuner = GetLinearTuner();
+        if (input.dataType == output.dataType && tuner->IsActive() &&
+            tuner->Run(input, weight, bias, output, n, m, k, threadSt, threadLen, DoCpuLinearDefault)) {
+            return;
+        }
+        DoCpuLinearDefault(input, weight, bias, output, n, m, k, threadSt, threadLen);
+    }
+
     void CpuLinearOp::Run(const std::string &opType, const fastllm::DataDict &datas,
                           const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
         Data &input = *(datas.find("input")->second);
@@ -4397,21 +4720,22 @@ ops += (long long)lines * inputDim * interDim * 2;
             (MultiThreadSliceOp(output, input, outer, outputStride, inputStride, copyLen)).Run();
             return;
         }
-        int threadNum = pool->threads.size();
-        int per = outer / pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
+        int per = outer / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadSliceOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? outer : cur + per + (cur + per * (threadNum - i) < outer));
-            ops.push_back(new MultiThreadSliceOp(output + cur * outputStride, input + cur * inputStride, end - cur, outputStride, inputStride, copyLen));
+            ops.push_back(opScope.New<MultiThreadSliceOp>(output + cur * outputStride, input + cur * inputStride, end - cur, outputStride, inputStride, copyLen));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -4862,10 +5186,12 @@ ops += (long long)lines * inputDim * interDim * 2;
         int cur = 0;
         if (input0.dataType == DataType::FLOAT32 && input1.dataType == DataType::FLOAT32) {
             auto *pool = GetAlivePool();
-            int threads = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threads = interval.second - interval.first;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadMatMulSingleOp*> ops;
             for (int o = 0; o < batch0; o++) {
-                ops.push_back(new MultiThreadMatMulSingleOp(
+                ops.push_back(opScope.New<MultiThreadMatMulSingleOp>(
                     (float *) input0.cpuData, (float *) input1.cpuData, (float *) output.cpuData,
                     input0Spatial, input1Spatial, outputSpatial, input0Stride, input1Stride,
                     n, m, k, alpha, o, o + 1
@@ -4873,10 +5199,10 @@ ops += (long long)lines * inputDim * interDim * 2;
             }
             for (int st = 0; st < ops.size(); st += threads) {
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->PushOp(i - st, ops[i]);
+                    pool->PushOp(threadSt + i - st, ops[i]);
                 }
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->Wait(i - st);
+                    pool->Wait(threadSt + i - st);
                 }
             }
         } else if (input0.dataType == DataType::FLOAT32 && input1.dataType == DataType::FLOAT16) {
@@ -4885,10 +5211,12 @@ ops += (long long)lines * inputDim * interDim * 2;
             Float32ToFloat16((float*)input0.cpuData, fp16InputData.data(), input0.Count(0));
 
             auto *pool = GetAlivePool();
-            int threads = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threads = interval.second - interval.first;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadMatMulFloat16SingleOp*> ops;
             for (int o = 0; o < batch0; o++) {
-                ops.push_back(new MultiThreadMatMulFloat16SingleOp(
+                ops.push_back(opScope.New<MultiThreadMatMulFloat16SingleOp>(
                     (uint16_t *) fp16InputData.data(), (uint16_t *) input1.cpuData, (uint16_t *) output.cpuData,
                     input0Spatial, input1Spatial, outputSpatial, input0Stride, input1Stride,
                     n, m, k, alpha, o, o + 1
@@ -4896,21 +5224,23 @@ ops += (long long)lines * inputDim * interDim * 2;
             }
             for (int st = 0; st < ops.size(); st += threads) {
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->PushOp(i - st, ops[i]);
+                    pool->PushOp(threadSt + i - st, ops[i]);
                 }
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->Wait(i - st);
+                    pool->Wait(threadSt + i - st);
                 }
             }
         } else if (input0.dataType == DataType::FLOAT16) {
             auto *pool = GetAlivePool();
-            int threads = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threads = interval.second - interval.first;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadMatMulFloat16SingleOp*> ops;
             if (batch0 == 1) {
                 int partn = std::max(1, n / threads);
                 for (int o = 0; o < n; o += partn) {
                     int len = std::min(partn, n - o);
-                    ops.push_back(new MultiThreadMatMulFloat16SingleOp(
+                    ops.push_back(opScope.New<MultiThreadMatMulFloat16SingleOp>(
                         ((uint16_t *) input0.cpuData) + o * m, 
                         (uint16_t *) input1.cpuData, 
                         ((uint16_t *) output.cpuData) + o * k,
@@ -4920,7 +5250,7 @@ ops += (long long)lines * inputDim * interDim * 2;
                 }
             } else {
                 for (int o = 0; o < batch0; o++) {
-                    ops.push_back(new MultiThreadMatMulFloat16SingleOp(
+                    ops.push_back(opScope.New<MultiThreadMatMulFloat16SingleOp>(
                         (uint16_t *) input0.cpuData, (uint16_t *) input1.cpuData, (uint16_t *) output.cpuData,
                         input0Spatial, input1Spatial, outputSpatial, input0Stride, input1Stride,
                         n, m, k, alpha, o, o + 1
@@ -4929,10 +5259,10 @@ ops += (long long)lines * inputDim * interDim * 2;
             }
             for (int st = 0; st < ops.size(); st += threads) {
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->PushOp(i - st, ops[i]);
+                    pool->PushOp(threadSt + i - st, ops[i]);
                 }
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->Wait(i - st);
+                    pool->Wait(threadSt + i - st);
                 }
             }
         }
@@ -5000,10 +5330,12 @@ ops += (long long)lines * inputDim * interDim * 2;
         int cur = 0;
         if (input0.dataType == DataType::FLOAT32 && input1.dataType == DataType::FLOAT32) {
             auto *pool = GetAlivePool();
-            int threads = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threads = interval.second - interval.first;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadMatMulTransBSingleOp*> ops;
             for (int o = 0; o < batch0; o++) {
-                ops.push_back(new MultiThreadMatMulTransBSingleOp(
+                ops.push_back(opScope.New<MultiThreadMatMulTransBSingleOp>(
                     (float *) input0.cpuData, (float *) input1.cpuData, (float *) output.cpuData,
                     input0Spatial, input1Spatial, outputSpatial, input0Stride, input1Stride,
                     n, m, k, alpha, o, o + 1
@@ -5011,10 +5343,10 @@ ops += (long long)lines * inputDim * interDim * 2;
             }
             for (int st = 0; st < ops.size(); st += threads) {
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->PushOp(i - st, ops[i]);
+                    pool->PushOp(threadSt + i - st, ops[i]);
                 }
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->Wait(i - st);
+                    pool->Wait(threadSt + i - st);
                 }
             }
         } else if (input0.dataType == DataType::FLOAT32 && input1.dataType == DataType::FLOAT16) {
@@ -5023,10 +5355,12 @@ ops += (long long)lines * inputDim * interDim * 2;
             Float32ToFloat16((float*)input0.cpuData, fp16InputData.data(), input0.Count(0));
 
             auto *pool = GetAlivePool();
-            int threads = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threads = interval.second - interval.first;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadMatMulTransBFloat16SingleOp*> ops;
             for (int o = 0; o < batch0; o++) {
-                ops.push_back(new MultiThreadMatMulTransBFloat16SingleOp(
+                ops.push_back(opScope.New<MultiThreadMatMulTransBFloat16SingleOp>(
                     (uint16_t *) fp16InputData.data(), (uint16_t *) input1.cpuData, (uint16_t *) output.cpuData,
                     input0Spatial, input1Spatial, outputSpatial, input0Stride, input1Stride,
                     n, m, k, alpha, o, o + 1
@@ -5034,21 +5368,23 @@ ops += (long long)lines * inputDim * interDim * 2;
             }
             for (int st = 0; st < ops.size(); st += threads) {
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->PushOp(i - st, ops[i]);
+                    pool->PushOp(threadSt + i - st, ops[i]);
                 }
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->Wait(i - st);
+                    pool->Wait(threadSt + i - st);
                 }
             }
         } else {
             auto *pool = GetAlivePool();
-            int threads = pool->threads.size();
+            auto interval = pool->GetActivateThreadInterval();
+            int threadSt = interval.first, threads = interval.second - interval.first;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadMatMulTransBFloat16SingleOp*> ops;
             if (batch0 == 1) {
                 int partn = std::max(1, n / threads);
                 for (int o = 0; o < n; o += partn) {
                     int len = std::min(partn, n - o);
-                    ops.push_back(new MultiThreadMatMulTransBFloat16SingleOp(
+                    ops.push_back(opScope.New<MultiThreadMatMulTransBFloat16SingleOp>(
                         ((uint16_t *) input0.cpuData) + o * m, 
                         (uint16_t *) input1.cpuData, 
                         ((uint16_t *) output.cpuData) + o * k,
@@ -5058,7 +5394,7 @@ ops += (long long)lines * inputDim * interDim * 2;
                 }
             } else {
                 for (int o = 0; o < batch0; o++) {
-                    ops.push_back(new MultiThreadMatMulTransBFloat16SingleOp(
+                    ops.push_back(opScope.New<MultiThreadMatMulTransBFloat16SingleOp>(
                         (uint16_t *) input0.cpuData, (uint16_t *) input1.cpuData, (uint16_t *) output.cpuData,
                         input0Spatial, input1Spatial, outputSpatial, input0Stride, input1Stride,
                         n, m, k, alpha, o, o + 1
@@ -5067,10 +5403,10 @@ ops += (long long)lines * inputDim * interDim * 2;
             }
             for (int st = 0; st < ops.size(); st += threads) {
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->PushOp(i - st, ops[i]);
+                    pool->PushOp(threadSt + i - st, ops[i]);
                 }
                 for (int i = st; i < ops.size() && i < st + threads; i++) {
-                    pool->Wait(i - st);
+                    pool->Wait(threadSt + i - st);
                 }
             }
         }
@@ -5819,21 +6155,22 @@ ops += (long long)lines * inputDim * interDim * 2;
             (MultiThreadAddToFloatOp(output, input, alpha, len)).Run();
             return;
         }
-        int threadNum = pool->threads.size();
-        int per = len / pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
+        int per = len / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadAddToFloatOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? len : cur + per + (cur + per * (threadNum - i) < len));
-            ops.push_back(new MultiThreadAddToFloatOp(output + cur, input + cur, alpha, end - cur));
+            ops.push_back(opScope.New<MultiThreadAddToFloatOp>(output + cur, input + cur, alpha, end - cur));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -5982,25 +6319,515 @@ ops += (long long)lines * inputDim * interDim * 2;
 
         int n = n0 * n1;
         auto pool = GetAlivePool();
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int per = n / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadRecurrentGatedDeltaRuleOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? n : cur + per + (cur + per * (threadNum - i) < n));
-            ops.push_back(new MultiThreadRecurrentGatedDeltaRuleOp(n0, n1, n2, n3, group, flast, fgt, fkt, fvt, fbt, fqt, fatv, cur, end));
+            ops.push_back(opScope.New<MultiThreadRecurrentGatedDeltaRuleOp>(n0, n1, n2, n3, group, flast, fgt, fkt, fvt, fbt, fqt, fatv, cur, end));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
 
         if (q.dataType == DataType::FLOAT16) {
             Float32ToFloat16(fatv, (uint16_t*)core_attn_out.cpuData, (int)atvVector.size());
+            Float32ToFloat16(flast, (uint16_t*)last_recurrent_state.cpuData, (int)lastVector.size());
+        }
+    }
+
+    void CpuChunkGatedDeltaRuleOp::Reshape(const std::string &opType, const fastllm::DataDict &datas,
+                                 const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
+        Data &q = *(datas.find("q")->second);
+        Data &v = *(datas.find("v")->second);
+        Data &last_recurrent_state = *(datas.find("last_recurrent_state")->second);
+        Data &core_attn_out = *(datas.find("core_attn_out")->second);
+
+        AssertInFastLLM(q.dims.size() == 4 && v.dims.size() == 4 && last_recurrent_state.dims.size() == 4,
+                        "ChunkGatedDeltaRule: q, v and last_recurrent_state should be 4D.\n");
+        AssertInFastLLM(q.dataType == DataType::FLOAT32 || q.dataType == DataType::FLOAT16,
+                        "ChunkGatedDeltaRule's input's type should be float32 or float16.\n");
+        AssertInFastLLM(v.dims[1] % q.dims[1] == 0 && last_recurrent_state.dims[1] == v.dims[1],
+                        "ChunkGatedDeltaRule: head num mismatch.\n");
+        core_attn_out.dataType = v.dataType;
+        core_attn_out.Resize({v.dims[0], v.dims[1], v.dims[2], v.dims[3]});
+    }
+
+    static inline float ChunkDot(const float *a, const float *b, int n) {
+        int i = 0;
+        float sum = 0.0f;
+#ifdef __AVX512F__
+        __m512 acc512 = _mm512_setzero_ps();
+        for (; i + 15 < n; i += 16) {
+            acc512 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc512);
+        }
+        sum += _mm512_reduce_add_ps(acc512);
+#endif
+#ifdef __AVX2__
+        __m256 acc = _mm256_setzero_ps();
+        for (; i + 7 < n; i += 8) {
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+        }
+        sum += Floatsum(acc);
+#endif
+        for (; i < n; i++) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+    }
+
+    // y += alpha * x
+    static inline void ChunkAxpy(float *y, const float *x, float alpha, int n) {
+        int i = 0;
+#ifdef __AVX512F__
+        __m512 va512 = _mm512_set1_ps(alpha);
+        for (; i + 15 < n; i += 16) {
+            _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va512, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+        }
+#endif
+#ifdef __AVX2__
+        __m256 va = _mm256_set1_ps(alpha);
+        for (; i + 7 < n; i += 8) {
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+        }
+#endif
+        for (; i < n; i++) {
+            y[i] += alpha * x[i];
+        }
+    }
+
+    // 分块(WY表示)的gated delta rule, 每个线程负责若干个(batch, head)
+    // 块内: T = (I + tril(diag(beta) K K^T * decay, -1))^-1, U = T (beta V), W = T (beta K exp(gc))
+    // 块间: vNew = U - W S, out = exp(gc) Q S + tril(Q K^T * decay) vNew, S = exp(gc_last) S + (K exp(gc_last - gc))^T vNew
+    struct MultiThreadChunkGatedDeltaRuleOp : MultiThreadBaseOp {
+        int seqLen, kDim, vDim, group, chunkSize;
+        float *fq, *fk, *fv, *fg, *fb, *fstate, *fout;
+        int st, end;
+
+        MultiThreadChunkGatedDeltaRuleOp(int seqLen, int kDim, int vDim, int group, int chunkSize,
+            float *fq, float *fk, float *fv, float *fg, float *fb, float *fstate, float *fout, int st, int end) :
+            seqLen(seqLen), kDim(kDim), vDim(vDim), group(group), chunkSize(chunkSize),
+            fq(fq), fk(fk), fv(fv), fg(fg), fb(fb), fstate(fstate), fout(fout), st(st), end(end) {}
+
+        void Run() {
+            int C = chunkSize;
+            std::vector <float> gc(C), A(C * C), kBeta(C * kDim), kDecay(C * kDim), W(C * kDim);
+            std::vector <float> U(C * vDim), row(C);
+            for (int h = st; h < end; h++) {
+                float *q = fq + (long long)(h / group) * seqLen * kDim;
+                float *k = fk + (long long)(h / group) * seqLen * kDim;
+                float *v = fv + (long long)h * seqLen * vDim;
+                float *g = fg + (long long)h * seqLen;
+                float *b = fb + (long long)h * seqLen;
+                float *S = fstate + (long long)h * kDim * vDim;
+                float *out = fout + (long long)h * seqLen * vDim;
+
+                for (int cs = 0; cs < seqLen; cs += C) {
+                    int len = std::min(C, seqLen - cs);
+                    float *qc = q + (long long)cs * kDim, *kc = k + (long long)cs * kDim;
+                    float *vc = v + (long long)cs * vDim, *oc = out + (long long)cs * vDim;
+                    float sum = 0.0f;
+                    for (int i = 0; i < len; i++) {
+                        sum += g[cs + i];
+                        gc[i] = sum;
+                    }
+                    for (int i = 0; i < len; i++) {
+                        float beta = b[cs + i];
+                        for (int d = 0; d < kDim; d++) {
+                            kBeta[i * kDim + d] = kc[i * kDim + d] * beta;
+                        }
+                    }
+
+                    // A = -tril(kBeta K^T * decay, -1), 然后逐行前代得到 T = (I - A)^-1 的严格下三角部分
+                    for (int i = 0; i < len; i++) {
+                        float *a = A.data() + i * C;
+                        for (int j = 0; j < i; j++) {
+                            row[j] = -ChunkDot(kBeta.data() + i * kDim, kc + j * kDim, kDim) * expf(gc[i] - gc[j]);
+                        }
+                        std::memcpy(a, row.data(), i * sizeof(float));
+                        for (int j = 1; j < i; j++) {
+                            ChunkAxpy(a, A.data() + j * C, row[j], j);
+                        }
+                    }
+
+                    // U = T (beta V), W = T (beta K exp(gc))
+                    for (int i = 0; i < len; i++) {
+                        float beta = b[cs + i], decay = expf(gc[i]);
+                        float *u = U.data() + i * vDim, *w = W.data() + i * kDim;
+                        for (int d = 0; d < vDim; d++) {
+                            u[d] = vc[i * vDim + d] * beta;
+                        }
+                        for (int d = 0; d < kDim; d++) {
+                            w[d] = kBeta[i * kDim + d] * decay;
+                        }
+                        for (int j = 0; j < i; j++) {
+                            float t = A[i * C + j];
+                            ChunkAxpy(u, vc + j * vDim, t * b[cs + j], vDim);
+                            ChunkAxpy(w, kBeta.data() + j * kDim, t * expf(gc[j]), kDim);
+                        }
+                    }
+
+                    // vNew = U - W S (存回U)
+                    for (int i = 0; i < len; i++) {
+                        float *u = U.data() + i * vDim, *w = W.data() + i * kDim;
+                        for (int d = 0; d < kDim; d++) {
+                            ChunkAxpy(u, S + d * vDim, -w[d], vDim);
+                        }
+                    }
+
+                    // out = exp(gc) Q S + tril(Q K^T * decay) vNew
+                    for (int i = 0; i < len; i++) {
+                        float *o = oc + i * vDim, *qi = qc + i * kDim;
+                        std::fill(o, o + vDim, 0.0f);
+                        float decay = expf(gc[i]);
+                        for (int d = 0; d < kDim; d++) {
+                            ChunkAxpy(o, S + d * vDim, qi[d] * decay, vDim);
+                        }
+                        for (int j = 0; j <= i; j++) {
+                            float a = ChunkDot(qi, kc + j * kDim, kDim) * expf(gc[i] - gc[j]);
+                            ChunkAxpy(o, U.data() + j * vDim, a, vDim);
+                        }
+                    }
+
+                    // S = exp(gc_last) S + (K exp(gc_last - gc))^T vNew
+                    float gLast = gc[len - 1], decayLast = expf(gLast);
+                    for (int j = 0; j < len; j++) {
+                        float decay = expf(gLast - gc[j]);
+                        for (int d = 0; d < kDim; d++) {
+                            kDecay[j * kDim + d] = kc[j * kDim + d] * decay;
+                        }
+                    }
+                    for (int d = 0; d < kDim; d++) {
+                        float *s = S + d * vDim;
+                        for (int e = 0; e < vDim; e++) {
+                            s[e] *= decayLast;
+                        }
+                        for (int j = 0; j < len; j++) {
+                            ChunkAxpy(s, U.data() + j * vDim, kDecay[j * kDim + d], vDim);
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    void CpuChunkGatedDeltaRuleOp::Run(const std::string &opType, const fastllm::DataDict &datas,
+                                 const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
+        Data &q = *(datas.find("q")->second);
+        Data &k = *(datas.find("k")->second);
+        Data &v = *(datas.find("v")->second);
+        Data &g = *(datas.find("g")->second);
+        Data &b = *(datas.find("b")->second);
+        Data &last_recurrent_state = *(datas.find("last_recurrent_state")->second);
+        Data &core_attn_out = *(datas.find("core_attn_out")->second);
+        int chunkSize = intParams.find("chunkSize") != intParams.end() ? intParams.find("chunkSize")->second : 64;
+        core_attn_out.Allocate(false);
+
+        int batch = v.dims[0], heads = v.dims[1], seqLen = v.dims[2], vDim = v.dims[3], kDim = q.dims[3];
+        int group = heads / q.dims[1];
+        AssertInFastLLM(last_recurrent_state.dims[2] == kDim && last_recurrent_state.dims[3] == vDim,
+                        "ChunkGatedDeltaRule: last_recurrent_state's shape should be [batch, heads, k_dim, v_dim].\n");
+        float *fq = (float*)q.cpuData, *fk = (float*)k.cpuData, *fv = (float*)v.cpuData;
+        float *fg = (float*)g.cpuData, *fb = (float*)b.cpuData;
+        float *fstate = (float*)last_recurrent_state.cpuData, *fout = (float*)core_attn_out.cpuData;
+
+        std::vector <float> qVector, kVector, vVector, gVector, bVector, stateVector, outVector;
+        if (q.dataType == DataType::FLOAT16) {
+            std::vector <std::pair <Data*, std::vector <float>*> > converts = {
+                {&q, &qVector}, {&k, &kVector}, {&v, &vVector}, {&g, &gVector}, {&b, &bVector}, {&last_recurrent_state, &stateVector}
+            };
+            for (auto &it : converts) {
+                it.second->resize(it.first->Count(0));
+                Float16ToFloat32((uint16_t*)it.first->cpuData, it.second->data(), (int)it.second->size());
+            }
+            outVector.resize(core_attn_out.Count(0));
+            fq = qVector.data(); fk = kVector.data(); fv = vVector.data();
+            fg = gVector.data(); fb = bVector.data();
+            fstate = stateVector.data(); fout = outVector.data();
+        }
+
+        int n = batch * heads;
+        auto pool = GetAlivePool();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = std::min(interval.second - interval.first, n);
+        int per = n / threadNum;
+        int cur = 0;
+        MultiThreadOpScope opScope;
+        std::vector<fastllm::MultiThreadChunkGatedDeltaRuleOp*> ops;
+        for (int i = 0; i < threadNum; i++) {
+            int end = (i == threadNum - 1 ? n : cur + per + (cur + per * (threadNum - i) < n));
+            ops.push_back(opScope.New<MultiThreadChunkGatedDeltaRuleOp>(seqLen, kDim, vDim, group, chunkSize,
+                                                               fq, fk, fv, fg, fb, fstate, fout, cur, end));
+            cur = end;
+        }
+        for (int i = 0; i < threadNum; i++) {
+            pool->PushOp(threadSt + i, ops[i]);
+        }
+        for (int i = 0; i < threadNum; i++) {
+            pool->Wait(threadSt + i);
+        }
+
+        if (q.dataType == DataType::FLOAT16) {
+            Float32ToFloat16(fout, (uint16_t*)core_attn_out.cpuData, (int)outVector.size());
+            Float32ToFloat16(fstate, (uint16_t*)last_recurrent_state.cpuData, (int)stateVector.size());
+        }
+    }
+
+    void CpuAttentionVarlenOp::Reshape(const std::string &opType, const fastllm::DataDict &datas,
+                                 const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
+        Data &q = *(datas.find("q")->second);
+        Data &k = *(datas.find("k")->second);
+        Data &v = *(datas.find("v")->second);
+        Data &output = *(datas.find("output")->second);
+
+        AssertInFastLLM(q.dims.size() == 3 && k.dims.size() == 3 && v.dims.size() == 3,
+                        "AttentionVarlen: q, k and v should be 3D ([total, heads, dim]).\n");
+        AssertInFastLLM(q.dims[0] == k.dims[0] && k.dims[0] == v.dims[0] && k.dims[1] == v.dims[1] && q.dims[2] == k.dims[2],
+                        "AttentionVarlen: q, k, v's shape mismatch.\n");
+        AssertInFastLLM(q.dims[1] % k.dims[1] == 0, "AttentionVarlen: head num mismatch.\n");
+        AssertInFastLLM(q.dataType == DataType::FLOAT32 || q.dataType == DataType::FLOAT16,
+                        "AttentionVarlen's input's type should be float32 or float16.\n");
+        output.dataType = q.dataType;
+        output.Resize({q.dims[0], q.dims[1], v.dims[2]});
+    }
+
+    // 变长双向attention, 每个任务为 (序列, head, [rowStart, rowEnd)行query), 只访问本序列内的k, v
+    struct MultiThreadAttentionVarlenOp : MultiThreadBaseOp {
+        float *qd, *kd, *vd, *od;
+        int heads, kvHeads, qDim, vDim;
+        float scale;
+        std::vector <int> *offsets;
+        std::vector <std::array <int, 4> > tasks;
+
+        MultiThreadAttentionVarlenOp(float *qd, float *kd, float *vd, float *od, int heads, int kvHeads, int qDim, int vDim,
+                                     float scale, std::vector <int> *offsets) :
+            qd(qd), kd(kd), vd(vd), od(od), heads(heads), kvHeads(kvHeads), qDim(qDim), vDim(vDim),
+            scale(scale), offsets(offsets) {}
+
+        void Run() {
+            int group = heads / kvHeads;
+            std::vector <float> scores;
+            for (auto &task : tasks) {
+                int off = (*offsets)[task[0]], len = (*offsets)[task[0] + 1] - off, h = task[1];
+                scores.resize(len);
+                const float *kBase = kd + (size_t)off * kvHeads * qDim + (h / group) * qDim;
+                const float *vBase = vd + (size_t)off * kvHeads * vDim + (h / group) * vDim;
+                for (int i = task[2]; i < task[3]; i++) {
+                    const float *qRow = qd + ((size_t)(off + i) * heads + h) * qDim;
+                    float *oRow = od + ((size_t)(off + i) * heads + h) * vDim;
+                    float maxValue = -1e30f, sum = 0.0f;
+                    for (int j = 0; j < len; j++) {
+                        scores[j] = ChunkDot(qRow, kBase + (size_t)j * kvHeads * qDim, qDim) * scale;
+                        maxValue = std::max(maxValue, scores[j]);
+                    }
+                    for (int j = 0; j < len; j++) {
+                        scores[j] = expf(scores[j] - maxValue);
+                        sum += scores[j];
+                    }
+                    std::fill(oRow, oRow + vDim, 0.0f);
+                    for (int j = 0; j < len; j++) {
+                        ChunkAxpy(oRow, vBase + (size_t)j * kvHeads * vDim, scores[j] / sum, vDim);
+                    }
+                }
+            }
+        }
+    };
+
+    void CpuAttentionVarlenOp::Run(const std::string &opType, const fastllm::DataDict &datas,
+                                 const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
+        Data &q = *(datas.find("q")->second);
+        Data &k = *(datas.find("k")->second);
+        Data &v = *(datas.find("v")->second);
+        Data &cuSeqLens = *(datas.find("cuSeqLens")->second);
+        Data &output = *(datas.find("output")->second);
+        float scale = floatParams.find("scale") != floatParams.end() ? floatParams.find("scale")->second : 1.0;
+        output.Allocate(false);
+
+        int total = q.dims[0], heads = q.dims[1], qDim = q.dims[2], kvHeads = k.dims[1], vDim = v.dims[2];
+        std::vector <int> offsets;
+        for (int i = 0; i < cuSeqLens.Count(0); i++) {
+            offsets.push_back((int)((float*)cuSeqLens.cpuData)[i]);
+        }
+        AssertInFastLLM(offsets.size() > 1 && offsets[0] == 0 && offsets.back() == total,
+                        "AttentionVarlen: sum of seqLens should be equal to q.dims[0].\n");
+
+        float *qd = (float*)q.cpuData, *kd = (float*)k.cpuData, *vd = (float*)v.cpuData, *od = (float*)output.cpuData;
+        std::vector <float> qVector, kVector, vVector, oVector;
+        if (q.dataType == DataType::FLOAT16) {
+            std::vector <std::pair <Data*, std::vector <float>*> > converts = {{&q, &qVector}, {&k, &kVector}, {&v, &vVector}};
+            for (auto &it : converts) {
+                it.second->resize(it.first->Count(0));
+                Float16ToFloat32((uint16_t*)it.first->cpuData, it.second->data(), (int)it.second->size());
+            }
+            oVector.resize(output.Count(0));
+            qd = qVector.data(); kd = kVector.data(); vd = vVector.data(); od = oVector.data();
+        }
+
+        // 按(序列, head, 行块)拆分任务, 再按计算量(行数 * 序列长度)连续地分给各个线程
+        const int rowBlock = 32;
+        std::vector <std::array <int, 4> > tasks;
+        long long totalCost = 0;
+        for (int b = 0; b + 1 < offsets.size(); b++) {
+            int len = offsets[b + 1] - offsets[b];
+            for (int h = 0; h < heads; h++) {
+                for (int r = 0; r < len; r += rowBlock) {
+                    tasks.push_back({b, h, r, std::min(len, r + rowBlock)});
+                    totalCost += (long long)(std::min(len, r + rowBlock) - r) * len;
+                }
+            }
+        }
+        auto pool = GetAlivePool();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = std::max(1, std::min(interval.second - interval.first, (int)tasks.size()));
+        MultiThreadOpScope opScope;
+        std::vector<fastllm::MultiThreadAttentionVarlenOp*> ops;
+        long long cost = 0;
+        for (int i = 0; i < threadNum; i++) {
+            ops.push_back(opScope.New<MultiThreadAttentionVarlenOp>(qd, kd, vd, od, heads, kvHeads, qDim, vDim, scale, &offsets));
+        }
+        for (auto &task : tasks) {
+            int id = std::min(threadNum - 1, (int)(cost * threadNum / std::max(1LL, totalCost)));
+            ops[id]->tasks.push_back(task);
+            cost += (long long)(task[3] - task[2]) * (offsets[task[0] + 1] - offsets[task[0]]);
+        }
+        for (int i = 0; i < threadNum; i++) {
+            pool->PushOp(threadSt + i, ops[i]);
+        }
+        for (int i = 0; i < threadNum; i++) {
+            pool->Wait(threadSt + i);
+        }
+
+        if (q.dataType == DataType::FLOAT16) {
+            Float32ToFloat16(od, (uint16_t*)output.cpuData, (int)oVector.size());
+        }
+    }
+
+    // 分段LoRA, 每个任务为 (segment, [rowStart, rowEnd)行): output[row] += loraB^T * (loraA * input[row])
+    struct MultiThreadSegmentLoraOp : MultiThreadBaseOp {
+        Data *input, *output;
+        Data **loraAs, **loraBs;
+        std::vector <int> *offsets;
+        std::vector <std::array <int, 3> > tasks;
+
+        MultiThreadSegmentLoraOp(Data *input, Data *output, Data **loraAs, Data **loraBs, std::vector <int> *offsets) :
+            input(input), output(output), loraAs(loraAs), loraBs(loraBs), offsets(offsets) {}
+
+        void Run() {
+            int n = input->dims.back(), m = output->dims.back();
+            std::vector <float> x, y, t;
+            if (input->dataType == DataType::FLOAT16) {
+                x.resize(n);
+            }
+            if (output->dataType == DataType::FLOAT16) {
+                y.resize(m);
+            }
+            for (auto &task : tasks) {
+                Data &loraA = *loraAs[task[0]], &loraB = *loraBs[task[0]];
+                int r = loraA.dims[0];
+                t.resize(r);
+                for (int i = (*offsets)[task[0]] + task[1]; i < (*offsets)[task[0]] + task[2]; i++) {
+                    float *xRow = (float*)input->cpuData + (size_t)i * n;
+                    float *yRow = (float*)output->cpuData + (size_t)i * m;
+                    if (input->dataType == DataType::FLOAT16) {
+                        Float16ToFloat32((uint16_t*)input->cpuData + (size_t)i * n, x.data(), n);
+                        xRow = x.data();
+                    }
+                    if (output->dataType == DataType::FLOAT16) {
+                        Float16ToFloat32((uint16_t*)output->cpuData + (size_t)i * m, y.data(), m);
+                        yRow = y.data();
+                    }
+                    for (int j = 0; j < r; j++) {
+                        t[j] = ChunkDot(xRow, (float*)loraA.cpuData + (size_t)j * n, n);
+                    }
+                    for (int j = 0; j < r; j++) {
+                        ChunkAxpy(yRow, (float*)loraB.cpuData + (size_t)j * m, t[j], m);
+                    }
+                    if (output->dataType == DataType::FLOAT16) {
+                        Float32ToFloat16(y.data(), (uint16_t*)output->cpuData + (size_t)i * m, m);
+                    }
+                }
+            }
+        }
+    };
+
+    void CpuSegmentLoraOp::Reshape(const std::string &opType, const fastllm::DataDict &datas,
+                                   const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
+        // output是基座Linear的结果, 原地累加, 不改变形状
+        Data &input = *(datas.find("input")->second);
+        Data &output = *(datas.find("output")->second);
+        AssertInFastLLM((input.dataType == DataType::FLOAT32 || input.dataType == DataType::FLOAT16) &&
+                        (output.dataType == DataType::FLOAT32 || output.dataType == DataType::FLOAT16),
+                        "SegmentLora's input and output's type should be float32 or float16.\n");
+        AssertInFastLLM(input.dims.size() > 0 && output.dims.size() > 0 &&
+                        input.Count(0) / input.dims.back() == output.Count(0) / output.dims.back(),
+                        "SegmentLora: input and output's rows mismatch.\n");
+    }
+
+    void CpuSegmentLoraOp::Run(const std::string &opType, const fastllm::DataDict &datas,
+                               const fastllm::FloatDict &floatParams, const fastllm::IntDict &intParams) {
+        Data &input = *(datas.find("input")->second);
+        Data &output = *(datas.find("output")->second);
+        Data &cuSeqLens = *(datas.find("cuSeqLens")->second);
+        Data **loraAs = (Data**)(datas.find("loraAs")->second);
+        Data **loraBs = (Data**)(datas.find("loraBs")->second);
+        int segs = intParams.find("loraAs___batch")->second;
+
+        int n = input.dims.back(), m = output.dims.back(), rows = input.Count(0) / n;
+        std::vector <int> offsets;
+        for (int i = 0; i < cuSeqLens.Count(0); i++) {
+            offsets.push_back((int)((float*)cuSeqLens.cpuData)[i]);
+        }
+        AssertInFastLLM(offsets.size() == segs + 1 && offsets.back() == rows,
+                        "SegmentLora: sum of segLens should be equal to input's rows.\n");
+
+        // 相邻的同一个adapter的行已经连续, 按64行一块拆分任务, 再按行数连续地分给各个线程
+        const int rowBlock = 64;
+        std::vector <std::array <int, 3> > tasks;
+        long long totalCost = 0;
+        for (int s = 0; s < segs; s++) {
+            if (loraAs[s] == nullptr || loraBs[s] == nullptr) {
+                continue;
+            }
+            AssertInFastLLM(loraAs[s]->dataType == DataType::FLOAT32 && loraBs[s]->dataType == DataType::FLOAT32,
+                            "SegmentLora's lora weights' type should be float32.\n");
+            AssertInFastLLM(loraAs[s]->dims.size() == 2 && loraAs[s]->dims[1] == n &&
+                            loraBs[s]->dims.size() == 2 && loraBs[s]->dims[0] == loraAs[s]->dims[0] && loraBs[s]->dims[1] == m,
+                            "SegmentLora: lora weights' shape mismatch.\n");
+            int len = offsets[s + 1] - offsets[s];
+            for (int st = 0; st < len; st += rowBlock) {
+                tasks.push_back({s, st, std::min(len, st + rowBlock)});
+                totalCost += (long long)(std::min(len, st + rowBlock) - st) * loraAs[s]->dims[0];
+            }
+        }
+        if (tasks.size() == 0) {
+            return;
+        }
+        auto pool = GetAlivePool();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = std::max(1, std::min(interval.second - interval.first, (int)tasks.size()));
+        MultiThreadOpScope opScope;
+        std::vector<fastllm::MultiThreadSegmentLoraOp*> ops;
+        long long cost = 0;
+        for (int i = 0; i < threadNum; i++) {
+            ops.push_back(opScope.New<MultiThreadSegmentLoraOp>(&input, &output, loraAs, loraBs, &offsets));
+        }
+        for (auto &task : tasks) {
+            int id = std::min(threadNum - 1, (int)(cost * threadNum / std::max(1LL, totalCost)));
+            ops[id]->tasks.push_back(task);
+            cost += (long long)(task[2] - task[1]) * loraAs[task[0]]->dims[0];
+        }
+        for (int i = 0; i < threadNum; i++) {
+            pool->PushOp(threadSt + i, ops[i]);
+        }
+        for (int i = 0; i < threadNum; i++) {
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -6754,22 +7581,23 @@ ops += (long long)lines * inputDim * interDim * 2;
             return;
         }
 
-        int threadNum = pool->threads.size();
-        int per = (bs * len) / pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
+        int per = (bs * len) / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLlamaRotatePosition2DFloatOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? (bs * len) : cur + per + (cur + per * (threadNum - i) < (bs * len)));
-            ops.push_back(new MultiThreadLlamaRotatePosition2DFloatOp(
+            ops.push_back(opScope.New<MultiThreadLlamaRotatePosition2DFloatOp>(
                 dataType, data, positionIds, sinData, cosData, bs, len, n, m, stride, spatial, posDim, rotaryDim, cur, end));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -6797,22 +7625,23 @@ ops += (long long)lines * inputDim * interDim * 2;
             return;
         }
 
-        int threadNum = pool->threads.size();
-        int per = (bs * len) / pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
+        int per = (bs * len) / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLlamaRotatePosition2DPartFloatOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? (bs * len) : cur + per + (cur + per * (threadNum - i) < (bs * len)));
-            ops.push_back(new MultiThreadLlamaRotatePosition2DPartFloatOp(
+            ops.push_back(opScope.New<MultiThreadLlamaRotatePosition2DPartFloatOp>(
                 dataType, data, positionIds, sinData, cosData, bs, len, n, m, stride, spatial, posDim, rotaryDim, part, cur, end));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -6965,106 +7794,111 @@ ops += (long long)lines * inputDim * interDim * 2;
 
     void SiluMultiThread(float *input, int len, float *output,
                          int n, int inputStride, int outputStride, AliveThreadPool *pool) {
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int per = len / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadSiluOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? len : cur + per + (cur + per * (threadNum - i) < len));
-            ops.push_back(new fastllm::MultiThreadSiluOp(input + cur, end - cur, output + cur,
+            ops.push_back(opScope.New<fastllm::MultiThreadSiluOp>(input + cur, end - cur, output + cur,
                                                          n, inputStride, outputStride));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
     void GeluMultiThread(float *input, int len, float *output,
                          int n, int inputStride, int outputStride, AliveThreadPool *pool) {
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int per = len / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadGeluOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? len : cur + per + (cur + per * (threadNum - i) < len));
-            ops.push_back(new fastllm::MultiThreadGeluOp(input + cur, end - cur, output + cur,
+            ops.push_back(opScope.New<fastllm::MultiThreadGeluOp>(input + cur, end - cur, output + cur,
                                                            n, inputStride, outputStride));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
     void SwigluGptOssMultiThread(float *input, int mid, int len, float *output,
                            int n, int inputStride, int outputStride, AliveThreadPool *pool) {
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int per = len / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadSwigluGptOssOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? len : cur + per + (cur + per * (threadNum - i) < len));
-            ops.push_back(new fastllm::MultiThreadSwigluGptOssOp(input + cur, mid, end - cur, output + cur,
+            ops.push_back(opScope.New<fastllm::MultiThreadSwigluGptOssOp>(input + cur, mid, end - cur, output + cur,
                                                            n, inputStride, outputStride));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
     void SwigluMultiThread(float *input, int mid, int len, float *output,
                            int n, int inputStride, int outputStride, AliveThreadPool *pool) {
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int per = len / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadSwigluOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? len : cur + per + (cur + per * (threadNum - i) < len));
-            ops.push_back(new fastllm::MultiThreadSwigluOp(input + cur, mid, end - cur, output + cur,
+            ops.push_back(opScope.New<fastllm::MultiThreadSwigluOp>(input + cur, mid, end - cur, output + cur,
                                                            n, inputStride, outputStride));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
     void SwigluMultiThreadFloat16(uint16_t *input, int mid, int len, uint16_t *output,
                            int n, int inputStride, int outputStride, AliveThreadPool *pool) {
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int per = len / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadSwigluFloat16Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? len : cur + per + (cur + per * (threadNum - i) < len));
-            ops.push_back(new fastllm::MultiThreadSwigluFloat16Op(input + cur, mid, end - cur, output + cur,
+            ops.push_back(opScope.New<fastllm::MultiThreadSwigluFloat16Op>(input + cur, mid, end - cur, output + cur,
                                                            n, inputStride, outputStride));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -7073,21 +7907,22 @@ ops += (long long)lines * inputDim * interDim * 2;
             (MultiThreadSoftmaxOp(input, n, m, lastlen)).Run();
             return;
         }
-        int threadNum = pool->threads.size();
+        auto interval = pool->GetActivateThreadInterval();
+        int threadSt = interval.first, threadNum = interval.second - interval.first;
         int per = n / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadSoftmaxOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? n : cur + per + (cur + per * (threadNum - i) < n));
-            ops.push_back(new fastllm::MultiThreadSoftmaxOp(input + cur * m, end - cur, m, lastlen + cur));
+            ops.push_back(opScope.New<fastllm::MultiThreadSoftmaxOp>(input + cur * m, end - cur, m, lastlen + cur));
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->PushOp(i, ops[i]);
+            pool->PushOp(threadSt + i, ops[i]);
         }
         for (int i = 0; i < threadNum; i++) {
-            pool->Wait(i);
-            delete ops[i];
+            pool->Wait(threadSt + i);
         }
     }
 
@@ -791,6 +791,10 @@ namespace fastllm {
     extern bool MatMulInt8Int4_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int n, int m, int k);
     extern bool MatMulInt8Int4Group_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, 
         int group, int realGroup, int groupCnt, float *iscales, float *scales, float *izeros, float *weightMins);
+    extern bool MatMulInt8Int4GroupTiled_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int n, int m, int k,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums);
+    extern bool MatMulInt8Int4GroupTiled_AVX2(uint8_t *a, uint8_t *b, float *c, int n, int m, int k,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums);
     
     void MultiThreadLinearInt8Int4GroupOp::Run() {
 #ifdef __AVX2__
@@ -947,7 +951,13 @@ namespace fastllm {
             std::vector <float> values;
             values.resize(n * k);
 
-            if (cpuInstructInfo.hasAVX512VNNI && 
+            // 多行输入 (prefill) 使用寄存器分块的kernel, 每次读入的权重被多行输入复用
+            // 两种指令集下输入的重排方式不同 (见Avx2InputPermute), 只能使用对应的kernel
+            if (n >= 4 && cpuInstructInfo.hasAVX512VNNI &&
+                MatMulInt8Int4GroupTiled_AVX512VNNI(a, b, values.data(), n, m, k, group, realGroup, groupCnt, iscales, izeros, scales, weightSums)) {
+            } else if (n >= 4 && !cpuInstructInfo.hasAVX512VNNI &&
+                MatMulInt8Int4GroupTiled_AVX2(a, b, values.data(), n, m, k, group, realGroup, groupCnt, iscales, izeros, scales, weightSums)) {
+            } else if (cpuInstructInfo.hasAVX512VNNI && 
                 MatMulInt8Int4Group_AVX512VNNI(a, b, values.data(), n, m, k, group, realGroup, groupCnt, iscales, scales, izeros, weightMins)) {
                     
             } else  {
@@ -1140,10 +1150,11 @@ namespace fastllm {
                                 AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearFloat32Float32Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
-            ops.push_back(new MultiThreadLinearFloat32Float32Op(inputData, weightData, biasData, outputData,
+            ops.push_back(opScope.New<MultiThreadLinearFloat32Float32Op>(inputData, weightData, biasData, outputData,
                                                     n, m, k, cur, end));
             cur = end;
         }
@@ -1152,7 +1163,6 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
     }
 
@@ -1179,13 +1189,14 @@ namespace fastllm {
 #endif
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearFloat32Float16Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
             if (i == threadNum - 1) {
                 end = k;
             }
-            ops.push_back(new MultiThreadLinearFloat32Float16Op(inputData, weightData, biasData, outputData,
+            ops.push_back(opScope.New<MultiThreadLinearFloat32Float16Op>(inputData, weightData, biasData, outputData,
                                                 n, m, k, cur, end));
             cur = end;
         }
@@ -1194,14 +1205,176 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
 #ifdef __ARM_FEATURE_FP16_VECTOR_ARITHMETIC
         delete[] temp;
 #endif
     }
 
-    struct FastllmBF16Manager {
+    extern bool GemmFloat32_6x16_AVX2_Kernel(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate);
+
+    // 分块GEMM的参数: 微内核计算GEMM_MR行 x GEMM_NR列; 每次处理长度为GEMM_KC的一段k,
+    // 打包后的权重块 (GEMM_NC列 x GEMM_KC) 留在L2中被GEMM_MC行输入复用, 每个GEMM_NR列的权重panel在L1中被所有输入panel复用
+    const int GEMM_MR = 6, GEMM_NR = 16, GEMM_KC = 256, GEMM_MC = 72, GEMM_NC = 256;
+    const int GEMM_BLOCKED_MIN_ROWS = 32; // 输入行数不少于这个值时使用分块GEMM
+
+    static void GemmFloat32_6x16_Base_Kernel(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+        float sum[GEMM_MR][GEMM_NR] = {};
+        for (int l = 0; l < kc; l++) {
+            for (int r = 0; r < GEMM_MR; r++) {
+                for (int j = 0; j < GEMM_NR; j++) {
+                    sum[r][j] += a[l * GEMM_MR + r] * b[l * GEMM_NR + j];
+                }
+            }
+        }
+        for (int r = 0; r < GEMM_MR; r++) {
+            for (int j = 0; j < GEMM_NR; j++) {
+                c[r * ldc + j] = (accumulate ? c[r * ldc + j] : 0.0f) + sum[r][j];
+            }
+        }
+    }
+
+    static void GemmFloat32_6x16_Kernel(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+        if (cpuInstructInfo.hasAVX2 && GemmFloat32_6x16_AVX2_Kernel(kc, a, b, c, ldc, accumulate)) {
+            return;
+        }
+        GemmFloat32_6x16_Base_Kernel(kc, a, b, c, ldc, accumulate);
+    }
+
+    void MultiThreadLinearFloat32HalfBlockedOp::Run() {
+        if (rowSt >= rowEnd || colSt >= colEnd) {
+            return;
+        }
+        std::vector <float> packedA((size_t)GEMM_MC * GEMM_KC), packedB((size_t)GEMM_NC * GEMM_KC);
+        float tile[GEMM_MR * GEMM_NR];
+        for (int jc = colSt; jc < colEnd; jc += GEMM_NC) {
+            int nc = std::min(GEMM_NC, colEnd - jc);
+            for (int pc = 0; pc < m; pc += GEMM_KC) {
+                int kc = std::min(GEMM_KC, m - pc);
+                // 打包权重块: 每GEMM_NR列一个panel, panel内按k连续存放, 转成float32, 不足GEMM_NR列的部分补0
+                for (int jr = 0; jr < nc; jr += GEMM_NR) {
+                    float *panel = packedB.data() + (size_t)jr * kc;
+                    for (int j = 0; j < GEMM_NR; j++) {
+                        if (jr + j >= nc) {
+                            for (int l = 0; l < kc; l++) {
+                                panel[l * GEMM_NR + j] = 0.0f;
+                            }
+                            continue;
+                        }
+                        uint16_t *w = weightData + (size_t)(jc + jr + j) * m + pc;
+                        float *dict = isBF16 ? bf16tofp32.dict : fp16tofp32.dict;
+                        for (int l = 0; l < kc; l++) {
+                            panel[l * GEMM_NR + j] = dict[w[l]];
+                        }
+                    }
+                }
+                for (int ic = rowSt; ic < rowEnd; ic += GEMM_MC) {
+                    int mc = std::min(GEMM_MC, rowEnd - ic);
+                    // 打包输入块: 每GEMM_MR行一个panel, panel内按k连续存放, 不足GEMM_MR行的部分补0
+                    for (int ir = 0; ir < mc; ir += GEMM_MR) {
+                        float *panel = packedA.data() + (size_t)ir * kc;
+                        for (int r = 0; r < GEMM_MR; r++) {
+                            float *x = inputData + (size_t)(ic + ir + r) * m + pc;
+                            for (int l = 0; l < kc; l++) {
+                                panel[l * GEMM_MR + r] = (ir + r < mc) ? x[l] : 0.0f;
+                            }
+                        }
+                    }
+                    for (int jr = 0; jr < nc; jr += GEMM_NR) {
+                        for (int ir = 0; ir < mc; ir += GEMM_MR) {
+                            float *a = packedA.data() + (size_t)ir * kc, *b = packedB.data() + (size_t)jr * kc;
+                            float *c = outputData + (size_t)(ic + ir) * k + jc + jr;
+                            if (ir + GEMM_MR <= mc && jr + GEMM_NR <= nc) {
+                                GemmFloat32_6x16_Kernel(kc, a, b, c, k, pc > 0);
+                            } else {
+                                // 边缘的不完整块先算到临时tile中
+                                GemmFloat32_6x16_Kernel(kc, a, b, tile, GEMM_NR, false);
+                                for (int r = 0; r < std::min(GEMM_MR, mc - ir); r++) {
+                                    for (int j = 0; j < std::min(GEMM_NR, nc - jr); j++) {
+                                        c[(size_t)r * k + j] = (pc > 0 ? c[(size_t)r * k + j] : 0.0f) + tile[r * GEMM_NR + j];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if (biasData != nullptr) {
+            for (int i = rowSt; i < rowEnd; i++) {
+                for (int j = colSt; j < colEnd; j++) {
+                    outputData[(size_t)i * k + j] += biasData[j];
+                }
+            }
+        }
+    }
+
+    bool UseLinearHalfBlocked(int n, int m, int k, DataType weightDataType) {
+        if (weightDataType != DataType::FLOAT16 && weightDataType != DataType::BFLOAT16) {
+            return false;
+        }
+        // decode规模 (n较小) 时direct kernel只读一遍权重, 已经接近带宽上限
+        if (n < GEMM_BLOCKED_MIN_ROWS || m < GEMM_KC / 4 || k < GEMM_NR || !cpuInstructInfo.hasAVX2) {
+            return false;
+        }
+        // 有avx512bf16时, bf16权重的direct kernel用bf16点积指令, 吞吐更高
+        if (weightDataType == DataType::BFLOAT16 && cpuInstructInfo.hasAVX512BF16) {
+            return false;
+        }
+        return true;
+    }
+
+    void RunLinearFloat32HalfBlocked(float *inputData, uint16_t *weightData, bool isBF16, float *outputData, float *biasData, 
+                                int n, int m, int k, 
+                                AliveThreadPool *pool, int startTid, int threadNum) {
+        // 行分成tr份, 列分成threadNum / tr份: 每份行都要读一遍对应列的权重, 每份列都要读一遍对应行的输入, 选总读取量最小的划分
+        int tr = 1;
+        double bestCost = 1e100;
+        for (int i = 1; i <= threadNum; i++) {
+            if (threadNum % i != 0 || (i > 1 && n / i < GEMM_MR)) {
+                continue;
+            }
+            double cost = (double)i * k * sizeof(uint16_t) + (double)(threadNum / i) * n * sizeof(float);
+            if (cost < bestCost) {
+                bestCost = cost;
+                tr = i;
+            }
+        }
+        int tc = threadNum / tr;
+        MultiThreadOpScope opScope;
+        std::vector<fastllm::MultiThreadLinearFloat32HalfBlockedOp*> ops;
+        for (int i = 0; i < tr; i++) {
+            // 行按GEMM_MR对齐, 列按GEMM_NR对齐, 尽量不产生不完整的块
+            int rowSt = std::min(n, (int)((long long)n * i / tr / GEMM_MR * GEMM_MR));
+            int rowEnd = (i == tr - 1) ? n : std::min(n, (int)((long long)n * (i + 1) / tr / GEMM_MR * GEMM_MR));
+            for (int j = 0; j < tc; j++) {
+                int colSt = std::min(k, (int)((long long)k * j / tc / GEMM_NR * GEMM_NR));
+                int colEnd = (j == tc - 1) ? k : std::min(k, (int)((long long)k * (j + 1) / tc / GEMM_NR * GEMM_NR));
+                ops.push_back(opScope.New<MultiThreadLinearFloat32HalfBlockedOp>(inputData, weightData, biasData, outputData,
+                                                n, m, k, rowSt, rowEnd, colSt, colEnd, isBF16));
+            }
+        }
+        for (int i = 0; i < ops.size(); i++) {
+            pool->PushOp(startTid + i, ops[i]);
+        }
+        for (int i = 0; i < ops.size(); i++) {
+            pool->Wait(startTid + i);
+        }
+    }
+
+    void RunLinearFloat16HalfBlocked(uint16_t *inputData, uint16_t *weightData, bool isBF16, uint16_t *outputData, float *biasData, 
+                                int n, int m, int k, 
+                                AliveThreadPool *pool, int startTid, int threadNum) {
+        std::vector <float> floatInput, floatOutput;
+        floatInput.resize((size_t)n * m);
+        floatOutput.resize((size_t)n * k);
+        Float16ToFloat32(inputData, floatInput.data(), n * m);
+        RunLinearFloat32HalfBlocked(floatInput.data(), weightData, isBF16, floatOutput.data(), biasData, n, m, k, pool, startTid, threadNum);
+        Float32ToFloat16(floatOutput.data(), outputData, n * k);
+    }
+
+    // 每个调度线程 (包括并发的op stream) 各自使用一份缓存
+    thread_local struct FastllmBF16Manager {
         std::vector <uint16_t> bf16Input;
         std::vector <uint16_t> bf16Weight;
     } fastllmBf16Manager;
@@ -1216,13 +1389,14 @@ namespace fastllm {
         if (n > 4) {
             int per = n * m / threadNum;
             int cur = 0;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadFloat32ToBFloat16Op*> ops;
             for (int i = 0; i < threadNum; i++) {
                 int end = cur + per + (cur + per * (threadNum - i) < n * m);
                 if (i == threadNum - 1) {
                     end = n * m;
                 }
-                ops.push_back(new MultiThreadFloat32ToBFloat16Op(inputData + cur, bf16Input.data() + cur, end - cur));
+                ops.push_back(opScope.New<MultiThreadFloat32ToBFloat16Op>(inputData + cur, bf16Input.data() + cur, end - cur));
                 cur = end;
             }
             for (int i = 0; i < threadNum; i++) {
@@ -1230,7 +1404,6 @@ namespace fastllm {
             }
             for (int i = 0; i < threadNum; i++) {
                 pool->Wait(startTid + i);
-                delete ops[i];
             }
         } else {
             Float32ToBFloat16(inputData, bf16Input.data(), n * m);
@@ -1294,13 +1467,14 @@ namespace fastllm {
 */
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearBFloat16BFloat16Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
             if (i == threadNum - 1) {
                 end = k;
             }
-            ops.push_back(new MultiThreadLinearBFloat16BFloat16Op(bf16Input.data(), weightData, biasData, outputData,
+            ops.push_back(opScope.New<MultiThreadLinearBFloat16BFloat16Op>(bf16Input.data(), weightData, biasData, outputData,
                                                 n, m, k, cur, end));
             cur = end;
         }
@@ -1309,7 +1483,6 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
     }
 
@@ -1318,13 +1491,14 @@ namespace fastllm {
                                 AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearBFloat16BFloat16Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
             if (i == threadNum - 1) {
                 end = k;
             }
-            ops.push_back(new MultiThreadLinearBFloat16BFloat16Op(inputData, weightData, biasData, outputData,
+            ops.push_back(opScope.New<MultiThreadLinearBFloat16BFloat16Op>(inputData, weightData, biasData, outputData,
                                                 n, m, k, cur, end));
             cur = end;
         }
@@ -1333,14 +1507,13 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
     }
     
     void LaunchLinearInt8Int8(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, 
         int *weightSums, int *weightZeros, float *scales, float *bias,
         float *inputSums, float *iscales, float *izeros,
-        std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
+        MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
         for (int i = 0; i < threadNum; i++) {
@@ -1348,7 +1521,7 @@ namespace fastllm {
             if (i == threadNum - 1) {
                 end = k;
             }
-            ops[startTid + i] = new MultiThreadLinearInt8Int8Op(a, b + cur * m, (int32_t*)c + cur, n, m, end - cur, k, 
+            ops[startTid + i] = opScope.New<MultiThreadLinearInt8Int8Op>(a, b + cur * m, (int32_t*)c + cur, n, m, end - cur, k, 
                                                         weightSums + cur, weightZeros + cur, scales + cur, 
                                                         (bias == nullptr ? (float *) nullptr : bias + cur), 
                                                         iscales, izeros, inputSums);
@@ -1366,13 +1539,14 @@ namespace fastllm {
                             AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearInt8Int8Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
             if (i == threadNum - 1) {
                 end = k;
             }
-            ops.push_back(new MultiThreadLinearInt8Int8Op(a, b + cur * m, (int32_t*)c + cur, n, m, end - cur, k, 
+            ops.push_back(opScope.New<MultiThreadLinearInt8Int8Op>(a, b + cur * m, (int32_t*)c + cur, n, m, end - cur, k, 
                                                         weightSums + cur, weightZeros + cur, scales + cur, 
                                                         (bias == nullptr ? (float *) nullptr : bias + cur), 
                                                         iscales, izeros, inputSums));
@@ -1383,7 +1557,6 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
     }
 
@@ -1394,10 +1567,11 @@ namespace fastllm {
                                 AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearInt8Int4GroupOp*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = (i == threadNum - 1 ? k : cur + per + (cur + per * (threadNum - i) < k));
-            ops.push_back(new MultiThreadLinearInt8Int4GroupOp(a, b + cur * m / 2, c + cur, n, m, end - cur, k,
+            ops.push_back(opScope.New<MultiThreadLinearInt8Int4GroupOp>(a, b + cur * m / 2, c + cur, n, m, end - cur, k,
                                 weightSums + cur * group, weightMins + cur * group, scales + cur * group,
                                 (bias == nullptr ? (float *) nullptr : bias + cur), iscales, izeros,
                                 inputSums, group, groupCnt));
@@ -1408,17 +1582,33 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
     }
 
+    // 量化Linear的输入在线量化时用到的临时空间, 只增不减, 避免每次调用都重新分配
+    thread_local struct FastllmQuantManager {
+        std::vector <uint8_t> uinput;
+        std::vector <LowBitConfig> inputConfigs;
+        std::vector <float> inputSums, iscales, izeros;
+        std::vector <float> floatInput, floatOutput; // FP16输入输出转换成的FP32
+        std::vector <uint8_t> expandInput; // 按BASE3_GROUP权重展开的输入
+    } fastllmQuantManager;
+
     void RunLinearFloat32Int8(float *inputData, Data &weight, float *outputData, float *biasData, 
                                 int n, int m, int k, 
-                                AliveThreadPool *pool, int startTid, int threadNum) {
+                                AliveThreadPool *pool, int startTid, int threadNum, QuantizedActivation *quantized) {
         weight.CalcWeightSum();
-        std::vector<LowBitConfig> inputConfigs;
-        std::vector<uint8_t> uinput;
-        std::vector <float> inputSums, iscales, izeros;
+        if (quantized != nullptr) {
+            // 输入已经在AddRMSNormQuant中量化好了
+            RunLinearInt8Int8(quantized->uinput.data(), (uint8_t*)weight.cpuData, outputData, n, m, k, 
+                    weight.weightSum.data(), weight.zeros.data(), weight.scales.data(), biasData, 
+                    quantized->inputSums.data(), quantized->iscales.data(), quantized->izeros.data(),
+                    pool, startTid, threadNum);
+            return;
+        }
+        std::vector<LowBitConfig> &inputConfigs = fastllmQuantManager.inputConfigs;
+        std::vector<uint8_t> &uinput = fastllmQuantManager.uinput;
+        std::vector <float> &inputSums = fastllmQuantManager.inputSums, &iscales = fastllmQuantManager.iscales, &izeros = fastllmQuantManager.izeros;
         OnlineQuantization(inputData, uinput, inputConfigs, n, m, 1, m, inputSums, iscales, izeros, 0);
 
         RunLinearInt8Int8(uinput.data(), (uint8_t*)weight.cpuData, outputData, n, m, k, 
@@ -1460,13 +1650,14 @@ namespace fastllm {
         if (n > 4) {
             int per = n * m / threadNum;
             int cur = 0;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadFloat32ToBFloat16Op*> ops;
             for (int i = 0; i < threadNum; i++) {
                 int end = cur + per + (cur + per * (threadNum - i) < n * m);
                 if (i == threadNum - 1) {
                     end = n * m;
                 }
-                ops.push_back(new MultiThreadFloat32ToBFloat16Op(inputData + cur, bf16Input.data() + cur, end - cur));
+                ops.push_back(opScope.New<MultiThreadFloat32ToBFloat16Op>(inputData + cur, bf16Input.data() + cur, end - cur));
                 cur = end;
             }
             for (int i = 0; i < threadNum; i++) {
@@ -1474,7 +1665,6 @@ namespace fastllm {
             }
             for (int i = 0; i < threadNum; i++) {
                 pool->Wait(startTid + i);
-                delete ops[i];
             }
         } else {
             Float32ToBFloat16(inputData, bf16Input.data(), n * m);
@@ -1487,10 +1677,11 @@ namespace fastllm {
 
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearBFloat16FP8E4M3Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
-            ops.push_back(new MultiThreadLinearBFloat16FP8E4M3Op(bf16Input.data(), weight.cpuData, biasData, outputData,
+            ops.push_back(opScope.New<MultiThreadLinearBFloat16FP8E4M3Op>(bf16Input.data(), weight.cpuData, biasData, outputData,
                                                     n, m, k, cur, end, weight.scales.data(), weight.blockK, weight.blockM));
             cur = end;
         }
@@ -1499,13 +1690,12 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
     }
 
     void LaunchLinearBFloat16FP8E4M3(uint16_t *inputData, Data &weight, float *outputData, float *biasData, 
         int n, int m, int k, 
-        std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
+        MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
         for (int i = 0; i < threadNum; i++) {
@@ -1513,7 +1703,7 @@ namespace fastllm {
             if (i == threadNum - 1) {
                 end = k;
             }
-            ops[startTid + i] = new MultiThreadLinearBFloat16FP8E4M3Op(inputData, weight.cpuData, biasData, outputData,
+            ops[startTid + i] = opScope.New<MultiThreadLinearBFloat16FP8E4M3Op>(inputData, weight.cpuData, biasData, outputData,
                                     n, m, k, cur, end, weight.scales.data(), weight.blockK, weight.blockM);
             cur = end;
         }
@@ -1524,7 +1714,7 @@ namespace fastllm {
 
     void LaunchLinearBFloat16BFloat16(uint16_t *inputData, Data &weight, float *outputData, float *biasData, 
                                 int n, int m, int k, 
-                                std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
+                                MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
         for (int i = 0; i < threadNum; i++) {
@@ -1532,7 +1722,7 @@ namespace fastllm {
             if (i == threadNum - 1) {
                 end = k;
             }
-            ops[startTid + i] = new MultiThreadLinearBFloat16BFloat16Op(inputData, (uint16_t*)weight.cpuData, biasData, outputData,
+            ops[startTid + i] = opScope.New<MultiThreadLinearBFloat16BFloat16Op>(inputData, (uint16_t*)weight.cpuData, biasData, outputData,
                                     n, m, k, cur, end);
             cur = end;
         }
@@ -1543,7 +1733,7 @@ namespace fastllm {
 
     void LaunchLinearFloat32Float16(float *inputData, Data &weight, float *outputData, float *biasData, 
                                 int n, int m, int k, 
-                                std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
+                                MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
                                     int per = k / threadNum;
         int cur = 0;
         for (int i = 0; i < threadNum; i++) {
@@ -1551,7 +1741,7 @@ namespace fastllm {
             if (i == threadNum - 1) {
                 end = k;
             }
-            ops[startTid + i] = new MultiThreadLinearFloat32Float16Op(inputData, (uint16_t*)weight.cpuData, biasData, outputData,
+            ops[startTid + i] = opScope.New<MultiThreadLinearFloat32Float16Op>(inputData, (uint16_t*)weight.cpuData, biasData, outputData,
                                     n, m, k, cur, end);
             cur = end;
         }
@@ -1560,16 +1750,20 @@ namespace fastllm {
         }
     }
 
-    struct FastllmQuantManager {
-        std::vector <uint8_t> uinput;
-    } fastllmQuantManager;
-
     void RunLinearFloat32Int4Group(float *inputData, Data &weight, float *outputData, float *biasData, 
                                 int n, int m, int k, int group, int groupCnt,
-                                AliveThreadPool *pool, int startTid, int threadNum) {
+                                AliveThreadPool *pool, int startTid, int threadNum, QuantizedActivation *quantized) {
         weight.CalcWeightSum();
-        std::vector<LowBitConfig> inputConfigs;
-        std::vector <float> inputSums, iscales, izeros;
+        if (quantized != nullptr) {
+            // 输入已经在AddRMSNormQuant中量化好了
+            RunLinearInt8Int4Group(quantized->uinput.data(), (uint8_t*)weight.cpuData, outputData, n, m, k,
+                                    group, groupCnt, weight.weightSum.data(), weight.mins.data(), weight.scales.data(), 
+                                    biasData, quantized->inputSums.data(), quantized->iscales.data(), quantized->izeros.data(),
+                                    pool, startTid, threadNum);
+            return;
+        }
+        std::vector<LowBitConfig> &inputConfigs = fastllmQuantManager.inputConfigs;
+        std::vector <float> &inputSums = fastllmQuantManager.inputSums, &iscales = fastllmQuantManager.iscales, &izeros = fastllmQuantManager.izeros;
         std::vector <uint8_t> &uinput = fastllmQuantManager.uinput;
         OnlineQuantization(inputData, uinput, inputConfigs, n, m, group, groupCnt, inputSums, iscales, izeros, 1);
         RunLinearInt8Int4Group(uinput.data(), (uint8_t*)weight.cpuData, outputData, n, m, k,
@@ -1609,16 +1803,85 @@ namespace fastllm {
         }
     };
 
+    extern bool MatMulInt8Int2GroupTiled_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, int st, int end,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums);
+    extern bool MatMulInt8Int2GroupTiled_AVX2(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, int st, int end,
+        int group, int realGroup, int groupCnt, float *iscales, float *izeros, float *scales, int *weightSums);
+    extern bool MatMulInt8Base3GroupTiled_AVX512VNNI(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, int st, int end,
+        int group, int realGroup, int groupCnt, float *inputSums, float *iscales, float *izeros, uint16_t *halfScales, int *weightSums);
+    extern bool MatMulInt8Base3GroupTiled_AVX2(uint8_t *a, uint8_t *b, float *c, int n, int m, int k, int st, int end,
+        int group, int realGroup, int groupCnt, float *inputSums, float *iscales, float *izeros, uint16_t *halfScales, int *weightSums);
+
+    // int8的输入 (按Int2InputPermute重排), int2分组的权重
+    // 每32个字节的权重移位取出4个平面, 分别和输入的4个平面做int8乘法, 访存量只有INT4_GROUP的一半
+    struct MultiThreadLinearInt8Int2GroupOp : MultiThreadBaseOp {
+        uint8_t *a, *b;
+        float *c, *bias;
+        int n, m, k, st, end, group, groupCnt;
+        int *weightSums;
+        float *mins, *scales, *inputSums, *iscales, *izeros;
+
+        MultiThreadLinearInt8Int2GroupOp(uint8_t *a, uint8_t *b, float *c, float *bias, int n, int m, int k, int st, int end,
+                                    int group, int groupCnt, int *weightSums, float *mins, float *scales,
+                                    float *inputSums, float *iscales, float *izeros) :
+            a(a), b(b), c(c), bias(bias), n(n), m(m), k(k), st(st), end(end), group(group), groupCnt(groupCnt),
+            weightSums(weightSums), mins(mins), scales(scales), inputSums(inputSums), iscales(iscales), izeros(izeros) {}
+
+        void Run() {
+            int realGroup = (m - 1) / groupCnt + 1;
+            if (cpuInstructInfo.hasAVX512VNNI &&
+                MatMulInt8Int2GroupTiled_AVX512VNNI(a, b, c, n, m, k, st, end, group, realGroup, groupCnt, iscales, izeros, scales, weightSums)) {
+            } else if (!MatMulInt8Int2GroupTiled_AVX2(a, b, c, n, m, k, st, end, group, realGroup, groupCnt, iscales, izeros, scales, weightSums)) {
+                ErrorInFastLLM("Linear error: int8 * int2 group kernel is unavailable.\n");
+            }
+            std::vector <float> tempValue(n * group);
+            for (int i = 0; i < n; i++) {
+                for (int g = 0; g < realGroup; g++) {
+                    int iid = i * group + g;
+                    int cnt = std::min(m, (g + 1) * groupCnt) - g * groupCnt;
+                    tempValue[iid] = (inputSums[iid] - izeros[iid] * cnt) * iscales[iid];
+                }
+            }
+            for (int i = 0; i < n; i++) {
+                for (int j = st; j < end; j++) {
+                    float minSum = 0.0f;
+                    for (int g = 0; g < realGroup; g++) {
+                        minSum += mins[j * group + g] * tempValue[i * group + g];
+                    }
+                    c[(size_t)i * k + j] += minSum + (bias == nullptr ? 0.0f : bias[j]);
+                }
+            }
+        }
+    };
+
     void RunLinearFloat32Int2Group(float *inputData, Data &weight, float *outputData, float *biasData, 
         int n, int m, int k, int group, int groupCnt,
         AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
-        std::vector<fastllm::MultiThreadLinearFloat32Int2GroupOp*> ops;
+        MultiThreadOpScope opScope;
+        std::vector<fastllm::MultiThreadBaseOp*> ops;
+        bool useInt8 = false;
+#ifdef __AVX2__
+        useInt8 = (m % 128 == 0 && groupCnt % 128 == 0);
+#endif
+        std::vector<LowBitConfig> &inputConfigs = fastllmQuantManager.inputConfigs;
+        std::vector <float> &inputSums = fastllmQuantManager.inputSums, &iscales = fastllmQuantManager.iscales, &izeros = fastllmQuantManager.izeros;
+        std::vector <uint8_t> &uinput = fastllmQuantManager.uinput;
+        if (useInt8) {
+            weight.CalcWeightSum();
+            OnlineQuantization(inputData, uinput, inputConfigs, n, m, group, groupCnt, inputSums, iscales, izeros, 2);
+        }
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
-            ops.push_back(new MultiThreadLinearFloat32Int2GroupOp(inputData, &weight, biasData, outputData,
+            if (useInt8) {
+                ops.push_back(opScope.New<MultiThreadLinearInt8Int2GroupOp>(uinput.data(), (uint8_t*)weight.cpuData, outputData, biasData,
+                                                    n, m, k, cur, end, group, groupCnt, weight.weightSum.data(), 
+                                                    weight.mins.data(), weight.scales.data(), inputSums.data(), iscales.data(), izeros.data()));
+            } else {
+                ops.push_back(opScope.New<MultiThreadLinearFloat32Int2GroupOp>(inputData, &weight, biasData, outputData,
                                                     n, m, k, cur, end));
+            }
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
@@ -1626,7 +1889,124 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
+        }
+    }
+
+    // BASE3_GROUP每个字节存5个三值权重 (byte = t0 + 3t1 + 9t2 + 27t3 + 81t4, 权重为t - 1)
+    struct MultiThreadLinearFloat32Base3GroupOp : MultiThreadBaseOp {
+        float *inputData;
+        Data *weight;
+        float *biasData, *outputData;
+        int n, m, k, st, end;
+
+        MultiThreadLinearFloat32Base3GroupOp(float *inputData, Data *weight, float *biasData, float *outputData,
+                           int n, int m, int k, int st, int end) : 
+            inputData(inputData), weight(weight), biasData(biasData), outputData(outputData),
+            n(n), m(m), k(k), st(st), end(end) {}
+
+        void Run() {
+            const int base[5] = {1, 3, 9, 27, 81};
+            int group = weight->group, groupCnt = weight->groupCnt;
+            int bytesPerGroup = (groupCnt - 1) / 5 + 1;
+            for (int i = 0; i < n; i++) {
+                for (int j = st; j < end; j++) {
+                    float now = biasData ? biasData[j] : 0.0f;
+                    for (int g = 0; g < group; g++) {
+                        uint8_t *cur = weight->cpuData + ((size_t)j * group + g) * bytesPerGroup;
+                        float sum = 0.0f;
+                        for (int l = 0; l < groupCnt && g * groupCnt + l < m; l++) {
+                            sum += inputData[i * m + g * groupCnt + l] * (cur[l / 5] / base[l % 5] % 3 - 1);
+                        }
+                        now += sum * fp16tofp32.dict[weight->halfScales[j * group + g]];
+                    }
+                    outputData[i * k + j] = now;
+                }
+            }
+        }
+    };
+
+    // 把量化后的输入展开成和BASE3_GROUP权重对应的布局: 每组按32个字节的权重分块, 每块展开成5个平面,
+    // 第p个平面是这32个字节中第4 - p位三值对应的输入. 超出组长或m的元素, 以及块中不属于这一组的字节都填0
+    void Base3InputExpand(uint8_t *input, uint8_t *output, int n, int m, int group, int groupCnt) {
+        int bytesPerGroup = (groupCnt - 1) / 5 + 1, blocks = (bytesPerGroup - 1) / 32 + 1;
+        size_t lda = (size_t)group * blocks * 160;
+        memset(output, 0, n * lda);
+        for (int i = 0; i < n; i++) {
+            for (int g = 0; g < group; g++) {
+                uint8_t *cur = output + i * lda + (size_t)g * blocks * 160;
+                for (int l = 0; l < groupCnt && g * groupCnt + l < m; l++) {
+                    int pos = l / 5, p = 4 - l % 5;
+                    cur[(pos / 32) * 160 + p * 32 + pos % 32] = input[(size_t)i * m + g * groupCnt + l];
+                }
+            }
+        }
+    }
+
+    // int8的输入 (按Base3InputExpand展开), base3分组的权重
+    struct MultiThreadLinearInt8Base3GroupOp : MultiThreadBaseOp {
+        uint8_t *a, *b;
+        float *c, *bias;
+        int n, m, k, st, end, group, groupCnt;
+        int *weightSums;
+        uint16_t *halfScales;
+        float *inputSums, *iscales, *izeros;
+
+        MultiThreadLinearInt8Base3GroupOp(uint8_t *a, uint8_t *b, float *c, float *bias, int n, int m, int k, int st, int end,
+                                    int group, int groupCnt, int *weightSums, uint16_t *halfScales, 
+                                    float *inputSums, float *iscales, float *izeros) :
+            a(a), b(b), c(c), bias(bias), n(n), m(m), k(k), st(st), end(end), group(group), groupCnt(groupCnt),
+            weightSums(weightSums), halfScales(halfScales), inputSums(inputSums), iscales(iscales), izeros(izeros) {}
+
+        void Run() {
+            int realGroup = (m - 1) / groupCnt + 1;
+            if (cpuInstructInfo.hasAVX512VNNI &&
+                MatMulInt8Base3GroupTiled_AVX512VNNI(a, b, c, n, m, k, st, end, group, realGroup, groupCnt, inputSums, iscales, izeros, halfScales, weightSums)) {
+            } else if (!MatMulInt8Base3GroupTiled_AVX2(a, b, c, n, m, k, st, end, group, realGroup, groupCnt, inputSums, iscales, izeros, halfScales, weightSums)) {
+                ErrorInFastLLM("Linear error: int8 * base3 group kernel is unavailable.\n");
+            }
+            AddBias(c, bias, n, k, st, end);
+        }
+    };
+
+    void RunLinearFloat32Base3Group(float *inputData, Data &weight, float *outputData, float *biasData, 
+        int n, int m, int k, int group, int groupCnt,
+        AliveThreadPool *pool, int startTid, int threadNum) {
+        bool useInt8 = false;
+#ifdef __AVX2__
+        useInt8 = true;
+#endif
+        std::vector<LowBitConfig> &inputConfigs = fastllmQuantManager.inputConfigs;
+        std::vector <float> &inputSums = fastllmQuantManager.inputSums, &iscales = fastllmQuantManager.iscales, &izeros = fastllmQuantManager.izeros;
+        std::vector <uint8_t> &uinput = fastllmQuantManager.uinput, &expandInput = fastllmQuantManager.expandInput;
+        if (useInt8) {
+            weight.CalcWeightSum();
+            OnlineQuantization(inputData, uinput, inputConfigs, n, m, group, groupCnt, inputSums, iscales, izeros, -1);
+            int bytesPerGroup = (groupCnt - 1) / 5 + 1, blocks = (bytesPerGroup - 1) / 32 + 1;
+            size_t len = (size_t)n * group * blocks * 160;
+            if (expandInput.size() < len) {
+                expandInput.resize(len);
+            }
+            Base3InputExpand(uinput.data(), expandInput.data(), n, m, group, groupCnt);
+        }
+        MultiThreadOpScope opScope;
+        std::vector<fastllm::MultiThreadBaseOp*> ops;
+        for (int t = 0, cur = 0; t < threadNum; t++) {
+            int end = cur + k / threadNum + (t < k % threadNum);
+            if (useInt8) {
+                ops.push_back(opScope.New<MultiThreadLinearInt8Base3GroupOp>(expandInput.data(), (uint8_t*)weight.cpuData, outputData, biasData,
+                                                    n, m, k, cur, end, group, groupCnt, weight.weightSum.data(), 
+                                                    weight.halfScales.data(), inputSums.data(), iscales.data(), izeros.data()));
+            } else {
+                ops.push_back(opScope.New<MultiThreadLinearFloat32Base3GroupOp>(inputData, &weight, biasData, outputData,
+                                                    n, m, k, cur, end));
+            }
+            cur = end;
+        }
+        for (int t = 0; t < threadNum; t++) {
+            pool->PushOp(startTid + t, ops[t]);
+        }
+        for (int t = 0; t < threadNum; t++) {
+            pool->Wait(startTid + t);
         }
     }
 
@@ -1635,10 +2015,11 @@ namespace fastllm {
                                 AliveThreadPool *pool, int startTid, int threadNum) {
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearFloat16Float16Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
-            ops.push_back(new MultiThreadLinearFloat16Float16Op(inputData, weightData, biasData, outputData,
+            ops.push_back(opScope.New<MultiThreadLinearFloat16Float16Op>(inputData, weightData, biasData, outputData,
                                                    n, m, k, cur, end));
             cur = end;
         }
@@ -1647,13 +2028,12 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
     }
 
     void RunLinearFloat16Int8(uint16_t *inputData, Data &weight, uint16_t *outputData, float *biasData, 
                             int n, int m, int k, AliveThreadPool *pool, int startTid, int threadNum) {
-        std::vector <float> floatInput, floatOutput;
+        std::vector <float> &floatInput = fastllmQuantManager.floatInput, &floatOutput = fastllmQuantManager.floatOutput;
         floatInput.resize(n * m);
         floatOutput.resize(n * k);
         Float16ToFloat32(inputData, floatInput.data(), n * m);
@@ -1664,7 +2044,7 @@ namespace fastllm {
     void RunLinearFloat16Int4Group(uint16_t *inputData, Data &weight, uint16_t *outputData, float *biasData, 
                             int n, int m, int k, int group, int groupCnt,
                             AliveThreadPool *pool, int startTid, int threadNum) {
-        std::vector <float> floatInput, floatOutput;
+        std::vector <float> &floatInput = fastllmQuantManager.floatInput, &floatOutput = fastllmQuantManager.floatOutput;
         floatInput.resize(n * m);
         floatOutput.resize(n * k);
         Float16ToFloat32(inputData, floatInput.data(), n * m);
@@ -1684,10 +2064,11 @@ namespace fastllm {
 
         int per = k / threadNum;
         int cur = 0;
+        MultiThreadOpScope opScope;
         std::vector<fastllm::MultiThreadLinearBFloat16FP8E4M3Op*> ops;
         for (int i = 0; i < threadNum; i++) {
             int end = cur + per + (cur + per * (threadNum - i) < k);
-            ops.push_back(new MultiThreadLinearBFloat16FP8E4M3Op(bf16Input.data(), weight.cpuData, biasData, floatOutput.data(), 
+            ops.push_back(opScope.New<MultiThreadLinearBFloat16FP8E4M3Op>(bf16Input.data(), weight.cpuData, biasData, floatOutput.data(), 
                                                     n, m, k, cur, end, weight.scales.data(), weight.blockK, weight.blockM));
             cur = end;
         }
@@ -1696,7 +2077,6 @@ namespace fastllm {
         }
         for (int i = 0; i < threadNum; i++) {
             pool->Wait(startTid + i);
-            delete ops[i];
         }
 
         Float32ToFloat16(floatOutput.data(), outputData, n * k);
@@ -1715,7 +2095,7 @@ namespace fastllm {
 
     void LaunchLinearQ8KGGUF(uint8_t *a, uint8_t *b, float *c, float *bias, Data *weight, 
                             int n, int m, int k,
-                            std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
+                            MultiThreadOpScope &opScope, std::vector<fastllm::MultiThreadBaseOp*> &ops, AliveThreadPool *pool, int startTid, int threadNum) {
         weight->Repack();
         int rows = 8;
         int ks = (k / rows);
@@ -1726,7 +2106,7 @@ namespace fastllm {
             if (i == threadNum - 1) {
                 end = ks;
             }
-            ops[startTid + i] = new MultiThreadLinearFloat32GGUFOp(a, b, bias, c, weight->ggmlTensor, n, m, k, cur * rows, end * rows);
+            ops[startTid + i] = opScope.New<MultiThreadLinearFloat32GGUFOp>(a, b, bias, c, weight->ggmlTensor, n, m, k, cur * rows, end * rows);
             cur = end;
         }
         for (int i = 0; i < threadNum; i++) {
@@ -1734,7 +2114,7 @@ namespace fastllm {
         }
     }
 
-    struct GGUFMemoryManager {
+    thread_local struct GGUFMemoryManager {
         std::vector <uint8_t> q8kInputs;
     } ggufMemoryManager;
 
@@ -1752,12 +2132,13 @@ namespace fastllm {
                 q8kInputs.resize(n * rowCount);
             }
             if (n > 1) {
+                MultiThreadOpScope opScope;
                 std::vector<fastllm::MultiThreadFloat32ToQ8KOp*> ops;
                 int per = n / threadNum;
                 int cur = 0;
                 for (int i = 0; i < threadNum; i++) {
                     int end = cur + per + (cur + per * (threadNum - i) < n);
-                    ops.push_back(new MultiThreadFloat32ToQ8KOp(
+                    ops.push_back(opScope.New<MultiThreadFloat32ToQ8KOp>(
                         inputData + cur * m, (uint8_t*)(q8kInputs.data() + cur * rowCount), (end - cur) * m, tensor->type));
                     cur = end;
                 }
@@ -1766,7 +2147,6 @@ namespace fastllm {
                 }
                 for (int i = 0; i < threadNum; i++) {
                     pool->Wait(startTid + i);
-                    delete ops[i];
                 }
             } else {
                 for (int i = 0; i < n; i++) {
@@ -1781,10 +2161,11 @@ namespace fastllm {
             int ks = (k / rows);
             int per = ks / threadNum;
             int cur = 0;
+            MultiThreadOpScope opScope;
             std::vector<fastllm::MultiThreadLinearFloat32GGUFOp*> ops;
             for (int i = 0; i < threadNum; i++) {
                 int end = cur + per + (cur + per * (threadNum - i) < ks);
-                ops.push_back(new MultiThreadLinearFloat32GGUFOp((uint8_t*)q8kInputs.data(), weightData, biasData, outputData,
+                ops.push_back(opScope.New<MultiThreadLinearFloat32GGUFOp>((uint8_t*)q8kInputs.data(), weightData, biasData, outputData,
                                                         (void*)tensor, n, m, k, cur * rows, i == threadNum - 1 ? k : end * rows));
                 cur = end;
             }
@@ -1793,7 +2174,6 @@ namespace fastllm {
             }
             for (int i = 0; i < threadNum; i++) {
                 pool->Wait(startTid + i);
-                delete ops[i];
             }        
             return;
         }
@@ -0,0 +1,233 @@
+//
+// Linear kernel的注册表与自动调优
+//
+
+#include "devices/cpu/lineartuner.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "utils.h"
+
+namespace fastllm {
+    extern CPUInstructInfo cpuInstructInfo;
+
+    static const std::vector <std::string> allCpuIsas = {"base", "avx2", "avx512f", "avx512vnni", "avx512bf16"};
+
+    static const std::string defaultVariantName = "default"; // 调用者的默认kernel在调优数据库中的名字
+
+    bool IsCpuIsaSupported(const std::string &isa) {
+        if (isa == "base") {
+            return true;
+        } else if (isa == "avx2") {
+            return cpuInstructInfo.hasAVX2;
+        } else if (isa == "avx512f") {
+            return cpuInstructInfo.hasAVX512F;
+        } else if (isa == "avx512vnni") {
+            return cpuInstructInfo.hasAVX512VNNI;
+        } else if (isa == "avx512bf16") {
+            return cpuInstructInfo.hasAVX512BF16;
+        }
+        return false;
+    }
+
+    // 当前机器支持的指令集, 例如 "base+avx2+avx512f", 调优结果只在相同指令集的机器上使用
+    static const std::string &GetCpuIsaSignature() {
+        static const std::string signature = [] () {
+            std::string ret = "";
+            for (auto &isa : allCpuIsas) {
+                if (IsCpuIsaSupported(isa)) {
+                    ret += (ret == "" ? "" : "+") + isa;
+                }
+            }
+            return ret;
+        } ();
+        return signature;
+    }
+
+    static std::string GetRegistryKey(DataType inputType, DataType weightType, const std::string &isa) {
+        return std::to_string((int)inputType) + "," + std::to_string((int)weightType) + "," + isa;
+    }
+
+    // n按2的幂次分段, 避免每个prompt长度都调优一次
+    static int GetTuneRowBucket(int n) {
+        int bucket = 1;
+        while (bucket < n && bucket < 4096) {
+            bucket <<= 1;
+        }
+        return bucket;
+    }
+
+    static std::string GetTuneKey(DataType inputType, DataType weightType, int threadLen, int n, int m, int k) {
+        return GetCpuIsaSignature() + "," + std::to_string((int)inputType) + "," + std::to_string((int)weightType) + "," +
+               std::to_string(threadLen) + "," + std::to_string(GetTuneRowBucket(n)) + "," +
+               std::to_string(m) + "," + std::to_string(k);
+    }
+
+    void LinearTuner::Register(DataType inputType, DataType weightType, const std::string &isa, const LinearKernelVariant &variant) {
+        std::lock_guard <std::mutex> guard(locker);
+        AssertInFastLLM(variant.name != defaultVariantName, "LinearTuner error: kernel name \"" + defaultVariantName + "\" is reserved.\n");
+        auto &variants = registry[GetRegistryKey(inputType, weightType, isa)];
+        for (auto &it : variants) {
+            AssertInFastLLM(it.name != variant.name, "LinearTuner error: kernel \"" + variant.name + "\" registered twice.\n");
+        }
+        variants.push_back(variant);
+    }
+
+    std::vector <LinearKernelVariant*> LinearTuner::GetCandidates(DataType inputType, DataType weightType) {
+        std::vector <LinearKernelVariant*> ret;
+        for (auto &isa : allCpuIsas) {
+            if (!IsCpuIsaSupported(isa)) {
+                continue;
+            }
+            auto it = registry.find(GetRegistryKey(inputType, weightType, isa));
+            if (it != registry.end()) {
+                for (auto &variant : it->second) {
+                    ret.push_back(&variant);
+                }
+            }
+        }
+        return ret;
+    }
+
+    bool LinearTuner::Run(Data &input, Data &weight, const Data &bias, Data &output, int n, int m, int k, int threadSt, int threadLen,
+                          const LinearKernelFunc &defaultKernel) {
+        if (!IsActive()) {
+            return false;
+        }
+        std::string key = GetTuneKey(input.dataType, weight.dataType, threadLen, n, m, k);
+        std::vector <LinearKernelVariant*> candidates;
+        LinearTuneResult result;
+        bool found = false;
+        {
+            std::lock_guard <std::mutex> guard(locker);
+            candidates = GetCandidates(input.dataType, weight.dataType);
+            auto it = db.find(key);
+            if (it != db.end()) {
+                result = it->second;
+                found = true;
+            }
+        }
+        if (candidates.empty()) {
+            return false;
+        }
+        if (found) {
+            if (result.variant == defaultVariantName) {
+                if (result.threads >= threadLen) {
+                    return false;
+                }
+                defaultKernel(input, weight, bias, output, n, m, k, threadSt, std::max(1, result.threads));
+                return true;
+            }
+            for (auto variant : candidates) {
+                if (variant->name == result.variant) {
+                    variant->run(input, weight, bias, output, n, m, k, threadSt, std::max(1, std::min(result.threads, threadLen)));
+                    return true;
+                }
+            }
+            // 调优文件中的变体已经不存在了, 使用默认kernel
+            return false;
+        }
+        if (!online) {
+            return false;
+        }
+
+        // 在线调优: 每个 (变体, 线程数) 运行两次取较快的一次, 所有候选的计算结果相同, 最后一次运行的结果即为输出
+        // 默认kernel排在最前面, 只有严格更快的变体才会替代它
+        LinearKernelVariant defaultVariant = {defaultVariantName, defaultKernel};
+        candidates.insert(candidates.begin(), &defaultVariant);
+        std::vector <int> threadOptions;
+        for (int t = threadLen; t >= 1 && threadOptions.size() < 3; t /= 2) {
+            threadOptions.push_back(t);
+        }
+        LinearKernelVariant *best = nullptr, *last = nullptr;
+        int bestThreads = threadLen, lastThreads = threadLen;
+        float bestSpend = 1e30f;
+        for (auto variant : candidates) {
+            for (int threads : threadOptions) {
+                float spend = 1e30f;
+                for (int rep = 0; rep < 2; rep++) {
+                    auto st = std::chrono::system_clock::now();
+                    variant->run(input, weight, bias, output, n, m, k, threadSt, threads);
+                    spend = std::min(spend, (float)GetSpan(st, std::chrono::system_clock::now()));
+                }
+                last = variant, lastThreads = threads;
+                if (spend < bestSpend) {
+                    best = variant, bestThreads = threads, bestSpend = spend;
+                }
+            }
+        }
+        if (best != last || bestThreads != lastThreads) {
+            best->run(input, weight, bias, output, n, m, k, threadSt, bestThreads);
+        }
+        std::lock_guard <std::mutex> guard(locker);
+        db[key] = LinearTuneResult {best->name, bestThreads, bestSpend};
+        dirty = true;
+        hasResults = true;
+        return true;
+    }
+
+    bool LinearTuner::Load(const std::string &fileName) {
+        std::ifstream fi(fileName);
+        if (!fi.good()) {
+            return false;
+        }
+        std::lock_guard <std::mutex> guard(locker);
+        std::string line;
+        while (std::getline(fi, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::stringstream ss(line);
+            std::string key;
+            LinearTuneResult result;
+            if (ss >> key >> result.variant >> result.threads >> result.spend) {
+                db[key] = result;
+            }
+        }
+        hasResults = !db.empty();
+        return true;
+    }
+
+    bool LinearTuner::Save(const std::string &fileName) {
+        FILE *fo = fopen(fileName.c_str(), "w");
+        if (fo == nullptr) {
+            return false;
+        }
+        std::lock_guard <std::mutex> guard(locker);
+        fprintf(fo, "# isa,inputType,weightType,threads,n,m,k variant threads spend\n");
+        for (auto &it : db) {
+            fprintf(fo, "%s %s %d %.9f\n", it.first.c_str(), it.second.variant.c_str(), it.second.threads, it.second.spend);
+        }
+        fclose(fo);
+        dirty = false;
+        return true;
+    }
+
+    static void SaveLinearTuningAtExit() {
+        LinearTuner *tuner = GetLinearTuner();
+        if (tuner->dirty && tuner->fileName != "") {
+            tuner->Save(tuner->fileName);
+        }
+    }
+
+    LinearTuner *GetLinearTuner() {
+        // 不析构, 保证进程退出时写回调优结果时仍然可用
+        static LinearTuner *tuner = [] () {
+            LinearTuner *ret = new LinearTuner();
+            const char *tune = getenv("FASTLLM_LINEAR_TUNE");
+            ret->online = (tune != nullptr && (std::string(tune) == "ON" || std::string(tune) == "1"));
+            const char *fileName = getenv("FASTLLM_TUNING_FILE");
+            if (fileName != nullptr && std::string(fileName) != "") {
+                ret->fileName = fileName;
+                ret->Load(ret->fileName);
+                atexit(SaveLinearTuningAtExit);
+            }
+            return ret;
+        } ();
+        return tuner;
+    }
+}
@@ -334,9 +334,14 @@ namespace fastllm {
             return false;
         }
         Data &input = *(datas.find("input")->second);
+        Data &weight = *(datas.find("weight")->second);
         if (input.dataType != DataType::FLOAT32) {
             return false;
         }
+        if (weight.dataType != DataType::FLOAT32 && weight.dataType != DataType::FLOAT16 &&
+            weight.dataType != DataType::BFLOAT16) {
+            return false; // 量化的词表在CPU上按行反量化
+        }
         return true;
     }
 
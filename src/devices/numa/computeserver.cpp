@@ -1202,6 +1202,7 @@ namespace fastllm {
             izerosDown.resize(v.size());
  // record.push_back(std::make_pair("prepare datas", GetSpan(ttt, std::chrono::system_clock::now())));
             for (int st = 0; st < v.size(); st++) {
+                MultiThreadOpScope opScope; // 每组专家的Linear和swiglu任务, Wait之后在循环体末尾一起释放
                 int k = localKs[st];
                 int end = st, selSum = 1; // 一共处理selSum * k个输出
 
@@ -1231,19 +1232,18 @@ namespace fastllm {
                         LaunchLinearInt8Int8(localInput, weightData, outputData, n, m, curK,
                                             weight->weightSum.data(), weight->zeros.data(), weight->scales.data(), biasData, 
                                             inputSums.data(), iscales.data(), izeros.data(), 
-                                            ops, pool, threadSt, curThread);
+                                            opScope, ops, pool, threadSt, curThread);
                     } else {
                         MultiplyInt4GroupMultiThreadLaunch(localInput, weightData, outputData, n, m, curK,
                                                 weight->weightSum.data(), weight->mins.data(), weight->scales.data(), 
                                                 biasData, inputSums, iscales, izeros,
-                                                inputConfigs, threadSt, curThread, group, groupCnt, ops, pool);
+                                                inputConfigs, threadSt, curThread, group, groupCnt, opScope, ops, pool);
                     }
                     threadSt += curThread;
                 }
 
                 for (int j = 0; j < ops.size(); j++) {
                     pool->Wait(j);
-                    delete ops[j];
                 }
  // record.push_back(std::make_pair("mul 0", GetSpan(ttt, std::chrono::system_clock::now())));
                 // swiglu
@@ -1253,8 +1253,8 @@ namespace fastllm {
                     float *outputData = middles[l].data();
                     int curK = localKs[idx];
 
-                    ops[l - st] = new fastllm::MultiThreadMultiOps();
-                    ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadSwigluOp(outputData, mid, mid, outputData, 1, spatial, spatial));
+                    ops[l - st] = opScope.New<fastllm::MultiThreadMultiOps>(false);
+                    ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadSwigluOp>(outputData, mid, mid, outputData, 1, spatial, spatial));
                     Data *weightDown = weights[idx * 2 + 1];
                     int groupDown = weightDown->group, groupCntDown = weightDown->groupCnt;
                     if (weightDown->dataType != DataType::INT4_GROUP) {
@@ -1271,7 +1271,7 @@ namespace fastllm {
                     inputSums.resize(n * groupDown);
                     iscales.resize(n * groupDown);
                     izeros.resize(n * groupDown);
-                    ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new MultiThreadOnlineQuantizationOp(
+                    ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<MultiThreadOnlineQuantizationOp>(
                                     middles[l].data(), uinputDown.data(), inputConfigs.data(),
                                     n, mid, groupDown, groupCntDown,
                                     inputSums.data(), iscales.data(), izeros.data(), permuteType));
@@ -1279,7 +1279,6 @@ namespace fastllm {
                 }
                 for (int l = st; l <= end; l++) {
                     pool->Wait(l - st);
-                    delete ops[l - st];
                 }
  // record.push_back(std::make_pair("swiglu", GetSpan(ttt, std::chrono::system_clock::now())));
 // record.push_back(std::make_pair("quant", GetSpan(ttt, std::chrono::system_clock::now())));
@@ -1305,19 +1304,18 @@ namespace fastllm {
                         LaunchLinearInt8Int8(uinputDown.data(), (uint8_t*)weightDown->cpuData, results[l].data(), 1, mid, m,
                                                 weightDown->weightSum.data(), weightDown->zeros.data(), weightDown->scales.data(), nullptr, 
                                                 inputSums.data(), iscales.data(), izeros.data(),
-                                                ops, pool, threadSt, curThread);
+                                                opScope, ops, pool, threadSt, curThread);
                     } else {
                         MultiplyInt4GroupMultiThreadLaunch(uinputDown.data(), (uint8_t*)weightDown->cpuData, results[l].data(), 1, mid, m,
                                                 weightDown->weightSum.data(), weightDown->mins.data(), weightDown->scales.data(), nullptr, 
                                                 inputSums, iscales, izeros,
-                                                inputConfigs, threadSt, curThread, groupDown, groupCntDown, ops, pool);
+                                                inputConfigs, threadSt, curThread, groupDown, groupCntDown, opScope, ops, pool);
                     }
                     threadSt += curThread;               
                 }
 
                 for (int j = 0; j < ops.size(); j++) {
                     pool->Wait(j);
-                    delete ops[j];
                 }
                 st = end;
  // record.push_back(std::make_pair("mul 1", GetSpan(ttt, std::chrono::system_clock::now())));
@@ -1565,6 +1563,7 @@ namespace fastllm {
 
 // record.push_back(std::make_pair("prepare datas", GetSpan(ttt, std::chrono::system_clock::now())));
             for (int st = 0; st < v.size(); st++) {
+                MultiThreadOpScope opScope;
                 int k = localKs[st];
                 int end = st, selSum = 1; // 一共处理selSum * k个输出
 
@@ -1591,13 +1590,13 @@ namespace fastllm {
                     int curK = localKs[l];
                     int curThread = (curK / k) * base;
                     if (weight->dataType == DataType::FP8_E4M3) {                            
-                        LaunchLinearBFloat16FP8E4M3(bf16Input.data(), *weight, outputData, biasData, 1, m, curK, ops, pool, threadSt, curThread);
+                        LaunchLinearBFloat16FP8E4M3(bf16Input.data(), *weight, outputData, biasData, 1, m, curK, opScope, ops, pool, threadSt, curThread);
                     } else if (weight->dataType == DataType::BFLOAT16) {                            
-                        LaunchLinearBFloat16BFloat16(bf16Input.data(), *weight, outputData, biasData, 1, m, curK, ops, pool, threadSt, curThread);
+                        LaunchLinearBFloat16BFloat16(bf16Input.data(), *weight, outputData, biasData, 1, m, curK, opScope, ops, pool, threadSt, curThread);
                     } else if (weight->dataType == DataType::FLOAT16) {
-                        LaunchLinearFloat32Float16(localInput, *weight, outputData, biasData, 1, m, curK, ops, pool, threadSt, curThread);
+                        LaunchLinearFloat32Float16(localInput, *weight, outputData, biasData, 1, m, curK, opScope, ops, pool, threadSt, curThread);
                     } else if (weight->dataType == DataType::DATA_GGUF_FORMAT) {
-                        LaunchLinearQ8KGGUF((uint8_t*)bf16Input.data(), weightData, outputData, biasData, weight, 1, m, curK, ops, pool, threadSt, curThread);
+                        LaunchLinearQ8KGGUF((uint8_t*)bf16Input.data(), weightData, outputData, biasData, weight, 1, m, curK, opScope, ops, pool, threadSt, curThread);
                     } else {
                         // TODO: other
                     }
@@ -1606,7 +1605,6 @@ namespace fastllm {
 
                 for (int j = 0; j < ops.size(); j++) {
                     pool->Wait(j);
-                    delete ops[j];
                 }
 // record.push_back(std::make_pair("mul 0", GetSpan(ttt, std::chrono::system_clock::now())));
                 // swiglu
@@ -1618,18 +1616,18 @@ namespace fastllm {
                     float *swigluData = swigluResults[l].data();
                     int curK = localKs[idx];
 
-                    ops[l - st] = new fastllm::MultiThreadMultiOps();
+                    ops[l - st] = opScope.New<fastllm::MultiThreadMultiOps>(false);
 
                     // 如果不是原始精度，那么需要量化一次
                     if (weightDown->dataType == DataType::FLOAT16) {
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadSwigluOp(outputData, mid, mid, outputData, 1, spatial, spatial));    
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadSwigluOp>(outputData, mid, mid, outputData, 1, spatial, spatial));    
                     } else {
-                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadSwigluOp(outputData, mid, mid, swigluData, 1, spatial, spatial));
+                        ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadSwigluOp>(outputData, mid, mid, swigluData, 1, spatial, spatial));
                         
                         if (weightDown->dataType == DataType::FP8_E4M3 || weightDown->dataType == DataType::BFLOAT16) {
-                            ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadFloat32ToBFloat16Op(swigluData, (uint16_t*)middles[l].data(), mid));
+                            ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadFloat32ToBFloat16Op>(swigluData, (uint16_t*)middles[l].data(), mid));
                         } else if (weightDown->dataType == DataType::DATA_GGUF_FORMAT) {
-                            ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(new fastllm::MultiThreadFloat32ToQ8KOp(swigluData, (uint8_t*)middles[l].data(), mid, weightDown->ggmlType));
+                            ((fastllm::MultiThreadMultiOps*)ops[l - st])->ops.push_back(opScope.New<fastllm::MultiThreadFloat32ToQ8KOp>(swigluData, (uint8_t*)middles[l].data(), mid, weightDown->ggmlType));
                         }
                     }
 
@@ -1637,7 +1635,6 @@ namespace fastllm {
                 }
                 for (int l = st; l <= end; l++) {
                     pool->Wait(l - st);
-                    delete ops[l - st];
                 }
 // record.push_back(std::make_pair("swiglu", GetSpan(ttt, std::chrono::system_clock::now())));
 // record.push_back(std::make_pair("quant", GetSpan(ttt, std::chrono::system_clock::now())));
@@ -1649,13 +1646,13 @@ namespace fastllm {
                     Data *weightDown = weights[idx * 2 + 1];
                     int curThread = (curK / k) * base;
                     if (weightDown->dataType == DataType::FP8_E4M3) {
-                        LaunchLinearBFloat16FP8E4M3((uint16_t*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, ops, pool, threadSt, curThread);
+                        LaunchLinearBFloat16FP8E4M3((uint16_t*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, opScope, ops, pool, threadSt, curThread);
                     } else if (weightDown->dataType == DataType::BFLOAT16) {
-                        LaunchLinearBFloat16BFloat16((uint16_t*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, ops, pool, threadSt, curThread);
+                        LaunchLinearBFloat16BFloat16((uint16_t*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, opScope, ops, pool, threadSt, curThread);
                     } else if (weightDown->dataType == DataType::FLOAT16) {
-                        LaunchLinearFloat32Float16((float*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, ops, pool, threadSt, curThread);
+                        LaunchLinearFloat32Float16((float*)middles[l].data(), *weightDown, results[l].data(), nullptr, 1, mid, m, opScope, ops, pool, threadSt, curThread);
                     } else if (weightDown->dataType == DataType::DATA_GGUF_FORMAT) {
-                        LaunchLinearQ8KGGUF((uint8_t*)middles[l].data(), (uint8_t*)weightDown->cpuData, results[l].data(), nullptr, weightDown, 1, mid, m, ops, pool, threadSt, curThread);
+                        LaunchLinearQ8KGGUF((uint8_t*)middles[l].data(), (uint8_t*)weightDown->cpuData, results[l].data(), nullptr, weightDown, 1, mid, m, opScope, ops, pool, threadSt, curThread);
                     } else {
                         // TODO: other
                     }
@@ -1664,7 +1661,6 @@ namespace fastllm {
 
                 for (int j = 0; j < ops.size(); j++) {
                     pool->Wait(j);
-                    delete ops[j];
                 }
                 st = end;
 // record.push_back(std::make_pair("mul 1", GetSpan(ttt, std::chrono::system_clock::now())));
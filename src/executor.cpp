@@ -3,6 +3,8 @@
 //
 
 #include "utils.h"
+#include "trace.h"
+#include "calibration.h"
 
 #include "executor.h"
 
@@ -108,6 +110,50 @@ namespace fastllm {
         return {0};
     }
 
+    // trace中记录的op信息: 运行的device以及每个数据的 dtype[shape]
+    static std::string GetOpTraceArgs(const std::string &deviceType, const fastllm::DataDict &datas, const fastllm::IntDict &intParams) {
+        std::string ret = "\"device\":\"" + deviceType + "\"";
+        for (auto &it: datas) {
+            Data *data = it.second;
+            std::string batchInfo = "";
+            if (intParams.find(it.first + "___batch") != intParams.end()) {
+                int batch = intParams.find(it.first + "___batch")->second;
+                batchInfo = std::to_string(batch) + " x ";
+                data = batch > 0 ? ((Data**)it.second)[0] : nullptr;
+            }
+            if (data == nullptr || data->dims.size() == 0) {
+                continue;
+            }
+            ret += ",\"" + it.first + "\":\"" + batchInfo + GetDataTypeName(data->dataType) + "[";
+            for (int i = 0; i < data->dims.size(); i++) {
+                ret += (i == 0 ? "" : ",") + std::to_string(data->dims[i]);
+            }
+            ret += "]\"";
+        }
+        return ret;
+    }
+
+    // 预量化的激活值只有Linear的input会读取; 其他op可能原地改写传入的任何数据 (AddTo, MulTo, Silu(x, x) ...)
+    // 而不经过Allocate, 所以运行前统一使这些数据上的量化结果失效
+    static void InvalidateQuantizedActivations(const std::string &opType, const fastllm::DataDict &datas, const fastllm::IntDict &intParams) {
+        for (auto &it: datas) {
+            if (opType == "Linear" && it.first == "input") {
+                continue;
+            }
+            int batch = 1;
+            Data **data = (Data**)&it.second;
+            if (intParams.find(it.first + "___batch") != intParams.end()) {
+                batch = intParams.find(it.first + "___batch")->second;
+                data = (Data**)it.second;
+            }
+            for (int i = 0; i < batch; i++) {
+                if (data[i] != nullptr && data[i]->quantizedActivation != nullptr) {
+                    data[i]->quantizedActivation->source = nullptr;
+                }
+            }
+        }
+    }
+
     bool Executor::CanRunOnFirstDevice(const std::string &opType, const fastllm::DataDict &datas, const fastllm::FloatDict &floatParams,
                        const fastllm::IntDict &intParams) {     
         return this->devices[0]->CanRun(opType, datas, floatParams, intParams);
@@ -116,6 +162,8 @@ namespace fastllm {
     void Executor::Run(const std::string &opType, const fastllm::DataDict &datas, const fastllm::FloatDict &floatParams,
                        const fastllm::IntDict &intParams) {
         auto st = std::chrono::system_clock::now();
+        bool traceActive = TraceEnabled();
+        long long traceSt = traceActive ? TraceNowUs() : 0;
         bool lockInCPU = false;
         if (GetKVCacheInCPU() || GetHistoryCacheInCPU()) {
             // 暂时只有kvcache可能lock在CPU上
@@ -131,6 +179,10 @@ namespace fastllm {
             }
         }
 
+        if (opType == "Linear" && CalibrationEnabled()) {
+            CollectLinearCalibration(*datas.find("input")->second, *datas.find("weight")->second);
+        }
+
         bool run = false;
         for (auto device: devices) {
             if (lockInCPU && device->deviceType != "cpu") {
@@ -175,8 +227,13 @@ namespace fastllm {
                         }
                     }
                 }
+                InvalidateQuantizedActivations(opType, datas, intParams);
                 device->Reshape(opType, datas, floatParams, intParams);
                 device->Run(opType, datas, floatParams, intParams);
+                if (traceActive) {
+                    TraceAddSpan("op", nullptr, opType, traceSt, TraceNowUs() - traceSt,
+                                 GetOpTraceArgs(device->deviceType, datas, intParams));
+                }
                 run = true;
                 break;
             }
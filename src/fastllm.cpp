@@ -8,6 +8,8 @@
 
 #include "executor.h"
 
+#include "calibration.h"
+
 #include <cstring>
 #include <cmath>
 #include <cfloat>
@@ -464,11 +466,14 @@ namespace fastllm {
         this->name = ori.name;
         this->isKVCache = ori.isKVCache;
         this->isLinearAttention = ori.isLinearAttention;
+        this->slidingWindow = ori.slidingWindow;
         this->cacheUid = ori.cacheUid;
         this->dataDevice = ori.dataDevice;
         
         // std::cout<<"调用拷贝构造"<<std::endl;
-        if (ori.expansionDims != this->expansionDims || ori.dims != this->dims || this->cpuData == nullptr || ori.dataType != this->dataType) {
+        if (ori.expansionDims != this->expansionDims || ori.dims != this->dims || this->cpuData == nullptr || ori.dataType != this->dataType
+            || ori.ggmlType != this->ggmlType) {
+            this->ggmlType = ori.ggmlType; // gguf格式的字节数由ggmlType决定, 需要在Resize之前设置
             if (ori.dims.size() == 0) {
                 this->dataType = ori.dataType;
                 this->UpdateUnitSize();
@@ -506,6 +511,19 @@ namespace fastllm {
             FastllmCudaCopyFromDeviceToDevice(this->cudaData, ori.cudaData, this->GetBytes());
 #endif
         }
+
+        // 量化参数也要复制, 例如共享词表的lm_head从量化的embedding拷贝而来
+        this->IsRepacked = ori.IsRepacked;
+        this->perChannelAxis = ori.perChannelAxis;
+        this->group = ori.group;
+        this->groupCnt = ori.groupCnt;
+        this->blockK = ori.blockK;
+        this->blockM = ori.blockM;
+        this->perChannelsConfigs = ori.perChannelsConfigs;
+        this->zeros = ori.zeros;
+        this->scales = ori.scales;
+        this->mins = ori.mins;
+        this->halfScales = ori.halfScales;
     }
 
     struct BF16ToFP16Manager {
@@ -1019,7 +1037,8 @@ namespace fastllm {
             this->unitSize = 1;
             this->unitSizeDiv = 2;
         } else if (this->dataType == DataType::INT2
-                || this->dataType == DataType::INT2_GROUP) {
+                || this->dataType == DataType::INT2_GROUP
+                || this->dataType == DataType::BASE3_GROUP) {
             this->unitSize = 1;
             this->unitSizeDiv = 4;
         } else if (this->dataType == DataType::BIT) {
@@ -1166,6 +1185,9 @@ namespace fastllm {
     }
 
     void Data::Allocate() {
+        if (quantizedActivation != nullptr) {
+            quantizedActivation->source = nullptr;
+        }
         if (!isFake && Count(0) > expansionSize) {
             FreeSpace();
             MallocSpace(Count(0));
@@ -1505,7 +1527,27 @@ namespace fastllm {
                     }
                 }
             }
-        } 
+        } else if (this->dataType == DataType::INT2_GROUP) {
+            weightSum.resize(n * this->group);
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < m; j++) {
+                    int id = (i * m + j) / 4;
+                    weightSum[i * this->group + j / this->groupCnt] += (cpuData[id] >> ((3 - (i * m + j) % 4) * 2)) & 3;
+                }
+            }
+        } else if (this->dataType == DataType::BASE3_GROUP) {
+            // 每组有效元素的三值权重 (-1, 0, 1) 之和
+            const int base[5] = {1, 3, 9, 27, 81};
+            int bytesPerGroup = (this->groupCnt - 1) / 5 + 1;
+            weightSum.resize(n * this->group);
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < m; j++) {
+                    int g = j / this->groupCnt, l = j % this->groupCnt;
+                    uint8_t v = cpuData[((size_t)i * this->group + g) * bytesPerGroup + l / 5];
+                    weightSum[i * this->group + g] += v / base[l % 5] % 3 - 1;
+                }
+            }
+        }
     }
 
     void Data::ToDevice(void *device) {
@@ -1935,6 +1977,107 @@ namespace fastllm {
         return -1;
     }
 
+    void LLMSamplingProbs(const float *logits, int vocabSize, const GenerationConfig &config,
+                          const LastTokensUnit &tokens, std::vector <std::pair <int, float> > &probs) {
+        std::vector <float> base = std::vector <float> (logits, logits + vocabSize);
+        if (fabs(config.repeat_penalty - 1.0) > 1e-6) {
+            std::set <int> unique(tokens.tokenSet.begin(), tokens.tokenSet.end());
+            auto apply = [&](int id) {
+                if (id >= 0 && id < vocabSize) {
+                    base[id] = (base[id] < 0 ? base[id] * config.repeat_penalty : base[id] / config.repeat_penalty);
+                }
+            };
+            if (config.last_n <= 0) {
+                for (int id : unique) {
+                    apply(id);
+                }
+            } else {
+                for (int id : tokens.tokenSet) {
+                    apply(id);
+                }
+            }
+        }
+
+        probs.clear();
+        int topk = std::min(vocabSize, std::max(1, config.top_k));
+        if (topk == 1) {
+            probs.push_back(std::make_pair((int)(std::max_element(base.begin(), base.end()) - base.begin()), 1.0f));
+            return;
+        }
+        float invTemp = 1.0f / config.temperature;
+        std::vector <std::pair <float, int> > v;
+        for (int i = 0; i < vocabSize; i++) {
+            v.push_back(std::make_pair(-base[i] * invTemp, i));
+        }
+        std::partial_sort(v.begin(), v.begin() + topk, v.end());
+        float psum = 0.0, maxValue = -v.begin()->first;
+        std::vector <float> ps;
+        for (int i = 0; i < topk; i++) {
+            ps.push_back(expf(-v[i].first - maxValue));
+            psum += ps.back();
+        }
+        // 和LLMSampling一致: 按top_p截断后重新归一化
+        float curSum = 0.0;
+        for (int i = 0; i < topk; i++) {
+            ps[i] /= psum;
+            curSum += ps[i];
+            if (curSum > config.top_p) {
+                topk = i + 1;
+                break;
+            }
+        }
+        for (int i = 0; i < topk; i++) {
+            probs.push_back(std::make_pair(v[i].second, ps[i] / curSum));
+        }
+    }
+
+    int SamplingFromProbs(const std::vector <std::pair <int, float> > &probs) {
+        float sum = 0.0;
+        for (auto &it : probs) {
+            sum += it.second;
+        }
+        float rnd = fastllmRandom.randP() * sum, curSum = 0.0;
+        for (int i = 0; i < probs.size(); i++) {
+            curSum += probs[i].second;
+            if (curSum > rnd || i + 1 == probs.size()) {
+                return probs[i].first;
+            }
+        }
+        return -1;
+    }
+
+    int SpeculativeAccept(int token, const std::vector <std::pair <int, float> > &target,
+                          const std::vector <std::pair <int, float> > &draft) {
+        std::map <int, float> q;
+        for (auto &it : draft) {
+            q[it.first] += it.second;
+        }
+        float p = 0.0f;
+        for (auto &it : target) {
+            if (it.first == token) {
+                p += it.second;
+            }
+        }
+        float qt = q[token];
+        if (p >= qt || (qt > 0 && fastllmRandom.randP() * qt < p)) {
+            return -1;
+        }
+
+        // 拒绝: 在残差分布 max(0, p - q) 上重新采样, 这样输出分布和只用目标模型采样完全一致
+        std::vector <std::pair <int, float> > residual;
+        for (auto &it : target) {
+            auto iq = q.find(it.first);
+            float r = it.second - (iq == q.end() ? 0.0f : iq->second);
+            if (r > 0) {
+                residual.push_back(std::make_pair(it.first, r));
+            }
+        }
+        if (residual.size() == 0) {
+            return SamplingFromProbs(target);
+        }
+        return SamplingFromProbs(residual);
+    }
+
     void WeightMap::LoadFromFile(const std::string &fileName) {
 #ifdef USE_MMAP
         std::shared_ptr<FileMmap> mapped_file = std::make_shared<FileMmap>(fileName);
@@ -2015,26 +2158,24 @@ namespace fastllm {
             weight[name] = Data(dataType, dims);
             weight[name].name = name;
 
-            if (lowMemMode && this->embeddingNames.find(name) != this->embeddingNames.end()) {
-                if (dataType == DataType::FLOAT32 || dataType == DataType::BFLOAT16 || dataType == DataType::FLOAT16) {
-                    weight[name].fileName = fileName;
+            // 低内存模式下浮点的embedding按需从文件读取, 量化的embedding本身较小, 直接加载
+            if (lowMemMode && this->embeddingNames.find(name) != this->embeddingNames.end() &&
+                (dataType == DataType::FLOAT32 || dataType == DataType::BFLOAT16 || dataType == DataType::FLOAT16)) {
+                weight[name].fileName = fileName;
 #if defined(_WIN32) or defined(_WIN64)
-                    weight[name].filePos = _ftelli64(buffer.f);
+                weight[name].filePos = _ftelli64(buffer.f);
 #else
 #ifdef USE_MMAP
-                    weight[name].filePos =  buffer.tell();
+                weight[name].filePos =  buffer.tell();
 #else
-                    weight[name].filePos = ftell(buffer.f);
+                weight[name].filePos = ftell(buffer.f);
 #endif
 #endif
 #ifdef USE_MMAP
-                    buffer.seek(weight[name].GetBytes(), SEEK_CUR);
+                buffer.seek(weight[name].GetBytes(), SEEK_CUR);
 #else
-                    fseek(buffer.f, weight[name].GetBytes(), SEEK_CUR);
+                fseek(buffer.f, weight[name].GetBytes(), SEEK_CUR);
 #endif
-                } else {
-                    ErrorInFastLLM("Error: embedding's type should be float32 or bfloat16.\n");
-                }
             } else {
 #ifdef USE_MMAP
                 weight[name].SetMapFile(mapped_file);
@@ -2086,9 +2227,9 @@ namespace fastllm {
 #else
                     buffer.ReadBytes(weight[name].cpuData, weight[name].GetBytes());
 #endif
-                } else if (dataType == DataType::INT4_GROUP) {
+                } else if (dataType == DataType::INT4_GROUP || dataType == DataType::INT2_GROUP) {
                     auto &curWeight = weight[name];
-                    int bit = 4;
+                    int bit = (dataType == DataType::INT4_GROUP ? 4 : 2);
                     curWeight.perChannelAxis = buffer.ReadInt();
                     curWeight.group = buffer.ReadInt();
                     curWeight.groupCnt = buffer.ReadInt();
@@ -2122,8 +2263,19 @@ namespace fastllm {
     }
 
     void WeightMap::SaveLowBitModel(const std::string &fileName, int bit) {
+        SaveQuantizedModel(fileName, bit, -1);
+    }
+
+    void WeightMap::SaveGroupLowBitModel(const std::string &fileName, int bit, int groupCnt) {
+        AssertInFastLLM(bit == 2 || bit == 4, "Error: group quantization only support 4 bit or 2 bit model.\n");
+        AssertInFastLLM(groupCnt > 0, "Error: groupCnt should be positive.\n");
+        SaveQuantizedModel(fileName, bit, groupCnt);
+    }
+
+    void WeightMap::SaveQuantizedModel(const std::string &fileName, int bit, int groupCnt) {
         AssertInFastLLM(fileName != "", "Error: output's name shouldn't be empty.\n");
-        AssertInFastLLM(bit == 0 || bit == 4 || bit == 8 || bit == 16, "Error: only support 16 bit or 8 bit or 4 bit model.\n");
+        AssertInFastLLM(bit == 0 || bit == 4 || bit == 8 || bit == 16 || (bit == 2 && groupCnt > 0),
+                        "Error: only support 16 bit or 8 bit or 4 bit model.\n");
         FileWriter buffer(fileName);
         buffer.WriteInt(this->versionId);
         if (this->versionId >= 1) {
@@ -2160,7 +2312,7 @@ namespace fastllm {
         }
 
         // 写入权重
-        int need = 0;
+        int need = 0, calibrated = 0;
         for (auto &it : weight) {
             need += (it.second.dims.size() > 0);
         }
@@ -2192,7 +2344,7 @@ namespace fastllm {
                         buffer.WriteFloat(data.perChannelsConfigs[i].max);
                     }
                     buffer.WriteBytes(data.cpuData, data.GetBytes());
-                } else if (dataType == DataType::INT4_GROUP) {
+                } else if (dataType == DataType::INT4_GROUP || dataType == DataType::INT2_GROUP) {
                     buffer.WriteInt((int) dataType);
                     buffer.WriteInt(data.perChannelAxis);
                     buffer.WriteInt(data.group);
@@ -2222,7 +2374,31 @@ namespace fastllm {
                     }
                     buffer.WriteBytes((uint8_t *) uDatas.data(), len * sizeof(uint16_t));
                 } else if (data.weightType == WeightType::LINEAR) {
-                    if (bit == 16) {
+                    if (groupCnt > 0) {
+                        // 分组量化, 有校准数据时使用激活感知的截断和GPTQ式的误差补偿
+                        AssertInFastLLM(data.dataType == DataType::FLOAT32, "Error: group quantization only support float32 weight.\n");
+                        int k = data.dims[0], m = data.dims[1];
+                        int curBit = (bit == 2 && m % 4 != 0) ? 4 : bit;
+                        int group = (m - 1) / groupCnt + 1, qmax = (1 << curBit) - 1;
+                        const LinearCalibrationStats *stats = GetLinearCalibrationStats(it.first);
+                        calibrated += (stats != nullptr);
+                        std::vector<LowBitConfig> configs;
+                        std::vector<uint8_t> uDatas;
+                        configs.resize(k * group);
+                        uDatas.resize(curBit == 4 ? ((size_t)k * m + 1) / 2 : (size_t)k * m / 4);
+                        QuantizeGroupWithCalibration((float *) data.cpuData, k, m, curBit, groupCnt, stats, uDatas.data(), configs.data());
+
+                        buffer.WriteInt(curBit == 4 ? (int) DataType::INT4_GROUP : (int) DataType::INT2_GROUP);
+                        buffer.WriteInt(0);
+                        buffer.WriteInt(group);
+                        buffer.WriteInt(groupCnt);
+                        // 读取时会用 (min, max) 重新计算量化参数, 这里写入取整后的范围保证读回的min / scale不变
+                        for (int i = 0; i < k * group; i++) {
+                            buffer.WriteFloat(configs[i].min);
+                            buffer.WriteFloat(configs[i].min + configs[i].scale * qmax);
+                        }
+                        buffer.WriteBytes(uDatas.data(), uDatas.size());
+                    } else if (bit == 16) {
                         // fp16, 直接转换
                         buffer.WriteInt((int) DataType::FLOAT16);
                         int len = data.Count(0);
@@ -2281,6 +2457,9 @@ namespace fastllm {
             fflush(stdout);
         }
         printf("\n");
+        if (groupCnt > 0) {
+            printf("%d linear weights quantized with calibration data.\n", calibrated);
+        }
         return;
     }
 
@@ -2332,6 +2511,7 @@ namespace fastllm {
 
     void WeightMap::AddQLinearWeight(const std::string &key, const std::vector <int> &dims,
                           int bit, float *scales, uint8_t *oriData) {
+        changeVersion++;
         AssertInFastLLM(bit == 4 || bit == 8, "Error: only support 8 bit or 4 bit QLinear.\n");
         DataType dataType = (bit == 4 ? DataType::INT4_NOZERO : DataType::INT8);
         std::vector <int> realDims = dims;
@@ -2384,17 +2564,20 @@ namespace fastllm {
     }
 
     void WeightMap::AddEmptyWeight(const std::string &key, const std::vector<int> &dims, fastllm::DataType dataType) {
+        changeVersion++;
         this->weight[key] = Data(dataType, dims);
         this->weight[key].name = std::string(key);
     }
 
     void WeightMap::AddEmptyGGMLWeight(const std::string &key, const std::vector<int> &dims, fastllm::DataType dataType, int ggmlType) {
+        changeVersion++;
         this->weight[key] = Data(dataType, ggmlType, dims);
         this->weight[key].name = std::string(key);
     }
 
     void WeightMap::AddWeight(const std::string &key, const std::vector<int> &dims, fastllm::DataType dataType,
                               fastllm::WeightType weightType, fastllm::DataType oriDataType, uint8_t *oriData, int groupCnt) {
+        changeVersion++;
         if (weightType == WeightType::AUTO) {
             weightType = GetWeightType(key);
             if (weightType == WeightType::EMBEDDING) {
@@ -2529,6 +2712,7 @@ namespace fastllm {
     }
 
     void WeightMap::ReleaseWeight() {
+        changeVersion++;
         for (auto &w : this->weight) {
             w.second.FreeSpace();
         }
@@ -2538,7 +2722,11 @@ namespace fastllm {
     }
 
     Data &WeightMap::operator[](const std::string &key) {
-        return weight[key];
+        auto it = weight.try_emplace(key);
+        if (it.second) {
+            changeVersion++;
+        }
+        return it.first->second;
     }
 
     void ToDataType(const Data &input, DataType dataType) {
@@ -2620,6 +2808,22 @@ namespace fastllm {
         }, {{"scale", scale}}, {{"group", group}, {"maskType", maskType}});
     }
 
+    bool CanRunAttentionVarlen() {
+        return curExecutor->CanRunOnFirstDevice("AttentionVarlen", {}, {}, {});
+    }
+
+    void AttentionVarlen(const Data &q, const Data &k, const Data &v, const std::vector <int> &seqLens, Data &output, float scale) {
+        std::vector <float> offsets = {0.0f};
+        for (int len : seqLens) {
+            offsets.push_back(offsets.back() + len);
+        }
+        Data cuSeqLens = Data(DataType::FLOAT32, {(int)offsets.size()}, offsets);
+        curExecutor->Run("AttentionVarlen", {
+                {"q", (Data*)&q}, {"k", (Data*)&k}, {"v", (Data*)&v},
+                {"cuSeqLens", &cuSeqLens}, {"output", &output}
+        }, {{"scale", scale}}, {});
+    }
+
     void Conv1DPerChannel(const Data &input, Data &weight, Data &bias, int inputChannels, int outputChannels, 
             int kernel, int stride, int pad, Data &output) {
         curExecutor->Run("Conv1DPerChannel", {
@@ -2647,6 +2851,18 @@ namespace fastllm {
         }, {{"eps", eps}}, {});
     }
 
+    bool CanRunAddRMSNormQuant(const Data &hidden, const Data &linearWeight) {
+        return curExecutor->CanRunOnFirstDevice("AddRMSNormQuant", {{"input", (Data*)&hidden}}, {}, 
+                {{"linearDataType", (int)linearWeight.dataType}});
+    }
+
+    void AddRMSNormQuant(Data &hidden, const Data &add, const Data &weight, float eps, const Data &linearWeight, Data &output) {
+        curExecutor->Run("AddRMSNormQuant", {
+                {"input", &hidden}, {"add", (Data*)&add}, {"weight", (Data*)&weight}, {"output", &output}
+        }, {{"eps", eps}}, {{"linearDataType", (int)linearWeight.dataType}, 
+                {"linearGroup", linearWeight.group}, {"linearGroupCnt", linearWeight.groupCnt}});
+    }
+
     void LayerNorm(Data &input, Data &gamma, Data &beta, int axis, Data &output) {
         curExecutor->Run("LayerNorm", {
             {"input", &input}, {"gamma", &gamma}, {"beta", &beta}, {"output", &output}
@@ -2850,6 +3066,18 @@ namespace fastllm {
         }, {}, {});                 
     }
 
+    bool CanRunChunkGatedDeltaRule() {
+        return curExecutor->CanRunOnFirstDevice("ChunkGatedDeltaRule", {}, {}, {});
+    }
+
+    void ChunkGatedDeltaRule(Data &q, Data &k, Data &v, Data &g, Data &b, 
+                            Data &last_recurrent_state, Data &core_attn_out, int chunkSize) {
+        curExecutor->Run("ChunkGatedDeltaRule", {
+            {"q", &q}, {"k", &k}, {"v", &v}, {"g", &g}, {"b", &b}, 
+            {"last_recurrent_state", &last_recurrent_state}, {"core_attn_out", &core_attn_out}
+        }, {}, {{"chunkSize", chunkSize}});
+    }
+
     void AddTo(Data &input0, const Data &input1, float alpha) {
         curExecutor->Run("AddTo", {
                 {"input0", &input0}, {"input1", (Data*)&input1}
@@ -3019,6 +3247,21 @@ namespace fastllm {
         });
     }
 
+    void SegmentLora(const Data &input, std::vector <Data*> &loraAs, std::vector <Data*> &loraBs,
+                     const std::vector <int> &segLens, Data &output) {
+        AssertInFastLLM(loraAs.size() == segLens.size() && loraBs.size() == segLens.size(),
+                        "SegmentLora: loraAs, loraBs and segLens' size mismatch.\n");
+        std::vector <float> offsets = {0.0f};
+        for (int len : segLens) {
+            offsets.push_back(offsets.back() + len);
+        }
+        Data cuSeqLens = Data(DataType::FLOAT32, {(int)offsets.size()}, offsets);
+        curExecutor->Run("SegmentLora", {
+                {"input", (Data*)&input}, {"output", &output}, {"cuSeqLens", &cuSeqLens},
+                {"loraAs", (Data*)loraAs.data()}, {"loraBs", (Data*)loraBs.data()}
+        }, {}, {{"loraAs___batch", (int)loraAs.size()}, {"loraBs___batch", (int)loraBs.size()}});
+    }
+
     void LoraLayer(Data &input, Data &weight, Data &loraA, Data &loraB, const Data &bias, Data &output, 
                    std::map <std::string, std::string> loraConfig) {
         float r = std::atof(loraConfig["r"].c_str());
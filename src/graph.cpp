@@ -74,6 +74,7 @@ namespace fastllm {
                         offset += curWeight.GetBytes();
                         weight.weight.erase(ops[l].datas["weight"]);
                     }
+                    weight.MarkChanged();
                     ComputeGraphNode input(op.datas["input"]), weight(mergeWeightName), bias(mergeBiasName), mid(outputName);
                     graph.Linear(input, weight, bias, mid);
 
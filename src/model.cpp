@@ -791,6 +791,34 @@ namespace fastllm {
     }
 
     // 从hf文件夹读取分词
+    void AddLoraAdapterFromHF(basellm *model, const std::string &name, const std::string &loraPath) {
+        std::string path = loraPath;
+        if (path.back() != '/' && path.back() != '\\') {
+            path += "/";
+        }
+        std::string loraConfigError;
+        auto loraConfig = json11::Json::parse(ReadAllFile(path + "adapter_config.json"), loraConfigError);
+        float loraScaling = loraConfig["lora_alpha"].number_value() / loraConfig["r"].number_value();
+
+        SafeTensors loraTensors({path + "adapter_model.safetensors"});
+        std::map <std::string, std::pair <Data, Data> > loras;
+        for (auto &it : loraTensors.GetSortedItemNames()) {
+            if (it.size() >= 31 &&
+                it.substr(0, 17) == "base_model.model." &&
+                (it.substr(it.size() - 14) == ".lora_A.weight" || it.substr(it.size() - 14) == ".lora_B.weight")) {
+                std::string originalName = it.substr(17, it.size() - 31) + ".weight";
+                auto &item = loraTensors.itmeDict[it];
+                AssertInFastLLM(item.dtype == "F32" || item.dtype == "F16" || item.dtype == "BF16",
+                                "Lora error: lora's dtype should be F32 or F16 or BF16.");
+                item.CreateBuffer(DataType::FLOAT32);
+                Data &data = (it.substr(it.size() - 14) == ".lora_A.weight") ? loras[originalName].first : loras[originalName].second;
+                data.CopyFrom(Data(DataType::FLOAT32, item.intShape, std::vector <float> ((float*)item.buffer, (float*)item.buffer + item.len)));
+                item.ClearBuffer();
+            }
+        }
+        model->AddLoraAdapter(name, loras, loraScaling);
+    }
+
     std::unique_ptr<basellm> CreateLLMTokenizerFromHF(const std::string &modelPath) {
         std::string error;
         std::string path = modelPath;
@@ -815,6 +843,27 @@ namespace fastllm {
         }
     }
 
+    void ParseDtypeRules(const std::string &dtypeConfigString, std::vector <std::pair <std::string, std::string> > &dtypeRules,
+                         std::vector <std::pair <std::string, std::string> > &embeddingDtypeRules) {
+        if (dtypeConfigString.size() == 0) {
+            return;
+        }
+        std::string error;
+        auto dtypeConfig = json11::Json::parse(dtypeConfigString, error);
+        if (error != "") {
+            printf("Parse dtype config faild.\n");
+            printf("config = %s\n", dtypeConfigString.c_str());
+            printf("error = %s\n", error.c_str());
+            return;
+        }
+        for (auto &it : dtypeConfig.array_items()) {
+            dtypeRules.push_back(std::make_pair(it["key"].string_value(), it["dtype"].string_value()));
+            if (it["embedding"].bool_value()) {
+                embeddingDtypeRules.push_back(dtypeRules.back());
+            }
+        }
+    }
+
     void ParseDataType(std::string weightName, std::vector <std::pair <std::string, std::string> > &dtypeRules, 
                         DataType &dataType, int &groupCnt, int &ggmlType) {
         std::string matchedType = "";
@@ -867,6 +916,25 @@ namespace fastllm {
         }        
     }
 
+    // embedding只使用写了 "embedding": true 的规则, 且只接受Embedding算子能直接按行读取的类型, 其余情况保持原类型
+    static void ParseEmbeddingDataType(std::string weightName, std::vector <std::pair <std::string, std::string> > &embeddingDtypeRules, 
+                                       DataType &dataType, int &groupCnt, int &ggmlType) {
+        static std::set <DataType> supportTypes = {
+            DataType::FLOAT32, DataType::FLOAT16, DataType::BFLOAT16, 
+            DataType::INT8, DataType::INT4_GROUP, DataType::DATA_GGUF_FORMAT
+        };
+        DataType oriType = dataType;
+        ParseDataType(weightName, embeddingDtypeRules, dataType, groupCnt, ggmlType);
+        if (supportTypes.find(dataType) == supportTypes.end()) {
+            if (dataType != oriType) {
+                printf("Warning: embedding \"%s\" can't use dtype %s, keep the original dtype.\n", 
+                       weightName.c_str(), dataTypeNames[dataType][0].c_str());
+            }
+            dataType = oriType;
+            ggmlType = -1;
+        }
+    }
+
     std::vector<std::string> GenerateGGUFFileList(const std::string& filename) {
         std::vector<std::string> fileList;
         
@@ -1198,6 +1266,16 @@ if (false) {
                                     for (auto input : it.inputs) {
                                         dim0Len += model->weight[input].dims[0];
                                     }
+                                    if (model->weight[it.inputs[0]].dims.size() == 2) {
+                                        // 记录合并前各部分的行数, 加载LoRA adapter时用来定位
+                                        std::vector <std::pair <std::string, int> > mergeParts;
+                                        for (auto input : it.inputs) {
+                                            mergeParts.push_back(std::make_pair(input, model->weight[input].dims[0]));
+                                        }
+                                        locker.lock();
+                                        model->mergedWeightParts[it.output] = mergeParts;
+                                        locker.unlock();
+                                    }
                                     if (model->weight[it.inputs[0]].dims.size() == 1) {
                                         std::string input0 = it.inputs[0];
                                         std::string mergeName = it.output;
@@ -1278,6 +1356,7 @@ if (false) {
                                     for (auto input : it.inputs) {
                                         model->weight.weight.erase(input);
                                     }
+                                    model->weight.MarkChanged();
                                 }
                                 locker.lock();
                             }
@@ -1355,6 +1434,15 @@ if (false) {
         if (moeGroupCnt == -1) {
             moeGroupCnt = groupCnt;
         }
+        // trace中记录加载的各个阶段
+        long long traceStageSt = TraceNowUs();
+        auto traceStage = [&](const char *stage) {
+            if (TraceEnabled()) {
+                long long now = TraceNowUs();
+                TraceAddSpan("loader", stage, "", traceStageSt, now - traceStageSt, "");
+                traceStageSt = now;
+            }
+        };
         std::map <std::string, std::pair <std::string, std::string> > loraDicts;
         SafeTensors *loraTensors = nullptr;
         float loraScaling;
@@ -1400,6 +1488,7 @@ if (false) {
             }
         }
         SafeTensors safeTensors(stFiles);
+        traceStage("open_safetensors");
 
         // 2. 创建网络基本信息
         std::string configFile = path + "config.json";
@@ -1490,6 +1579,7 @@ if (false) {
 
         // 4.0 更新模型信息
         model->InitParams();
+        traceStage("config_and_tokenizer");
 
         // 4.1 读取权重
         auto tensors = safeTensors.GetSortedItemNames();
@@ -1528,19 +1618,8 @@ if (false) {
             }
         }
 
-        std::vector <std::pair <std::string, std::string> > dtypeRules;
-        if (dtypeConfigString.size() > 0) {
-            auto dtypeConfig = json11::Json::parse(dtypeConfigString, error);
-            if (error != "") {
-                printf("Parse dtype config faild.\n");
-                printf("config = %s\n", dtypeConfigString.c_str());
-                printf("error = %s\n", error.c_str());
-            } else {
-                for (auto &it : dtypeConfig.array_items()) {
-                    dtypeRules.push_back(std::make_pair(it["key"].string_value(), it["dtype"].string_value()));
-                }
-            }
-        }
+        std::vector <std::pair <std::string, std::string> > dtypeRules, embeddingDtypeRules;
+        ParseDtypeRules(dtypeConfigString, dtypeRules, embeddingDtypeRules);
 
         int cur = 0;
         long long totalBytes = 0;
@@ -1563,6 +1642,9 @@ if (false) {
                     if (tensor.dtype != "F8_E4M3" && dataType == DataType::FP8_E4M3) {
                         dataType = DataType::FLOAT16;
                     }
+                } else if (dataType == DATA_AUTO_EMBEDDING && embeddingDtypeRules.size() > 0) {
+                    int groupCnt = -1;
+                    ParseEmbeddingDataType(weightName, embeddingDtypeRules, dataType, groupCnt, ggmlType);
                 }
 
                 if (dataType >= DATA_AUTO_NONE) {
@@ -1594,6 +1676,8 @@ if (false) {
             fflush(stdout);
         }
 
+        traceStage("alloc_weights");
+
         // 4.2 读取
         std::vector <std::thread*> threads;
         int threadNum = std::min(16, std::max(4, (int)GetAlivePool()->threads.size()));
@@ -1626,6 +1710,7 @@ if (false) {
                 new std::thread([&](int st, int end) {
                     for (int i = st; i < end; i++) {
                         auto &tensorName = tensors[i];
+                        TraceScope traceTensor("loader", tensorName);
                         if (StringEndWith(tensorName, "_scale_inv") ||
                             (isAwqModel && (StringEndWith(tensorName, ".scales") || StringEndWith(tensorName, ".qzeros")))) {
                             locker.lock();
@@ -1655,6 +1740,8 @@ if (false) {
                                 }
                                 printf("\n");
 */
+                            } else if (dataType == DATA_AUTO_EMBEDDING && embeddingDtypeRules.size() > 0) {
+                                ParseEmbeddingDataType(weightName, embeddingDtypeRules, dataType, curGroupCnt, ggmlType);
                             }
                             if (dataType >= DATA_AUTO_NONE) {
                                 // AUTO类型
@@ -1853,6 +1940,16 @@ if (false) {
                                     for (auto input : it.inputs) {
                                         dim0Len += model->weight[input].dims[0];
                                     }
+                                    if (model->weight[it.inputs[0]].dims.size() == 2) {
+                                        // 记录合并前各部分的行数, 加载LoRA adapter时用来定位
+                                        std::vector <std::pair <std::string, int> > mergeParts;
+                                        for (auto input : it.inputs) {
+                                            mergeParts.push_back(std::make_pair(input, model->weight[input].dims[0]));
+                                        }
+                                        locker.lock();
+                                        model->mergedWeightParts[it.output] = mergeParts;
+                                        locker.unlock();
+                                    }
                                     if (model->weight[it.inputs[0]].dims.size() == 1) {
                                         std::string input0 = it.inputs[0];
                                         std::string mergeName = it.output;
@@ -1933,6 +2030,7 @@ if (false) {
                                     for (auto input : it.inputs) {
                                         model->weight.weight.erase(input);
                                     }
+                                    model->weight.MarkChanged();
                                 }
                                 locker.lock();
                             }
@@ -1980,11 +2078,14 @@ if (false) {
 
         printf("\n");
         fflush(stdout);
+        traceStage("load_weights");
 
         delete loraTensors;
 
-        if (!weightOnly)
+        if (!weightOnly) {
             model->WarmUp();
+            traceStage("warmup");
+        }
         return std::unique_ptr<fastllm::basellm> (model);
     }
 
@@ -2107,19 +2208,8 @@ if (false) {
             }
         }
 
-        std::vector <std::pair <std::string, std::string> > dtypeRules;
-        if (dtypeConfigString.size() > 0) {
-            auto dtypeConfig = json11::Json::parse(dtypeConfigString, error);
-            if (error != "") {
-                printf("Parse dtype config faild.\n");
-                printf("config = %s\n", dtypeConfigString.c_str());
-                printf("error = %s\n", error.c_str());
-            } else {
-                for (auto &it : dtypeConfig.array_items()) {
-                    dtypeRules.push_back(std::make_pair(it["key"].string_value(), it["dtype"].string_value()));
-                }
-            }
-        }
+        std::vector <std::pair <std::string, std::string> > dtypeRules, embeddingDtypeRules;
+        ParseDtypeRules(dtypeConfigString, dtypeRules, embeddingDtypeRules);
 
         if (dtypeRules.size() > 0) {
             printf("Dtype rules:\n");
@@ -2156,6 +2246,9 @@ if (false) {
                     if (tensor.dtype != "F8_E4M3" && dataType == DataType::FP8_E4M3) {
                         dataType = DataType::FLOAT16;
                     }
+                } else if (dataType == DATA_AUTO_EMBEDDING && embeddingDtypeRules.size() > 0) {
+                    int groupCnt = -1;
+                    ParseEmbeddingDataType(weightName, embeddingDtypeRules, dataType, groupCnt, ggmlType);
                 }
 
                 if (dataType >= DATA_AUTO_NONE) {
@@ -2212,6 +2305,8 @@ if (false) {
                                     }
                                     printf("\n");
                                 }
+                            } else if (dataType == DATA_AUTO_EMBEDDING && embeddingDtypeRules.size() > 0) {
+                                ParseEmbeddingDataType(weightName, embeddingDtypeRules, dataType, curGroupCnt, ggmlType);
                             }
 
                             if (dataType >= DATA_AUTO_NONE) {
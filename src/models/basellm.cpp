@@ -4,8 +4,11 @@
 
 #include "basellm.h"
 #include "utils.h"
+#include "trace.h"
 #include <sstream>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 
 #ifdef USE_CUDA
 #include "fastllm-cuda.cuh"
@@ -55,14 +58,103 @@ namespace fastllm {
         }
         isEnding = false;
         preTokens = 0;
+        pendingTruncateLen = -1;
+        stateCheckpoints.clear();
+    }
+
+    // 线性attention的状态和滑动窗口的环形KV Cache都不能按前缀截取, 只能整体保存
+    static bool IsWholeStateCache(const Data &cache) {
+        return cache.isLinearAttention || cache.slidingWindow > 0;
+    }
+
+    // 隔一个删一个, 直到快照数不超过maxCheckpoints (保留最靠前的快照, 相当于把间隔翻倍)
+    static void ThinStateCheckpoints(std::map <int, std::vector <std::pair <Data, Data> > > &checkpoints, int maxCheckpoints) {
+        while ((int)checkpoints.size() > std::max(maxCheckpoints, 0)) {
+            int id = 0;
+            for (auto it = checkpoints.begin(); it != checkpoints.end(); id++) {
+                if (id % 2 == 1 || maxCheckpoints <= 0) {
+                    it = checkpoints.erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
     }
 
     void ResponseContext::TryRecord(basellm *model) {
-        if (model->saveHistoryChat) {
-            model->pastKVCacheManager.Record(this->allTokens, this->allTokens.size(), &this->pastKeyValues);
+        // 使用LoRA adapter的请求, KV Cache和基座模型的不同, 不记录到前缀缓存中
+        if (model->saveHistoryChat && this->generationConfig.adapter_name.empty()) {
+            // 最后一个生成的token可能还没有forward, 以KV Cache中实际的长度为准
+            int tokens = this->allTokens.size();
+            Data &cache = this->pastKeyValues[model->kvCacheId].first;
+            if (cache.dims.size() == 0) {
+                return;
+            }
+            if (!IsWholeStateCache(cache)) {
+                tokens = std::min(tokens, cache.dims[1]);
+            }
+            model->pastKVCacheManager.Record(std::vector <int> (this->allTokens.begin(), this->allTokens.begin() + tokens),
+                                             tokens, &this->pastKeyValues, &this->stateCheckpoints);
         }
     }
 
+    void ResponseContext::SaveStateCheckpoint(int tokens, int maxCheckpoints) {
+        auto &states = this->stateCheckpoints[tokens];
+        states.clear();
+        for (int i = 0; i < this->pastKeyValues.size(); i++) {
+            states.push_back(std::make_pair(Data(this->pastKeyValues[i].first.dataType), Data(this->pastKeyValues[i].second.dataType)));
+            if (!IsWholeStateCache(this->pastKeyValues[i].first)) {
+                continue;
+            }
+            states[i].first.CopyFrom(this->pastKeyValues[i].first);
+            states[i].second.CopyFrom(this->pastKeyValues[i].second);
+            if (GetHistoryCacheInCPU()) {
+                states[i].first.ToDevice(DataDevice::CPU);
+                states[i].first.lockInCPU = true;
+                states[i].second.ToDevice(DataDevice::CPU);
+                states[i].second.lockInCPU = true;
+            }
+        }
+        ThinStateCheckpoints(this->stateCheckpoints, maxCheckpoints);
+    }
+
+    static uint64_t HashTokens(const std::vector <int> &tokens, int st, int len) {
+        uint64_t hash = 0;
+        for (int i = st; i < st + len; i++) {
+            hash = hash * 1000003 + (uint32_t)tokens[i] + 1;
+        }
+        return hash;
+    }
+
+    void PromptLookupIndex::Update(const std::vector <int> &tokens) {
+        if (lasts.size() != maxNgram + 1) {
+            lasts.clear();
+            lasts.resize(maxNgram + 1);
+            indexed = 0;
+        }
+        for (; indexed + 1 < (int)tokens.size(); indexed++) {
+            for (int n = 1; n <= maxNgram && n <= indexed + 1; n++) {
+                lasts[n][HashTokens(tokens, indexed - n + 1, n)] = indexed;
+            }
+        }
+    }
+
+    std::vector <int> PromptLookupIndex::Propose(const std::vector <int> &tokens, int k) {
+        int len = tokens.size();
+        for (int n = std::min(maxNgram, len - 1); n >= 1; n--) {
+            auto it = lasts[n].find(HashTokens(tokens, len - n, n));
+            if (it == lasts[n].end()) {
+                continue;
+            }
+            int pos = it->second;
+            if (!std::equal(tokens.begin() + pos - n + 1, tokens.begin() + pos + 1, tokens.begin() + len - n)) {
+                continue; // hash冲突
+            }
+            return std::vector <int> (tokens.begin() + pos + 1, tokens.begin() + std::min(len, pos + 1 + k));
+        }
+        return {};
+    }
+
     PastKVCacheMemory::PastKVCacheMemory(const std::vector <int> &inputToken, int tokens, long long flushTime, std::vector<std::pair<Data, Data> > *kv) {
         this->inputToken = inputToken;
         this->tokens = tokens;
@@ -90,18 +182,35 @@ namespace fastllm {
         this->maxRecordNum = maxRecordNum;
     }
 
-    void PastKVCacheManager::Record(const std::vector <int> &inputToken, int tokens, std::vector<std::pair<Data, Data> > *kv) {
+    void PastKVCacheManager::SetCheckpointInterval(int checkpointInterval) {
+        std::lock_guard <std::mutex> lock(this->locker);
+        this->checkpointInterval = std::max(checkpointInterval, 0);
+    }
+
+    void PastKVCacheManager::Record(const std::vector <int> &inputToken, int tokens, std::vector<std::pair<Data, Data> > *kv,
+                                    std::map <int, std::vector <std::pair <Data, Data> > > *checkpoints) {
+        // 线性attention的状态和滑动窗口的环形KV Cache都不能按前缀截取, 只能整体复用或者从快照恢复
         bool isLinear = false;
         for (int i = 0; i < kv->size(); i++) {
-            if ((*kv)[i].first.isLinearAttention) {
+            if (IsWholeStateCache((*kv)[i].first)) {
                 isLinear = true;
                 break;
             }
         }
         std::lock_guard <std::mutex> lock(this->locker);
         if (this->memorys.find(inputToken) != this->memorys.end()) {
-            this->memorys[inputToken]->recordTimes++;
-            this->memorys[inputToken]->flushTime = ++flushTime;
+            PastKVCacheMemory *memory = this->memorys[inputToken];
+            memory->recordTimes++;
+            memory->flushTime = ++flushTime;
+            if (checkpoints != nullptr) {
+                for (auto &it : *checkpoints) {
+                    if (it.first < memory->tokens && memory->checkpoints.find(it.first) == memory->checkpoints.end()) {
+                        std::swap(memory->checkpoints[it.first], it.second);
+                    }
+                }
+                checkpoints->clear();
+                ThinStateCheckpoints(memory->checkpoints, this->maxCheckpoints);
+            }
             return;
         }
 
@@ -139,7 +248,14 @@ namespace fastllm {
             this->memorys.erase(this->memorys.find(eraseToken));
         }
 
-        this->memorys[inputToken] = new PastKVCacheMemory(inputToken, tokens, ++flushTime, kv);
+        PastKVCacheMemory *memory = new PastKVCacheMemory(inputToken, tokens, ++flushTime, kv);
+        if (isLinear && checkpoints != nullptr) {
+            std::swap(memory->checkpoints, *checkpoints);
+            checkpoints->clear();
+            memory->checkpoints.erase(memory->checkpoints.lower_bound(tokens), memory->checkpoints.end());
+            ThinStateCheckpoints(memory->checkpoints, this->maxCheckpoints);
+        }
+        this->memorys[inputToken] = memory;
     }
 
     void PastKVCacheManager::Remove(const std::vector <int> &inputToken) {
@@ -153,17 +269,17 @@ namespace fastllm {
     }
 
     std::pair <PastKVCacheMemory*, int> PastKVCacheManager::Get(const std::vector <int> &inputToken) {
+        std::lock_guard <std::mutex> lock(this->locker);
         bool isLinear = false;
         if (this->memorys.size() > 0) {
             auto &kv = this->memorys.begin()->second->kv;
             for (int i = 0; i < kv.size(); i++) {
-                if (kv[i].first.isLinearAttention) {
+                if (IsWholeStateCache(kv[i].first)) {
                     isLinear = true;
                     break;
                 }
             }
         }
-        std::lock_guard <std::mutex> lock(this->locker);
         int maxPrefixToken = 0;
         PastKVCacheMemory *ret = nullptr;
         for (auto &it : this->memorys) {
@@ -176,8 +292,19 @@ namespace fastllm {
                     break;
                 }
             }
-            if (isLinear && match != cur.size()) {
-                continue;
+            if (isLinear) {
+                // 状态不能回退, 只能用完整匹配的记录或者不超过匹配长度的快照, 并且至少要留一个token做forward
+                int usable = 0;
+                if (match == cur.size() && match < inputToken.size()) {
+                    usable = match;
+                } else {
+                    for (auto &ck : it.second->checkpoints) {
+                        if (ck.first <= match && ck.first < inputToken.size()) {
+                            usable = std::max(usable, ck.first);
+                        }
+                    }
+                }
+                match = usable;
             }
             if (match > maxPrefixToken) {
                 maxPrefixToken = match;
@@ -195,6 +322,668 @@ namespace fastllm {
         locker.unlock();
     }
 
+    MetricsHistogram::MetricsHistogram (const std::vector <double> &bounds) {
+        this->bounds = bounds;
+        this->counts.resize(bounds.size() + 1, 0);
+    }
+
+    void MetricsHistogram::Observe(double value) {
+        for (int i = 0; i < bounds.size(); i++) {
+            if (value <= bounds[i]) {
+                counts[i]++;
+            }
+        }
+        counts.back()++;
+        sum += value;
+    }
+
+    void MetricsHistogram::Dump(std::string &out, const std::string &name, const std::string &labels) const {
+        std::string sep = (labels == "" ? "" : ",");
+        char buffer[64];
+        for (int i = 0; i <= bounds.size(); i++) {
+            if (i < bounds.size()) {
+                snprintf(buffer, sizeof(buffer), "%g", bounds[i]);
+            } else {
+                snprintf(buffer, sizeof(buffer), "+Inf");
+            }
+            out += name + "_bucket{" + labels + sep + "le=\"" + buffer + "\"} " + std::to_string(counts[i]) + "\n";
+        }
+        snprintf(buffer, sizeof(buffer), "%.6f", sum);
+        std::string suffix = (labels == "" ? "" : "{" + labels + "}");
+        out += name + "_sum" + suffix + " " + buffer + "\n";
+        out += name + "_count" + suffix + " " + std::to_string(counts.back()) + "\n";
+    }
+
+    void ServingMetrics::RecordStep(double seconds, int batch, int prefill, int decode) {
+        std::lock_guard <std::mutex> guard(locker);
+        if (prefill > 0) {
+            prefillSteps++;
+            prefillStepLatency.Observe(seconds);
+            stepPrefillTokens.Observe(prefill);
+        } else {
+            decodeSteps++;
+            decodeStepLatency.Observe(seconds);
+            stepDecodeTokens.Observe(decode);
+        }
+        stepBatchSize.Observe(batch);
+        prefillTokens += prefill;
+        decodeTokens += decode;
+        generatedTokens += batch;
+    }
+
+    std::string ServingMetrics::ToPrometheus() {
+        std::lock_guard <std::mutex> guard(locker);
+        std::string out;
+        auto head = [&](const std::string &name, const std::string &type, const std::string &help) {
+            out += "# HELP " + name + " " + help + "\n";
+            out += "# TYPE " + name + " " + type + "\n";
+        };
+        auto single = [&](const std::string &name, const std::string &type, const std::string &help, long long value) {
+            head(name, type, help);
+            out += name + " " + std::to_string(value) + "\n";
+        };
+        single("fastllm_requests_running", "gauge", "Requests in decode phase.", runningRequests);
+        single("fastllm_requests_waiting", "gauge", "Requests waiting for prefill.", waitingRequests);
+        single("fastllm_batch_limit", "gauge", "Max batch size of the scheduler.", batchLimit);
+        single("fastllm_kv_cache_used_bytes", "gauge", "KV cache bytes reserved by alive requests.", kvCacheBytesUsed);
+        single("fastllm_kv_cache_free_bytes", "gauge", "KV cache bytes still available.", std::max(0LL, kvCacheBytesLimit - kvCacheBytesUsed));
+        single("fastllm_requests_total", "counter", "Requests launched.", requests);
+        single("fastllm_requests_aborted_total", "counter", "Requests aborted by the client.", abortedRequests);
+        single("fastllm_requests_prompt_too_long_total", "counter", "Requests rejected because the prompt is too long.", promptTooLongRequests);
+        single("fastllm_prompt_tokens_total", "counter", "Prompt tokens processed by prefill.", prefillTokens);
+        single("fastllm_decode_tokens_total", "counter", "Tokens processed by decode steps.", decodeTokens);
+        single("fastllm_generation_tokens_total", "counter", "Tokens generated.", generatedTokens);
+        single("fastllm_prefix_cache_hit_tokens_total", "counter", "Prompt tokens reused from the prefix cache.", prefixCacheHitTokens);
+
+        single("fastllm_speculative_steps_total", "counter", "Speculative decoding steps.", speculativeSteps);
+        single("fastllm_speculative_draft_tokens_total", "counter", "Tokens proposed by the draft model or prompt lookup.", draftTokens);
+        single("fastllm_speculative_accepted_tokens_total", "counter", "Draft tokens accepted by the target model.", acceptedDraftTokens);
+
+        head("fastllm_steps_total", "counter", "Forward steps.");
+        out += "fastllm_steps_total{phase=\"prefill\"} " + std::to_string(prefillSteps) + "\n";
+        out += "fastllm_steps_total{phase=\"decode\"} " + std::to_string(decodeSteps) + "\n";
+        head("fastllm_step_latency_seconds", "histogram", "Latency of one forward step.");
+        prefillStepLatency.Dump(out, "fastllm_step_latency_seconds", "phase=\"prefill\"");
+        decodeStepLatency.Dump(out, "fastllm_step_latency_seconds", "phase=\"decode\"");
+        head("fastllm_step_batch_size", "histogram", "Requests in one forward step.");
+        stepBatchSize.Dump(out, "fastllm_step_batch_size", "");
+        head("fastllm_step_tokens", "histogram", "Tokens in one forward step.");
+        stepPrefillTokens.Dump(out, "fastllm_step_tokens", "phase=\"prefill\"");
+        stepDecodeTokens.Dump(out, "fastllm_step_tokens", "phase=\"decode\"");
+        return out;
+    }
+
+    std::string basellm::GetMetrics() {
+        return metrics.ToPrometheus();
+    }
+
+    // 把KV Cache截断到前len个token, 只修改dims, 已经申请的空间留给之后的CatDirect继续使用
+    static void TruncateKVCache(std::vector <std::pair <Data, Data> > &pastKeyValues, int len) {
+        for (auto &it : pastKeyValues) {
+            for (Data *cache : {&it.first, &it.second}) {
+                if (cache->dims.size() > 1 && cache->dims[1] > len) {
+                    std::vector <int> dims = cache->dims;
+                    dims[1] = len;
+                    cache->Resize(dims);
+                }
+            }
+        }
+    }
+
+    // token是否会结束生成
+    static bool IsEndToken(basellm *model, const GenerationConfig &config, int token) {
+        return token == model->eos_token_id || model->eos_token_ids.find(token) != model->eos_token_ids.end() ||
+               config.stop_token_ids.find(token) != config.stop_token_ids.end();
+    }
+
+    // 这一步最多可以投机多少个token (受output_token_limit和max_positions限制)
+    static int SpeculativeBudget(basellm *model, ResponseContext *context, int k) {
+        auto &config = context->generationConfig;
+        if (config.output_token_limit > 0) {
+            k = std::min(k, config.output_token_limit - context->curTokens - 1);
+        }
+        return std::min(k, model->max_positions - (int)context->allTokens.size() - 1);
+    }
+
+    // 用prompt lookup为decode中的请求提出草稿token, 遇到结束token时截断
+    static std::vector <int> ProposeLookupTokens(basellm *model, ResponseContext *context) {
+        int k = SpeculativeBudget(model, context, model->promptLookupTokens);
+        if (k <= 0) {
+            return {};
+        }
+        auto &index = context->lookupIndex;
+        if (index.maxNgram != model->promptLookupNgram) {
+            index.maxNgram = model->promptLookupNgram;
+            index.lasts.clear();
+        }
+        index.Update(context->allTokens);
+        std::vector <int> proposals = index.Propose(context->allTokens, k);
+        for (int i = 0; i < proposals.size(); i++) {
+            if (IsEndToken(model, context->generationConfig, proposals[i])) {
+                proposals.resize(i + 1);
+                break;
+            }
+        }
+        return proposals;
+    }
+
+    int basellm::GetLogitsTail(int b, int seqLen) {
+        int tail = b < this->outputLogitsTails.size() ? this->outputLogitsTails[b] : 1;
+        return std::max(1, std::min(seqLen, tail));
+    }
+
+    std::vector <int> basellm::SampleTailLogits(int batch, const std::vector <int> &seqLens, Data &logits,
+                                               std::vector <std::pair <Data*, Data*> > &pastKeyValues,
+                                               const std::vector <GenerationConfig> &generationConfigs,
+                                               const LastTokensManager &lastTokens, std::vector <std::vector <float>*> *retLogits) {
+        ToDataType(logits, DataType::FLOAT32);
+        logits.ToDevice(DataDevice::CPU);
+        int vocabSize = logits.dims.back();
+        float *data = (float*)logits.cpuData;
+        std::vector <int> ret;
+        for (int b = 0; b < batch; b++) {
+            int tail = GetLogitsTail(b, seqLens[b]);
+            if (generationConfigs[b].output_logits && retLogits != nullptr && (*retLogits)[b] != nullptr) {
+                (*retLogits)[b]->assign(data, data + (long long)tail * vocabSize);
+            }
+            Data last = Data(DataType::FLOAT32, {1, vocabSize},
+                             std::vector <float> (data + (long long)(tail - 1) * vocabSize, data + (long long)tail * vocabSize));
+            std::vector <std::pair <Data*, Data*> > curKV = std::vector <std::pair <Data*, Data*> > (
+                    pastKeyValues.begin() + b * this->block_cnt, pastKeyValues.begin() + (b + 1) * this->block_cnt);
+            ResetLogitsOfEOS(1, &last, curKV, std::vector <GenerationConfig> {generationConfigs[b]});
+            ret.push_back(LLMSampling(last, 0, generationConfigs[b], lastTokens.units[b]));
+            data += (long long)tail * vocabSize;
+        }
+        return ret;
+    }
+
+    // 把weight的rows行拷贝成一个新的权重 (每行的量化参数一起拷贝), 只支持按行连续存储的类型
+    template <typename T>
+    static void GatherRowParams(const std::vector <T> &src, std::vector <T> &dst, int k, const std::vector <int> &rows) {
+        dst.clear();
+        if (src.size() == 0 || src.size() % k != 0) {
+            return;
+        }
+        size_t per = src.size() / k;
+        for (int row : rows) {
+            dst.insert(dst.end(), src.begin() + row * per, src.begin() + (row + 1) * per);
+        }
+    }
+
+    static bool GatherWeightRows(Data &weight, const std::vector <int> &rows, Data &sub) {
+        static std::set <DataType> rowTypes = {
+            DataType::FLOAT32, DataType::FLOAT16, DataType::BFLOAT16, DataType::INT8, DataType::INT4_NOZERO,
+            DataType::INT4_GROUP, DataType::INT2_GROUP, DataType::DATA_GGUF_FORMAT
+        };
+        if (weight.dims.size() != 2 || weight.dataDevice != DataDevice::CPU || weight.cpuData == nullptr ||
+            rowTypes.find(weight.dataType) == rowTypes.end() || weight.IsRepacked) {
+            return false;
+        }
+        bool isFloat = (weight.dataType == DataType::FLOAT32 || weight.dataType == DataType::FLOAT16 ||
+                        weight.dataType == DataType::BFLOAT16 || weight.dataType == DataType::DATA_GGUF_FORMAT);
+        int k = weight.dims[0], m = weight.dims[1];
+        uint64_t bytes = weight.GetBytes();
+        if (bytes % k != 0 || (!isFloat && weight.perChannelAxis != 0)) {
+            return false;
+        }
+        uint64_t rowBytes = bytes / k;
+
+        sub.FreeSpace();
+        if (weight.dataType == DataType::DATA_GGUF_FORMAT) {
+            sub = Data(weight.dataType, weight.ggmlType, {(int)rows.size(), m});
+        } else {
+            sub = Data(weight.dataType, {(int)rows.size(), m});
+        }
+        sub.weightType = WeightType::LINEAR;
+        sub.perChannelAxis = weight.perChannelAxis;
+        sub.group = weight.group;
+        sub.groupCnt = weight.groupCnt;
+        sub.Allocate();
+        for (int i = 0; i < rows.size(); i++) {
+            memcpy(sub.cpuData + i * rowBytes, weight.cpuData + rows[i] * rowBytes, rowBytes);
+        }
+        GatherRowParams(weight.perChannelsConfigs, sub.perChannelsConfigs, k, rows);
+        GatherRowParams(weight.zeros, sub.zeros, k, rows);
+        GatherRowParams(weight.scales, sub.scales, k, rows);
+        GatherRowParams(weight.mins, sub.mins, k, rows);
+        GatherRowParams(weight.halfScales, sub.halfScales, k, rows);
+        return true;
+    }
+
+    // 用float类型的lm_head生成低比特的lm_head, float16先转成bfloat16 (只用于选候选, 精度足够)
+    static bool BuildLMHeadProxy(Data &lmHead, DataType proxyType, Data &proxy) {
+        if (lmHead.dims.size() != 2 || lmHead.dataDevice != DataDevice::CPU || lmHead.cpuData == nullptr ||
+            (lmHead.dataType != DataType::FLOAT32 && lmHead.dataType != DataType::FLOAT16 && lmHead.dataType != DataType::BFLOAT16)) {
+            return false;
+        }
+        int k = lmHead.dims[0], m = lmHead.dims[1];
+        proxy.FreeSpace();
+        proxy = Data(proxyType, {k, m});
+        if (lmHead.dataType == DataType::FLOAT16) {
+            std::vector <uint16_t> bf16((size_t)k * m);
+            uint16_t *src = (uint16_t*)lmHead.cpuData;
+            for (size_t i = 0; i < bf16.size(); i++) {
+                float now = half_to_float(src[i]);
+                bf16[i] = (*(uint32_t*)&now) >> 16;
+            }
+            proxy.CreateFromOriData(WeightType::LINEAR, DataType::BFLOAT16, (uint8_t*)bf16.data(), nullptr, nullptr, -1);
+        } else {
+            proxy.CreateFromOriData(WeightType::LINEAR, lmHead.dataType, lmHead.cpuData, nullptr, nullptr, -1);
+        }
+        return true;
+    }
+
+    void basellm::SetLMHeadShortlist(int candidates, DataType proxyType) {
+        AssertInFastLLM(proxyType == DataType::INT8 || proxyType == DataType::INT4_NOZERO ||
+                        proxyType == DataType::INT4_GROUP || proxyType == DataType::INT2_GROUP,
+                        "SetLMHeadShortlist error: proxy dtype should be int8, int4, int4g or int2g.\n");
+        std::lock_guard <std::mutex> forwardGuard(this->forwardLocker);
+        if (candidates <= 0 || proxyType != this->lmHeadProxyType) {
+            this->lmHeadProxy.FreeSpace();
+            this->lmHeadProxy = Data();
+            this->lmHeadProxySource = nullptr;
+        }
+        this->lmHeadCandidates = std::max(0, candidates);
+        this->lmHeadProxyType = proxyType;
+    }
+
+    std::vector <int> basellm::SelectLMHeadCandidates(Data &hiddenStates, Data &lmHead,
+                                                      const std::vector <GenerationConfig> &generationConfigs) {
+        if (lmHead.cpuData == nullptr) {
+            return {};
+        }
+        if (this->lmHeadProxySource != lmHead.cpuData) {
+            this->lmHeadProxySource = lmHead.cpuData;
+            if (!BuildLMHeadProxy(lmHead, this->lmHeadProxyType, this->lmHeadProxy)) {
+                printf("Warning: lm_head (%s) can't be used for shortlist, compute the full lm_head.\n",
+                       GetDataTypeName(lmHead.dataType).c_str());
+                this->lmHeadProxy.FreeSpace();
+                this->lmHeadProxy = Data();
+            }
+        }
+        if (this->lmHeadProxy.dims.size() == 0) {
+            return {};
+        }
+
+        Data proxyLogits;
+        Linear(hiddenStates, this->lmHeadProxy, Data(), proxyLogits);
+        ToDataType(proxyLogits, DataType::FLOAT32);
+        proxyLogits.ToDevice(DataDevice::CPU);
+        int vocabSize = lmHead.dims[0], candidates = std::min(vocabSize, this->lmHeadCandidates);
+        int rows = proxyLogits.Count(0) / vocabSize;
+        float *data = (float*)proxyLogits.cpuData;
+
+        std::vector <bool> selected(vocabSize, false);
+        std::vector <int> ids(vocabSize);
+        for (int r = 0; r < rows; r++) {
+            float *cur = data + (size_t)r * vocabSize;
+            for (int i = 0; i < vocabSize; i++) {
+                ids[i] = i;
+            }
+            std::nth_element(ids.begin(), ids.begin() + (candidates - 1), ids.end(),
+                             [cur](int a, int b) { return cur[a] > cur[b]; });
+            for (int i = 0; i < candidates; i++) {
+                selected[ids[i]] = true;
+            }
+        }
+        // 结束token总是精确计算, 避免因为低比特的误差无法结束
+        std::vector <int> endTokens (this->eos_token_ids.begin(), this->eos_token_ids.end());
+        endTokens.push_back(this->eos_token_id);
+        for (auto &config : generationConfigs) {
+            endTokens.insert(endTokens.end(), config.stop_token_ids.begin(), config.stop_token_ids.end());
+        }
+        for (int token : endTokens) {
+            if (token >= 0 && token < vocabSize) {
+                selected[token] = true;
+            }
+        }
+
+        std::vector <int> ret;
+        for (int i = 0; i < vocabSize; i++) {
+            if (selected[i]) {
+                ret.push_back(i);
+            }
+        }
+        return ret;
+    }
+
+    void basellm::ComputeLMHead(Data &hiddenStates, Data &lmHead, Data &logits,
+                                const std::vector <GenerationConfig> &generationConfigs, const std::vector <int> &seqLens) {
+        int vocabSize = lmHead.dims[0];
+        auto &allowed = generationConfigs[0].allowed_token_ids;
+        bool anyAllowed = false, sameAllowed = true;
+        bool canShortlist = this->lmHeadCandidates > 0 && this->outputLogitsTails.empty();
+        for (auto &config : generationConfigs) {
+            anyAllowed |= (config.allowed_token_ids.size() > 0);
+            sameAllowed &= (config.allowed_token_ids == allowed);
+            // 需要完整分布的请求 (返回logits, 或者top_k超过候选数的采样) 计算完整的lm_head
+            canShortlist &= (!config.output_logits && config.top_k >= 1 && config.top_k <= this->lmHeadCandidates);
+        }
+
+        Data *sub = nullptr, tempSub;
+        std::vector <int> tokens;
+        if (anyAllowed && sameAllowed) {
+            // 限定了token集合时只计算这些token, 结果是精确的, 任何采样方式都可以使用
+            for (int token : allowed) {
+                if (token >= 0 && token < vocabSize) {
+                    tokens.push_back(token);
+                }
+            }
+            if (tokens.size() > 0 && tokens == this->lmHeadSubTokens && lmHead.cpuData == this->lmHeadSubSource) {
+                sub = &this->lmHeadSub;
+            } else if (tokens.size() > 0 && GatherWeightRows(lmHead, tokens, this->lmHeadSub)) {
+                this->lmHeadSubTokens = tokens;
+                this->lmHeadSubSource = lmHead.cpuData;
+                sub = &this->lmHeadSub;
+            }
+        } else if (!anyAllowed && canShortlist) {
+            tokens = SelectLMHeadCandidates(hiddenStates, lmHead, generationConfigs);
+            if (tokens.size() > 0 && GatherWeightRows(lmHead, tokens, tempSub)) {
+                sub = &tempSub;
+            }
+        }
+
+        if (sub != nullptr) {
+            Data subLogits;
+            Linear(hiddenStates, *sub, Data(), subLogits);
+            ToDataType(subLogits, DataType::FLOAT32);
+            subLogits.ToDevice(DataDevice::CPU);
+            int rows = subLogits.Count(0) / tokens.size();
+            float *subData = (float*)subLogits.cpuData;
+            std::vector <float> values((size_t)rows * vocabSize, -INFINITY);
+            for (int r = 0; r < rows; r++) {
+                for (int i = 0; i < tokens.size(); i++) {
+                    values[(size_t)r * vocabSize + tokens[i]] = subData[(size_t)r * tokens.size() + i];
+                }
+            }
+            std::vector <int> dims = hiddenStates.dims;
+            dims.back() = vocabSize;
+            logits.CopyFrom(Data(DataType::FLOAT32, dims, values));
+            return;
+        }
+
+        Linear(hiddenStates, lmHead, Data(), logits);
+        ToDataType(logits, DataType::FLOAT32);
+        if (!anyAllowed) {
+            return;
+        }
+
+        // 各请求的allowed_token_ids不同 (或者lm_head不能按行拷贝) 时, 在完整的logits上屏蔽其余token
+        logits.ToDevice(DataDevice::CPU);
+        int rows = logits.Count(0) / vocabSize;
+        float *data = (float*)logits.cpuData;
+        // 每个请求的行数: 一个请求时是全部行, 否则是每个请求最后GetLogitsTail个位置, 或者全部seqLens[b]个位置
+        std::vector <int> cnts = std::vector <int> (generationConfigs.size(), 1);
+        if (generationConfigs.size() == 1) {
+            cnts[0] = rows;
+        } else if (seqLens.size() == generationConfigs.size()) {
+            int tails = 0, total = 0;
+            for (int b = 0; b < seqLens.size(); b++) {
+                cnts[b] = GetLogitsTail(b, seqLens[b]);
+                tails += cnts[b];
+                total += seqLens[b];
+            }
+            if (tails != rows && total == rows) {
+                cnts = seqLens;
+            }
+        }
+        std::vector <bool> keep(vocabSize);
+        for (int b = 0, row = 0; b < generationConfigs.size() && row < rows; b++) {
+            int cnt = cnts[b];
+            auto &curAllowed = generationConfigs[b].allowed_token_ids;
+            if (curAllowed.size() > 0) {
+                std::fill(keep.begin(), keep.end(), false);
+                for (int token : curAllowed) {
+                    if (token >= 0 && token < vocabSize) {
+                        keep[token] = true;
+                    }
+                }
+                for (int r = row; r < row + cnt && r < rows; r++) {
+                    for (int i = 0; i < vocabSize; i++) {
+                        if (!keep[i]) {
+                            data[(size_t)r * vocabSize + i] = -INFINITY;
+                        }
+                    }
+                }
+            }
+            row += cnt;
+        }
+    }
+
+    void basellm::TruncateKV(int handleId, int len) {
+        std::unique_lock <std::mutex> dictGuard(this->dictLocker);
+        ResponseContext *context = responseContextDict.GetHandle(handleId);
+        if (context == nullptr || context->isEnding) {
+            return;
+        }
+        AssertInFastLLM(this->canDoSpeculative && context->multimodalInput.size() == 0,
+                        "TruncateKV error: truncating kv cache is not supported for model " + this->model_type + ".\n");
+        AssertInFastLLM(!context->generationConfig.output_logits, "TruncateKV error: requests with output_logits can't be truncated.\n");
+        AssertInFastLLM(context->preTokens > 0, "TruncateKV error: the prompt hasn't been processed yet.\n");
+        int minLen = std::max(context->intParams["promptLen"], 2), maxLen = context->allTokens.size();
+        AssertInFastLLM(len >= minLen && len <= maxLen,
+                        "TruncateKV error: len should be in [" + std::to_string(minLen) + ", " + std::to_string(maxLen) + "].\n");
+        context->pendingTruncateLen = context->pendingTruncateLen < 0 ? len : std::min(context->pendingTruncateLen, len);
+        dictGuard.unlock();
+        dictCV.notify_one();
+    }
+
+    // 应用TruncateKV记录的回滚, 调用时持有dictLocker, 且这个请求不在forward中
+    // 回滚后KV Cache中是前len - 1个token, 第len个token作为下一步decode的输入, 重新计算它的logits
+    static void ApplyPendingTruncate(ResponseContext *context) {
+        int len = context->pendingTruncateLen, promptLen = context->intParams["promptLen"];
+        context->pendingTruncateLen = -1;
+        // 请求可能在调用TruncateKV之后生成了结束符, 回滚后继续生成
+        context->isEnding = false;
+
+        // resultTokenQueue中是allTokens末尾还没有被fetch的token, 丢掉其中被回滚的部分
+        int removed = (int)context->allTokens.size() - len;
+        std::queue <int> results;
+        while ((int)context->resultTokenQueue.size() > removed) {
+            results.push(context->resultTokenQueue.front());
+            context->resultTokenQueue.pop();
+        }
+        context->resultTokenQueue.swap(results);
+
+        context->allTokens.resize(len);
+        context->currentTokens = std::vector <int> {context->allTokens.back()};
+        context->curTokens = len - promptLen;
+        context->tokens.Init(context->tokens.tot);
+        for (int i = promptLen; i < len; i++) {
+            context->tokens.Push(context->allTokens[i]);
+        }
+        TruncateKVCache(context->pastKeyValues, len - 1);
+        context->draftLen = std::min(context->draftLen, len - 1);
+        TruncateKVCache(context->draftPastKeyValues, context->draftLen);
+        context->lookupIndex = PromptLookupIndex();
+        // 调度时index会先加1, 之后decode的位置为promptLen + index - 1 = len - 1
+        context->intParams["index"] = len - 1 - promptLen;
+    }
+
+    std::vector <int> basellm::VerifySpeculative(ResponseContext *context, const std::vector <int> &proposals,
+                                                const std::vector <std::vector <std::pair <int, float> > > &draftProbs,
+                                                const std::vector <float> &logits, const GenerationConfig &config) {
+        // logits中依次是 [当前token, 草稿token...] 每个位置的logits
+        int verifyLen = proposals.size() + 1;
+        AssertInFastLLM(logits.size() % verifyLen == 0, "VerifySpeculative error: wrong logits size.\n");
+        int vocabSize = logits.size() / verifyLen;
+        // 目标模型的KV Cache中已经写入了当前token和所有草稿token
+        int kvLen = context->allTokens.size() - 1;
+        TraceScope traceSpec("scheduler", "speculative");
+
+        // 逐个位置做接受判定, 第一个被拒绝的位置用残差分布重新采样; 全部接受时再从最后一个位置多采样一个token
+        std::vector <int> ret;
+        int accepted = 0;
+        LastTokensUnit acceptTokens = context->tokens;
+        for (int i = 0; i < verifyLen; i++) {
+            std::vector <std::pair <int, float> > probs;
+            LLMSamplingProbs(logits.data() + (long long)i * vocabSize, vocabSize, config, acceptTokens, probs);
+            if (i == proposals.size()) {
+                ret.push_back(SamplingFromProbs(probs));
+                break;
+            }
+            int token = SpeculativeAccept(proposals[i], probs, draftProbs[i]);
+            if (token != -1) {
+                ret.push_back(token);
+                break;
+            }
+            ret.push_back(proposals[i]);
+            acceptTokens.Push(proposals[i]);
+            accepted++;
+            if (IsEndToken(this, context->generationConfig, proposals[i])) {
+                break;
+            }
+        }
+
+        // 回滚被拒绝位置的KV, 目标模型的KV中保留当前token和被接受的草稿token
+        TruncateKVCache(context->pastKeyValues, kvLen + ret.size());
+        context->draftLen = std::min(context->draftLen, kvLen + (int)ret.size());
+        TruncateKVCache(context->draftPastKeyValues, context->draftLen);
+
+        if (traceSpec.active) {
+            traceSpec.args = "\"draft\":" + std::to_string(proposals.size()) + ",\"accepted\":" + std::to_string(accepted);
+        }
+        std::lock_guard <std::mutex> guard(this->metrics.locker);
+        this->metrics.speculativeSteps++;
+        this->metrics.draftTokens += proposals.size();
+        this->metrics.acceptedDraftTokens += accepted;
+        this->metrics.generatedTokens += ret.size() - 1;
+        return ret;
+    }
+
+    // 模型输出的词表大小 (lm_head的行数, 没有单独的lm_head时和embedding共享), 未知时返回-1
+    static int GetOutputVocabSize(basellm *model) {
+        for (const char *name : {"lm_head.weight", "model.embed_tokens.weight"}) {
+            auto it = model->weight.weight.find(name);
+            if (it != model->weight.weight.end() && it->second.dims.size() > 0) {
+                return it->second.dims[0];
+            }
+        }
+        return -1;
+    }
+
+    void basellm::SetDraftModel(basellm *draft, int tokens) {
+        if (draft != nullptr) {
+            AssertInFastLLM(draft != this, "SetDraftModel error: draft model can't be the model itself.\n");
+            AssertInFastLLM(this->canDoSpeculative && draft->canDoSpeculative,
+                            "SetDraftModel error: speculative decoding is not supported for model " +
+                            this->model_type + " with draft model " + draft->model_type + ".\n");
+            AssertInFastLLM(tokens > 0, "SetDraftModel error: tokens should be positive.\n");
+            // 草稿模型提出的token要在目标模型的词表内
+            int vocab = GetOutputVocabSize(this), draftVocab = GetOutputVocabSize(draft);
+            AssertInFastLLM(vocab == -1 || draftVocab == -1 || vocab == draftVocab,
+                            "SetDraftModel error: draft model's vocab size (" + std::to_string(draftVocab) +
+                            ") doesn't match the model's vocab size (" + std::to_string(vocab) + ").\n");
+        }
+        std::lock_guard <std::mutex> dictGuard(this->dictLocker);
+        std::lock_guard <std::mutex> forwardGuard(this->forwardLocker);
+        this->draftModel = draft;
+        this->speculativeTokens = tokens;
+        // 已有请求的草稿KV属于之前的草稿模型, 需要重新prefill
+        for (auto &it : this->responseContextDict.dicts) {
+            it.second->draftPastKeyValues.clear();
+            it.second->draftLen = 0;
+        }
+    }
+
+    void basellm::SetPromptLookup(int tokens, int maxNgram) {
+        if (tokens > 0) {
+            AssertInFastLLM(this->canDoSpeculative,
+                            "SetPromptLookup error: speculative decoding is not supported for model " + this->model_type + ".\n");
+            AssertInFastLLM(maxNgram > 0, "SetPromptLookup error: maxNgram should be positive.\n");
+        }
+        std::lock_guard <std::mutex> dictGuard(this->dictLocker);
+        this->promptLookupTokens = std::max(0, tokens);
+        this->promptLookupNgram = maxNgram;
+    }
+
+    std::vector <int> basellm::SpeculativeStep(ResponseContext *context) {
+        basellm *draft = this->draftModel;
+        if (draft == nullptr) {
+            return {};
+        }
+        auto &config = context->generationConfig;
+        // allTokens的最后一个token是这一步的输入, 其余的已经在KV Cache中
+        int len = context->allTokens.size();
+        int k = SpeculativeBudget(this, context, this->speculativeTokens);
+        if (k <= 0) {
+            return {};
+        }
+
+        TraceScope traceDraft("scheduler", "draft");
+        std::vector <float> logits;
+        std::vector <int> proposals;
+        std::vector <std::vector <std::pair <int, float> > > draftProbs;
+
+        // 1. 草稿模型先补齐落后的token, 然后逐个提出k个token
+        if (context->draftPastKeyValues.size() != draft->block_cnt) {
+            context->draftPastKeyValues.clear();
+            for (int i = 0; i < draft->block_cnt; i++) {
+                context->draftPastKeyValues.push_back(std::make_pair(Data(draft->dataType), Data(draft->dataType)));
+                context->draftPastKeyValues.back().first.SetKVCache();
+                context->draftPastKeyValues.back().second.SetKVCache();
+            }
+            context->draftLen = 0;
+        }
+        GenerationConfig draftConfig = config;
+        draftConfig.output_logits = true;
+        LastTokensManager draftTokens;
+        draftTokens.units.push_back(context->tokens);
+        LastTokensUnit &tokens = draftTokens.units[0];
+        std::vector <int> pending = std::vector <int> (context->allTokens.begin() + context->draftLen, context->allTokens.end());
+        // 草稿模型的forward状态 (outputLogitsTails, lm_head缓存等) 也会被它自己的调度循环使用, forward期间持有它的forwardLocker
+        std::unique_lock <std::mutex> draftGuard(draft->forwardLocker);
+        for (int i = 0; i < k; i++) {
+            for (int st = 0; st < pending.size(); st += 2048) {
+                int end = std::min((int)pending.size(), st + 2048);
+                std::vector <std::vector <float> > fInputTokens;
+                fInputTokens.resize(1);
+                for (int j = st; j < end; j++) {
+                    fInputTokens[0].push_back(pending[j]);
+                }
+                Data inputIds, attentionMask, positionIds;
+                draft->FillLLMInputs(fInputTokens, {{"promptLen", context->draftLen + end}, {"index", 0}, {"add_special_tokens", false}},
+                                     inputIds, attentionMask, positionIds);
+                ToDataType(attentionMask, draft->dataType);
+                draft->Forward(inputIds, attentionMask, positionIds, context->draftPastKeyValues, draftConfig, draftTokens, &logits);
+            }
+            context->draftLen += pending.size();
+            // 草稿模型的Forward可能会修改draftConfig (例如禁用greedy), 所以用Forward之后的配置计算分布
+            draftProbs.push_back(std::vector <std::pair <int, float> > ());
+            LLMSamplingProbs(logits.data(), logits.size(), draftConfig, tokens, draftProbs.back());
+            int token = SamplingFromProbs(draftProbs.back());
+            proposals.push_back(token);
+            tokens.Push(token);
+            pending = std::vector <int> {token};
+            if (IsEndToken(this, config, token)) {
+                break;
+            }
+        }
+        draftGuard.unlock();
+
+        // 2. 目标模型一次forward计算 [当前token, 草稿token...] 所有位置的logits
+        std::vector <std::vector <float> > fInputTokens;
+        fInputTokens.resize(1);
+        fInputTokens[0].push_back(context->allTokens.back());
+        for (int token : proposals) {
+            fInputTokens[0].push_back(token);
+        }
+        Data inputIds, attentionMask, positionIds;
+        this->FillLLMInputs(fInputTokens, {{"promptLen", len + (int)proposals.size()}, {"index", 0}, {"add_special_tokens", false}},
+                            inputIds, attentionMask, positionIds);
+        ToDataType(attentionMask, this->dataType);
+        GenerationConfig targetConfig = config;
+        targetConfig.output_logits = true;
+        LastTokensManager targetTokens;
+        targetTokens.units.push_back(context->tokens);
+        this->outputLogitsTails = std::vector <int> {(int)proposals.size() + 1};
+        this->Forward(inputIds, attentionMask, positionIds, context->pastKeyValues, targetConfig, targetTokens, &logits);
+        this->outputLogitsTails.clear();
+
+        // 3. 接受判定并回滚被拒绝位置的KV
+        return VerifySpeculative(context, proposals, draftProbs, logits, targetConfig);
+    }
+
     basellm::~basellm() {
         dictLocker.lock();
         this->isFree = true;
@@ -228,6 +1017,8 @@ namespace fastllm {
 
     std::string basellm::Response(const std::string &oriInput, RuntimeResult retCb,
                                   const fastllm::GenerationConfig &generationConfig) {
+        AssertInFastLLM(generationConfig.allowed_token_ids.empty() || SupportAllowedTokenIds(),
+                        "Model \"" + model_struct + "\" doesn`t support allowed_token_ids.\n");
         std::string input = oriInput;
         if (this->saveHistoryChat) {
             if (lastKeyValues != nullptr) {
@@ -352,6 +1143,8 @@ namespace fastllm {
 
     void basellm::ResponseBatch(const std::vector<std::string> &inputs, std::vector<std::string> &outputs,
                                 RuntimeResultBatch retCb, const fastllm::GenerationConfig &generationConfig) {
+        AssertInFastLLM(generationConfig.allowed_token_ids.empty() || SupportAllowedTokenIds(),
+                        "Model \"" + model_struct + "\" doesn`t support allowed_token_ids.\n");
 #ifdef USE_CUDA
         FastllmCudaClearBigBuffer();
 #endif
@@ -565,6 +1358,15 @@ namespace fastllm {
     int basellm::LaunchResponseTokens(const std::vector<int> &inputTokens,
                                       const fastllm::GenerationConfig &generationConfig,
                                       const std::map <std::string, std::vector <Data*> > &multimodalInput) {
+        if (!generationConfig.adapter_name.empty()) {
+            AssertInFastLLM(SupportLoraAdapter(), "Model \"" + model_struct + "\" doesn`t support lora adapter.\n");
+            std::lock_guard <std::mutex> loraGuard(loraLocker);
+            if (loraAdapters.find(generationConfig.adapter_name) == loraAdapters.end()) {
+                ErrorInFastLLM("Can`t find lora adapter: " + generationConfig.adapter_name);
+            }
+        }
+        AssertInFastLLM(generationConfig.allowed_token_ids.empty() || SupportAllowedTokenIds(),
+                        "Model \"" + model_struct + "\" doesn`t support allowed_token_ids.\n");
         mainLoopLocker.lock();
         if (mainLoop == nullptr) {
             if (mainLoop == nullptr) {
@@ -615,6 +1417,12 @@ namespace fastllm {
                     
                     model->tokensLimit = maxTotalLens;
                     int limit = maxTotalLens;
+                    long long kvCacheBytesPerToken = model->elementsInKVCachePerToken > 0 ?
+                                                     model->elementsInKVCachePerToken * unitSize : kvCacheLimit / std::max(1, maxTotalLens);
+                    model->metrics.locker.lock();
+                    model->metrics.kvCacheBytesLimit = kvCacheLimit;
+                    model->metrics.batchLimit = maxBatch;
+                    model->metrics.locker.unlock();
                     model->promptLimit = limit * 3 / 4;
 
                     if (model->verbose) {
@@ -626,6 +1434,7 @@ namespace fastllm {
 
                     auto lastRecordTime = std::chrono::system_clock::now();
                     long long genTokens = 0;
+                    SetTraceThreadName("main_loop");
                     while (true) {
                         if (model->isFree) {
                             break;
@@ -639,6 +1448,11 @@ namespace fastllm {
                         std::vector <GenerationConfig> generationConfigs;
                         LastTokensManager tokensManager;
                         std::vector <std::vector <float>* > logits;
+                        // prompt lookup投机解码的请求: 草稿token和对应的草稿分布, 以及每个请求需要返回logits的位置数
+                        std::vector <std::vector <int> > specProposals;
+                        std::vector <int> logitsTails;
+                        bool hasMultiTails = false;
+                        int prefillTokens = 0, decodeTokens = 0;
                         
                         std::unique_lock<std::mutex> dictLocker(model->dictLocker);
                         auto &forwardLocker = model->forwardLocker;
@@ -654,17 +1468,33 @@ namespace fastllm {
                         for (auto &it : abortHandles) {
                             model->responseContextDict.RemoveHandle(it);
                         }
+                        if (abortHandles.size() > 0) {
+                            std::lock_guard <std::mutex> guard(model->metrics.locker);
+                            model->metrics.abortedRequests += abortHandles.size();
+                        }
+                        for (auto &it: model->responseContextDict.dicts) {
+                            if (it.second->pendingTruncateLen > 0) {
+                                ApplyPendingTruncate(it.second);
+                            }
+                        }
 
                         int limit = maxTotalLens;
                         int promptLimit = model->promptLimit;
 
-                        int lenSum = 0, currentActivate = 0;
+                        int lenSum = 0, currentActivate = 0, waiting = 0;
                         for (auto &it: model->responseContextDict.dicts) {
                             if (it.second->pastKeyValues[model->kvCacheId].first.expansionDims.size() > 0) {
                                 lenSum += it.second->pastKeyValues[model->kvCacheId].first.expansionDims[1];
                                 currentActivate++;
+                            } else if (!it.second->isEnding) {
+                                waiting++;
                             }
                         }
+                        model->metrics.locker.lock();
+                        model->metrics.runningRequests = currentActivate;
+                        model->metrics.waitingRequests = waiting;
+                        model->metrics.kvCacheBytesUsed = (long long)lenSum * kvCacheBytesPerToken;
+                        model->metrics.locker.unlock();
                         std::vector <std::pair <int, int> > orders;
                         for (auto &it : model->responseContextDict.dicts) {
                             orders.push_back(std::make_pair(-(int)it.second->currentTokens.size(), it.first));
@@ -721,6 +1551,12 @@ namespace fastllm {
                                     it.second->cacheLen + it.second->currentTokens.size() > model->max_positions) {
                                     it.second->isEnding = true;
                                     it.second->error = ResponseContextErrorPromptTooLong;
+                                    model->metrics.locker.lock();
+                                    model->metrics.promptTooLongRequests++;
+                                    model->metrics.locker.unlock();
+                                    if (model->responseNotifier) {
+                                        model->responseNotifier(it.first);
+                                    }
                                     continue;
                                 }
 
@@ -736,7 +1572,7 @@ namespace fastllm {
                                 }
 
                                 if (!isPrompt) {
-                                    if (it.second->pastKeyValues[model->kvCacheId].first.expansionDims[1] == it.second->pastKeyValues[0].first.dims[1]) {
+                                    if (it.second->pastKeyValues[model->kvCacheId].first.expansionDims[1] == it.second->pastKeyValues[model->kvCacheId].first.dims[1]) {
                                         int sur = it.second->generationConfig.output_token_limit - it.second->curTokens;                                        
                                         int predictLen = 256;
                                         if (sur > 0) {
@@ -756,8 +1592,23 @@ namespace fastllm {
                                     currentActivate++;
                                 }
 
+                                // prompt lookup不需要草稿模型, 直接把草稿token接在当前token之后和其他请求一起decode, forward之后再做接受判定
+                                std::vector <int> proposals;
+                                if (!isPrompt && model->draftModel == nullptr && model->promptLookupTokens > 0 &&
+                                    it.second->currentTokens.size() == 1 && it.second->multimodalInput.size() == 0 &&
+                                    !it.second->generationConfig.output_logits && it.second->generationConfig.output_token_least <= 0) {
+                                    proposals = ProposeLookupTokens(model, it.second);
+                                }
+                                specProposals.push_back(proposals);
+                                logitsTails.push_back(proposals.size() + 1);
+                                hasMultiTails |= (proposals.size() > 0);
+
                                 generationConfigs.push_back(it.second->generationConfig);
-                                if (it.second->generationConfig.output_logits) {
+                                if (proposals.size() > 0) {
+                                    // 接受判定需要所有位置的logits, 这个vector由调度循环自己释放
+                                    generationConfigs.back().output_logits = true;
+                                    logits.push_back(new std::vector<float>());
+                                } else if (it.second->generationConfig.output_logits) {
                                     it.second->resultLogits.push(new std::vector<float>());
                                     logits.push_back(it.second->resultLogits.back());
                                 } else {
@@ -780,7 +1631,19 @@ namespace fastllm {
                                 for (int i: it.second->currentTokens) {
                                     tokens[0].push_back(i);
                                 }
-                                model->FillLLMInputs(tokens, it.second->intParams, inputIds, attentionMask, curPositionIds);
+                                for (int i: proposals) {
+                                    tokens[0].push_back(i);
+                                }
+                                if (!isPrompt && tokens[0].size() > 1) {
+                                    // 多token的decode: 输入接在KV Cache之后, 按照每个请求自己的KV长度生成位置和causal mask
+                                    int kvLen = it.second->allTokens.size() - it.second->currentTokens.size();
+                                    auto params = it.second->intParams;
+                                    params["promptLen"] = kvLen + (int)tokens[0].size();
+                                    params["index"] = 0;
+                                    model->FillLLMInputs(tokens, params, inputIds, attentionMask, curPositionIds);
+                                } else {
+                                    model->FillLLMInputs(tokens, it.second->intParams, inputIds, attentionMask, curPositionIds);
+                                }
                                 ToDataType(attentionMask, model->dataType);
 
                                 seqLens.push_back(inputIds.Count(0));
@@ -801,6 +1664,7 @@ namespace fastllm {
                                     positionIds.back()->CopyFrom(curPositionIds);
                                 }
                                 it.second->preTokens += seqLens.back();
+                                (isPrompt ? prefillTokens : decodeTokens) += seqLens.back();
                                 for (int i = 0; i < model->block_cnt; i++) {
                                     pastKeyValues.push_back(std::make_pair(&it.second->pastKeyValues[i].first,
                                                                            &it.second->pastKeyValues[i].second));
@@ -821,8 +1685,33 @@ namespace fastllm {
                         }
                         if (seqLens.size() > 0) {
                             std::vector <std::pair <Data, Data> > *pastKeyValue1;
+                            ResponseContext *specContext = nullptr;
+                            // 单个请求prefill时, 需要给线性attention的状态做快照的请求, 以及它KV Cache中已有的token数
+                            ResponseContext *checkpointContext = nullptr;
+                            int checkpointBase = 0, checkpointInterval = model->pastKVCacheManager.checkpointInterval;
                             if (seqLens.size() == 1) {
-                                pastKeyValue1 = &model->responseContextDict.dicts[handles[0]]->pastKeyValues;
+                                auto context = model->responseContextDict.dicts[handles[0]];
+                                pastKeyValue1 = &context->pastKeyValues;
+                                if (model->saveHistoryChat && checkpointInterval > 0 && seqLens[0] > 1 &&
+                                    context->multimodalInput.size() == 0 && specProposals[0].size() == 0) {
+                                    for (auto &it : context->pastKeyValues) {
+                                        if (IsWholeStateCache(it.first)) {
+                                            checkpointContext = context;
+                                            checkpointBase = (int)context->allTokens.size() - (int)context->currentTokens.size();
+                                            break;
+                                        }
+                                    }
+                                }
+                                // 单个请求decode时, 如果设置了草稿模型则做投机解码
+                                if (model->draftModel != nullptr && decodeTokens > 0 &&
+                                    context->currentTokens.size() == 1 && context->multimodalInput.size() == 0 &&
+                                    !context->generationConfig.output_logits && context->generationConfig.output_token_least <= 0) {
+                                    specContext = context;
+                                }
+                            }
+                            std::vector <ResponseContext*> specContexts;
+                            for (int i = 0; i < handles.size(); i++) {
+                                specContexts.push_back(specProposals[i].size() > 0 ? model->responseContextDict.dicts[handles[i]] : nullptr);
                             }
                             dictLocker.unlock();
                             forwardLocker.lock();
@@ -831,8 +1720,14 @@ namespace fastllm {
 #endif
                             Data inputIds = Data(DataType::FLOAT32, {1, (int) ids.size()}, ids);
                             std::vector<int> ret;
+                            std::vector <std::vector <int> > specResults = std::vector <std::vector <int> > (handles.size());
+                            if (hasMultiTails) {
+                                model->outputLogitsTails = logitsTails;
+                            }
 auto st = std::chrono::system_clock::now();
 //ClearProfiler();
+                            bool traceStep = TraceEnabled();
+                            long long traceSt = traceStep ? TraceNowUs() : 0;
                             if (seqLens.size() > 1) {
                                 if (!model->canDoBatchForward) {
                                     dictLocker.lock();
@@ -857,12 +1752,20 @@ auto st = std::chrono::system_clock::now();
                                     first = 1024;
                                     part = 1024;
                                 }
-                                if (model->model_struct == "qwen3_next") {
-                                    // TODO: qwen3_next支持更长的切片
+                                if (model->model_struct == "qwen3_next" && !CanRunChunkGatedDeltaRule()) {
+                                    // 不能使用ChunkGatedDeltaRule时走通用算子的分块实现, 需要更短的切片
                                     first = 2048;
                                     part = 1024;
                                 }
-                                if (seqLens[0] > first) {
+                                if (specContext != nullptr) {
+                                    specResults[0] = model->SpeculativeStep(specContext);
+                                }
+                                // prefill跨过了快照位置时, 也要切片, 在快照位置保存状态
+                                bool needCheckpoint = checkpointContext != nullptr && 
+                                    (checkpointBase + seqLens[0] - 1) / checkpointInterval * checkpointInterval > checkpointBase;
+                                if (specResults[0].size() > 0) {
+                                    ret = std::vector <int> {specResults[0].back()};
+                                } else if (seqLens[0] > first || needCheckpoint) {
                                     int len = seqLens[0];
                                     for (int st = 0; st < len; ) {
                                         if (model->verbose) {
@@ -875,6 +1778,14 @@ auto st = std::chrono::system_clock::now();
                                             }
                                         }
                                         int curLen = std::min(st == 0 ? first : part, len - st);
+                                        if (needCheckpoint) {
+                                            int next = ((checkpointBase + st) / checkpointInterval + 1) * checkpointInterval;
+                                            curLen = std::min(curLen, next - checkpointBase - st);
+                                        }
+                                        TraceScope traceChunk("scheduler", "prefill_chunk");
+                                        if (traceChunk.active) {
+                                            traceChunk.args = "\"start\":" + std::to_string(st) + ",\"len\":" + std::to_string(curLen);
+                                        }
                                         Data curInput, curPositionIds;
                                         Split(inputIds, 1, st, st + curLen, curInput);
                                         Split(*positionIds[0], 1, st, st + curLen, curPositionIds);
@@ -882,6 +1793,9 @@ auto st = std::chrono::system_clock::now();
                                         ret = std::vector <int> {model->Forward(curInput, Data(), curPositionIds,
                                             *pastKeyValue1, generationConfigs[0], tokensManager, logits[0])};
                                         st += curLen;
+                                        if (needCheckpoint && st < len && (checkpointBase + st) % checkpointInterval == 0) {
+                                            checkpointContext->SaveStateCheckpoint(checkpointBase + st, model->pastKVCacheManager.maxCheckpoints);
+                                        }
                                     }
                                 } else {
                                     if (model->responseContextDict.dicts.begin()->second->multimodalInput.size() > 0) {
@@ -904,6 +1818,33 @@ for (int i : seqLens) total += i;
 float spend = GetSpan(st, std::chrono::system_clock::now());
 printf("len = %d, spend = %f s. tokens / s = %f\n", (int)total, spend, (float)total / spend);
 */
+                            if (traceStep) {
+                                std::string args = "\"batch\":" + std::to_string(seqLens.size()) +
+                                                   ",\"prefill_tokens\":" + std::to_string(prefillTokens) +
+                                                   ",\"decode_tokens\":" + std::to_string(decodeTokens) + ",\"handles\":[";
+                                for (int i = 0; i < handles.size(); i++) {
+                                    args += (i == 0 ? "" : ",") + std::to_string(handles[i]);
+                                }
+                                args += "]";
+                                TraceAddSpan("scheduler", prefillTokens > 0 ? "prefill" : "decode", "",
+                                             traceSt, TraceNowUs() - traceSt, args);
+                            }
+                            if (hasMultiTails) {
+                                model->outputLogitsTails.clear();
+                                for (int i = 0; i < handles.size(); i++) {
+                                    if (specContexts[i] == nullptr) {
+                                        continue;
+                                    }
+                                    // 有的模型会在Forward中修改采样参数, 所以用Forward之后的配置做接受判定
+                                    std::vector <std::vector <std::pair <int, float> > > draftProbs;
+                                    for (int token : specProposals[i]) {
+                                        draftProbs.push_back(std::vector <std::pair <int, float> > {std::make_pair(token, 1.0f)});
+                                    }
+                                    specResults[i] = model->VerifySpeculative(specContexts[i], specProposals[i], draftProbs,
+                                                                              *logits[i], generationConfigs[i]);
+                                }
+                            }
+                            model->metrics.RecordStep(GetSpan(st, std::chrono::system_clock::now()), seqLens.size(), prefillTokens, decodeTokens);
                             forwardLocker.unlock();
                             dictLocker.lock();
 
@@ -932,29 +1873,40 @@ printf("len = %d, spend = %f s. tokens / s = %f\n", (int)total, spend, (float)to
 
                             for (int i = 0; i < handles.size(); i++) {
                                 auto &it = *model->responseContextDict.dicts.find(handles[i]);
-                                int curRet = ret[i];
-                                if (curRet == model->eos_token_id || model->eos_token_ids.find(curRet) != model->eos_token_ids.end()) {
-                                    it.second->isEnding = true;
-                                    it.second->TryRecord(model);
-                                } else {
-                                    auto itStopTk = it.second->generationConfig.stop_token_ids.find(curRet);
-                                    if (itStopTk != it.second->generationConfig.stop_token_ids.end()) {
+                                // 投机解码一步可能产生多个token, 除了最后一个之外的token都已经写入了KV Cache
+                                std::vector <int> curRets = specResults[i].size() > 0 ? specResults[i] : std::vector <int> {ret[i]};
+                                for (int j = 0; j < curRets.size() && (j == 0 || !it.second->isEnding); j++) {
+                                    int curRet = curRets[j];
+                                    if (curRet == model->eos_token_id || model->eos_token_ids.find(curRet) != model->eos_token_ids.end()) {
                                         it.second->isEnding = true;
                                         it.second->TryRecord(model);
+                                    } else {
+                                        auto itStopTk = it.second->generationConfig.stop_token_ids.find(curRet);
+                                        if (itStopTk != it.second->generationConfig.stop_token_ids.end()) {
+                                            it.second->isEnding = true;
+                                            it.second->TryRecord(model);
+                                        }
                                     }
-                                }
-                                if (it.second->isEnding == false) {
-                                    it.second->currentTokens = std::vector<int>{curRet};
-                                    it.second->resultTokenQueue.push(curRet);
-                                    it.second->allTokens.push_back(curRet);
-                                    it.second->tokens.Push(curRet);
-                                    it.second->curTokens++;
-                                    if (it.second->curTokens == it.second->generationConfig.output_token_limit
-                                        || it.second->allTokens.size() >= model->max_positions) {
-                                        it.second->isEnding = true;
-                                        it.second->TryRecord(model);
+                                    if (it.second->isEnding == false) {
+                                        it.second->currentTokens = std::vector<int>{curRet};
+                                        it.second->resultTokenQueue.push(curRet);
+                                        it.second->allTokens.push_back(curRet);
+                                        it.second->tokens.Push(curRet);
+                                        it.second->curTokens++;
+                                        if (it.second->curTokens == it.second->generationConfig.output_token_limit
+                                            || it.second->allTokens.size() >= model->max_positions) {
+                                            it.second->isEnding = true;
+                                            it.second->TryRecord(model);
+                                        }
                                     }
                                 }
+                                if ((curRets.size() > 1 || seqLens[i] > 1) && it.second->multimodalInput.size() == 0) {
+                                    // 这一步写入KV Cache的token数不是1, 重新对齐下一步decode的位置 (位置 = KV Cache长度)
+                                    it.second->intParams["index"] = (int)it.second->allTokens.size() - 1 - it.second->intParams["promptLen"];
+                                }
+                                if (model->responseNotifier) {
+                                    model->responseNotifier(handles[i]);
+                                }
                             }
                         } else {
                             int maxLen = -1, select = -1;
@@ -972,6 +1924,9 @@ printf("len = %d, spend = %f s. tokens / s = %f\n", (int)total, spend, (float)to
                             }
                             if (select != -1) {
                                 model->responseContextDict.dicts[select]->isEnding = true;
+                                if (model->responseNotifier) {
+                                    model->responseNotifier(select);
+                                }
                                 continue;
                             }
                         }
@@ -982,6 +1937,11 @@ printf("len = %d, spend = %f s. tokens / s = %f\n", (int)total, spend, (float)to
                         for (int i = 0; i < positionIds.size(); i++) {
                             delete positionIds[i];
                         }
+                        for (int i = 0; i < specProposals.size(); i++) {
+                            if (specProposals[i].size() > 0) {
+                                delete logits[i];
+                            }
+                        }
 
                         if (seqLens.size() == 0) {
                             model->dictCV.wait(dictLocker);
@@ -1001,16 +1961,20 @@ printf("len = %d, spend = %f s. tokens / s = %f\n", (int)total, spend, (float)to
         context->generationConfig = generationConfig;
         context->multimodalInput = multimodalInput;
         context->tokens = LastTokensUnit(generationConfig.last_n);
-
-        auto cache = pastKVCacheManager.Get(inputTokens);
+        // 前缀缓存中只有基座模型的KV Cache, 使用adapter的请求不复用
+        auto cache = generationConfig.adapter_name.empty() ? pastKVCacheManager.Get(inputTokens) : 
+                                                             std::make_pair((PastKVCacheMemory*)nullptr, 0);
         if (cache.first != nullptr && cache.second > 0) {
             int len = cache.second;
             
             forwardLocker.lock();
+            // 只匹配到记录的一部分时, 整体保存的状态从对应长度的快照恢复
+            auto checkpoint = cache.first->checkpoints.find(len);
+            auto &states = (len < cache.first->tokens && checkpoint != cache.first->checkpoints.end()) ? checkpoint->second : cache.first->kv;
             for (int i = 0; i < this->block_cnt; i++) {
-                if (cache.first->kv[i].first.isLinearAttention) {
-                    context->pastKeyValues[i].first.CopyFrom(cache.first->kv[i].first);
-                    context->pastKeyValues[i].second.CopyFrom(cache.first->kv[i].second);
+                if (IsWholeStateCache(cache.first->kv[i].first)) {
+                    context->pastKeyValues[i].first.CopyFrom(states[i].first);
+                    context->pastKeyValues[i].second.CopyFrom(states[i].second);
                 } else {
                     Split(cache.first->kv[i].first, 1, 0, len, context->pastKeyValues[i].first);
                     Split(cache.first->kv[i].second, 1, 0, len, context->pastKeyValues[i].second);
@@ -1027,6 +1991,10 @@ printf("len = %d, spend = %f s. tokens / s = %f\n", (int)total, spend, (float)to
             context->currentTokens.erase(context->currentTokens.begin(), context->currentTokens.begin() + len);
             context->cacheLen = len;
         }
+        metrics.locker.lock();
+        metrics.requests++;
+        metrics.prefixCacheHitTokens += context->cacheLen;
+        metrics.locker.unlock();
 
         dictLocker.unlock();
         dictCV.notify_one();
@@ -1263,6 +2231,148 @@ printf("len = %d, spend = %f s. tokens / s = %f\n", (int)total, spend, (float)to
         }
     }
 
+    void basellm::BuildDecoderLayerWeights() {
+        auto find = [this](const std::string &name) -> Data* {
+            auto it = weight.weight.find(name);
+            return it == weight.weight.end() ? nullptr : &it->second;
+        };
+        layerWeights.clear();
+        layerWeights.resize(block_cnt);
+        for (int i = 0; i < block_cnt; i++) {
+            std::string pre = "model.layers." + std::to_string(i);
+            DecoderLayerWeights &layer = layerWeights[i];
+            layer.inputNorm = find(pre + ".input_layernorm.weight");
+            layer.postNorm = find(pre + ".post_attention_layernorm.weight");
+            layer.q = find(pre + ".self_attn.q_proj.weight");
+            layer.qBias = find(pre + ".self_attn.q_proj.bias");
+            layer.k = find(pre + ".self_attn.k_proj.weight");
+            layer.kBias = find(pre + ".self_attn.k_proj.bias");
+            layer.v = find(pre + ".self_attn.v_proj.weight");
+            layer.vBias = find(pre + ".self_attn.v_proj.bias");
+            layer.wPack = find(pre + ".self_attn.W_pack.weight");
+            layer.mergeQkv = find(pre + ".self_attn.mergeqkv.weight");
+            layer.o = find(pre + ".self_attn.o_proj.weight");
+            layer.oBias = find(pre + ".self_attn.o_proj.bias");
+            layer.qNorm = find(pre + ".self_attn.q_norm.weight");
+            layer.kNorm = find(pre + ".self_attn.k_norm.weight");
+            layer.gateUp = find(pre + ".mlp.gateup_proj.weight");
+            layer.gate = find(pre + ".mlp.gate_proj.weight");
+            layer.up = find(pre + ".mlp.up_proj.weight");
+            layer.down = find(pre + ".mlp.down_proj.weight");
+            if (layer.mergeQkv != nullptr) {
+                // MergeAttention需要bias的引用, 不存在的bias指向一个共享的空权重 (不向权重表中插入空项)
+                layer.mergeQkvBias = find(pre + ".self_attn.mergeqkv.bias");
+                if (layer.mergeQkvBias == nullptr) {
+                    layer.mergeQkvBias = &emptyLayerBias;
+                }
+                if (layer.oBias == nullptr) {
+                    layer.oBias = &emptyLayerBias;
+                }
+            }
+        }
+        layerWeightsVersion = weight.changeVersion;
+    }
+
+    void basellm::AddLoraAdapter(const std::string &name, std::map <std::string, std::pair <Data, Data> > &loras, float scaling) {
+        AssertInFastLLM(SupportLoraAdapter(), "AddLoraAdapter: model \"" + model_struct + "\" doesn`t support lora adapter.\n");
+        // 同一个基座权重上的各部分lora: (在基座权重中的起始行, loraA, loraB)
+        std::map <Data*, std::vector <std::tuple <int, Data*, Data*> > > parts;
+        for (auto &it : loras) {
+            Data &loraA = it.second.first, &loraB = it.second.second;
+            AssertInFastLLM(loraA.dataType == DataType::FLOAT32 && loraB.dataType == DataType::FLOAT32,
+                            "AddLoraAdapter: lora weights' type should be float32.\n");
+            AssertInFastLLM(loraA.dims.size() == 2 && loraB.dims.size() == 2 && loraA.dims[0] == loraB.dims[1],
+                            "AddLoraAdapter: lora weights' shape mismatch (" + it.first + ").\n");
+            Data *base = nullptr;
+            int rowStart = 0, rows = -1;
+            if (this->weight.weight.find(it.first) != this->weight.weight.end()) {
+                base = &this->weight.weight[it.first];
+                rows = base->dims[0];
+            } else {
+                // 读取时已经被合并进其它权重 (如q, k, v合并为mergeqkv)
+                for (auto &merged : this->mergedWeightParts) {
+                    int offset = 0;
+                    for (auto &part : merged.second) {
+                        if (part.first == it.first && this->weight.weight.find(merged.first) != this->weight.weight.end()) {
+                            base = &this->weight.weight[merged.first];
+                            rowStart = offset;
+                            rows = part.second;
+                        }
+                        offset += part.second;
+                    }
+                }
+            }
+            if (base == nullptr) {
+                ErrorInFastLLM("AddLoraAdapter: can`t find weight " + it.first + ".\n");
+            }
+            AssertInFastLLM(base->dims.size() == 2 && loraA.dims[1] == base->dims[1] && loraB.dims[0] == rows,
+                            "AddLoraAdapter: lora weights' shape mismatch with " + it.first + ".\n");
+            parts[base].push_back(std::make_tuple(rowStart, &loraA, &loraB));
+        }
+
+        std::lock_guard <std::mutex> forwardGuard(this->forwardLocker);
+        std::lock_guard <std::mutex> loraGuard(this->loraLocker);
+        LoraAdapter &adapter = this->loraAdapters[name];
+        adapter.weights.clear();
+        for (auto &it : parts) {
+            int n = it.first->dims[1], m = it.first->dims[0], r = 0;
+            for (auto &part : it.second) {
+                r += std::get <1> (part)->dims[0];
+            }
+            std::vector <float> a, b = std::vector <float> ((size_t)r * m, 0.0f);
+            int rankStart = 0;
+            for (auto &part : it.second) {
+                Data &loraA = *std::get <1> (part), &loraB = *std::get <2> (part);
+                int rowStart = std::get <0> (part), curR = loraA.dims[0], rows = loraB.dims[0];
+                a.insert(a.end(), (float*)loraA.cpuData, (float*)loraA.cpuData + (size_t)curR * n);
+                // loraB转置为[r, out], 放在这一部分对应的行和列上
+                for (int i = 0; i < rows; i++) {
+                    for (int j = 0; j < curR; j++) {
+                        b[(size_t)(rankStart + j) * m + rowStart + i] = ((float*)loraB.cpuData)[(size_t)i * curR + j] * scaling;
+                    }
+                }
+                rankStart += curR;
+            }
+            LoraWeight &lora = adapter.weights[it.first];
+            lora.loraA.CopyFrom(Data(DataType::FLOAT32, {r, n}, a));
+            lora.loraB.CopyFrom(Data(DataType::FLOAT32, {r, m}, b));
+        }
+    }
+
+    bool basellm::GetLoraAdapters(const std::vector <GenerationConfig> &generationConfigs, std::vector <LoraAdapter*> &adapters) {
+        adapters.clear();
+        bool useLora = false;
+        std::lock_guard <std::mutex> loraGuard(this->loraLocker);
+        for (auto &config : generationConfigs) {
+            auto it = config.adapter_name.empty() ? this->loraAdapters.end() : this->loraAdapters.find(config.adapter_name);
+            adapters.push_back(it == this->loraAdapters.end() ? nullptr : &it->second);
+            useLora |= (adapters.back() != nullptr);
+        }
+        if (!useLora) {
+            adapters.clear();
+        }
+        return useLora;
+    }
+
+    void basellm::ApplyLora(const Data &input, Data *baseWeight, Data &output,
+                            const std::vector <LoraAdapter*> &adapters, const std::vector <int> &segLens) {
+        if (adapters.size() == 0) {
+            return;
+        }
+        std::vector <Data*> loraAs, loraBs;
+        bool hasLora = false;
+        for (auto *adapter : adapters) {
+            auto it = adapter == nullptr ? std::unordered_map <Data*, LoraWeight>::iterator() : adapter->weights.find(baseWeight);
+            bool found = adapter != nullptr && it != adapter->weights.end();
+            loraAs.push_back(found ? &it->second.loraA : nullptr);
+            loraBs.push_back(found ? &it->second.loraB : nullptr);
+            hasLora |= found;
+        }
+        if (hasLora) {
+            SegmentLora(input, loraAs, loraBs, segLens, output);
+        }
+    }
+
     void basellm::SetAdapter(const std::string &name) {
         if (weight.peftDict.find(name) == weight.peftDict.end()) {
             ErrorInFastLLM("Can`t find adapter name: " + name);
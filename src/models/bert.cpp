@@ -6,6 +6,7 @@
 #include "utils.h"
 #include <sstream>
 #include <cstring>
+#include <algorithm>
 
 namespace fastllm {
     void BertModel::LoadFromFile(const std::string &fileName) {
@@ -169,31 +170,246 @@ namespace fastllm {
         positionIds.CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {batch, len}, position_ids));
     }
 
+    void BertModel::FillBertInputsVarlen(const std::vector <std::vector <int> > &tokens,
+                            Data &inputIds, Data &tokenTypeIds, Data &positionIds) {
+        std::vector <float> ids, token_type_ids, position_ids;
+        for (int i = 0; i < tokens.size(); i++) {
+            for (int j = 0; j < tokens[i].size(); j++) {
+                ids.push_back(tokens[i][j]);
+                token_type_ids.push_back(0.0f);
+                position_ids.push_back(j);
+            }
+        }
+        int total = ids.size();
+        inputIds.CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {1, total}, ids));
+        tokenTypeIds.CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {1, total}, token_type_ids));
+        positionIds.CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {1, total}, position_ids));
+    }
+
+    std::vector <std::vector <float> > BertModel::ForwardVarlen(const std::vector <std::vector <int> > &tokens, bool normalize) {
+        Data inputIds, tokenTypeIds, positionIds;
+        FillBertInputsVarlen(tokens, inputIds, tokenTypeIds, positionIds);
+        std::vector <int> seqLens;
+        for (auto &it : tokens) {
+            seqLens.push_back(it.size());
+        }
+        int total = inputIds.dims[1];
+
+        // embedding
+        Data inputEmbeddings, tokenTypeEmbeddings, positionIdEmbeddings;
+        Embedding(inputIds, this->weight["embeddings.word_embeddings.weight"], inputEmbeddings);
+        Embedding(tokenTypeIds, this->weight["embeddings.token_type_embeddings.weight"], tokenTypeEmbeddings);
+        Embedding(positionIds, this->weight["embeddings.position_embeddings.weight"], positionIdEmbeddings);
+        AddTo(inputEmbeddings, tokenTypeEmbeddings);
+        AddTo(inputEmbeddings, positionIdEmbeddings);
+
+        Data hiddenStates;
+        LayerNorm(inputEmbeddings, this->weight["embeddings.LayerNorm.weight"], this->weight["embeddings.LayerNorm.bias"], -1, hiddenStates);
+
+        Data q, k, v, qkv, attnOutput, inter;
+        for (int i = 0; i < this->block_cnt; i++) {
+            std::string pre = "encoder.layer." + std::to_string(i);
+            Linear(hiddenStates, this->weight[pre + ".attention.self.query.weight"], this->weight[pre + ".attention.self.query.bias"], q);
+            Linear(hiddenStates, this->weight[pre + ".attention.self.key.weight"], this->weight[pre + ".attention.self.key.bias"], k);
+            Linear(hiddenStates, this->weight[pre + ".attention.self.value.weight"], this->weight[pre + ".attention.self.value.bias"], v);
+
+            std::vector <int> qdims = {total, this->num_attention_heads, this->head_dim};
+            q.Reshape(qdims);
+            k.Reshape(qdims);
+            v.Reshape(qdims);
+            AttentionVarlen(q, k, v, seqLens, qkv, 1.0 / sqrt(this->head_dim));
+            qkv.Reshape({1, total, -1});
+
+            Linear(qkv, this->weight[pre + ".attention.output.dense.weight"], this->weight[pre + ".attention.output.dense.bias"], attnOutput);
+            AddTo(hiddenStates, attnOutput);
+            LayerNorm(hiddenStates, this->weight[pre + ".attention.output.LayerNorm.weight"], this->weight[pre + ".attention.output.LayerNorm.bias"], -1, hiddenStates);
+
+            if (CanRunLinearEx(LinearExType::ExGelu)) {
+                LinearEx(hiddenStates, this->weight[pre + ".intermediate.dense.weight"], this->weight[pre + ".intermediate.dense.bias"], inter, LinearExType::ExGelu);
+            } else {
+                Linear(hiddenStates, this->weight[pre + ".intermediate.dense.weight"], this->weight[pre + ".intermediate.dense.bias"], inter);
+                Gelu(inter, inter);
+            }
+
+            Linear(inter, this->weight[pre + ".output.dense.weight"], this->weight[pre + ".output.dense.bias"], attnOutput);
+            AddTo(hiddenStates, attnOutput);
+            LayerNorm(hiddenStates, this->weight[pre + ".output.LayerNorm.weight"], this->weight[pre + ".output.LayerNorm.bias"], -1, hiddenStates);
+        }
+
+        // 取每个序列的第一个token (和ForwardAll一致, 不使用pooler的输出)
+        hiddenStates.ToDevice(DataDevice::CPU);
+        float *fret = (float*)hiddenStates.cpuData;
+        int outputDim = hiddenStates.dims[2];
+        std::vector <std::vector <float> > ret;
+        ret.resize(tokens.size(), std::vector <float> (outputDim, 0.0f));
+        for (int i = 0, off = 0; i < tokens.size(); off += seqLens[i], i++) {
+            memcpy(ret[i].data(), fret + (size_t)off * outputDim, outputDim * sizeof(float));
+            if (normalize) {
+                Normalize(ret[i].data(), outputDim);
+            }
+        }
+        return ret;
+    }
+
+    std::vector <std::vector <float> > BertModel::ForwardTokens(const std::vector <std::vector <int> > &tokens, bool normalize) {
+        std::vector <int> order;
+        for (int i = 0; i < tokens.size(); i++) {
+            order.push_back(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [&tokens](int a, int b) {
+            return tokens[a].size() < tokens[b].size();
+        });
+
+        bool varlen = this->useVarlen && CanRunAttentionVarlen();
+        std::vector <std::vector <float> > ret;
+        ret.resize(tokens.size());
+        for (int st = 0; st < order.size(); ) {
+            // 长度从小到大装桶, 至少放一个序列
+            int end = st;
+            long long sumLen = 0;
+            while (end < order.size()) {
+                int len = tokens[order[end]].size();
+                long long need = varlen ? sumLen + len : (long long)len * (end - st + 1);
+                if (end > st && need > this->maxBatchTokens) {
+                    break;
+                }
+                sumLen += len;
+                end++;
+            }
+
+            std::vector <std::vector <int> > batchTokens;
+            for (int i = st; i < end; i++) {
+                batchTokens.push_back(tokens[order[i]]);
+            }
+            std::vector <std::vector <float> > cur;
+            if (varlen) {
+                cur = ForwardVarlen(batchTokens, normalize);
+            } else {
+                fastllm::Data inputIds, attentionMask, tokenTypeIds, positionIds;
+                FillBertInputsBatch(batchTokens, inputIds, attentionMask, tokenTypeIds, positionIds);
+                cur = ForwardAll(inputIds, attentionMask, tokenTypeIds, positionIds, normalize);
+            }
+            for (int i = st; i < end; i++) {
+                ret[order[i]] = std::move(cur[i - st]);
+            }
+            st = end;
+        }
+        return ret;
+    }
+
+    std::future <std::vector <float> > BertModel::LaunchEmbedding(const std::vector <int> &tokens, bool normalize) {
+        EmbeddingRequest *request = new EmbeddingRequest();
+        request->tokens = tokens;
+        request->normalize = normalize;
+        request->arriveTime = std::chrono::system_clock::now();
+        std::future <std::vector <float> > ret = request->result.get_future();
+
+        std::unique_lock <std::mutex> lock(embeddingLocker);
+        if (embeddingLoop == nullptr) {
+            stopEmbeddingLoop = false;
+            embeddingLoop = new std::thread([](BertModel *model) {
+                model->EmbeddingLoop();
+            }, this);
+        }
+        embeddingQueue.push_back(request);
+        embeddingCV.notify_one();
+        return ret;
+    }
+
+    void BertModel::SetEmbeddingBatchWait(int ms) {
+        std::unique_lock <std::mutex> lock(embeddingLocker);
+        maxBatchWaitMs = std::max(0, ms);
+        embeddingCV.notify_one();
+    }
+
+    void BertModel::StopEmbeddingLoop() {
+        {
+            std::unique_lock <std::mutex> lock(embeddingLocker);
+            if (embeddingLoop == nullptr) {
+                return;
+            }
+            stopEmbeddingLoop = true;
+            embeddingCV.notify_all();
+        }
+        embeddingLoop->join();
+        delete embeddingLoop;
+        embeddingLoop = nullptr;
+    }
+
+    void BertModel::EmbeddingLoop() {
+        while (true) {
+            std::vector <EmbeddingRequest*> requests;
+            {
+                std::unique_lock <std::mutex> lock(embeddingLocker);
+                embeddingCV.wait(lock, [this]() { return stopEmbeddingLoop || !embeddingQueue.empty(); });
+                if (embeddingQueue.empty()) {
+                    break;
+                }
+                // 凑batch: 等到队列中的token数达到maxBatchTokens, 或者最早的请求已经等待了maxBatchWaitMs
+                while (!stopEmbeddingLoop) {
+                    long long queueTokens = 0;
+                    for (auto *it : embeddingQueue) {
+                        queueTokens += it->tokens.size();
+                    }
+                    auto deadline = embeddingQueue.front()->arriveTime + std::chrono::milliseconds(maxBatchWaitMs);
+                    if (queueTokens >= maxBatchTokens || embeddingCV.wait_until(lock, deadline) == std::cv_status::timeout) {
+                        break;
+                    }
+                }
+                // 按到达顺序取出请求, 至少取一个
+                long long batchTokens = 0;
+                while (!embeddingQueue.empty()) {
+                    int len = embeddingQueue.front()->tokens.size();
+                    if (requests.size() > 0 && batchTokens + len > maxBatchTokens) {
+                        break;
+                    }
+                    batchTokens += len;
+                    requests.push_back(embeddingQueue.front());
+                    embeddingQueue.pop_front();
+                }
+            }
+
+            std::vector <std::vector <int> > tokens;
+            for (auto *it : requests) {
+                tokens.push_back(it->tokens);
+            }
+            auto ret = ForwardTokens(tokens, false);
+            for (int i = 0; i < requests.size(); i++) {
+                if (requests[i]->normalize) {
+                    Normalize(ret[i].data(), ret[i].size());
+                }
+                requests[i]->result.set_value(std::move(ret[i]));
+                delete requests[i];
+            }
+        }
+    }
+
     std::vector <float> BertModel::ComputeScore(std::vector <std::vector <int> > tokens) {
-        fastllm::Data inputIds, attentionMask, tokenTypeIds, positionIds;
-        FillBertInputsBatch(tokens, inputIds, attentionMask, tokenTypeIds, positionIds);
-        auto ret = ForwardAll(inputIds, attentionMask, tokenTypeIds, positionIds, false);
+        std::vector <std::future <std::vector <float> > > futures;
+        for (int i = 0; i < tokens.size(); i++) {
+            futures.push_back(LaunchEmbedding(tokens[i], false));
+        }
         std::vector <float> lastRet;
-        for (int i = 0; i < ret.size(); i++) {
-            lastRet.push_back(ret[i][0]);
+        for (int i = 0; i < futures.size(); i++) {
+            lastRet.push_back(futures[i].get()[0]);
         }
         return lastRet;
     }
 
     std::vector <float> BertModel::EmbeddingSentence(const std::vector <int> &tokens, bool normalize) {
-        std::vector <std::vector <int> > tokenss;
-        tokenss.push_back(tokens);
-        return EmbeddingSentenceBatch(tokenss, normalize)[0];
+        return LaunchEmbedding(tokens, normalize).get();
     }
 
     std::vector <std::vector <float> > BertModel::EmbeddingSentenceBatch(const std::vector <std::vector <int> > &tokens, bool normalize) {
-        fastllm::Data inputIds, attentionMask, tokenTypeIds, positionIds;
-        FillBertInputsBatch(tokens, inputIds, attentionMask, tokenTypeIds, positionIds);
-        int batch = tokens.size(), len = 0;
-        for (int i = 0; i < batch; i++) {
-            len = std::max(len, (int)tokens[i].size());
+        std::vector <std::future <std::vector <float> > > futures;
+        for (int i = 0; i < tokens.size(); i++) {
+            futures.push_back(LaunchEmbedding(tokens[i], normalize));
+        }
+        std::vector <std::vector <float> > ret;
+        for (int i = 0; i < futures.size(); i++) {
+            ret.push_back(futures[i].get());
         }
-        return ForwardAll(inputIds, attentionMask, tokenTypeIds, positionIds, normalize);
+        return ret;
     }
 
     std::vector <float> BertModel::EmbeddingSentence(const std::string &context, bool normalize) {
@@ -213,9 +429,7 @@ namespace fastllm {
             }
             len = std::max(len, (int)tokens[i].size());
         }
-        fastllm::Data inputIds, attentionMask, tokenTypeIds, positionIds;
-        FillBertInputsBatch(tokens, inputIds, attentionMask, tokenTypeIds, positionIds);
-        return ForwardAll(inputIds, attentionMask, tokenTypeIds, positionIds, normalize);
+        return EmbeddingSentenceBatch(tokens, normalize);
     }
 
     void BertModel::WarmUp() {
@@ -451,6 +451,7 @@ namespace fastllm {
                     Split(this->weight[kvWeightName], 1, 0, qk_nope_head_dim, this->weight[kv0Name]);
                     Split(this->weight[kvWeightName], 1, qk_nope_head_dim, qk_nope_head_dim + v_head_dim, this->weight[kv1Name]);
                     this->weight.weight.erase(kvWeightName);
+                    this->weight.MarkChanged();
                 }
 
                 Data &kv0 = this->weight[kv0Name];
@@ -577,10 +578,18 @@ namespace fastllm {
             Data oBias = (weight.weight.find(oBiasName) != weight.weight.end()) ? weight[oBiasName] : Data();
             Linear(attenOutput, weight[oWeightName], oBias, attenLastOutput);
 
-            AddTo(hiddenStates, attenLastOutput);
-            RMSNorm(hiddenStates, this->weight["model.layers." + std::to_string(i) + ".post_attention_layernorm.weight"], rms_norm_eps, attenInput);            
+            std::string postNormWeightName = "model.layers." + std::to_string(i) + ".post_attention_layernorm.weight";
+            std::string gateProjWeightName = "model.layers." + std::to_string(i) + ".mlp.gate_proj.weight";
+            bool denseMlp = weight.weight.find(gateProjWeightName) != weight.weight.end();
+            if (denseMlp && CanRunAddRMSNormQuant(hiddenStates, weight[gateProjWeightName])) {
+                // 残差相加, RMSNorm, mlp输入的量化一次完成 (moe层的输入由MergeMOE自己处理)
+                AddRMSNormQuant(hiddenStates, attenLastOutput, weight[postNormWeightName], rms_norm_eps, weight[gateProjWeightName], attenInput);
+            } else {
+                AddTo(hiddenStates, attenLastOutput);
+                RMSNorm(hiddenStates, weight[postNormWeightName], rms_norm_eps, attenInput);
+            }
             // 2. moe mlp
-            if (weight.weight.find("model.layers." + std::to_string(i) + ".mlp.gate_proj.weight") != weight.weight.end()) {
+            if (denseMlp) {
                 if (CanRunLinearEx(LinearExType::ExSilu)) {
                     LinearEx(attenInput, weight["model.layers." + std::to_string(i) + ".mlp.gate_proj.weight"], Data(), w1, LinearExType::ExSilu);
                 } else {
@@ -1182,10 +1191,18 @@ namespace fastllm {
 
             Data oBias = (weight.weight.find(oBiasName) != weight.weight.end()) ? weight[oBiasName] : Data();
             Linear(attenOutput, weight[oWeightName], oBias, attenLastOutput);
-            AddTo(hiddenStates, attenLastOutput);
-            RMSNorm(hiddenStates, this->weight["model.layers." + std::to_string(i) + ".post_attention_layernorm.weight"], rms_norm_eps, attenInput);
+            std::string postNormWeightName = "model.layers." + std::to_string(i) + ".post_attention_layernorm.weight";
+            std::string gateProjWeightName = "model.layers." + std::to_string(i) + ".mlp.gate_proj.weight";
+            bool denseMlp = weight.weight.find(gateProjWeightName) != weight.weight.end();
+            if (denseMlp && CanRunAddRMSNormQuant(hiddenStates, weight[gateProjWeightName])) {
+                // 残差相加, RMSNorm, mlp输入的量化一次完成 (moe层的输入由MergeMOE自己处理)
+                AddRMSNormQuant(hiddenStates, attenLastOutput, weight[postNormWeightName], rms_norm_eps, weight[gateProjWeightName], attenInput);
+            } else {
+                AddTo(hiddenStates, attenLastOutput);
+                RMSNorm(hiddenStates, weight[postNormWeightName], rms_norm_eps, attenInput);
+            }
             // 2. moe mlp
-            if (weight.weight.find("model.layers." + std::to_string(i) + ".mlp.gate_proj.weight") != weight.weight.end()) {
+            if (denseMlp) {
                 if (CanRunLinearEx(LinearExType::ExSilu)) {
                     LinearEx(attenInput, weight["model.layers." + std::to_string(i) + ".mlp.gate_proj.weight"], Data(), w1, LinearExType::ExSilu);
                 } else {
@@ -12,6 +12,8 @@
 
 #include <cstring>
 
+#include "json11.hpp"
+
 #ifdef USE_CUDA
 #include "fastllm-cuda.cuh"
 #endif
@@ -115,6 +117,36 @@ namespace fastllm {
         if (this->weight.dicts.find("rope_scaling.factor") != this->weight.dicts.end()) {
             rope_factor = atof(this->weight.dicts["rope_scaling.factor"].c_str());
         }
+        if (this->weight.dicts.find("sliding_window") != this->weight.dicts.end()) {
+            sliding_window = atoi(this->weight.dicts["sliding_window"].c_str());
+        }
+        isSlidingLayer = std::vector <bool> (block_cnt, false);
+        if (sliding_window > 0) {
+            if (this->weight.dicts.find("layer_types") != this->weight.dicts.end()) {
+                std::string error;
+                json11::Json layerTypes = json11::Json::parse(this->weight.dicts["layer_types"], error);
+                for (int i = 0; i < block_cnt && i < layerTypes.array_items().size(); i++) {
+                    isSlidingLayer[i] = (layerTypes.array_items()[i].string_value() == "sliding_attention");
+                }
+            } else {
+                // 没有layer_types时按照gpt-oss的默认配置: 偶数层是滑动窗口层
+                for (int i = 0; i < block_cnt; i += 2) {
+                    isSlidingLayer[i] = true;
+                }
+            }
+        }
+        // 滑动窗口层的KV Cache大小是固定的, 调度时只需要统计full attention层的KV Cache
+        int fullLayers = 0;
+        for (int i = 0; i < block_cnt; i++) {
+            if (!isSlidingLayer[i]) {
+                if (fullLayers == 0) {
+                    this->kvCacheId = i;
+                }
+                fullLayers++;
+            }
+        }
+        elementsInKVCachePerToken = (long long)fullLayers * 2 * num_key_value_heads * head_dim;
+
         std::pair<std::vector<float>, std::vector<float>> &&pair = this->UpdateRotaryPosEmb(rope_base, rope_factor);
         sinData.ToDevice(DataDevice::CPU);
         cosData.ToDevice(DataDevice::CPU);
@@ -222,6 +254,78 @@ namespace fastllm {
         return std::make_pair(fsin, fcos);
     }
 
+    void RingKVCacheWrite(Data &cache, Data &cur, int pos, int window) {
+        if (cache.dims.size() == 0) {
+            if (cache.expansionDims.size() == 0 || cache.expansionDims[1] < window) {
+                cache.Expansion({cur.dims[0], window, cur.dims[2]});
+            }
+        } else if (cache.expansionDims.size() == 0 || cache.expansionDims[1] < window) {
+            std::vector <int> dims = cache.dims;
+            dims[1] = window;
+            cache.Expansion(dims);
+        }
+        cache.slidingWindow = window;
+
+        int len = cur.dims[1];
+        Data last, part;
+        Data *input = &cur;
+        if (len >= window) {
+            // 整个窗口都会被覆盖, 只需要写入最后window个token
+            if (len > window) {
+                Split(cur, 1, len - window, len, last);
+                input = &last;
+                pos += len - window;
+                len = window;
+            }
+            cache.Resize({cur.dims[0], window, cur.dims[2]});
+        }
+
+        // 写入的位置最多绕回一次, 所以最多分成两段
+        for (int st = 0; st < len; ) {
+            int slot = (pos + st) % window;
+            int curLen = std::min(len - st, window - slot);
+            Data *seg = input;
+            if (curLen != len) {
+                Split(*input, 1, st, st + curLen, part);
+                seg = &part;
+            }
+            std::vector <int> dims = cache.dims;
+            int cacheLen = dims.size() > 0 ? dims[1] : 0;
+            AssertInFastLLM(slot <= cacheLen, "RingKVCacheWrite error: position is not continuous.\n");
+            if (slot < cacheLen) {
+                // 覆盖已经滑出窗口的token: 先把长度设为slot, CatDirect写入之后再恢复长度
+                std::vector <int> writeDims = dims;
+                writeDims[1] = slot;
+                cache.Resize(writeDims);
+            }
+            CatDirect(cache, *seg, 1);
+            if (cache.dims[1] < cacheLen) {
+                cache.Resize(dims);
+            }
+            st += curLen;
+        }
+    }
+
+    Data SlidingWindowMask(int pos, int cacheLen, int seqLen, int window) {
+        int keyLen = cacheLen + seqLen;
+        std::vector <int> keyPos;
+        for (int j = 0; j < cacheLen; j++) {
+            keyPos.push_back(window > 0 ? pos - 1 - (pos - 1 - j) % window : j);
+        }
+        for (int j = 0; j < seqLen; j++) {
+            keyPos.push_back(pos + j);
+        }
+        std::vector <float> mask = std::vector <float> ((long long)seqLen * keyLen, 0.0f);
+        for (int i = 0; i < seqLen; i++) {
+            for (int j = 0; j < keyLen; j++) {
+                if (keyPos[j] > pos + i || (window > 0 && keyPos[j] <= pos + i - window)) {
+                    mask[(long long)i * keyLen + j] = 1.0f;
+                }
+            }
+        }
+        return Data(DataType::FLOAT32, {seqLen, keyLen}, mask);
+    }
+
     int GptOssModel::Forward(const fastllm::Data &inputIds, const fastllm::Data &attentionMask,
                             const fastllm::Data &positionIds, std::vector<std::pair<Data, Data>> &pastKeyValues,
                             const GenerationConfig &generationConfig, const LastTokensManager &lastTokens,
@@ -270,6 +374,16 @@ namespace fastllm {
         
         Data attenInputTemp;
         bool cudaSe = GetCudaSharedExpert();
+
+        // 滑动窗口层需要当前输入的起始位置来定位环形KV Cache (只在batch = 1时使用环形KV Cache)
+        int startPos = 0;
+        if (sliding_window > 0 && batch == 1) {
+            Data cpuPositionIds;
+            cpuPositionIds.CopyFrom(positionIds);
+            cpuPositionIds.ToDevice(DataDevice::CPU);
+            startPos = (int)(((float*)cpuPositionIds.cpuData)[0] + 1e-3);
+        }
+        Data windowMask, causalMask;
         
         for (int i = 0; i < block_cnt; i++) {
             bool canRunExSilu = CanRunLinearEx(LinearExType::ExSilu);
@@ -364,43 +478,74 @@ namespace fastllm {
                 k.Reshape(qkvSize);
                 v.Reshape(qkvSize);
 
-                int unitLen = 64;
-    #ifdef USE_CUDA
-                unitLen = 128;
-    #endif
-                while ((pastKey.dims.size() == 0 && (pastKey.expansionDims.size() == 0 || k.dims[1] > pastKey.expansionDims[1]))
-                    || (pastKey.dims.size() > 0 && pastKey.dims[1] + k.dims[1] > pastKey.expansionDims[1])) {
-                    std::vector <int> newDims;
-                    if (pastKey.Count(0) == 0 || pastKey.dims.size() == 0) {
-                        newDims = std::vector <int> {k.dims[0], ((k.dims[1] - 1) / unitLen + 1) * unitLen, k.dims[2]};
-                    } else {
-                        newDims = pastKey.dims;
-                        newDims[1] += ((k.dims[1] - 1) / unitLen + 1) * unitLen;
+                int window = (batch == 1 && isSlidingLayer[i]) ? sliding_window : 0;
+                Data windowKey, windowValue, emptyMask;
+                Data *attnKey = &pastKey, *attnValue = &pastValue;
+                const Data *attnMask = &attentionMask;
+                if (window > 0) {
+                    // 滑动窗口层: 当前输入和环形cache中的token一起计算attention, 然后把当前输入写入环形cache
+                    int cacheLen = pastKey.dims.size() > 0 ? pastKey.dims[1] : 0;
+                    attnMask = &emptyMask;
+                    if (seqlen > 1) {
+                        Cat(pastKey, k, 1, windowKey);
+                        Cat(pastValue, v, 1, windowValue);
+                        attnKey = &windowKey;
+                        attnValue = &windowValue;
+                        if (windowMask.dims.size() == 0) {
+                            windowMask.CopyFrom(SlidingWindowMask(startPos, cacheLen, seqlen, window));
+                        }
+                        attnMask = &windowMask;
                     }
-                    pastKey.Expansion(newDims);
-                }
-                while ((pastValue.dims.size() == 0 && (pastValue.expansionDims.size() == 0 || v.dims[1] > pastValue.expansionDims[1]))
-                    || (pastValue.dims.size() > 0 && pastValue.dims[1] + v.dims[1] > pastValue.expansionDims[1])) {
-                    std::vector <int> newDims;
-                    if (pastValue.Count(0) == 0 || pastValue.dims.size() == 0) {
-                        newDims = std::vector <int> {v.dims[0], ((v.dims[1] - 1) / unitLen + 1) * unitLen, v.dims[2]};
-                    } else {
-                        newDims = pastValue.dims;
-                        newDims[1] += ((v.dims[1] - 1) / unitLen + 1) * unitLen;
+                    RingKVCacheWrite(pastKey, k, startPos, window);
+                    RingKVCacheWrite(pastValue, v, startPos, window);
+                } else {
+                    int unitLen = 64;
+        #ifdef USE_CUDA
+                    unitLen = 128;
+        #endif
+                    while ((pastKey.dims.size() == 0 && (pastKey.expansionDims.size() == 0 || k.dims[1] > pastKey.expansionDims[1]))
+                        || (pastKey.dims.size() > 0 && pastKey.dims[1] + k.dims[1] > pastKey.expansionDims[1])) {
+                        std::vector <int> newDims;
+                        if (pastKey.Count(0) == 0 || pastKey.dims.size() == 0) {
+                            newDims = std::vector <int> {k.dims[0], ((k.dims[1] - 1) / unitLen + 1) * unitLen, k.dims[2]};
+                        } else {
+                            newDims = pastKey.dims;
+                            newDims[1] += ((k.dims[1] - 1) / unitLen + 1) * unitLen;
+                        }
+                        pastKey.Expansion(newDims);
+                    }
+                    while ((pastValue.dims.size() == 0 && (pastValue.expansionDims.size() == 0 || v.dims[1] > pastValue.expansionDims[1]))
+                        || (pastValue.dims.size() > 0 && pastValue.dims[1] + v.dims[1] > pastValue.expansionDims[1])) {
+                        std::vector <int> newDims;
+                        if (pastValue.Count(0) == 0 || pastValue.dims.size() == 0) {
+                            newDims = std::vector <int> {v.dims[0], ((v.dims[1] - 1) / unitLen + 1) * unitLen, v.dims[2]};
+                        } else {
+                            newDims = pastValue.dims;
+                            newDims[1] += ((v.dims[1] - 1) / unitLen + 1) * unitLen;
+                        }
+                        pastValue.Expansion(newDims);
                     }
-                    pastValue.Expansion(newDims);
-                }
 
-                CatDirect(pastKey, k, 1);
-                CatDirect(pastValue, v, 1);
+                    CatDirect(pastKey, k, 1);
+                    CatDirect(pastValue, v, 1);
+                    if (seqlen > 1 && batch == 1 && attentionMask.dims.size() == 0) {
+                        // 很长的输入不会传入mask, 这里需要自己生成causal mask
+                        if (causalMask.dims.size() == 0) {
+                            causalMask.CopyFrom(SlidingWindowMask(pastKey.dims[1] - seqlen, pastKey.dims[1] - seqlen, seqlen, 0));
+                        }
+                        attnMask = &causalMask;
+                    }
+                }
 
                 // 1.2 Attention
                 if (false) {
-                    Attention(q, pastKey, pastValue, attentionMask, qkv, q.dims[0] / pastKey.dims[0], 1.0 / sqrt(head_dim), 1);
+                    Attention(q, *attnKey, *attnValue, *attnMask, qkv, q.dims[0] / attnKey->dims[0], 1.0 / sqrt(head_dim), 1);
                 } else {
-                    MatMulTransB(q, pastKey, attenWeights, 1.0 / sqrt(head_dim), q.dims[0] / pastKey.dims[0]);
+                    MatMulTransB(q, *attnKey, attenWeights, 1.0 / sqrt(head_dim), q.dims[0] / attnKey->dims[0]);
                     attenWeights.Reshape({1, attenWeights.dims[0], attenWeights.dims[1], attenWeights.dims[2]});
-                    AttentionMask(attenWeights, attentionMask, -10000);
+                    if (attnMask->dims.size() > 0) {
+                        AttentionMask(attenWeights, *attnMask, -10000);
+                    }
 
                     Data curSinks0, curSinks, combinedLogits;
                     weight[sinkWeightName].Reshape({1, -1, 1, 1});
@@ -410,7 +555,7 @@ namespace fastllm {
                     Cat(attenWeights, curSinks, -1, combinedLogits);
                     Softmax(combinedLogits, combinedLogits, -1);
                     Split(combinedLogits, -1, 0, combinedLogits.dims.back() - 1, attenWeights);
-                    MatMul(attenWeights, pastValue, qkv, 1.f, attenWeights.dims[1] / pastValue.dims[0]);
+                    MatMul(attenWeights, *attnValue, qkv, 1.f, attenWeights.dims[1] / attnValue->dims[0]);
                     qkv.Reshape({qkv.dims[1], qkv.dims[2], qkv.dims[3]});
                 }
 
@@ -457,6 +602,7 @@ namespace fastllm {
                     weight.weight.erase(gateUpBiasName);
                     weight.weight.erase(downWeightName);
                     weight.weight.erase(downBiasName);
+                    weight.MarkChanged();
                 }
 
                 // 这里是moe mlp
@@ -673,6 +819,17 @@ namespace fastllm {
             }
         }
 
+        // 每个请求的起始位置, 用来定位滑动窗口层的环形KV Cache
+        std::vector <int> startPositions;
+        if (sliding_window > 0) {
+            for (int b = 0; b < batch; b++) {
+                Data cpuPositionIds;
+                cpuPositionIds.CopyFrom(*positionIds[b]);
+                cpuPositionIds.ToDevice(DataDevice::CPU);
+                startPositions.push_back((int)(((float*)cpuPositionIds.cpuData)[0] + 1e-3));
+            }
+        }
+
         Embedding(inputIds, this->weight["model.embed_tokens.weight"], hiddenStates);
 
         int seqlen = hiddenStates.dims[1];
@@ -680,6 +837,7 @@ namespace fastllm {
         bool cudaSe = GetCudaSharedExpert();
 
         for (int i = 0; i < block_cnt; i++) {
+            int window = isSlidingLayer[i] ? sliding_window : 0;
             ApplyDeviceMap(this->deviceMap, i + 1, block_cnt);
             RMSNorm(hiddenStates, this->weight["model.layers." + std::to_string(i) + ".input_layernorm.weight"],
                     rms_norm_eps, attenInput);
@@ -742,7 +900,7 @@ namespace fastllm {
                     cosDataPtr = new Data(DataType::FLOAT32, {(int)this->cos.size(), (int)this->cos[0].size()}, pair.second);
             }
 
-            for (int b = 0; b < batch; b++) {
+            for (int b = 0; b < batch && window == 0; b++) {
                 Data &pastKey = *pastKeyValues[b * block_cnt + i].first, &pastValue = *pastKeyValues[b * block_cnt + i].second;
                 int curLen = seqLens[b];
                 
@@ -846,8 +1004,16 @@ namespace fastllm {
                     pointersK[b] = (&curKs[b]);
                     pointersV[b] = (&curVs[b]);
                 }
-                CatDirectBatch(keys, pointersK, 1);
-                CatDirectBatch(values, pointersV, 1);
+                if (window == 0) {
+                    CatDirectBatch(keys, pointersK, 1);
+                    CatDirectBatch(values, pointersV, 1);
+                } else if (all1 && batch > 1) {
+                    // 滑动窗口层的decode: 直接写入环形cache, cache中的token就是窗口内的全部token
+                    for (int b = 0; b < batch; b++) {
+                        RingKVCacheWrite(*keys[b], curKs[b], startPositions[b], window);
+                        RingKVCacheWrite(*values[b], curVs[b], startPositions[b], window);
+                    }
+                }
             }
 
             if (all1 && batch > 1) {
@@ -858,7 +1024,7 @@ namespace fastllm {
                     qs[b] = (&curQs[b]);
                     keys[b] = (pastKeyValues[b * block_cnt + i].first);
                     values[b] = (pastKeyValues[b * block_cnt + i].second);
-                    masks[b] = attentionMask[b];
+                    masks[b] = (window == 0 ? attentionMask[b] : nullptr);
                     curContextLayer[b].FakeFrom(attenOutput, b * embed_dim * attenOutput.unitSize);
                     contexts[b] = (&curContextLayer[b]);
                 }
@@ -875,7 +1041,24 @@ namespace fastllm {
                     curLen += seqLens[b];
 
                     // 1.2 Attention
-                    if (attentionMask[b] == nullptr) {
+                    if (window > 0) {
+                        // 滑动窗口层: 当前输入和环形cache中的token一起计算attention, 然后把当前输入写入环形cache
+                        int cacheLen = pastKey.dims.size() > 0 ? pastKey.dims[1] : 0;
+                        if (seqLens[b] > 1) {
+                            Data windowKey, windowValue;
+                            Cat(pastKey, k, 1, windowKey);
+                            Cat(pastValue, v, 1, windowValue);
+                            Data windowMask = SlidingWindowMask(startPositions[b], cacheLen, seqLens[b], window);
+                            ToDataType(windowMask, q.dataType);
+                            Attention(q, windowKey, windowValue, windowMask, curAttenOutput, q.dims[0] / windowKey.dims[0], 1.0 / sqrt(head_dim), 1);
+                            RingKVCacheWrite(pastKey, k, startPositions[b], window);
+                            RingKVCacheWrite(pastValue, v, startPositions[b], window);
+                        } else {
+                            RingKVCacheWrite(pastKey, k, startPositions[b], window);
+                            RingKVCacheWrite(pastValue, v, startPositions[b], window);
+                            Attention(q, pastKey, pastValue, Data(), curAttenOutput, q.dims[0] / pastKey.dims[0], 1.0 / sqrt(head_dim), 1);
+                        }
+                    } else if (attentionMask[b] == nullptr) {
                         Attention(q, pastKey, pastValue, Data(), curAttenOutput, q.dims[0] / pastKey.dims[0], 1.0 / sqrt(head_dim), 1);
                     } else {
                         Attention(q, pastKey, pastValue, *attentionMask[b], curAttenOutput, q.dims[0] / pastKey.dims[0], 1.0 / sqrt(head_dim), 1);
@@ -1193,7 +1376,7 @@ return;
         }
         Forward(inputIds, attentionMask, positionIds, pastKeyValues);
         this->num_experts_per_tok = oldTopk;
-        elementsInKVCachePerToken = (long long)block_cnt * 
+        elementsInKVCachePerToken = (long long)(block_cnt - std::count(isSlidingLayer.begin(), isSlidingLayer.end(), true)) * 
             (pastKeyValues[0].first.dims[0] * pastKeyValues[0].first.dims[2] + 
              pastKeyValues[0].second.dims[0] * pastKeyValues[0].second.dims[2]);
         printf("finish.\n");
@@ -20,6 +20,7 @@ namespace fastllm {
     Internlm2Model::Internlm2Model()
         : LlamaModel() {
         this->model_type = "internlm";
+        this->canDoSpeculative = false; // 自己实现了Forward, 没有支持outputLogitsTails
         rotary_dim = 128;
         weight.embeddingNames.insert("model.tok_embeddings.weight");
         weight.linearNames = {"model.layers.*.attention.wq.weight", "model.layers.*.attention.wk.weight", "model.layers.*.attention.wv.weight", 
@@ -82,6 +83,7 @@ namespace fastllm {
 
                 weight.weight.erase(w1WeightName);
                 weight.weight.erase(w3WeightName);
+                weight.MarkChanged();
             }
 
             this->mergeSwiglu = canMerge;            
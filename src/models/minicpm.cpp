@@ -20,6 +20,7 @@ namespace fastllm {
     
     MiniCpmModel::MiniCpmModel() {
         this->model_type = "minicpm";
+        this->canDoSpeculative = false; // 自己实现了Forward, 没有支持outputLogitsTails
 
         this->history_sep = "";
         this->pre_prompt = "";
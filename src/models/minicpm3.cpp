@@ -20,6 +20,7 @@ namespace fastllm {
     
     MiniCpm3Model::MiniCpm3Model() {
         this->model_type = "minicpm3";
+        this->canDoSpeculative = false; // 自己实现了Forward, 没有支持outputLogitsTails
 
         this->history_sep = "";
         this->pre_prompt = "";
@@ -182,6 +182,7 @@ namespace fastllm {
                     weight.weight.erase(qBiasName);
                     weight.weight.erase(kBiasName);
                     weight.weight.erase(vBiasName);
+                    weight.MarkChanged();
                 }
             }
 
@@ -229,6 +230,7 @@ namespace fastllm {
 
                     weight.weight.erase(w1WeightName);
                     weight.weight.erase(w3WeightName);
+                    weight.MarkChanged();
                 }
 
                 this->mergeSwiglu = canMerge;
@@ -20,6 +20,7 @@ namespace fastllm {
     Phi3Model::Phi3Model()
         : LlamaModel() {
         this->model_type = "phi3";
+        this->canDoSpeculative = false; // 自己实现了Forward, 没有支持outputLogitsTails
         rotary_dim = 128;
         weight.embeddingNames.insert("model.embed_tokens.weight");
         weight.linearNames = {
@@ -23,6 +23,7 @@ namespace fastllm {
     Qwen3Model::Qwen3Model() {
         this->model_struct = "llama";
         this->model_type = "qwen3";
+        this->canDoSpeculative = true;
 
         // 默认使用 llama3 的提示词和instruction
         this->pre_prompt="<|begin_of_text|><|start_header_id|>system<|end_header_id|>\nYou are a helpful assistant.<|eot_id|>";
@@ -148,31 +149,30 @@ namespace fastllm {
         Data* sinDataPtr = &sinData;
         Data* cosDataPtr = &cosData;
 
+        if (LayerWeightsExpired()) {
+            BuildDecoderLayerWeights();
+        }
+        Data emptyData; // 不存在的bias
+        // 每个请求使用的LoRA adapter, 单batch的forward中所有行使用同一个配置; 使用adapter时不走融合了Linear的算子
+        std::vector <LoraAdapter*> curAdapters;
+        std::vector <int> loraSegLens = {(int)inputIds.Count(0)};
+        bool useLora = GetLoraAdapters({generationConfig}, curAdapters);
         Embedding(inputIds, this->weight["model.embed_tokens.weight"], hiddenStates);
         ToDataType(hiddenStates, this->dataType);
 
         int seqlen = hiddenStates.dims[1];
         for (int i = 0; i < block_cnt; i++) {
             ApplyDeviceMap(this->deviceMap, i + 1, block_cnt);
-            RMSNorm(hiddenStates, this->weight["model.layers." + std::to_string(i) + ".input_layernorm.weight"],
-                    rms_norm_eps, attenInput);
-            std::string qWeightName = "model.layers." + std::to_string(i) + ".self_attn.q_proj.weight";
-            std::string qBiasName = "model.layers." + std::to_string(i) + ".self_attn.q_proj.bias";
-            std::string kWeightName = "model.layers." + std::to_string(i) + ".self_attn.k_proj.weight";
-            std::string kBiasName = "model.layers." + std::to_string(i) + ".self_attn.k_proj.bias";
-            std::string vWeightName = "model.layers." + std::to_string(i) + ".self_attn.v_proj.weight";
-            std::string vBiasName = "model.layers." + std::to_string(i) + ".self_attn.v_proj.bias";
-            std::string qkvWeightName = "model.layers." + std::to_string(i) + ".self_attn.W_pack.weight";
-            std::string oWeightName = "model.layers." + std::to_string(i) + ".self_attn.o_proj.weight";
-            std::string oBiasName = "model.layers." + std::to_string(i) + ".self_attn.o_proj.bias";
-            std::string mergeQkvWeightName = "model.layers." + std::to_string(i) + ".self_attn.mergeqkv.weight";
-            std::string mergeQkvBiasName = "model.layers." + std::to_string(i) + ".self_attn.mergeqkv.bias";
+            DecoderLayerWeights &layer = layerWeights[i];
+            RMSNorm(hiddenStates, *layer.inputNorm, rms_norm_eps, attenInput);
+
+            Data *attenResidual = nullptr; // attention的输出, 在mlp之前加到hiddenStates上
 
             // 1.1 Get q, k, v
             int bsz = attenInput.dims[0], seqlen = attenInput.dims[1];
 
-            if (weight.weight.find(mergeQkvWeightName) != weight.weight.end()
-                && CanRunMergeAttention()
+            if (layer.mergeQkv != nullptr
+                && !useLora && CanRunMergeAttention()
                 && false) {
                 // MLP(attenInput, weight[swigluWeightName], Data(), weight[downWeightName], Data(), k);
                 // printf("n_head = %d, %d\n", num_attention_heads, num_key_value_heads);
@@ -182,25 +182,27 @@ namespace fastllm {
                 masks.push_back((Data*)&attentionMask);
                 MergeAttention (
                     attenInput, 
-                    weight[mergeQkvWeightName], weight[mergeQkvBiasName], 
-                    weight[oWeightName], weight[oBiasName],
+                    *layer.mergeQkv, *layer.mergeQkvBias, 
+                    *layer.o, *layer.oBias,
                     qkv, q, k, v, curInput, curOutput,
                     num_attention_heads, num_key_value_heads, head_dim, rotary_dim, 1.0 / sqrt(head_dim),
                     positionIds, *sinDataPtr, *cosDataPtr, 
                     keys, values, masks, w1
                 );
-                AddTo(hiddenStates, w1);
+                attenResidual = &w1;
             } else {
-                if (weight.weight.find(qkvWeightName) != weight.weight.end()) {
-                    Linear(attenInput, weight[qkvWeightName], Data(), qkv);
+                if (layer.wPack != nullptr) {
+                    Linear(attenInput, *layer.wPack, Data(), qkv);
+                    ApplyLora(attenInput, layer.wPack, qkv, curAdapters, loraSegLens);
                     int per = qkv.dims.back() / (num_attention_heads / num_key_value_heads + 2);
                     int qdim = per * (num_attention_heads / num_key_value_heads);
                     Split(qkv, -1, 0, qdim, q);
                     Split(qkv, -1, qdim, qdim + per, k);
                     Split(qkv, -1, qdim + per, qdim + per * 2, v);
                 } else {
-                    if (weight.weight.find(mergeQkvWeightName) != weight.weight.end()) {
-                        Linear(attenInput, weight[mergeQkvWeightName], weight[mergeQkvBiasName], qkv);
+                    if (layer.mergeQkv != nullptr) {
+                        Linear(attenInput, *layer.mergeQkv, *layer.mergeQkvBias, qkv);
+                        ApplyLora(attenInput, layer.mergeQkv, qkv, curAdapters, loraSegLens);
                         int per = qkv.dims.back() / (num_attention_heads / num_key_value_heads + 2);
                         int qdim = per * (num_attention_heads / num_key_value_heads);
 
@@ -208,12 +210,12 @@ namespace fastllm {
                         Split(qkv, -1, qdim, qdim + per, k);
                         Split(qkv, -1, qdim + per, qdim + per * 2, v);
                     } else {
-                        Data qBias = (weight.weight.find(qBiasName) != weight.weight.end()) ? weight[qBiasName] : Data();
-                        Data kBias = (weight.weight.find(kBiasName) != weight.weight.end()) ? weight[kBiasName] : Data();
-                        Data vBias = (weight.weight.find(vBiasName) != weight.weight.end()) ? weight[vBiasName] : Data();
-                        Linear(attenInput, weight[qWeightName], qBias, q);
-                        Linear(attenInput, weight[kWeightName], kBias, k);
-                        Linear(attenInput, weight[vWeightName], vBias, v);
+                        Linear(attenInput, *layer.q, layer.qBias ? *layer.qBias : emptyData, q);
+                        ApplyLora(attenInput, layer.q, q, curAdapters, loraSegLens);
+                        Linear(attenInput, *layer.k, layer.kBias ? *layer.kBias : emptyData, k);
+                        ApplyLora(attenInput, layer.k, k, curAdapters, loraSegLens);
+                        Linear(attenInput, *layer.v, layer.vBias ? *layer.vBias : emptyData, v);
+                        ApplyLora(attenInput, layer.v, v, curAdapters, loraSegLens);
                     }
                 }
 
@@ -222,8 +224,8 @@ namespace fastllm {
                 k.Reshape(qkvSize);
                 v.Reshape(qkvSize);
 
-                RMSNorm(q, this->weight["model.layers." + std::to_string(i) + ".self_attn.q_norm.weight"], rms_norm_eps, q);
-                RMSNorm(k, this->weight["model.layers." + std::to_string(i) + ".self_attn.k_norm.weight"], rms_norm_eps, k);
+                RMSNorm(q, *layer.qNorm, rms_norm_eps, q);
+                RMSNorm(k, *layer.kNorm, rms_norm_eps, k);
 
                 Data &pastKey = pastKeyValues[i].first, &pastValue = pastKeyValues[i].second;
                 if (GetKVCacheInCPU()) {
@@ -291,38 +293,47 @@ namespace fastllm {
                 qkv.Reshape({seqlen, bsz, -1});
                 PermuteSelf(qkv, {1, 0, 2});
 
-                Data oBias = (weight.weight.find(oBiasName) != weight.weight.end()) ? weight[oBiasName] : Data();
-                Linear(qkv, weight[oWeightName], oBias, attenInput);
-                AddTo(hiddenStates, attenInput);
+                Linear(qkv, *layer.o, layer.oBias ? *layer.oBias : emptyData, attenInput);
+                ApplyLora(qkv, layer.o, attenInput, curAdapters, loraSegLens);
+                attenResidual = &attenInput;
             }
 
             // 2. mlp
-            RMSNorm(hiddenStates, this->weight["model.layers." + std::to_string(i) + ".post_attention_layernorm.weight"], rms_norm_eps, attenInput);
+            Data &mlpInWeight = layer.gateUp != nullptr ? *layer.gateUp : *layer.gate;
+            if (!useLora && CanRunAddRMSNormQuant(hiddenStates, mlpInWeight)) {
+                // 残差相加, RMSNorm, mlp输入的量化一次完成
+                AddRMSNormQuant(hiddenStates, *attenResidual, *layer.postNorm, rms_norm_eps, mlpInWeight, attenInput);
+            } else {
+                AddTo(hiddenStates, *attenResidual);
+                RMSNorm(hiddenStates, *layer.postNorm, rms_norm_eps, attenInput);
+            }
 
-            std::string swigluWeightName = "model.layers." + std::to_string(i) + ".mlp.gateup_proj.weight";
-            if (weight.weight.find(swigluWeightName) != weight.weight.end() && CanRunMLP()) {
-                std::string downWeightName = "model.layers." + std::to_string(i) + ".mlp.down_proj.weight";
-                MLP(attenInput, weight[swigluWeightName], Data(), weight[downWeightName], Data(), w1, w2, w3, k);
+            if (layer.gateUp != nullptr && !useLora && CanRunMLP()) {
+                MLP(attenInput, *layer.gateUp, Data(), *layer.down, Data(), w1, w2, w3, k);
                 AddTo(hiddenStates, k);
             } else {
-                if (weight.weight.find(swigluWeightName) != weight.weight.end()) {
-                    if (CanRunLinearEx(LinearExType::ExSwiglu)) {
-                        LinearEx(attenInput, weight[swigluWeightName], Data(), q, LinearExType::ExSwiglu);
+                if (layer.gateUp != nullptr) {
+                    if (!useLora && CanRunLinearEx(LinearExType::ExSwiglu)) {
+                        LinearEx(attenInput, *layer.gateUp, Data(), q, LinearExType::ExSwiglu);
                     } else {
-                        Linear(attenInput, weight[swigluWeightName], Data(), v);
+                        Linear(attenInput, *layer.gateUp, Data(), v);
+                        ApplyLora(attenInput, layer.gateUp, v, curAdapters, loraSegLens);
                         Swiglu(v, q);
                     }
                 } else {
-                    if (CanRunLinearEx(LinearExType::ExSilu)) {
-                        LinearEx(attenInput, weight["model.layers." + std::to_string(i) + ".mlp.gate_proj.weight"], Data(), q, LinearExType::ExSilu);
+                    if (!useLora && CanRunLinearEx(LinearExType::ExSilu)) {
+                        LinearEx(attenInput, *layer.gate, Data(), q, LinearExType::ExSilu);
                     } else {
-                        Linear(attenInput, weight["model.layers." + std::to_string(i) + ".mlp.gate_proj.weight"], Data(), q);
+                        Linear(attenInput, *layer.gate, Data(), q);
+                        ApplyLora(attenInput, layer.gate, q, curAdapters, loraSegLens);
                         Silu(q, q);
                     }
-                    Linear(attenInput, weight["model.layers." + std::to_string(i) + ".mlp.up_proj.weight"], Data(), v);
+                    Linear(attenInput, *layer.up, Data(), v);
+                    ApplyLora(attenInput, layer.up, v, curAdapters, loraSegLens);
                     MulTo(q, v);
                 }
-                Linear(q, weight["model.layers." + std::to_string(i) + ".mlp.down_proj.weight"], Data(), k);
+                Linear(q, *layer.down, Data(), k);
+                ApplyLora(q, layer.down, k, curAdapters, loraSegLens);
                 AddTo(hiddenStates, k);
             }
         }
@@ -330,8 +341,9 @@ namespace fastllm {
         Data logits, topk;
         Data tempHiddenStates;
         Data *lastHiddenStates;
-        if (maxLen > 1) {
-            Split(hiddenStates, 1, maxLen - 1, maxLen, tempHiddenStates);
+        int tail = GetLogitsTail(0, maxLen);
+        if (maxLen > tail) {
+            Split(hiddenStates, 1, maxLen - tail, maxLen, tempHiddenStates);
             lastHiddenStates = &tempHiddenStates;
         } else {
             lastHiddenStates = &hiddenStates;
@@ -341,16 +353,16 @@ namespace fastllm {
         {
             auto &hiddenStates = *lastHiddenStates;
             RMSNorm(hiddenStates, weight["model.norm.weight"], rms_norm_eps, hiddenStates);
-            Linear(hiddenStates, weight["lm_head.weight"], Data(), logits);
+            ComputeLMHead(hiddenStates, weight["lm_head.weight"], logits, {generationConfig}, {});
             ToDataType(logits, DataType::FLOAT32);
             if (generationConfig.output_logits && retLogits != nullptr) {
                 int size = logits.dims.back();
                 logits.ToDevice(DataDevice::CPU);
                 for (int b = 0; b < batch; b++) {
-                    (*retLogits)[b]->resize(size);
+                    (*retLogits)[b]->resize(size * tail);
                     memcpy((float*)(*retLogits)[b]->data(), 
-                        ((float*)logits.cpuData) + ((b + 1) * logits.dims[1] - 1) * size, 
-                        size * logits.unitSize);
+                        ((float*)logits.cpuData) + ((b + 1) * logits.dims[1] - tail) * size, 
+                        size * tail * logits.unitSize);
                 }
             }
 
@@ -368,7 +380,7 @@ namespace fastllm {
                 TopK(logits, topk, 1);
                 topk.ToDevice(DataDevice::CPU);
                 for (int b = 0; b < batch; b++) {
-                    int base = b;
+                    int base = (b + 1) * logits.dims[1] - 1;
                     lastRet.push_back((int) (((float *) topk.cpuData)[base * 2] + 1e-3));
                 }
             } else if (generationConfig.top_k <= 50 && !generationConfig.output_logits) {
@@ -470,38 +482,36 @@ namespace fastllm {
             }
         }
 
+        if (LayerWeightsExpired()) {
+            BuildDecoderLayerWeights();
+        }
+        Data emptyData; // 不存在的bias
+        // 每个请求使用的LoRA adapter, 使用adapter时不走融合了Linear的算子
+        std::vector <LoraAdapter*> curAdapters;
+        bool useLora = GetLoraAdapters(generationConfigs, curAdapters);
         Embedding(inputIds, this->weight["model.embed_tokens.weight"], hiddenStates);
         ToDataType(hiddenStates, this->dataType);
 
         int seqlen = hiddenStates.dims[1];
         for (int i = 0; i < block_cnt; i++) {
             ApplyDeviceMap(this->deviceMap, i + 1, block_cnt);
-            RMSNorm(hiddenStates, this->weight["model.layers." + std::to_string(i) + ".input_layernorm.weight"],
-                    rms_norm_eps, attenInput);
-            std::string qWeightName = "model.layers." + std::to_string(i) + ".self_attn.q_proj.weight";
-            std::string qBiasName = "model.layers." + std::to_string(i) + ".self_attn.q_proj.bias";
-            std::string kWeightName = "model.layers." + std::to_string(i) + ".self_attn.k_proj.weight";
-            std::string kBiasName = "model.layers." + std::to_string(i) + ".self_attn.k_proj.bias";
-            std::string vWeightName = "model.layers." + std::to_string(i) + ".self_attn.v_proj.weight";
-            std::string vBiasName = "model.layers." + std::to_string(i) + ".self_attn.v_proj.bias";
-            std::string qkvWeightName = "model.layers." + std::to_string(i) + ".self_attn.W_pack.weight";
-            std::string oWeightName = "model.layers." + std::to_string(i) + ".self_attn.o_proj.weight";
-            std::string oBiasName = "model.layers." + std::to_string(i) + ".self_attn.o_proj.bias";
-            std::string mergeQkvWeightName = "model.layers." + std::to_string(i) + ".self_attn.mergeqkv.weight";
-            std::string mergeQkvBiasName = "model.layers." + std::to_string(i) + ".self_attn.mergeqkv.bias";
+            DecoderLayerWeights &layer = layerWeights[i];
+            RMSNorm(hiddenStates, *layer.inputNorm, rms_norm_eps, attenInput);
 
             // 1.1 Get q, k, v
             int bsz = attenInput.dims[0], seqlen = attenInput.dims[1];
-            if (weight.weight.find(qkvWeightName) != weight.weight.end()) {
-                Linear(attenInput, weight[qkvWeightName], Data(), qkv);
+            if (layer.wPack != nullptr) {
+                Linear(attenInput, *layer.wPack, Data(), qkv);
+                ApplyLora(attenInput, layer.wPack, qkv, curAdapters, seqLens);
                 int per = qkv.dims.back() / (num_attention_heads / num_key_value_heads + 2);
                 int qdim = per * (num_attention_heads / num_key_value_heads);
                 Split(qkv, -1, 0, qdim, q);
                 Split(qkv, -1, qdim, qdim + per, k);
                 Split(qkv, -1, qdim + per, qdim + per * 2, v);
             } else {
-                if (weight.weight.find(mergeQkvWeightName) != weight.weight.end()) {
-                    Linear(attenInput, weight[mergeQkvWeightName], weight[mergeQkvBiasName], qkv);
+                if (layer.mergeQkv != nullptr) {
+                    Linear(attenInput, *layer.mergeQkv, *layer.mergeQkvBias, qkv);
+                    ApplyLora(attenInput, layer.mergeQkv, qkv, curAdapters, seqLens);
                     int per = qkv.dims.back() / (num_attention_heads / num_key_value_heads + 2);
                     int qdim = per * (num_attention_heads / num_key_value_heads);
 
@@ -509,12 +519,12 @@ namespace fastllm {
                     Split(qkv, -1, qdim, qdim + per, k);
                     Split(qkv, -1, qdim + per, qdim + per * 2, v);
                 } else {
-                    Data qBias = (weight.weight.find(qBiasName) != weight.weight.end()) ? weight[qBiasName] : Data();
-                    Data kBias = (weight.weight.find(kBiasName) != weight.weight.end()) ? weight[kBiasName] : Data();
-                    Data vBias = (weight.weight.find(vBiasName) != weight.weight.end()) ? weight[vBiasName] : Data();
-                    Linear(attenInput, weight[qWeightName], qBias, q);
-                    Linear(attenInput, weight[kWeightName], kBias, k);
-                    Linear(attenInput, weight[vWeightName], vBias, v);
+                    Linear(attenInput, *layer.q, layer.qBias ? *layer.qBias : emptyData, q);
+                    ApplyLora(attenInput, layer.q, q, curAdapters, seqLens);
+                    Linear(attenInput, *layer.k, layer.kBias ? *layer.kBias : emptyData, k);
+                    ApplyLora(attenInput, layer.k, k, curAdapters, seqLens);
+                    Linear(attenInput, *layer.v, layer.vBias ? *layer.vBias : emptyData, v);
+                    ApplyLora(attenInput, layer.v, v, curAdapters, seqLens);
                 }
             }
 
@@ -522,8 +532,8 @@ namespace fastllm {
             k.Reshape({k.dims[0], k.dims[1], -1, head_dim});
             v.Reshape({v.dims[0], v.dims[1], -1, head_dim});
 
-            RMSNorm(q, this->weight["model.layers." + std::to_string(i) + ".self_attn.q_norm.weight"], rms_norm_eps, q);
-            RMSNorm(k, this->weight["model.layers." + std::to_string(i) + ".self_attn.k_norm.weight"], rms_norm_eps, k);
+            RMSNorm(q, *layer.qNorm, rms_norm_eps, q);
+            RMSNorm(k, *layer.kNorm, rms_norm_eps, k);
 
             int cacheOuter = k.dims[2], cacheInner = k.dims[3];
             int targetSeqLength = 0;
@@ -676,37 +686,46 @@ namespace fastllm {
                 }
             }
 
-            Data oBias = (weight.weight.find(oBiasName) != weight.weight.end()) ? weight[oBiasName] : Data();
-            Linear(attenOutput, weight[oWeightName], oBias, attenLastOutput);
-            AddTo(hiddenStates, attenLastOutput);
+            Linear(attenOutput, *layer.o, layer.oBias ? *layer.oBias : emptyData, attenLastOutput);
+            ApplyLora(attenOutput, layer.o, attenLastOutput, curAdapters, seqLens);
+
             // 2. mlp
-            RMSNorm(hiddenStates, this->weight["model.layers." + std::to_string(i) + ".post_attention_layernorm.weight"], rms_norm_eps, attenInput);
+            Data &mlpInWeight = layer.gateUp != nullptr ? *layer.gateUp : *layer.gate;
+            if (!useLora && CanRunAddRMSNormQuant(hiddenStates, mlpInWeight)) {
+                // 残差相加, RMSNorm, mlp输入的量化一次完成
+                AddRMSNormQuant(hiddenStates, attenLastOutput, *layer.postNorm, rms_norm_eps, mlpInWeight, attenInput);
+            } else {
+                AddTo(hiddenStates, attenLastOutput);
+                RMSNorm(hiddenStates, *layer.postNorm, rms_norm_eps, attenInput);
+            }
 
-            std::string swigluWeightName = "model.layers." + std::to_string(i) + ".mlp.gateup_proj.weight";
-            if (weight.weight.find(swigluWeightName) != weight.weight.end() && CanRunMLP()) {
-                std::string downWeightName = "model.layers." + std::to_string(i) + ".mlp.down_proj.weight";
-                MLP(attenInput, weight[swigluWeightName], Data(), weight[downWeightName], Data(), w1, w2, w3, k);
+            if (layer.gateUp != nullptr && !useLora && CanRunMLP()) {
+                MLP(attenInput, *layer.gateUp, Data(), *layer.down, Data(), w1, w2, w3, k);
                 AddTo(hiddenStates, k);
             } else {
-                if (weight.weight.find(swigluWeightName) != weight.weight.end()) {
-                    if (CanRunLinearEx(LinearExType::ExSwiglu)) {
-                        LinearEx(attenInput, weight[swigluWeightName], Data(), w1, LinearExType::ExSwiglu);
+                if (layer.gateUp != nullptr) {
+                    if (!useLora && CanRunLinearEx(LinearExType::ExSwiglu)) {
+                        LinearEx(attenInput, *layer.gateUp, Data(), w1, LinearExType::ExSwiglu);
                     } else {
-                        Linear(attenInput, weight[swigluWeightName], Data(), w3);
+                        Linear(attenInput, *layer.gateUp, Data(), w3);
+                        ApplyLora(attenInput, layer.gateUp, w3, curAdapters, seqLens);
                         Swiglu(w3, w1);
                     }
                 } else {
-                    if (CanRunLinearEx(LinearExType::ExSilu)) {
-                        LinearEx(attenInput, weight["model.layers." + std::to_string(i) + ".mlp.gate_proj.weight"], Data(), w1, LinearExType::ExSilu);
+                    if (!useLora && CanRunLinearEx(LinearExType::ExSilu)) {
+                        LinearEx(attenInput, *layer.gate, Data(), w1, LinearExType::ExSilu);
                     } else {
-                        Linear(attenInput, weight["model.layers." + std::to_string(i) + ".mlp.gate_proj.weight"], Data(), w1);
+                        Linear(attenInput, *layer.gate, Data(), w1);
+                        ApplyLora(attenInput, layer.gate, w1, curAdapters, seqLens);
                         Silu(w1, w1);
                     }
-                    Linear(attenInput, weight["model.layers." + std::to_string(i) + ".mlp.up_proj.weight"], Data(), w3);
+                    Linear(attenInput, *layer.up, Data(), w3);
+                    ApplyLora(attenInput, layer.up, w3, curAdapters, seqLens);
                     MulTo(w1, w3);
                 }
 
-                Linear(w1, weight["model.layers." + std::to_string(i) + ".mlp.down_proj.weight"], Data(), w2);
+                Linear(w1, *layer.down, Data(), w2);
+                ApplyLora(w1, layer.down, w2, curAdapters, seqLens);
                 AddTo(hiddenStates, w2);
             }
         }
@@ -715,13 +734,14 @@ namespace fastllm {
         std::vector <Data> curLogits;
         curLogits.resize(batch);
 
-        if (batch > 1 && !all1) {
+        bool hasTails = this->outputLogitsTails.size() > 0;
+        if ((batch > 1 || hasTails) && !all1) {
             int total = 0;
             std::vector <Data> lastTokens;
             std::vector <Data*> lastTokenPointers;
             lastTokens.resize(seqLens.size());
             for (int b = 0; b < seqLens.size(); b++) {
-                Split(hiddenStates, 1, total + seqLens[b] - 1, total + seqLens[b], lastTokens[b]);
+                Split(hiddenStates, 1, total + seqLens[b] - GetLogitsTail(b, seqLens[b]), total + seqLens[b], lastTokens[b]);
                 total += seqLens[b];
                 lastTokenPointers.push_back(&lastTokens[b]);
             }
@@ -729,7 +749,7 @@ namespace fastllm {
         }
 
         RMSNorm(hiddenStates, weight["model.norm.weight"], rms_norm_eps, hiddenStates);
-        Linear(hiddenStates, weight["lm_head.weight"], Data(), logits);
+        ComputeLMHead(hiddenStates, weight["lm_head.weight"], logits, generationConfigs, seqLens);
         ToDataType(logits, DataType::FLOAT32);
         std::vector <int> lastRet;
         int total = 0;
@@ -758,8 +778,13 @@ namespace fastllm {
             maxTopK = std::max(maxTopK, generationConfigs[b].top_k);
         }
 
-        ResetLogitsOfEOS(batch, &logits, pastKeyValues, generationConfigs);
-        if (batch > 1 && allSimple) {
+        if (!hasTails) {
+            ResetLogitsOfEOS(batch, &logits, pastKeyValues, generationConfigs);
+        }
+        if (hasTails) {
+            // 每个请求有多个位置的logits, 由SampleTailLogits分别处理
+            lastRet = SampleTailLogits(batch, seqLens, logits, pastKeyValues, generationConfigs, lastTokens, retLogits);
+        } else if (batch > 1 && allSimple) {
             Data topk;
             TopK(logits, topk, 1);
             topk.ToDevice(DataDevice::CPU);
@@ -22,6 +22,7 @@ namespace fastllm {
 
     Qwen3MOEModel::Qwen3MOEModel() {
         this->model_type = "qwen3_moe";
+        this->canDoSpeculative = true;
         this->model_struct = "qwen3_moe";
 
         // 默认使用alpaca的提示词和instruction
@@ -450,8 +451,9 @@ namespace fastllm {
         Data logits, topk;
         Data tempHiddenStates;
         Data *lastHiddenStates;
-        if (maxLen > 1) {
-            Split(hiddenStates, 1, maxLen - 1, maxLen, tempHiddenStates);
+        int tail = GetLogitsTail(0, maxLen);
+        if (maxLen > tail) {
+            Split(hiddenStates, 1, maxLen - tail, maxLen, tempHiddenStates);
             lastHiddenStates = &tempHiddenStates;
         } else {
             lastHiddenStates = &hiddenStates;
@@ -470,16 +472,16 @@ namespace fastllm {
         {
             auto &hiddenStates = *lastHiddenStates;
             RMSNorm(hiddenStates, weight["model.norm.weight"], rms_norm_eps, hiddenStates);
-            Linear(hiddenStates, weight["lm_head.weight"], Data(), logits);
+            ComputeLMHead(hiddenStates, weight["lm_head.weight"], logits, {generationConfig}, {});
 
             if (generationConfig.output_logits && retLogits != nullptr) {
                 int size = logits.dims.back();
                 logits.ToDevice(DataDevice::CPU);
                 for (int b = 0; b < batch; b++) {
-                    (*retLogits)[b]->resize(size);
+                    (*retLogits)[b]->resize(size * tail);
                     memcpy((float*)(*retLogits)[b]->data(), 
-                        ((float*)logits.cpuData) + ((b + 1) * logits.dims[1] - 1) * size, 
-                        size * logits.unitSize);
+                        ((float*)logits.cpuData) + ((b + 1) * logits.dims[1] - tail) * size, 
+                        size * tail * logits.unitSize);
                 }
             }
 
@@ -487,7 +489,7 @@ namespace fastllm {
                 TopK(logits, topk, 1);
                 topk.ToDevice(DataDevice::CPU);
                 for (int b = 0; b < batch; b++) {
-                    int base = b;
+                    int base = (b + 1) * logits.dims[1] - 1;
                     lastRet.push_back((int) (((float *) topk.cpuData)[base * 2] + 1e-3));
                 }
             } else if (generationConfig.top_k <= 50 && !generationConfig.output_logits) {
@@ -963,7 +965,6 @@ namespace fastllm {
 
         Data logits, curLogit;
         RMSNorm(hiddenStates, weight["model.norm.weight"], rms_norm_eps, hiddenStates);
-        Linear(hiddenStates, weight["lm_head.weight"], Data(), logits);
         std::vector <int> lastRet;
         int total = 0;
 
@@ -977,9 +978,12 @@ namespace fastllm {
                 }
             }
         }
+        ComputeLMHead(hiddenStates, weight["lm_head.weight"], logits, generationConfigs, seqLens);
         
         for (int b = 0; b < batch; b++) {
-            Split(logits, 1, total + seqLens[b] - 1, total + seqLens[b], curLogit);
+            // 默认只取最后一个位置, 设置了outputLogitsTails时取最后tail个位置, 用最后一个位置采样
+            int tail = GetLogitsTail(b, seqLens[b]);
+            Split(logits, 1, total + seqLens[b] - tail, total + seqLens[b], curLogit);
             if (generationConfigs[b].output_logits && retLogits != nullptr && (*retLogits)[b] != nullptr) {
                 curLogit.ToDevice(DataDevice::CPU);
                 (*retLogits)[b]->resize(curLogit.Count(0));
@@ -989,9 +993,9 @@ namespace fastllm {
                 Data topk;
                 TopK(curLogit, topk, 1);
                 topk.ToDevice(DataDevice::CPU);
-                lastRet.push_back((int) (((float *) topk.cpuData)[0] + 1e-3));
+                lastRet.push_back((int) (((float *) topk.cpuData)[(tail - 1) * 2] + 1e-3));
             } else {
-                lastRet.push_back(LLMSampling(curLogit, 0, generationConfigs[b], lastTokens.units[b]));
+                lastRet.push_back(LLMSampling(curLogit, tail - 1, generationConfigs[b], lastTokens.units[b]));
             }
             total += seqLens[b];
         }
@@ -434,6 +434,15 @@ namespace fastllm {
                     Split(conv, -1, conv.dims.back() - 1, conv.dims.back(), qkv);
                     Silu(qkv, qkv);
                 } else {
+                    // 已经有卷积状态时(分段prefill, 或者从前缀缓存的快照恢复), 用之前的输入代替左侧的pad
+                    int convPad = 3;
+                    if (pastKey.dims.size() > 0) {
+                        Data convState, hidden_states_new;
+                        Split(pastKey, -1, pastKey.dims.back() - 3, pastKey.dims.back(), convState);
+                        Cat(convState, qkv, -1, hidden_states_new);
+                        Mul(hidden_states_new, 1.0f, qkv);
+                        convPad = 0;
+                    }
                     if (qkv.dims.back() >= 4) {
                         Split(qkv, -1, qkv.dims.back() - 4, qkv.dims.back(), pastKey);
                         // PermuteSelf(pastKey, {0, 2, 1});
@@ -444,7 +453,7 @@ namespace fastllm {
 
                     Conv1DPerChannel(
                         qkv, weight[conv1dWeightName], weight[conv1dBiasName], 
-                        qkv.dims[1], weight[conv1dWeightName].dims[0], 4, 1, 3, 
+                        qkv.dims[1], weight[conv1dWeightName].dims[0], 4, 1, convPad, 
                         conv
                     );
                     Split(conv, -1, 0, seqlen, qkv);
@@ -527,131 +536,138 @@ namespace fastllm {
                     
                     // batch_size, sequence_length, num_heads, k_head_dim = key.shape, 这里num_heads才是真正的序列长度
                     int key_batch_size = k.dims[0], key_sequence_length = k.dims[1], key_num_heads = k.dims[2], key_k_head_dim = k.dims[3];
-
-                    int chunk_size = 64;
-                    int v_head_dim = v.dims.back();
-                    int seq = k.dims[2];
-                    int pad_size = (chunk_size - seq % chunk_size) % chunk_size;
-
-                    Data qtemp, qq, kk, vv, bb, gg, decayMask;
-                    {
-                        // pad 
-                        FakePad(q, qtemp, 2, pad_size); // query = F.pad(query, (0, 0, 0, pad_size))
-                        FakePad(k, kk, 2, pad_size); // key = F.pad(key, (0, 0, 0, pad_size))
-                        FakePad(v, vv, 2, pad_size); // value = F.pad(value, (0, 0, 0, pad_size))
-                        FakePad(b, bb, 2, pad_size); // beta = F.pad(beta, (0, pad_size))
-                        FakePad(g, gg, 2, pad_size); // g = F.pad(g, (0, pad_size))
-                    }
-
-                    int tot_heads = seq + pad_size;
-                    float scale = 1.0f / pow(qtemp.dims.back(), 0.5);
-                    Mul(qtemp, scale, qq); // query = query * scale
-
-                    bb.Resize({bb.dims[0], bb.dims[1], bb.dims[2], 1});
-                    Data k_beta, v_beta;
-                    Mul(kk, 1.0f, k_beta);
-                    Mul(vv, 1.0f, v_beta);
-                    MulTo(k_beta, bb);
-                    MulTo(v_beta, bb);
-
-                    qq.Reshape({qq.dims[0], qq.dims[1], -1, chunk_size, qq.dims.back()});
-                    kk.Reshape({kk.dims[0], kk.dims[1], -1, chunk_size, kk.dims.back()});
-                    k_beta.Reshape({k_beta.dims[0], k_beta.dims[1], -1, chunk_size, k_beta.dims.back()});
-                    v_beta.Reshape({v_beta.dims[0], v_beta.dims[1], -1, chunk_size, v_beta.dims.back()});
-                    gg.Reshape({gg.dims[0], gg.dims[1], -1, chunk_size});
-
-                    CumSumLastDim(gg);
-                    MakeDecayMask(gg, decayMask);
-
-                    Data at, attn;
-                    MatMulTransB(k_beta, kk, at);
-                    Mul(at, -1.0f, attn);
-                    MulTo(attn, decayMask);
-                    CausalMask(attn, 0, 0.0f);
-
-                    TransferAttn(attn);
-                    MatMul(attn, v_beta, vv);
-                    
-                    Data k_temp, k_cumdecay;                    
-                    Exp(gg, g);
-
-                    Mul(k_beta, 1.0f, k_temp);
-                    MulTo(k_temp, g);
-                    MatMul(attn, k_temp, k_cumdecay);
-
                     if (last_recurrent_state.dims.size() == 0) {
-                        last_recurrent_state.Resize({key_batch_size, key_sequence_length, key_k_head_dim, v_head_dim});
+                        last_recurrent_state.Resize({key_batch_size, key_sequence_length, key_k_head_dim, v.dims.back()});
                         last_recurrent_state.Allocate(0.0f);
                     }
 
-                    for (int i = 0; i < tot_heads / chunk_size; i++) {
-                        Data q_i, k_i, v_i, decay_mask_i, k_cumdecay_i;
-                        Split(qq, 2, i, i + 1, q_i);
-                        Split(kk, 2, i, i + 1, k_i);
-                        Split(vv, 2, i, i + 1, v_i);
+                    if (CanRunChunkGatedDeltaRule()) {
+                        // 融合的分块实现, 不需要pad, 也不需要逐块拼接输出
+                        float scale = 1.0f / pow(q.dims.back(), 0.5);
+                        Mul(q, scale, q); // query = query * scale
+                        ChunkGatedDeltaRule(q, k, v, g, b, last_recurrent_state, core_attn_out, 64);
+                        PermuteSelf(core_attn_out, {0, 2, 1, 3});
+                    } else {
+                        int chunk_size = 64;
+                        int v_head_dim = v.dims.back();
+                        int seq = k.dims[2];
+                        int pad_size = (chunk_size - seq % chunk_size) % chunk_size;
+
+                        Data qtemp, qq, kk, vv, bb, gg, decayMask;
+                        {
+                            // pad 
+                            FakePad(q, qtemp, 2, pad_size); // query = F.pad(query, (0, 0, 0, pad_size))
+                            FakePad(k, kk, 2, pad_size); // key = F.pad(key, (0, 0, 0, pad_size))
+                            FakePad(v, vv, 2, pad_size); // value = F.pad(value, (0, 0, 0, pad_size))
+                            FakePad(b, bb, 2, pad_size); // beta = F.pad(beta, (0, pad_size))
+                            FakePad(g, gg, 2, pad_size); // g = F.pad(g, (0, pad_size))
+                        }
 
-                        q_i.Resize({q_i.dims[0], q_i.dims[1], q_i.dims[3], q_i.dims[4]});
-                        k_i.Resize({k_i.dims[0], k_i.dims[1], k_i.dims[3], k_i.dims[4]});
-                        v_i.Resize({v_i.dims[0], v_i.dims[1], v_i.dims[3], v_i.dims[4]});
+                        int tot_heads = seq + pad_size;
+                        float scale = 1.0f / pow(qtemp.dims.back(), 0.5);
+                        Mul(qtemp, scale, qq); // query = query * scale
+
+                        bb.Resize({bb.dims[0], bb.dims[1], bb.dims[2], 1});
+                        Data k_beta, v_beta;
+                        Mul(kk, 1.0f, k_beta);
+                        Mul(vv, 1.0f, v_beta);
+                        MulTo(k_beta, bb);
+                        MulTo(v_beta, bb);
+
+                        qq.Reshape({qq.dims[0], qq.dims[1], -1, chunk_size, qq.dims.back()});
+                        kk.Reshape({kk.dims[0], kk.dims[1], -1, chunk_size, kk.dims.back()});
+                        k_beta.Reshape({k_beta.dims[0], k_beta.dims[1], -1, chunk_size, k_beta.dims.back()});
+                        v_beta.Reshape({v_beta.dims[0], v_beta.dims[1], -1, chunk_size, v_beta.dims.back()});
+                        gg.Reshape({gg.dims[0], gg.dims[1], -1, chunk_size});
+
+                        CumSumLastDim(gg);
+                        MakeDecayMask(gg, decayMask);
+
+                        Data at, attn;
+                        MatMulTransB(k_beta, kk, at);
+                        Mul(at, -1.0f, attn);
+                        MulTo(attn, decayMask);
+                        CausalMask(attn, 0, 0.0f);
+
+                        TransferAttn(attn);
+                        MatMul(attn, v_beta, vv);
+                    
+                        Data k_temp, k_cumdecay;                    
+                        Exp(gg, g);
+
+                        Mul(k_beta, 1.0f, k_temp);
+                        MulTo(k_temp, g);
+                        MatMul(attn, k_temp, k_cumdecay);
+
+                        for (int i = 0; i < tot_heads / chunk_size; i++) {
+                            Data q_i, k_i, v_i, decay_mask_i, k_cumdecay_i;
+                            Split(qq, 2, i, i + 1, q_i);
+                            Split(kk, 2, i, i + 1, k_i);
+                            Split(vv, 2, i, i + 1, v_i);
+
+                            q_i.Resize({q_i.dims[0], q_i.dims[1], q_i.dims[3], q_i.dims[4]});
+                            k_i.Resize({k_i.dims[0], k_i.dims[1], k_i.dims[3], k_i.dims[4]});
+                            v_i.Resize({v_i.dims[0], v_i.dims[1], v_i.dims[3], v_i.dims[4]});
                         
-                        Split(decayMask, 2, i, i + 1, decay_mask_i);
-                        decay_mask_i.Resize({decay_mask_i.dims[0], decay_mask_i.dims[1], decay_mask_i.dims[3], decay_mask_i.dims[4]});
-
-                        MatMulTransB(q_i, k_i, attn);
-                        MulTo(attn, decay_mask_i);
-                        CausalMask(attn, 1, 0.0f);
-
-                        Split(k_cumdecay, 2, i, i + 1, k_cumdecay_i);
-                        k_cumdecay_i.Resize({k_cumdecay_i.dims[0], k_cumdecay_i.dims[1], k_cumdecay_i.dims[3], k_cumdecay_i.dims[4]});
-
-                        Data v_prime, v_new;
-                        MatMul(k_cumdecay_i, last_recurrent_state, v_prime);
-                        Mul(v_prime, -1.0f, v_new);
-                        AddTo(v_new, v_i);
-
-                        Data attn_inter, g_i, g_i_exp, q_i_temp;
-                        Split(gg, 2, i, i + 1, g_i);
-                        g_i.Resize({g_i.dims[0], g_i.dims[1], g_i.dims[3], 1});
-                        Exp(g_i, g_i_exp);
-                        Mul(q_i, 1.0f, q_i_temp);
-                        MulTo(q_i_temp, g_i_exp);
-
-                        MatMul(q_i_temp, last_recurrent_state, attn_inter);
-                        Data atv;
-                        MatMul(attn, v_new, atv);
-                        AddTo(atv, attn_inter);
-                        atv.Resize({atv.dims[0], atv.dims[1], 1, atv.dims[2], atv.dims[3]});
-                        if (i == 0) {
-                            Mul(atv, 1.0f, core_attn_out);
-                        } else {
-                            Mul(core_attn_out, 1.0f, core_attn_out_temp);
-                            Cat(core_attn_out_temp, atv, 3, core_attn_out);
+                            Split(decayMask, 2, i, i + 1, decay_mask_i);
+                            decay_mask_i.Resize({decay_mask_i.dims[0], decay_mask_i.dims[1], decay_mask_i.dims[3], decay_mask_i.dims[4]});
+
+                            MatMulTransB(q_i, k_i, attn);
+                            MulTo(attn, decay_mask_i);
+                            CausalMask(attn, 1, 0.0f);
+
+                            Split(k_cumdecay, 2, i, i + 1, k_cumdecay_i);
+                            k_cumdecay_i.Resize({k_cumdecay_i.dims[0], k_cumdecay_i.dims[1], k_cumdecay_i.dims[3], k_cumdecay_i.dims[4]});
+
+                            Data v_prime, v_new;
+                            MatMul(k_cumdecay_i, last_recurrent_state, v_prime);
+                            Mul(v_prime, -1.0f, v_new);
+                            AddTo(v_new, v_i);
+
+                            Data attn_inter, g_i, g_i_exp, q_i_temp;
+                            Split(gg, 2, i, i + 1, g_i);
+                            g_i.Resize({g_i.dims[0], g_i.dims[1], g_i.dims[3], 1});
+                            Exp(g_i, g_i_exp);
+                            Mul(q_i, 1.0f, q_i_temp);
+                            MulTo(q_i_temp, g_i_exp);
+
+                            MatMul(q_i_temp, last_recurrent_state, attn_inter);
+                            Data atv;
+                            MatMul(attn, v_new, atv);
+                            AddTo(atv, attn_inter);
+                            atv.Resize({atv.dims[0], atv.dims[1], 1, atv.dims[2], atv.dims[3]});
+                            if (i == 0) {
+                                Mul(atv, 1.0f, core_attn_out);
+                            } else {
+                                Mul(core_attn_out, 1.0f, core_attn_out_temp);
+                                Cat(core_attn_out_temp, atv, 3, core_attn_out);
+                            }
+
+                            g_i.Resize({g_i.dims[0], g_i.dims[1], g_i.dims[2]});
+                            Data g_i_last, g_i_last_repeat, g_i_l_temp;
+                            Split(g_i, -1, g_i.dims.back() - 1, g_i.dims.back(), g_i_last);
+                            Repeat(g_i_last, -1, g_i.dims.back(), g_i_last_repeat);
+                            Mul(g_i, -1.0f, g_i_l_temp);
+                            AddTo(g_i_l_temp, g_i_last_repeat);
+                            Exp(g_i_l_temp, g_i_l_temp);
+                            g_i_l_temp.Resize({g_i_l_temp.dims[0], g_i_l_temp.dims[1], g_i_l_temp.dims[2], 1});
+                            MulTo(k_i, g_i_l_temp);
+                            PermuteSelf(k_i, {0, 1, 3, 2});
+
+                            Data k_i_v_new;
+                            MatMul(k_i, v_new, k_i_v_new);
+
+                            Data g_i_exp_last;
+                            Split(g_i_exp, 2, g_i_exp.dims[2] - 1, g_i_exp.dims[2], g_i_exp_last);
+                            MulTo(last_recurrent_state, g_i_exp_last);
+                            AddTo(last_recurrent_state, k_i_v_new);
                         }
 
-                        g_i.Resize({g_i.dims[0], g_i.dims[1], g_i.dims[2]});
-                        Data g_i_last, g_i_last_repeat, g_i_l_temp;
-                        Split(g_i, -1, g_i.dims.back() - 1, g_i.dims.back(), g_i_last);
-                        Repeat(g_i_last, -1, g_i.dims.back(), g_i_last_repeat);
-                        Mul(g_i, -1.0f, g_i_l_temp);
-                        AddTo(g_i_l_temp, g_i_last_repeat);
-                        Exp(g_i_l_temp, g_i_l_temp);
-                        g_i_l_temp.Resize({g_i_l_temp.dims[0], g_i_l_temp.dims[1], g_i_l_temp.dims[2], 1});
-                        MulTo(k_i, g_i_l_temp);
-                        PermuteSelf(k_i, {0, 1, 3, 2});
-
-                        Data k_i_v_new;
-                        MatMul(k_i, v_new, k_i_v_new);
-
-                        Data g_i_exp_last;
-                        Split(g_i_exp, 2, g_i_exp.dims[2] - 1, g_i_exp.dims[2], g_i_exp_last);
-                        MulTo(last_recurrent_state, g_i_exp_last);
-                        AddTo(last_recurrent_state, k_i_v_new);
+                        core_attn_out.Reshape({core_attn_out.dims[0], core_attn_out.dims[1], -1, core_attn_out.dims.back()});
+                        Split(core_attn_out, 2, 0, seq, core_attn_out_temp);
+                        PermuteSelf(core_attn_out_temp, {0, 2, 1, 3});
+                        Mul(core_attn_out_temp, 1.0f, core_attn_out);
                     }
-
-                    core_attn_out.Reshape({core_attn_out.dims[0], core_attn_out.dims[1], -1, core_attn_out.dims.back()});
-                    Split(core_attn_out, 2, 0, seq, core_attn_out_temp);
-                    PermuteSelf(core_attn_out_temp, {0, 2, 1, 3});
-                    Mul(core_attn_out_temp, 1.0f, core_attn_out);
                 }
 
                 {
@@ -171,4 +171,98 @@ namespace fastllm {
         }
         return ret;
     }
+
+    void XlmRobertaModel::FillBertInputsVarlen(const std::vector <std::vector <int> > &tokens,
+                                Data &inputIds, Data &tokenTypeIds, Data &positionIds) {
+        std::vector <float> ids, token_type_ids, position_ids;
+        for (int i = 0; i < tokens.size(); i++) {
+            for (int j = 0; j < tokens[i].size(); j++) {
+                ids.push_back(tokens[i][j]);
+                token_type_ids.push_back(0.0f);
+                position_ids.push_back(2 + j);
+            }
+        }
+        int total = ids.size();
+        inputIds.CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {1, total}, ids));
+        tokenTypeIds.CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {1, total}, token_type_ids));
+        positionIds.CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {1, total}, position_ids));
+    }
+
+    std::vector <std::vector <float> > XlmRobertaModel::ForwardVarlen(const std::vector <std::vector <int> > &tokens, bool normalize) {
+        Data inputIds, tokenTypeIds, positionIds;
+        FillBertInputsVarlen(tokens, inputIds, tokenTypeIds, positionIds);
+        std::vector <int> seqLens;
+        for (auto &it : tokens) {
+            seqLens.push_back(it.size());
+        }
+        int total = inputIds.dims[1];
+
+        Data inputEmbeddings, tokenTypeEmbeddings, positionIdEmbeddings;
+        Embedding(inputIds, this->weight["roberta.embeddings.word_embeddings.weight"], inputEmbeddings);
+        Embedding(tokenTypeIds, this->weight["roberta.embeddings.token_type_embeddings.weight"], tokenTypeEmbeddings);
+        Embedding(positionIds, this->weight["roberta.embeddings.position_embeddings.weight"], positionIdEmbeddings);
+        AddTo(inputEmbeddings, tokenTypeEmbeddings);
+        AddTo(inputEmbeddings, positionIdEmbeddings);
+        Data hiddenStates;
+        LayerNorm(inputEmbeddings, this->weight["roberta.embeddings.LayerNorm.weight"], this->weight["roberta.embeddings.LayerNorm.bias"], -1, hiddenStates);
+
+        Data q, k, v, qkv, attnOutput, inter, pooler, logits;
+        for (int i = 0; i < this->block_cnt; i++) {
+            std::string pre = "roberta.encoder.layer." + std::to_string(i);
+            Linear(hiddenStates, this->weight[pre + ".attention.self.query.weight"], this->weight[pre + ".attention.self.query.bias"], q);
+            Linear(hiddenStates, this->weight[pre + ".attention.self.key.weight"], this->weight[pre + ".attention.self.key.bias"], k);
+            Linear(hiddenStates, this->weight[pre + ".attention.self.value.weight"], this->weight[pre + ".attention.self.value.bias"], v);
+
+            std::vector <int> qdims = {total, this->num_attention_heads, this->head_dim};
+            q.Reshape(qdims);
+            k.Reshape(qdims);
+            v.Reshape(qdims);
+            AttentionVarlen(q, k, v, seqLens, qkv, 1.0 / sqrt(this->head_dim));
+            qkv.Reshape({1, total, -1});
+
+            Linear(qkv, this->weight[pre + ".attention.output.dense.weight"], this->weight[pre + ".attention.output.dense.bias"], attnOutput);
+            AddTo(hiddenStates, attnOutput);
+            LayerNorm(hiddenStates, this->weight[pre + ".attention.output.LayerNorm.weight"], this->weight[pre + ".attention.output.LayerNorm.bias"], -1, hiddenStates);
+
+            if (CanRunLinearEx(LinearExType::ExGelu)) {
+                LinearEx(hiddenStates, this->weight[pre + ".intermediate.dense.weight"], this->weight[pre + ".intermediate.dense.bias"], inter, LinearExType::ExGelu);
+            } else {
+                Linear(hiddenStates, this->weight[pre + ".intermediate.dense.weight"], this->weight[pre + ".intermediate.dense.bias"], inter);
+                Gelu(inter, inter);
+            }
+
+            Linear(inter, this->weight[pre + ".output.dense.weight"], this->weight[pre + ".output.dense.bias"], attnOutput);
+            AddTo(hiddenStates, attnOutput);
+            LayerNorm(hiddenStates, this->weight[pre + ".output.LayerNorm.weight"], this->weight[pre + ".output.LayerNorm.bias"], -1, hiddenStates);
+        }
+
+        // 取每个序列的第一个token, 拼成[batch, hidden]
+        hiddenStates.ToDevice(DataDevice::CPU);
+        int batch = tokens.size(), hidden = hiddenStates.dims[2];
+        std::vector <float> firsts((size_t)batch * hidden);
+        for (int i = 0, off = 0; i < batch; off += seqLens[i], i++) {
+            memcpy(firsts.data() + (size_t)i * hidden, (float*)hiddenStates.cpuData + (size_t)off * hidden, hidden * sizeof(float));
+        }
+        Data firstStates = Data(DataType::FLOAT32, {batch, hidden}, firsts);
+        if (this->weight.weight.find("classifier.dense.weight") != this->weight.weight.end()) {
+            Linear(firstStates, this->weight["classifier.dense.weight"], this->weight["classifier.dense.bias"], pooler);
+            TanH(pooler, pooler);
+            Linear(pooler, this->weight["classifier.out_proj.weight"], this->weight["classifier.out_proj.bias"], logits);
+        } else {
+            Mul(firstStates, 1.0f, logits);
+        }
+
+        logits.ToDevice(DataDevice::CPU);
+        float *fret = (float*)logits.cpuData;
+        int outputDim = logits.dims[1];
+        std::vector <std::vector <float> > ret;
+        ret.resize(batch, std::vector <float> (outputDim, 0.0f));
+        for (int i = 0; i < batch; i++) {
+            if (normalize) {
+                Normalize(fret + i * outputDim, outputDim);
+            }
+            memcpy(ret[i].data(), fret + i * outputDim, outputDim * sizeof(float));
+        }
+        return ret;
+    }
 }
\ No newline at end of file
@@ -588,7 +588,8 @@ PYBIND11_MODULE(pyfastllm, m) {
     // .def("to", &pyfastllm::ToDevice);
 
   // model classes
-  py::class_<fastllm::basellm>(m, "basellm");
+  py::class_<fastllm::basellm>(m, "basellm")
+    .def("get_metrics", &fastllm::basellm::GetMetrics);
 
   py::class_<fastllm::ChatGLMModel, fastllm::basellm>(m, "ChatGLMModel")
     .def(py::init<>())
@@ -0,0 +1,207 @@
+//
+// 热路径追踪的线程缓冲区与Chrome trace导出
+//
+
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __GNUC__
+#include <cxxabi.h>
+#endif
+
+namespace fastllm {
+#ifndef FASTLLM_NO_TRACE
+    std::atomic <bool> traceEnabled(false);
+#endif
+
+    struct TraceEvent {
+        const char *category;
+        const char *staticName;
+        std::string name;
+        std::string args;
+        long long st, dur;
+        bool demangle;
+    };
+
+    struct TraceThreadBuffer {
+        int tid;
+        std::string threadName;
+        std::vector <TraceEvent> events; // 环形缓冲区
+        size_t pos = 0; // 缓冲区写满后, 下一个被覆盖(也就是最旧)的位置
+        std::mutex locker; // 只和导出 / 清空竞争
+    };
+
+    struct TraceManager {
+        std::mutex locker;
+        std::vector <std::unique_ptr <TraceThreadBuffer> > buffers;
+        int eventsPerThread = 1 << 16;
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        std::string exitFileName;
+    };
+
+    static TraceManager *GetTraceManager() {
+        static TraceManager *manager = new TraceManager();
+        return manager;
+    }
+
+    static TraceThreadBuffer *GetTraceThreadBuffer() {
+        thread_local TraceThreadBuffer *buffer = nullptr;
+        if (buffer == nullptr) {
+            auto manager = GetTraceManager();
+            std::lock_guard <std::mutex> guard(manager->locker);
+            manager->buffers.push_back(std::unique_ptr <TraceThreadBuffer> (new TraceThreadBuffer()));
+            buffer = manager->buffers.back().get();
+            buffer->tid = (int)manager->buffers.size();
+        }
+        return buffer;
+    }
+
+    long long TraceNowUs() {
+        return std::chrono::duration_cast <std::chrono::microseconds> (
+                std::chrono::steady_clock::now() - GetTraceManager()->startTime).count();
+    }
+
+    void SetTraceEnable(bool enable) {
+#ifndef FASTLLM_NO_TRACE
+        traceEnabled.store(enable);
+#else
+        if (enable) {
+            printf("Warning: fastllm is compiled with FASTLLM_NO_TRACE, trace is disabled.\n");
+        }
+#endif
+    }
+
+    void SetTraceBufferSize(int eventsPerThread) {
+        auto manager = GetTraceManager();
+        std::lock_guard <std::mutex> guard(manager->locker);
+        manager->eventsPerThread = std::max(1, eventsPerThread);
+    }
+
+    void SetTraceThreadName(const std::string &name) {
+        auto buffer = GetTraceThreadBuffer();
+        std::lock_guard <std::mutex> guard(buffer->locker);
+        buffer->threadName = name;
+    }
+
+    void ClearTrace() {
+        auto manager = GetTraceManager();
+        std::lock_guard <std::mutex> guard(manager->locker);
+        for (auto &buffer : manager->buffers) {
+            std::lock_guard <std::mutex> bufferGuard(buffer->locker);
+            buffer->events.clear();
+            buffer->pos = 0;
+        }
+    }
+
+    void TraceAddSpan(const char *category, const char *staticName, const std::string &name,
+                      long long st, long long dur, const std::string &args, bool demangle) {
+        auto buffer = GetTraceThreadBuffer();
+        int limit = GetTraceManager()->eventsPerThread;
+        std::lock_guard <std::mutex> guard(buffer->locker);
+        size_t idx;
+        if (buffer->events.size() < limit) {
+            buffer->events.push_back(TraceEvent());
+            idx = buffer->events.size() - 1;
+        } else {
+            idx = buffer->pos;
+            buffer->pos = (buffer->pos + 1) % buffer->events.size();
+        }
+        auto &event = buffer->events[idx];
+        event.category = category;
+        event.staticName = staticName;
+        event.name = (staticName == nullptr ? name : "");
+        event.args = args;
+        event.st = st;
+        event.dur = dur;
+        event.demangle = demangle;
+    }
+
+    static std::string TraceEscape(const std::string &s) {
+        std::string ret;
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                ret += '\\';
+                ret += c;
+            } else if ((unsigned char)c < 0x20) {
+                char temp[8];
+                snprintf(temp, sizeof(temp), "\\u%04x", (int)(unsigned char)c);
+                ret += temp;
+            } else {
+                ret += c;
+            }
+        }
+        return ret;
+    }
+
+    static std::string TraceDemangle(const char *name) {
+#ifdef __GNUC__
+        int status = 0;
+        char *real = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if (status == 0 && real != nullptr) {
+            std::string ret = real;
+            free(real);
+            return ret;
+        }
+#endif
+        return name;
+    }
+
+    bool ExportTrace(const std::string &fileName) {
+        FILE *fo = fopen(fileName.c_str(), "w");
+        if (fo == nullptr) {
+            printf("Export trace to %s failed.\n", fileName.c_str());
+            return false;
+        }
+        auto manager = GetTraceManager();
+        std::lock_guard <std::mutex> guard(manager->locker);
+        fprintf(fo, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for (auto &buffer : manager->buffers) {
+            std::lock_guard <std::mutex> bufferGuard(buffer->locker);
+            if (buffer->threadName != "") {
+                fprintf(fo, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                        first ? "" : ",\n", buffer->tid, TraceEscape(buffer->threadName).c_str());
+                first = false;
+            }
+            size_t n = buffer->events.size();
+            size_t start = buffer->pos;
+            for (size_t i = 0; i < n; i++) {
+                auto &event = buffer->events[(start + i) % n];
+                std::string name = event.staticName == nullptr ? event.name :
+                                   (event.demangle ? TraceDemangle(event.staticName) : std::string(event.staticName));
+                fprintf(fo, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %lld, \"dur\": %lld, \"args\": {%s}}",
+                        first ? "" : ",\n", TraceEscape(name).c_str(), event.category, buffer->tid,
+                        event.st, event.dur, event.args.c_str());
+                first = false;
+            }
+        }
+        fprintf(fo, "\n]}\n");
+        fclose(fo);
+        return true;
+    }
+
+    // 环境变量 FASTLLM_TRACE=文件名: 启动时打开追踪, 进程退出时导出
+    static void ExportTraceAtExit() {
+        SetTraceEnable(false);
+        ExportTrace(GetTraceManager()->exitFileName);
+    }
+
+    struct TraceEnvInit {
+        TraceEnvInit () {
+            const char *fileName = getenv("FASTLLM_TRACE");
+            if (fileName != nullptr && std::string(fileName) != "" && std::string(fileName) != "OFF") {
+                GetTraceManager()->exitFileName = fileName;
+                SetTraceEnable(true);
+                atexit(ExportTraceAtExit);
+            }
+        }
+    } traceEnvInit;
+}
@@ -0,0 +1,623 @@
+//
+// CPU算子微基准测试: 按形状 / 数据类型 / 线程数扫描, 对比实测的机器峰值(roofline), 结果可导出为json
+//
+
+#include "fastllm.h"
+#include "utils.h"
+#include "gguf.h"
+#include "json11.hpp"
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+struct BenchConfig {
+    std::vector <int> threads; // 测试的线程数
+    std::vector <int> ns = {1, 4, 16, 64, 256}; // 输入的行数(token数)
+    std::vector <std::pair <int, int> > linearShapes = {{4096, 4096}, {4096, 12288}, {12288, 4096}}; // Linear的(m, k) = (输入维度, 输出维度)
+    std::set <std::string> ops = {"linear", "mergemoe", "attention", "rmsnorm", "swiglu"};
+    std::vector <std::string> dtypes = {"float16", "bfloat16", "int8", "int4g", "fp8", "q4_k", "q8_0"};
+    int experts = 32, topk = 8, moeHidden = 2048, moeInter = 768; // MergeMOE的形状(默认规模较小, 避免占用过多内存)
+    int heads = 32, kvHeads = 8, headDim = 128; // Attention的形状
+    std::vector <int> contexts = {1024, 4096}; // Attention的上下文长度
+    int hidden = 4096, inter = 12288; // RMSNorm / Swiglu的形状
+    int layers = 32; // 权重查找测试的层数
+    int repeat = 20; // 每个case最多重复次数
+    float minTime = 0.2f; // 每个case最少运行时间(秒)
+    std::string output; // json输出文件, 为空则不输出
+};
+
+struct MachinePeak {
+    double gflops = 0.0; // 实测fp32 FMA峰值
+    double gbps = 0.0; // 实测读带宽
+};
+
+void Usage() {
+    std::cout << "Usage:" << std::endl;
+    std::cout << "[-h|--help]:                  显示帮助" << std::endl;
+    std::cout << "<-t|--threads> <args>:        测试的线程数, 逗号分隔, 例如 1,4,8" << std::endl;
+    std::cout << "<-n|--tokens> <args>:         输入行数(token数), 逗号分隔" << std::endl;
+    std::cout << "<--shapes> <args>:            Linear形状, 格式 m1xk1,m2xk2 (输入维度x输出维度)" << std::endl;
+    std::cout << "<--ops> <args>:               测试的算子, 逗号分隔(linear,mergemoe,attention,rmsnorm,swiglu,addnorm,weightlookup)" << std::endl;
+    std::cout << "<--dtypes> <args>:            权重类型, 逗号分隔(float16,bfloat16,int8,int4g,int2g,base3g,fp8,q4_0,q4_k,q8_0 ...)" << std::endl;
+    std::cout << "<--experts> <args>:           MergeMOE的专家数" << std::endl;
+    std::cout << "<--contexts> <args>:          Attention的上下文长度, 逗号分隔" << std::endl;
+    std::cout << "<--layers> <args>:            权重查找测试的层数" << std::endl;
+    std::cout << "<--repeat> <args>:            每个case最多重复次数" << std::endl;
+    std::cout << "<--min_time> <args>:          每个case最少运行时间(秒)" << std::endl;
+    std::cout << "<-o|--output> <args>:         json结果输出文件" << std::endl;
+}
+
+std::vector <std::string> SplitString(const std::string &s, char sep) {
+    std::vector <std::string> ret;
+    std::stringstream ss(s);
+    std::string cur;
+    while (std::getline(ss, cur, sep)) {
+        if (cur != "") {
+            ret.push_back(cur);
+        }
+    }
+    return ret;
+}
+
+std::vector <int> ParseIntList(const std::string &s) {
+    std::vector <int> ret;
+    for (auto &it : SplitString(s, ',')) {
+        ret.push_back(atoi(it.c_str()));
+    }
+    return ret;
+}
+
+void ParseArgs(int argc, char **argv, BenchConfig &config) {
+    std::vector <std::string> sargv;
+    for (int i = 0; i < argc; i++) {
+        sargv.push_back(std::string(argv[i]));
+    }
+    for (int i = 1; i < argc; i++) {
+        if (sargv[i] == "-h" || sargv[i] == "--help") {
+            Usage();
+            exit(0);
+        } else if (sargv[i] == "-t" || sargv[i] == "--threads") {
+            config.threads = ParseIntList(sargv[++i]);
+        } else if (sargv[i] == "-n" || sargv[i] == "--tokens") {
+            config.ns = ParseIntList(sargv[++i]);
+        } else if (sargv[i] == "--shapes") {
+            config.linearShapes.clear();
+            for (auto &it : SplitString(sargv[++i], ',')) {
+                auto mk = SplitString(it, 'x');
+                fastllm::AssertInFastLLM(mk.size() == 2, "benchOps: shape should be like 4096x4096.\n");
+                config.linearShapes.push_back(std::make_pair(atoi(mk[0].c_str()), atoi(mk[1].c_str())));
+            }
+        } else if (sargv[i] == "--ops") {
+            auto ops = SplitString(sargv[++i], ',');
+            config.ops = std::set <std::string> (ops.begin(), ops.end());
+        } else if (sargv[i] == "--dtypes") {
+            config.dtypes = SplitString(sargv[++i], ',');
+        } else if (sargv[i] == "--experts") {
+            config.experts = atoi(sargv[++i].c_str());
+        } else if (sargv[i] == "--contexts") {
+            config.contexts = ParseIntList(sargv[++i]);
+        } else if (sargv[i] == "--layers") {
+            config.layers = atoi(sargv[++i].c_str());
+        } else if (sargv[i] == "--repeat") {
+            config.repeat = atoi(sargv[++i].c_str());
+        } else if (sargv[i] == "--min_time") {
+            config.minTime = atof(sargv[++i].c_str());
+        } else if (sargv[i] == "-o" || sargv[i] == "--output") {
+            config.output = sargv[++i];
+        } else {
+            Usage();
+            exit(-1);
+        }
+    }
+    if (config.threads.size() == 0) {
+        config.threads.push_back(std::max(1, (int)std::thread::hardware_concurrency()));
+    }
+    // AliveThreadPool只会扩容, 因此从小到大测试
+    std::sort(config.threads.begin(), config.threads.end());
+}
+
+// 峰值测试: 每个线程执行独立的FMA链
+struct MultiThreadPeakFlopsOp : fastllm::MultiThreadBaseOp {
+    int iters;
+    float *result;
+
+    MultiThreadPeakFlopsOp (int iters, float *result) : iters(iters), result(result) {}
+
+    void Run() {
+        const int lanes = 128;
+        float acc[lanes], mul = 0.999999f, add = 1e-7f;
+        for (int j = 0; j < lanes; j++) {
+            acc[j] = (float)j;
+        }
+        for (int i = 0; i < iters; i++) {
+            for (int j = 0; j < lanes; j++) {
+                acc[j] = acc[j] * mul + add;
+            }
+        }
+        float sum = 0.0f;
+        for (int j = 0; j < lanes; j++) {
+            sum += acc[j];
+        }
+        *result = sum;
+    }
+};
+
+// 带宽测试: 每个线程顺序读取自己的一段内存
+struct MultiThreadPeakBandwidthOp : fastllm::MultiThreadBaseOp {
+    float *data;
+    size_t len;
+    int rounds;
+    float *result;
+
+    MultiThreadPeakBandwidthOp (float *data, size_t len, int rounds, float *result) :
+        data(data), len(len), rounds(rounds), result(result) {}
+
+    void Run() {
+        float sum[16] = {0};
+        for (int r = 0; r < rounds; r++) {
+            for (size_t i = 0; i + 16 <= len; i += 16) {
+                for (int j = 0; j < 16; j++) {
+                    sum[j] += data[i + j];
+                }
+            }
+        }
+        float ret = 0.0f;
+        for (int j = 0; j < 16; j++) {
+            ret += sum[j];
+        }
+        *result = ret;
+    }
+};
+
+template <typename OpMaker>
+double RunOnThreads(int threads, OpMaker maker) {
+    auto *pool = fastllm::GetAlivePool();
+    std::vector <fastllm::MultiThreadBaseOp*> ops;
+    for (int i = 0; i < threads; i++) {
+        ops.push_back(maker(i));
+    }
+    auto st = std::chrono::system_clock::now();
+    for (int i = 0; i < threads; i++) {
+        pool->PushOp(i, ops[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pool->Wait(i);
+        delete ops[i];
+    }
+    return fastllm::GetSpan(st, std::chrono::system_clock::now());
+}
+
+MachinePeak MeasurePeak(int threads) {
+    MachinePeak peak;
+    std::vector <float> results(threads);
+    int iters = 1 << 20;
+    double spend = RunOnThreads(threads, [&](int i) { return new MultiThreadPeakFlopsOp(iters, &results[i]); });
+    peak.gflops = 2.0 * 128 * iters * threads / spend / 1e9;
+
+    size_t perThread = (64 << 20) / sizeof(float); // 每个线程64MB, 远大于LLC
+    std::vector <float> buffer(perThread * threads, 1.0f);
+    int rounds = 4;
+    RunOnThreads(threads, [&](int i) { return new MultiThreadPeakBandwidthOp(buffer.data() + i * perThread, perThread, 1, &results[i]); });
+    spend = RunOnThreads(threads, [&](int i) { return new MultiThreadPeakBandwidthOp(buffer.data() + i * perThread, perThread, rounds, &results[i]); });
+    peak.gbps = (double)perThread * sizeof(float) * rounds * threads / spend / 1e9;
+    return peak;
+}
+
+std::vector <float> RandomFloats(size_t len, float range, int seed) {
+    std::vector <float> ret(len);
+    uint32_t x = 2463534242u + seed;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+        ret[i] = ((float)(x & 0xFFFFFF) / (float)0xFFFFFF * 2.0f - 1.0f) * range;
+    }
+    return ret;
+}
+
+uint8_t Float32ToFP8E4M3(float v) {
+    static std::vector <std::pair <float, uint8_t> > table;
+    if (table.size() == 0) {
+        for (int i = 0; i < 127; i++) {
+            int e = (i >> 3) & 15, mant = i & 7;
+            float value = (e == 0) ? ldexp((float)mant / 8.0f, -6) : ldexp(1.0f + (float)mant / 8.0f, e - 7);
+            table.push_back(std::make_pair(value, (uint8_t)i));
+        }
+    }
+    uint8_t sign = v < 0 ? 0x80 : 0;
+    float a = fabs(v);
+    auto it = std::lower_bound(table.begin(), table.end(), std::make_pair(a, (uint8_t)0));
+    if (it == table.end()) {
+        return sign | table.back().second;
+    }
+    if (it != table.begin() && a - (it - 1)->first < it->first - a) {
+        it--;
+    }
+    return sign | it->second;
+}
+
+bool ParseWeightType(const std::string &name, fastllm::DataType &dataType, int &ggmlType) {
+    ggmlType = -1;
+    for (auto &it : fastllm::dataTypeNames) {
+        for (auto &s : it.second) {
+            if (s == name) {
+                dataType = it.first;
+                return true;
+            }
+        }
+    }
+    for (int i = 0; i < GGML_TYPE_COUNT; i++) {
+        const char *typeName = ggml_type_name((ggml_type)i);
+        if (typeName == nullptr || strlen(typeName) != name.size()) {
+            continue;
+        }
+        bool same = true;
+        for (int j = 0; j < name.size(); j++) {
+            same &= (tolower(typeName[j]) == tolower(name[j]));
+        }
+        if (same && ggml_type_from_float_ref((ggml_type)i) != nullptr) {
+            dataType = fastllm::DataType::DATA_GGUF_FORMAT;
+            ggmlType = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 构造一个[k, m]的权重, 数据类型与模型加载后的权重一致
+void MakeWeight(fastllm::Data &weight, const std::string &dtype, int k, int m, int seed) {
+    fastllm::DataType dataType;
+    int ggmlType;
+    fastllm::AssertInFastLLM(ParseWeightType(dtype, dataType, ggmlType), "benchOps: unknown dtype " + dtype + ".\n");
+    std::vector <float> ori = RandomFloats((size_t)k * m, 0.05f, seed);
+    if (dataType == fastllm::DataType::DATA_GGUF_FORMAT) {
+        weight = fastllm::Data(dataType, ggmlType, {k, m});
+        weight.CreateFromOriData(fastllm::WeightType::LINEAR, fastllm::DataType::FLOAT32, (uint8_t*)ori.data(), nullptr, nullptr);
+    } else if (dataType == fastllm::DataType::BFLOAT16) {
+        weight = fastllm::Data(dataType, {k, m});
+        weight.weightType = fastllm::WeightType::LINEAR;
+        weight.Allocate();
+        uint16_t *bf16 = (uint16_t*)weight.cpuData;
+        for (size_t i = 0; i < ori.size(); i++) {
+            uint32_t bits;
+            memcpy(&bits, &ori[i], sizeof(bits));
+            bf16[i] = (uint16_t)(bits >> 16);
+        }
+    } else if (dataType == fastllm::DataType::FP8_E4M3) {
+        int block = 128;
+        int ks = (k - 1) / block + 1, ms = (m - 1) / block + 1;
+        std::vector <float> scales(ks * ms, 0.0f);
+        for (int i = 0; i < k; i++) {
+            for (int j = 0; j < m; j++) {
+                float &s = scales[(i / block) * ms + j / block];
+                s = std::max(s, std::fabs(ori[(size_t)i * m + j]) / 448.0f);
+            }
+        }
+        std::vector <uint8_t> fp8(ori.size());
+        for (int i = 0; i < k; i++) {
+            for (int j = 0; j < m; j++) {
+                float s = scales[(i / block) * ms + j / block];
+                fp8[(size_t)i * m + j] = Float32ToFP8E4M3(s > 0 ? ori[(size_t)i * m + j] / s : 0.0f);
+            }
+        }
+        weight = fastllm::Data(dataType, {k, m});
+        weight.CreateFromOriData(fastllm::WeightType::LINEAR, dataType, fp8.data(), nullptr, scales.data(), -1, block, block);
+    } else if (dataType == fastllm::DataType::FLOAT32) {
+        weight.CopyFrom(fastllm::Data(dataType, {k, m}, ori));
+        weight.weightType = fastllm::WeightType::LINEAR;
+    } else {
+        weight = fastllm::Data(dataType, {k, m});
+        int groupCnt = fastllm::DefaultGroupCnts.find(dataType) != fastllm::DefaultGroupCnts.end() ?
+                        fastllm::DefaultGroupCnts[dataType] : -1;
+        weight.CreateFromOriData(fastllm::WeightType::LINEAR, fastllm::DataType::FLOAT32, (uint8_t*)ori.data(), nullptr, nullptr, groupCnt);
+    }
+}
+
+// 运行func直到满足最少时间或次数, 返回单次平均耗时
+double TimeIt(const std::function<void()> &func, const BenchConfig &config) {
+    func(); // warm up
+    int times = 0;
+    auto st = std::chrono::system_clock::now();
+    double spend = 0.0;
+    while (times < config.repeat || spend < config.minTime) {
+        func();
+        times++;
+        spend = fastllm::GetSpan(st, std::chrono::system_clock::now());
+        if (times >= config.repeat * 100) {
+            break;
+        }
+    }
+    return spend / times;
+}
+
+struct BenchRecorder {
+    std::vector <json11::Json> results;
+    MachinePeak peak;
+    int threads = 1;
+
+    void Add(const std::string &op, const std::string &dtype, const json11::Json::object &shape,
+             double seconds, double flops, double bytes) {
+        double gflops = flops / seconds / 1e9, gbps = bytes / seconds / 1e9;
+        // roofline: 可达到的上限 = min(计算峰值, 算术强度 * 带宽峰值)
+        double intensity = bytes > 0 ? flops / bytes : 0.0;
+        double roof = std::min(peak.gflops, intensity * peak.gbps);
+        double efficiency = roof > 0 ? gflops / roof : 0.0;
+        std::string shapeStr = "";
+        for (auto &it : shape) {
+            shapeStr += (shapeStr == "" ? "" : " ") + it.first + "=" + std::to_string(it.second.int_value());
+        }
+        printf("%-10s %-10s t=%-3d %-36s %10.3f ms %10.2f GFLOP/s %8.2f GB/s  roofline %5.1f%%\n",
+               op.c_str(), dtype.c_str(), threads, shapeStr.c_str(),
+               seconds * 1e3, gflops, gbps, efficiency * 100);
+        json11::Json::object result = {
+            {"op", op}, {"dtype", dtype}, {"threads", threads}, {"shape", shape},
+            {"ms", seconds * 1e3}, {"gflops", gflops}, {"gbps", gbps},
+            {"peak_gflops_pct", peak.gflops > 0 ? gflops / peak.gflops * 100 : 0.0},
+            {"peak_gbps_pct", peak.gbps > 0 ? gbps / peak.gbps * 100 : 0.0},
+            {"roofline_pct", efficiency * 100}
+        };
+        results.push_back(result);
+    }
+};
+
+void BenchLinear(const BenchConfig &config, BenchRecorder &recorder) {
+    for (auto &shape : config.linearShapes) {
+        int m = shape.first, k = shape.second;
+        for (auto &dtype : config.dtypes) {
+            fastllm::Data weight;
+            MakeWeight(weight, dtype, k, m, m + k);
+            for (int n : config.ns) {
+                fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, RandomFloats((size_t)n * m, 1.0f, n));
+                fastllm::Data output;
+                double spend = TimeIt([&]() { fastllm::Linear(input, weight, fastllm::Data(), output); }, config);
+                double bytes = (double)weight.GetBytes() + (double)n * m * 4 + (double)n * k * 4;
+                recorder.Add("linear", dtype, {{"n", n}, {"m", m}, {"k", k}}, spend, 2.0 * n * m * k, bytes);
+            }
+        }
+    }
+}
+
+void BenchMergeMOE(const BenchConfig &config, BenchRecorder &recorder) {
+    int experts = config.experts, topk = std::min(config.topk, config.experts);
+    int hidden = config.moeHidden, inter = config.moeInter;
+    for (auto &dtype : config.dtypes) {
+        std::vector <fastllm::Data> expertWeights(experts * 2);
+        std::vector <fastllm::Data*> weights = {nullptr, nullptr};
+        std::vector <fastllm::Data*> biass = {nullptr, nullptr};
+        for (int e = 0; e < experts; e++) {
+            MakeWeight(expertWeights[e * 2], dtype, inter * 2, hidden, e * 2);
+            MakeWeight(expertWeights[e * 2 + 1], dtype, hidden, inter, e * 2 + 1);
+            weights.push_back(&expertWeights[e * 2]);
+            weights.push_back(&expertWeights[e * 2 + 1]);
+            biass.push_back(nullptr);
+            biass.push_back(nullptr);
+        }
+        double expertBytes = (double)expertWeights[0].GetBytes() + expertWeights[1].GetBytes();
+        for (int n : config.ns) {
+            fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, hidden}, RandomFloats((size_t)n * hidden, 1.0f, n));
+            fastllm::Data logits = fastllm::Data(fastllm::DataType::FLOAT32, {n, experts}, RandomFloats((size_t)n * experts, 4.0f, n + 1));
+            fastllm::Softmax(logits, logits, -1);
+            if (!fastllm::CanRunMergeMOE(input, biass)) {
+                continue;
+            }
+            fastllm::Data gateBias, w1, w2, w3, curInput, curOutput, output;
+            double spend = TimeIt([&]() {
+                fastllm::MergeMOE(input, logits, gateBias, weights, biass, w1, w2, w3, curInput, curOutput,
+                                  1.0f, 1.0f, topk, true, output);
+            }, config);
+            // 实际访问的专家数按期望估计: experts * (1 - (1 - topk / experts) ^ n)
+            double touched = experts * (1.0 - pow(1.0 - (double)topk / experts, n));
+            double flops = 2.0 * n * topk * (3.0 * hidden * inter);
+            double bytes = touched * expertBytes + (double)n * hidden * 8;
+            recorder.Add("mergemoe", dtype, {{"n", n}, {"hidden", hidden}, {"inter", inter}, {"experts", experts}, {"topk", topk}},
+                         spend, flops, bytes);
+        }
+    }
+}
+
+void BenchAttention(const BenchConfig &config, BenchRecorder &recorder) {
+    int heads = config.heads, kvHeads = config.kvHeads, dim = config.headDim;
+    for (int context : config.contexts) {
+        fastllm::Data k = fastllm::Data(fastllm::DataType::FLOAT32, {kvHeads, context, dim}, RandomFloats((size_t)kvHeads * context * dim, 1.0f, 1));
+        fastllm::Data v = fastllm::Data(fastllm::DataType::FLOAT32, {kvHeads, context, dim}, RandomFloats((size_t)kvHeads * context * dim, 1.0f, 2));
+        for (int n : config.ns) {
+            if (n > context) {
+                continue;
+            }
+            fastllm::Data q = fastllm::Data(fastllm::DataType::FLOAT32, {heads, n, dim}, RandomFloats((size_t)heads * n * dim, 1.0f, 3));
+            fastllm::Data output;
+            double spend = TimeIt([&]() {
+                fastllm::Attention(q, k, v, fastllm::Data(), output, heads / kvHeads, 1.0f / sqrt((float)dim), 0);
+            }, config);
+            double flops = 4.0 * heads * n * context * dim;
+            double bytes = (double)(q.GetBytes() + k.GetBytes() + v.GetBytes()) + (double)heads * n * dim * 4;
+            recorder.Add("attention", "float32", {{"n", n}, {"context", context}, {"heads", heads}, {"kv_heads", kvHeads}, {"head_dim", dim}},
+                         spend, flops, bytes);
+        }
+    }
+}
+
+// 残差相加 + RMSNorm + 量化权重的Linear, 对比分开执行和AddRMSNormQuant融合执行
+void BenchAddNormLinear(const BenchConfig &config, BenchRecorder &recorder) {
+    for (auto &shape : config.linearShapes) {
+        int m = shape.first, k = shape.second;
+        fastllm::Data normWeight = fastllm::Data(fastllm::DataType::FLOAT32, {m}, RandomFloats(m, 1.0f, 7));
+        for (auto &dtype : config.dtypes) {
+            fastllm::Data weight;
+            MakeWeight(weight, dtype, k, m, m + k);
+            if (!fastllm::CanRunAddRMSNormQuant(fastllm::Data(fastllm::DataType::FLOAT32), weight)) {
+                continue;
+            }
+            for (int n : config.ns) {
+                fastllm::Data hidden = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, RandomFloats((size_t)n * m, 1.0f, n));
+                fastllm::Data add = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, RandomFloats((size_t)n * m, 0.01f, n + 1));
+                fastllm::Data norm, output;
+                double flops = 2.0 * n * m * k, bytes = (double)weight.GetBytes() + (double)n * m * 12 + (double)n * k * 4;
+                double spend = TimeIt([&]() {
+                    fastllm::AddTo(hidden, add);
+                    fastllm::RMSNorm(hidden, normWeight, 1e-6, norm);
+                    fastllm::Linear(norm, weight, fastllm::Data(), output);
+                }, config);
+                recorder.Add("addnorm", dtype, {{"n", n}, {"m", m}, {"k", k}}, spend, flops, bytes);
+                spend = TimeIt([&]() {
+                    fastllm::AddRMSNormQuant(hidden, add, normWeight, 1e-6, weight, norm);
+                    fastllm::Linear(norm, weight, fastllm::Data(), output);
+                }, config);
+                recorder.Add("addnorm_fused", dtype, {{"n", n}, {"m", m}, {"k", k}}, spend, flops, bytes);
+            }
+        }
+    }
+}
+
+void BenchElementwise(const BenchConfig &config, BenchRecorder &recorder) {
+    for (int n : config.ns) {
+        if (config.ops.count("rmsnorm")) {
+            fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, config.hidden}, RandomFloats((size_t)n * config.hidden, 1.0f, 4));
+            fastllm::Data weight = fastllm::Data(fastllm::DataType::FLOAT32, {config.hidden}, RandomFloats(config.hidden, 1.0f, 5));
+            fastllm::Data output;
+            double spend = TimeIt([&]() { fastllm::RMSNorm(input, weight, 1e-6, output); }, config);
+            recorder.Add("rmsnorm", "float32", {{"n", n}, {"hidden", config.hidden}}, spend,
+                         4.0 * n * config.hidden, 8.0 * n * config.hidden);
+        }
+        if (config.ops.count("swiglu")) {
+            fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, config.inter * 2}, RandomFloats((size_t)n * config.inter * 2, 1.0f, 6));
+            fastllm::Data output;
+            double spend = TimeIt([&]() { fastllm::Swiglu(input, output); }, config);
+            recorder.Add("swiglu", "float32", {{"n", n}, {"inter", config.inter}}, spend,
+                         6.0 * n * config.inter, 12.0 * n * config.inter);
+        }
+    }
+}
+
+// 一次decode中每层权重的查找开销: 每步拼接权重名 + 哈希查表(以及bias的拷贝), 对比预先建立的指针表
+void BenchWeightLookup(const BenchConfig &config, BenchRecorder &recorder) {
+    struct LayerWeights {
+        fastllm::Data *inputNorm, *postNorm, *q, *qBias, *k, *kBias, *v, *vBias, *o, *oBias, *gateUp, *down;
+    };
+    int kvDim = config.hidden / config.heads * config.kvHeads;
+    fastllm::WeightMap weights;
+    std::vector <LayerWeights> table(config.layers);
+    for (int i = 0; i < config.layers; i++) {
+        std::string pre = "model.layers." + std::to_string(i);
+        // 只有bias需要真实的数据(原来的写法每步会拷贝bias), 其余权重用空的Data占位
+        for (auto &name : {".input_layernorm.weight", ".post_attention_layernorm.weight", ".self_attn.q_proj.weight",
+                           ".self_attn.k_proj.weight", ".self_attn.v_proj.weight", ".self_attn.o_proj.weight",
+                           ".mlp.gateup_proj.weight", ".mlp.down_proj.weight"}) {
+            weights[pre + name];
+        }
+        weights[pre + ".self_attn.q_proj.bias"].CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {config.hidden}, RandomFloats(config.hidden, 1.0f, i)));
+        weights[pre + ".self_attn.k_proj.bias"].CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {kvDim}, RandomFloats(kvDim, 1.0f, i + 1)));
+        weights[pre + ".self_attn.v_proj.bias"].CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {kvDim}, RandomFloats(kvDim, 1.0f, i + 2)));
+    }
+    auto find = [&](const std::string &name) -> fastllm::Data* {
+        auto it = weights.weight.find(name);
+        return it == weights.weight.end() ? nullptr : &it->second;
+    };
+    for (int i = 0; i < config.layers; i++) {
+        std::string pre = "model.layers." + std::to_string(i);
+        table[i] = LayerWeights {find(pre + ".input_layernorm.weight"), find(pre + ".post_attention_layernorm.weight"),
+                                 find(pre + ".self_attn.q_proj.weight"), find(pre + ".self_attn.q_proj.bias"),
+                                 find(pre + ".self_attn.k_proj.weight"), find(pre + ".self_attn.k_proj.bias"),
+                                 find(pre + ".self_attn.v_proj.weight"), find(pre + ".self_attn.v_proj.bias"),
+                                 find(pre + ".self_attn.o_proj.weight"), find(pre + ".self_attn.o_proj.bias"),
+                                 find(pre + ".mlp.gateup_proj.weight"), find(pre + ".mlp.down_proj.weight")};
+    }
+
+    volatile long long sink = 0;
+    // 和原来的llama / qwen3 forward中每层的写法一致
+    double spend = TimeIt([&]() {
+        for (int i = 0; i < config.layers; i++) {
+            sink += (long long)&weights["model.layers." + std::to_string(i) + ".input_layernorm.weight"];
+            std::string qWeightName = "model.layers." + std::to_string(i) + ".self_attn.q_proj.weight";
+            std::string qBiasName = "model.layers." + std::to_string(i) + ".self_attn.q_proj.bias";
+            std::string kWeightName = "model.layers." + std::to_string(i) + ".self_attn.k_proj.weight";
+            std::string kBiasName = "model.layers." + std::to_string(i) + ".self_attn.k_proj.bias";
+            std::string vWeightName = "model.layers." + std::to_string(i) + ".self_attn.v_proj.weight";
+            std::string vBiasName = "model.layers." + std::to_string(i) + ".self_attn.v_proj.bias";
+            std::string qkvWeightName = "model.layers." + std::to_string(i) + ".self_attn.W_pack.weight";
+            std::string oWeightName = "model.layers." + std::to_string(i) + ".self_attn.o_proj.weight";
+            std::string oBiasName = "model.layers." + std::to_string(i) + ".self_attn.o_proj.bias";
+            std::string mergeQkvWeightName = "model.layers." + std::to_string(i) + ".self_attn.mergeqkv.weight";
+            std::string mergeQkvBiasName = "model.layers." + std::to_string(i) + ".self_attn.mergeqkv.bias";
+            sink += weights.weight.find(mergeQkvWeightName) != weights.weight.end();
+            sink += weights.weight.find(qkvWeightName) != weights.weight.end();
+            sink += weights.weight.find(mergeQkvWeightName) != weights.weight.end();
+            fastllm::Data qBias = (weights.weight.find(qBiasName) != weights.weight.end()) ? weights[qBiasName] : fastllm::Data();
+            fastllm::Data kBias = (weights.weight.find(kBiasName) != weights.weight.end()) ? weights[kBiasName] : fastllm::Data();
+            fastllm::Data vBias = (weights.weight.find(vBiasName) != weights.weight.end()) ? weights[vBiasName] : fastllm::Data();
+            sink += (long long)&weights[qWeightName] + (long long)&weights[kWeightName] + (long long)&weights[vWeightName];
+            sink += qBias.dims.size() + kBias.dims.size() + vBias.dims.size();
+            fastllm::Data oBias = (weights.weight.find(oBiasName) != weights.weight.end()) ? weights[oBiasName] : fastllm::Data();
+            sink += (long long)&weights[oWeightName] + oBias.dims.size();
+
+            std::string postNormWeightName = "model.layers." + std::to_string(i) + ".post_attention_layernorm.weight";
+            std::string swigluWeightName = "model.layers." + std::to_string(i) + ".mlp.gateup_proj.weight";
+            std::string mlpInWeightName = weights.weight.find(swigluWeightName) != weights.weight.end() ?
+                                          swigluWeightName : "model.layers." + std::to_string(i) + ".mlp.gate_proj.weight";
+            sink += (long long)&weights[mlpInWeightName] + (long long)&weights[postNormWeightName];
+            if (weights.weight.find(swigluWeightName) != weights.weight.end()) {
+                std::string downWeightName = "model.layers." + std::to_string(i) + ".mlp.down_proj.weight";
+                sink += (long long)&weights[swigluWeightName] + (long long)&weights[downWeightName];
+            }
+        }
+    }, config);
+    recorder.Add("lookup_name", "-", {{"layers", config.layers}, {"hidden", config.hidden}}, spend, 0.0, 0.0);
+
+    fastllm::Data emptyData;
+    spend = TimeIt([&]() {
+        for (auto &layer : table) {
+            sink += (long long)layer.inputNorm + (long long)layer.q + (long long)layer.k + (long long)layer.v;
+            const fastllm::Data &qBias = layer.qBias ? *layer.qBias : emptyData;
+            const fastllm::Data &kBias = layer.kBias ? *layer.kBias : emptyData;
+            const fastllm::Data &vBias = layer.vBias ? *layer.vBias : emptyData;
+            const fastllm::Data &oBias = layer.oBias ? *layer.oBias : emptyData;
+            sink += qBias.dims.size() + kBias.dims.size() + vBias.dims.size() + oBias.dims.size();
+            sink += (long long)layer.o + (long long)layer.postNorm + (long long)layer.gateUp + (long long)layer.down;
+        }
+    }, config);
+    recorder.Add("lookup_table", "-", {{"layers", config.layers}, {"hidden", config.hidden}}, spend, 0.0, 0.0);
+}
+
+int main(int argc, char **argv) {
+    BenchConfig config;
+    ParseArgs(argc, argv, config);
+
+    std::vector <json11::Json> machines, results;
+    for (int threads : config.threads) {
+        fastllm::SetThreads(threads);
+        BenchRecorder recorder;
+        recorder.threads = threads;
+        recorder.peak = MeasurePeak(threads);
+        printf("threads = %d, peak = %.2f GFLOP/s (fp32 fma), %.2f GB/s (read)\n", threads, recorder.peak.gflops, recorder.peak.gbps);
+        machines.push_back(json11::Json::object {
+            {"threads", threads}, {"peak_gflops", recorder.peak.gflops}, {"peak_gbps", recorder.peak.gbps}
+        });
+
+        if (config.ops.count("linear")) {
+            BenchLinear(config, recorder);
+        }
+        if (config.ops.count("mergemoe")) {
+            BenchMergeMOE(config, recorder);
+        }
+        if (config.ops.count("attention")) {
+            BenchAttention(config, recorder);
+        }
+        if (config.ops.count("addnorm")) {
+            BenchAddNormLinear(config, recorder);
+        }
+        if (config.ops.count("weightlookup")) {
+            BenchWeightLookup(config, recorder);
+        }
+        BenchElementwise(config, recorder);
+        results.insert(results.end(), recorder.results.begin(), recorder.results.end());
+    }
+
+    if (config.output != "") {
+        json11::Json ret = json11::Json::object {{"machine", machines}, {"results", results}};
+        std::ofstream fout(config.output);
+        fout << ret.dump() << std::endl;
+        printf("Results saved to %s\n", config.output.c_str());
+    }
+    return 0;
+}
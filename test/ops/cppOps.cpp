@@ -1,4 +1,13 @@
 #include "fastllm.h"
+#include "devices/cpu/cpudevice.h"
+#include "devices/cpu/lineartuner.h"
+#include "calibration.h"
+#include "gguf.h"
+#include "llama.h"
+#include "gpt_oss.h"
+#include "model.h"
+#include <chrono>
+#include <thread>
 
 void callBaseOp(int optype=0){
     fastllm::Data inputs = fastllm::Data(fastllm::DataType::FLOAT32, {1, 2}, {1, 5});
@@ -32,6 +41,39 @@ void callBaseOp(int optype=0){
     outputs.Print();
 }
 
+void callEmbeddingOp(fastllm::DataType weightType, int ggmlType = -1){
+    // 量化词表上按行反量化取embedding, 误差不超过量化步长; 拷贝出的权重 (共享词表的lm_head) 结果应当一致
+    int vocab = 50, embSize = 256, groupCnt = 128;
+    std::vector <float> w;
+    for (int i = 0; i < vocab * embSize; i++) {
+        w.push_back(0.05f * cos(i * 0.37f));
+    }
+    fastllm::Data weight = (ggmlType == -1 ? fastllm::Data(weightType, {vocab, embSize}) : fastllm::Data(weightType, ggmlType, {vocab, embSize}));
+    weight.CreateFromOriData(fastllm::WeightType::EMBEDDING, fastllm::DataType::FLOAT32, (uint8_t*)w.data(), nullptr, nullptr, groupCnt);
+    std::vector <float> ids = {0, 7, 49, 7};
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {1, (int)ids.size()}, ids);
+    fastllm::Data output, copyOutput, copyWeight;
+    fastllm::Embedding(input, weight, output);
+    copyWeight.CopyFrom(weight);
+    fastllm::Embedding(input, copyWeight, copyOutput);
+
+    float maxDiff = 0.0f, copyDiff = 0.0f;
+    for (int i = 0; i < ids.size(); i++) {
+        for (int j = 0; j < embSize; j++) {
+            float now = ((float*)output.cpuData)[i * embSize + j];
+            maxDiff = std::max(maxDiff, std::fabs(now - w[(int)ids[i] * embSize + j]));
+            copyDiff = std::max(copyDiff, std::fabs(now - ((float*)copyOutput.cpuData)[i * embSize + j]));
+        }
+    }
+    float step = 0.1f / (weightType == fastllm::DataType::INT4_GROUP ? 15 : 255); // 每行 (组) 的范围不超过0.1
+    std::string name = fastllm::GetDataTypeName(weight.GetDataType());
+    printf("Embedding (%s) max diff = %f\n", name.c_str(), maxDiff);
+    if (maxDiff > step || copyDiff > 0.0f) {
+        printf("Embedding (%s) error: result mismatch.\n", name.c_str());
+        exit(1);
+    }
+}
+
 void callNormOp(int normType=0){
     fastllm::Data inputs = fastllm::Data(fastllm::DataType::FLOAT32, {1, 2}, {1, 5}); 
     fastllm::Data weights = fastllm::Data(fastllm::DataType::FLOAT32, {1, 2}, {1, 2});
@@ -53,6 +95,66 @@ void callNormOp(int normType=0){
     outputs.ToDevice(fastllm::DataDevice::CPU);
     outputs.Print();
 }
+
+// AddRMSNormQuant + Linear 应该和 AddTo + RMSNorm + Linear 结果一致
+void callFusedNormOp(fastllm::DataType weightType){
+    int n = 3, m = 256, k = 8;
+    std::vector <float> hidden, add, norm, weight;
+    for (int i = 0; i < n * m; i++) {
+        hidden.push_back(sin(i * 0.1f));
+        add.push_back(cos(i * 0.3f) * 0.5f);
+    }
+    for (int i = 0; i < m; i++) {
+        norm.push_back(1.0f + 0.01f * (i % 7));
+    }
+    for (int i = 0; i < k * m; i++) {
+        weight.push_back(0.05f * sin(i * 0.7f));
+    }
+    fastllm::Data normWeight = fastllm::Data(fastllm::DataType::FLOAT32, {m}, norm);
+    fastllm::Data linearWeight = fastllm::Data(weightType, {k, m});
+    linearWeight.CreateFromOriData(fastllm::WeightType::LINEAR, fastllm::DataType::FLOAT32, (uint8_t*)weight.data(), nullptr, nullptr, 
+                                   weightType == fastllm::DataType::INT4_GROUP ? 128 : -1);
+
+    fastllm::Data hidden0 = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, hidden);
+    fastllm::Data add0 = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, add);
+    fastllm::Data norm0, output0;
+    fastllm::AddTo(hidden0, add0);
+    fastllm::RMSNorm(hidden0, normWeight, 1e-5, norm0);
+    fastllm::Linear(norm0, linearWeight, fastllm::Data(), output0);
+
+    if (!fastllm::CanRunAddRMSNormQuant(hidden0, linearWeight)) {
+        printf("AddRMSNormQuant can't run.\n");
+        return;
+    }
+    fastllm::Data hidden1 = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, hidden);
+    fastllm::Data add1 = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, add);
+    fastllm::Data norm1, output1;
+    fastllm::AddRMSNormQuant(hidden1, add1, normWeight, 1e-5, linearWeight, norm1);
+    fastllm::Linear(norm1, linearWeight, fastllm::Data(), output1);
+
+    float maxDiff = 0.0f;
+    for (int i = 0; i < n * m; i++) {
+        maxDiff = std::max(maxDiff, std::fabs(((float*)hidden0.cpuData)[i] - ((float*)hidden1.cpuData)[i]));
+        maxDiff = std::max(maxDiff, std::fabs(((float*)norm0.cpuData)[i] - ((float*)norm1.cpuData)[i]));
+    }
+    for (int i = 0; i < n * k; i++) {
+        maxDiff = std::max(maxDiff, std::fabs(((float*)output0.cpuData)[i] - ((float*)output1.cpuData)[i]));
+    }
+
+    // 原地改写norm之后, Linear不能再使用AddRMSNormQuant留下的量化结果
+    fastllm::AddTo(norm0, add0);
+    fastllm::AddTo(norm1, add1);
+    fastllm::Linear(norm0, linearWeight, fastllm::Data(), output0);
+    fastllm::Linear(norm1, linearWeight, fastllm::Data(), output1);
+    for (int i = 0; i < n * k; i++) {
+        maxDiff = std::max(maxDiff, std::fabs(((float*)output0.cpuData)[i] - ((float*)output1.cpuData)[i]));
+    }
+    printf("AddRMSNormQuant max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-3) {
+        printf("AddRMSNormQuant error: result mismatch.\n");
+        exit(1);
+    }
+}
     
 
 void callLinearOp(){
@@ -65,6 +167,544 @@ void callLinearOp(){
     outputs.Print();
 }
 
+void callSegmentLoraOp(){
+    // 3段请求: adapter 0, 不使用adapter, adapter 1 (rank不同)
+    std::vector <int> segLens = {2, 3, 4};
+    std::vector <int> ranks = {2, 0, 3};
+    int n = 5, m = 6, rows = 9;
+    std::vector <float> x, base;
+    for (int i = 0; i < rows * n; i++) {
+        x.push_back(sin(i * 0.31f));
+    }
+    for (int i = 0; i < rows * m; i++) {
+        base.push_back(cos(i * 0.17f));
+    }
+    std::vector <fastllm::Data> as(segLens.size()), bs(segLens.size());
+    std::vector <fastllm::Data*> loraAs, loraBs;
+    for (int s = 0; s < segLens.size(); s++) {
+        if (ranks[s] == 0) {
+            loraAs.push_back(nullptr);
+            loraBs.push_back(nullptr);
+            continue;
+        }
+        std::vector <float> a, b;
+        for (int i = 0; i < ranks[s] * n; i++) {
+            a.push_back(sin(i * 0.7f + s));
+        }
+        for (int i = 0; i < ranks[s] * m; i++) {
+            b.push_back(cos(i * 0.3f + s));
+        }
+        as[s].CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {ranks[s], n}, a));
+        bs[s].CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, {ranks[s], m}, b));
+        loraAs.push_back(&as[s]);
+        loraBs.push_back(&bs[s]);
+    }
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {1, rows, n}, x);
+    fastllm::Data output = fastllm::Data(fastllm::DataType::FLOAT32, {1, rows, m}, base);
+    fastllm::SegmentLora(input, loraAs, loraBs, segLens, output);
+    output.ToDevice(fastllm::DataDevice::CPU);
+
+    float maxDiff = 0.0f;
+    for (int s = 0, off = 0; s < segLens.size(); off += segLens[s], s++) {
+        for (int i = off; i < off + segLens[s]; i++) {
+            for (int o = 0; o < m; o++) {
+                float ref = base[i * m + o];
+                for (int j = 0; j < ranks[s]; j++) {
+                    float t = 0.0f;
+                    for (int k = 0; k < n; k++) {
+                        t += x[i * n + k] * ((float*)as[s].cpuData)[j * n + k];
+                    }
+                    ref += t * ((float*)bs[s].cpuData)[j * m + o];
+                }
+                maxDiff = std::max(maxDiff, std::fabs(ref - ((float*)output.cpuData)[i * m + o]));
+            }
+        }
+    }
+    printf("SegmentLora max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-4) {
+        printf("SegmentLora error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callLinearHalfBlockedOp(){
+    // prefill规模 (n >= 32) 的FP16权重走分块GEMM, m和k都不是分块大小的整数倍
+    int n = 40, m = 300, k = 37;
+    std::vector <float> x, w, b;
+    for (int i = 0; i < n * m; i++) {
+        x.push_back(sin(i * 0.13f));
+    }
+    for (int i = 0; i < k * m; i++) {
+        w.push_back((i % 37 - 18) / 256.0f); // fp16可精确表示
+    }
+    for (int i = 0; i < k; i++) {
+        b.push_back(i * 0.01f);
+    }
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {1, n, m}, x);
+    fastllm::Data weight = fastllm::Data(fastllm::DataType::FLOAT32, {k, m}, w);
+    fastllm::Data bias = fastllm::Data(fastllm::DataType::FLOAT32, {k}, b);
+    fastllm::ToDataType(weight, fastllm::DataType::FLOAT16);
+    fastllm::Data output;
+    fastllm::Linear(input, weight, bias, output);
+    output.ToDevice(fastllm::DataDevice::CPU);
+
+    float maxDiff = 0.0f;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < k; j++) {
+            float ref = b[j];
+            for (int l = 0; l < m; l++) {
+                ref += x[i * m + l] * w[j * m + l];
+            }
+            maxDiff = std::max(maxDiff, std::fabs(ref - ((float*)output.cpuData)[i * k + j]));
+        }
+    }
+    printf("Linear (blocked) max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-3) {
+        printf("Linear (blocked) error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callLinearInt4GroupTiledOp(){
+    // INT4_GROUP权重, 多行输入走分块kernel, 结果应该和逐行计算一致
+    int n = 9, m = 256, k = 7;
+    std::vector <float> x, w;
+    for (int i = 0; i < n * m; i++) {
+        x.push_back(sin(i * 0.37f));
+    }
+    for (int i = 0; i < k * m; i++) {
+        w.push_back(0.05f * cos(i * 0.71f));
+    }
+    fastllm::Data weight = fastllm::Data(fastllm::DataType::INT4_GROUP, {k, m});
+    weight.CreateFromOriData(fastllm::WeightType::LINEAR, fastllm::DataType::FLOAT32, (uint8_t*)w.data(), nullptr, nullptr, 128);
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, x);
+    fastllm::Data output;
+    fastllm::Linear(input, weight, fastllm::Data(), output);
+    output.ToDevice(fastllm::DataDevice::CPU);
+
+    float maxDiff = 0.0f;
+    for (int i = 0; i < n; i++) {
+        fastllm::Data row = fastllm::Data(fastllm::DataType::FLOAT32, {1, m}, std::vector <float> (x.begin() + i * m, x.begin() + (i + 1) * m));
+        fastllm::Data rowOutput;
+        fastllm::Linear(row, weight, fastllm::Data(), rowOutput);
+        rowOutput.ToDevice(fastllm::DataDevice::CPU);
+        for (int j = 0; j < k; j++) {
+            maxDiff = std::max(maxDiff, std::fabs(((float*)rowOutput.cpuData)[j] - ((float*)output.cpuData)[i * k + j]));
+        }
+    }
+    printf("Linear (int4 group tiled) max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-3) {
+        printf("Linear (int4 group tiled) error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callQuantizationAllOp(){
+    // SIMD路径和标量尾部应该逐位一致: 都是先加0.5再截断
+    int len = 1003;
+    std::vector <float> x;
+    for (int i = 0; i < len; i++) {
+        x.push_back(3.0f * sin(i * 0.53f) + 0.7f * cos(i * 1.37f));
+    }
+    fastllm::LowBitConfig config = fastllm::LowBitConfig(-3.5f, 3.5f, 8, 0);
+    std::vector <uint8_t> u(len);
+    fastllm::QuantizationAll(x.data(), u.data(), len, &config);
+    for (int i = 0; i < len; i++) {
+        uint8_t ref = (uint8_t) (std::min(255., (double) std::max(x[i] / config.scale + config.zeroPoint + 0.5, 0.0)));
+        if (u[i] != ref) {
+            printf("QuantizationAll error: element %d got %d, expected %d.\n", i, u[i], ref);
+            exit(1);
+        }
+    }
+    printf("QuantizationAll matches scalar path.\n");
+}
+
+void callLinearLowBitOp(fastllm::DataType weightType){
+    // 和反量化后的权重计算的结果对比, 输入取int8可以精确表示的值 (每组的最小值-2, 最大值127/64, 零点128)
+    int n = 6, m = 256, k = 5, groupCnt = 128; // 6行输入同时覆盖4行分块和剩余的单行
+    std::vector <float> x, w;
+    for (int i = 0; i < n * m; i++) {
+        x.push_back(i % groupCnt == 0 ? -2.0f : (i % groupCnt == 1 ? 127.0f / 64 : ((i * 37) % 256 - 128) / 64.0f));
+    }
+    for (int i = 0; i < k * m; i++) {
+        // BASE3_GROUP的scale是每组绝对值的均值, 只取±0.0625时反量化是精确的
+        w.push_back(weightType == fastllm::DataType::BASE3_GROUP ? ((i * 7 % 3 == 0) ? -0.0625f : 0.0625f) : 0.05f * cos(i * 0.71f));
+    }
+    fastllm::Data weight = fastllm::Data(weightType, {k, m});
+    weight.CreateFromOriData(fastllm::WeightType::LINEAR, fastllm::DataType::FLOAT32, (uint8_t*)w.data(), nullptr, nullptr, groupCnt);
+    if (weightType == fastllm::DataType::INT2_GROUP) {
+        for (int i = 0; i < k * m; i++) {
+            int gid = i / m * weight.group + i % m / groupCnt;
+            w[i] = weight.mins[gid] + weight.scales[gid] * ((weight.cpuData[i / 4] >> ((3 - i % 4) * 2)) & 3);
+        }
+    }
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, x);
+    fastllm::Data output;
+    fastllm::Linear(input, weight, fastllm::Data(), output);
+    output.ToDevice(fastllm::DataDevice::CPU);
+
+    float maxDiff = 0.0f;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < k; j++) {
+            float ref = 0.0f;
+            for (int l = 0; l < m; l++) {
+                ref += x[i * m + l] * w[j * m + l];
+            }
+            maxDiff = std::max(maxDiff, std::fabs(ref - ((float*)output.cpuData)[i * k + j]));
+        }
+    }
+    std::string name = fastllm::GetDataTypeName(weightType);
+    printf("Linear (%s) max diff = %f\n", name.c_str(), maxDiff);
+    if (maxDiff > 1e-3) {
+        printf("Linear (%s) error: result mismatch.\n", name.c_str());
+        exit(1);
+    }
+}
+
+void callMergeMOEOp(){
+    // INT4_GROUP专家的MergeMOE (解码路径) 和逐个专家Linear + Swiglu的加权和对比
+    int n = 2, m = 128, inter = 64, experts = 4, topk = 2, groupCnt = 64;
+    std::vector <fastllm::Data> expertWeights;
+    expertWeights.reserve(experts * 2); // 不能扩容, weights中保存的是元素的地址
+    std::vector <fastllm::Data*> weights(experts * 2 + 2, nullptr), biass(experts * 2 + 2, nullptr);
+    for (int e = 0; e < experts; e++) {
+        std::vector <float> gateUp, down;
+        for (int i = 0; i < inter * 2 * m; i++) {
+            gateUp.push_back(0.05f * cos(i * 0.37f + e));
+        }
+        for (int i = 0; i < m * inter; i++) {
+            down.push_back(0.05f * sin(i * 0.53f + e));
+        }
+        expertWeights.emplace_back(fastllm::DataType::INT4_GROUP, std::vector <int> {inter * 2, m});
+        expertWeights[e * 2].CreateFromOriData(fastllm::WeightType::LINEAR, fastllm::DataType::FLOAT32, (uint8_t*)gateUp.data(), nullptr, nullptr, groupCnt);
+        expertWeights.emplace_back(fastllm::DataType::INT4_GROUP, std::vector <int> {m, inter});
+        expertWeights[e * 2 + 1].CreateFromOriData(fastllm::WeightType::LINEAR, fastllm::DataType::FLOAT32, (uint8_t*)down.data(), nullptr, nullptr, groupCnt);
+        weights[e * 2 + 2] = &expertWeights[e * 2];
+        weights[e * 2 + 3] = &expertWeights[e * 2 + 1];
+    }
+    std::vector <float> x, logits;
+    for (int i = 0; i < n * m; i++) {
+        x.push_back(sin(i * 0.19f));
+    }
+    for (int i = 0; i < n * experts; i++) {
+        logits.push_back(0.1f * ((i * 7) % experts) + 0.05f * i);
+    }
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, x);
+    fastllm::Data routerLogits = fastllm::Data(fastllm::DataType::FLOAT32, {n, experts}, logits);
+    fastllm::Data gateBias, w1, w2, w3, curInput, curOutput, output;
+    fastllm::MergeMOE(input, routerLogits, gateBias, weights, biass, w1, w2, w3, curInput, curOutput,
+                      1.0f, 1.0f, topk, false, output);
+    output.ToDevice(fastllm::DataDevice::CPU);
+
+    float maxDiff = 0.0f;
+    for (int i = 0; i < n; i++) {
+        std::vector <std::pair <float, int> > order;
+        for (int e = 0; e < experts; e++) {
+            order.push_back(std::make_pair(-logits[i * experts + e], e));
+        }
+        std::sort(order.begin(), order.end());
+        std::vector <float> ref(m, 0.0f);
+        fastllm::Data row = fastllm::Data(fastllm::DataType::FLOAT32, {1, m}, std::vector <float> (x.begin() + i * m, x.begin() + (i + 1) * m));
+        for (int j = 0; j < topk; j++) {
+            int e = order[j].second;
+            fastllm::Data gateUpOutput, swigluOutput, downOutput;
+            fastllm::Linear(row, expertWeights[e * 2], fastllm::Data(), gateUpOutput);
+            fastllm::Swiglu(gateUpOutput, swigluOutput);
+            fastllm::Linear(swigluOutput, expertWeights[e * 2 + 1], fastllm::Data(), downOutput);
+            downOutput.ToDevice(fastllm::DataDevice::CPU);
+            for (int l = 0; l < m; l++) {
+                ref[l] += logits[i * experts + e] * ((float*)downOutput.cpuData)[l];
+            }
+        }
+        for (int l = 0; l < m; l++) {
+            maxDiff = std::max(maxDiff, std::fabs(ref[l] - ((float*)output.cpuData)[i * m + l]));
+        }
+    }
+    printf("MergeMOE (int4 group) max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-4) {
+        printf("MergeMOE error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callCalibratedQuantOp(int bit){
+    // 通道尺度不均匀且相关的输入 + 带离群值的权重, 校准量化的输出误差应该小于直接取整
+    int n = 64, m = 256, k = 8, groupCnt = 128;
+    std::vector <float> x, w;
+    for (int t = 0; t < n; t++) {
+        for (int j = 0; j < m; j++) {
+            x.push_back((j % 16 == 0 ? 5.0f : 1.0f) * (sin(t * 0.37f + j * 0.11f) + 0.5f * cos(t * 1.3f + (j / 8) * 0.7f)));
+        }
+    }
+    for (int i = 0; i < k * m; i++) {
+        w.push_back(0.05f * cos(i * 0.31f) + (i % 23 == 0 ? 0.3f : 0.0f));
+    }
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, x);
+    fastllm::Data weight = fastllm::Data(fastllm::DataType::FLOAT32, {k, m}, w);
+    weight.name = "calibration.weight";
+    fastllm::Data output;
+    fastllm::ClearCalibration();
+    fastllm::StartCalibration(groupCnt);
+    fastllm::Linear(input, weight, fastllm::Data(), output);
+    fastllm::StopCalibration();
+
+    float errors[2];
+    for (int calib = 0; calib < 2; calib++) {
+        const fastllm::LinearCalibrationStats *stats = calib ? fastllm::GetLinearCalibrationStats(weight.name) : nullptr;
+        if (calib && stats == nullptr) {
+            printf("Calibration error: no stats collected.\n");
+            exit(1);
+        }
+        int group = m / groupCnt;
+        std::vector <uint8_t> q(k * m * bit / 8);
+        std::vector <fastllm::LowBitConfig> configs(k * group);
+        fastllm::QuantizeGroupWithCalibration(w.data(), k, m, bit, groupCnt, stats, q.data(), configs.data());
+        errors[calib] = 0.0f;
+        for (int t = 0; t < n; t++) {
+            for (int i = 0; i < k; i++) {
+                float diff = 0.0f;
+                for (int j = 0; j < m; j++) {
+                    int id = i * m + j;
+                    int v = (bit == 4 ? (q[id / 2] >> (id % 2 ? 0 : 4)) & 15 : (q[id / 4] >> ((3 - id % 4) * 2)) & 3);
+                    auto &config = configs[i * group + j / groupCnt];
+                    diff += x[t * m + j] * (w[id] - (config.min + config.scale * v));
+                }
+                errors[calib] += diff * diff;
+            }
+        }
+    }
+    printf("GroupQuant (int%d) rtn error = %f, calibrated error = %f\n", bit, errors[0], errors[1]);
+    if (errors[1] >= errors[0]) {
+        printf("GroupQuant (int%d) error: calibration doesn't reduce the error.\n", bit);
+        exit(1);
+    }
+}
+
+void callDtypePlanOp(){
+    int n = 32, m = 256, k = 16;
+    std::vector <float> x, w;
+    for (int i = 0; i < n * m; i++) {
+        x.push_back(sin(i * 0.13f) + (i % m == 3 ? 4.0f : 0.0f));
+    }
+    for (int i = 0; i < k * m; i++) {
+        w.push_back(0.05f * cos(i * 0.29f));
+    }
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, x);
+    fastllm::Data weight = fastllm::Data(fastllm::DataType::FLOAT32, {k, m}, w);
+    weight.name = "plan.weight";
+    fastllm::Data output;
+    fastllm::ClearCalibration();
+    fastllm::StartCalibration(128, 8);
+    fastllm::Linear(input, weight, fastllm::Data(), output);
+    fastllm::StopCalibration();
+
+    // fp8无法从float32转换, 会被跳过
+    auto profiles = fastllm::ProfileLinearDtypes(weight, {"int4g", "int8", "float16", "fp8"});
+    if (profiles.size() != 3 || !(profiles[0].error > profiles[1].error && profiles[1].error > profiles[2].error) ||
+        !(profiles[0].bytes < profiles[1].bytes && profiles[1].bytes < profiles[2].bytes)) {
+        printf("DtypePlan error: unexpected profiles.\n");
+        exit(1);
+    }
+
+    // 两组权重, 预算只够一组使用int8
+    std::vector <std::vector <fastllm::LinearDtypeProfile> > units = {profiles, profiles};
+    units[1][0].error *= 2;
+    double budget = profiles[0].bytes + profiles[1].bytes;
+    auto choice = fastllm::PlanLinearDtypes(units, budget, -1);
+    auto best = fastllm::PlanLinearDtypes(units, -1, -1);
+    printf("DtypePlan: %s + %s under budget, %s + %s without budget\n", units[0][choice[0]].dtype.c_str(),
+           units[1][choice[1]].dtype.c_str(), units[0][best[0]].dtype.c_str(), units[1][best[1]].dtype.c_str());
+    if (choice[0] != 0 || choice[1] != 1 || best[0] != 2 || best[1] != 2) {
+        printf("DtypePlan error: wrong plan.\n");
+        exit(1);
+    }
+
+    // 计划写成的dtype config要能被加载器按原始权重名匹配: 合并出的权重展开为各部分, 加载后才生成的权重不写规则
+    std::string pre = "model.layers.0.";
+    std::map <std::string, std::vector <std::pair <std::string, int> > > mergedWeightParts = {
+        {pre + "self_attn.mergeqkv.weight", {{pre + "self_attn.q_proj.weight", 64}, {pre + "self_attn.k_proj.weight", 16},
+                                             {pre + "self_attn.v_proj.weight", 16}}}
+    };
+    std::set <std::string> loaderNames = {pre + "self_attn.mergeqkv.weight", pre + "mlp.down_proj.weight"};
+    std::vector <fastllm::DtypePlanEntry> entries = {
+        {{pre + "self_attn.mergeqkv.weight"}, "int8", "qkv"},
+        {{pre + "mlp.down_proj.weight"}, "int4g256", "down"},
+        {{pre + "self_attn.kv_b_proj.weight.split"}, "float16", "created after loading"}
+    };
+    std::vector <std::string> skipped;
+    std::string plan = fastllm::DtypePlanToConfig(entries, mergedWeightParts, loaderNames, skipped);
+    std::vector <std::pair <std::string, std::string> > rules, embeddingRules;
+    fastllm::ParseDtypeRules(plan, rules, embeddingRules);
+    auto parse = [&](const std::string &name, fastllm::DataType &dataType, int &groupCnt) {
+        int ggmlType = -1;
+        dataType = fastllm::DataType::FLOAT32, groupCnt = -1;
+        fastllm::ParseDataType(name, rules, dataType, groupCnt, ggmlType);
+    };
+    fastllm::DataType dataType;
+    int groupCnt;
+    bool ok = (rules.size() == 4 && skipped.size() == 1 && embeddingRules.size() == 0);
+    for (auto &part : mergedWeightParts.begin()->second) {
+        parse(part.first, dataType, groupCnt);
+        ok &= (dataType == fastllm::DataType::INT8);
+    }
+    parse(pre + "mlp.down_proj.weight", dataType, groupCnt);
+    ok &= (dataType == fastllm::DataType::INT4_GROUP && groupCnt == 256);
+    // 规则是整名匹配, 不会命中名字相近的其它权重
+    parse("model.layers.10.self_attn.q_proj.weight", dataType, groupCnt);
+    ok &= (dataType == fastllm::DataType::FLOAT32);
+    if (!ok) {
+        printf("DtypePlan error: plan doesn't round-trip through the dtype config loader.\n");
+        exit(1);
+    }
+}
+
+void callLMHeadShortlistOp(){
+    // allowed_token_ids只计算集合内的token; 两阶段lm_head的候选中包含最大值, 且候选位置的logits和完整的lm_head一致
+    int vocab = 1000, m = 128, n = 2;
+    std::vector <float> w, x;
+    for (int i = 0; i < vocab * m; i++) {
+        w.push_back(0.05f * cos(i * 0.13f) + 0.02f * sin(i * 0.011f));
+    }
+    for (int i = 0; i < n * m; i++) {
+        // 每一行接近某个token的权重, 使得最大的logits比较明显
+        x.push_back(10.0f * w[(123 + 456 * (i / m)) * m + i % m] + 0.3f * cos(i * 0.7f));
+    }
+    fastllm::Data lmHead = fastllm::Data(fastllm::DataType::FLOAT32, {vocab, m}, w);
+    fastllm::Data hidden = fastllm::Data(fastllm::DataType::FLOAT32, {1, n, m}, x);
+    fastllm::Data full, allowedLogits, shortlistLogits;
+    fastllm::Linear(hidden, lmHead, fastllm::Data(), full);
+    float *fullData = (float*)full.cpuData;
+
+    fastllm::LlamaModel model;
+    model.eos_token_id = 2;
+    fastllm::GenerationConfig config;
+    config.allowed_token_ids = {3, 17, 500};
+    model.ComputeLMHead(hidden, lmHead, allowedLogits, {config}, {});
+    float maxDiff = 0.0f;
+    for (int i = 0; i < n * vocab; i++) {
+        float now = ((float*)allowedLogits.cpuData)[i];
+        if (config.allowed_token_ids.find(i % vocab) != config.allowed_token_ids.end()) {
+            maxDiff = std::max(maxDiff, std::fabs(now - fullData[i]));
+        } else if (now != -INFINITY) {
+            maxDiff = INFINITY;
+        }
+    }
+    printf("LMHead (allowed tokens) max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-5) {
+        printf("LMHead (allowed tokens) error: result mismatch.\n");
+        exit(1);
+    }
+
+    model.SetLMHeadShortlist(32);
+    model.ComputeLMHead(hidden, lmHead, shortlistLogits, {fastllm::GenerationConfig()}, {});
+    maxDiff = 0.0f;
+    int computed = 0;
+    for (int r = 0; r < n; r++) {
+        float *cur = (float*)shortlistLogits.cpuData + r * vocab, *ref = fullData + r * vocab;
+        int best = std::max_element(ref, ref + vocab) - ref;
+        if (cur[best] == -INFINITY || cur[2] == -INFINITY) {
+            maxDiff = INFINITY;
+        }
+        for (int i = 0; i < vocab; i++) {
+            if (cur[i] != -INFINITY) {
+                maxDiff = std::max(maxDiff, std::fabs(cur[i] - ref[i]));
+                computed++;
+            }
+        }
+    }
+    printf("LMHead (shortlist) computed %d / %d logits, max diff = %f\n", computed, n * vocab, maxDiff);
+    if (maxDiff > 1e-5) {
+        printf("LMHead (shortlist) error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callLinearTunerOp(){
+    // 在线调优后结果保持正确, 且调优结果可以保存和加载
+    fastllm::LinearTuner *tuner = fastllm::GetLinearTuner();
+    bool oldOnline = tuner->online;
+    tuner->online = true;
+    int n = 3, m = 64, k = 20;
+    std::vector <float> x, w;
+    for (int i = 0; i < n * m; i++) {
+        x.push_back(sin(i * 0.11f));
+    }
+    for (int i = 0; i < k * m; i++) {
+        w.push_back((i % 29 - 14) / 128.0f);
+    }
+    fastllm::Data input = fastllm::Data(fastllm::DataType::FLOAT32, {n, m}, x);
+    fastllm::Data weight = fastllm::Data(fastllm::DataType::FLOAT32, {k, m}, w);
+    fastllm::ToDataType(weight, fastllm::DataType::FLOAT16);
+    fastllm::Data output;
+    int oldSize = tuner->db.size();
+    fastllm::Linear(input, weight, fastllm::Data(), output);
+    output.ToDevice(fastllm::DataDevice::CPU);
+    tuner->online = oldOnline;
+
+    float maxDiff = 0.0f;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < k; j++) {
+            float ref = 0.0f;
+            for (int l = 0; l < m; l++) {
+                ref += x[i * m + l] * w[j * m + l];
+            }
+            maxDiff = std::max(maxDiff, std::fabs(ref - ((float*)output.cpuData)[i * k + j]));
+        }
+    }
+    printf("Linear (tuned) max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-3 || tuner->db.size() != oldSize + 1) {
+        printf("LinearTuner error: result mismatch.\n");
+        exit(1);
+    }
+    std::string fileName = "linear_tuning_test.txt";
+    auto db = tuner->db;
+    tuner->Save(fileName);
+    tuner->db.clear();
+    tuner->Load(fileName);
+    remove(fileName.c_str());
+    if (tuner->db.size() != db.size() || tuner->db.begin()->second.variant != db.begin()->second.variant) {
+        printf("LinearTuner error: save / load mismatch.\n");
+        exit(1);
+    }
+
+    // 默认kernel也参与计时, 注册的变体更慢时记录并回退到默认kernel
+    auto registry = tuner->registry;
+    tuner->registry.clear();
+    auto naive = [](fastllm::Data &input, fastllm::Data &weight, const fastllm::Data &bias, fastllm::Data &output,
+                    int n, int m, int k, int threadSt, int threadLen) {
+        float *a = (float*)input.cpuData, *b = (float*)weight.cpuData, *c = (float*)output.cpuData;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < k; j++) {
+                c[i * k + j] = 0.0f;
+                for (int l = 0; l < m; l++) {
+                    c[i * k + j] += a[i * m + l] * b[j * m + l];
+                }
+            }
+        }
+    };
+    tuner->Register(fastllm::DataType::FLOAT32, fastllm::DataType::FLOAT32, "base", {"slow",
+        [naive](fastllm::Data &input, fastllm::Data &weight, const fastllm::Data &bias, fastllm::Data &output,
+                int n, int m, int k, int threadSt, int threadLen) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            naive(input, weight, bias, output, n, m, k, threadSt, threadLen);
+        }});
+    tuner->online = true;
+    fastllm::Data weight32 = fastllm::Data(fastllm::DataType::FLOAT32, {k, m}, w);
+    fastllm::Data output32 = fastllm::Data(fastllm::DataType::FLOAT32, {n, k});
+    output32.Allocate();
+    tuner->db.clear();
+    bool tuned = tuner->Run(input, weight32, fastllm::Data(), output32, n, m, k, 0, 1, naive);
+    bool reused = tuner->Run(input, weight32, fastllm::Data(), output32, n, m, k, 0, 1, naive);
+    tuner->online = oldOnline;
+    tuner->registry = registry;
+    std::string variant = tuner->db.size() == 1 ? tuner->db.begin()->second.variant : "";
+    tuner->db = db;
+    if (!tuned || reused || variant != "default") {
+        printf("LinearTuner error: default kernel should win against a slower variant.\n");
+        exit(1);
+    }
+}
+
 void callActivationOp(int activateType=0){
     fastllm::Data inputs = fastllm::Data(fastllm::DataType::FLOAT32, {1, 2}, {1, 5});
     fastllm::Data outputs;
@@ -101,11 +741,437 @@ void callAttentionOp(int group=1, int attentionType=0){
     fastllm::Attention(q, k, v, mask, output, group, scale, attentionType);
 }
 
+// ChunkGatedDeltaRule 应该和逐token的 RecurrentGatedDeltaRule 结果一致
+void callChunkGatedDeltaRuleOp(){
+    int kHeads = 1, heads = 2, seqLen = 37, kDim = 8, vDim = 4, chunkSize = 16;
+    std::vector <float> q, k, v, g, b;
+    for (int i = 0; i < kHeads * seqLen * kDim; i++) {
+        q.push_back(0.3f * sin(i * 0.37f));
+        k.push_back(0.3f * cos(i * 0.21f));
+    }
+    for (int i = 0; i < heads * seqLen * vDim; i++) {
+        v.push_back(sin(i * 0.13f));
+    }
+    for (int i = 0; i < heads * seqLen; i++) {
+        g.push_back(-0.05f - 0.1f * (i % 5));
+        b.push_back(0.2f + 0.1f * (i % 7));
+    }
+
+    fastllm::Data state0 = fastllm::Data(fastllm::DataType::FLOAT32, {1, heads, kDim, vDim});
+    state0.Allocate(0.0f);
+    std::vector <float> output0(heads * seqLen * vDim);
+    for (int t = 0; t < seqLen; t++) {
+        std::vector <float> qt, kt, vt, gt, bt;
+        for (int h = 0; h < kHeads; h++) {
+            qt.insert(qt.end(), q.begin() + (h * seqLen + t) * kDim, q.begin() + (h * seqLen + t + 1) * kDim);
+            kt.insert(kt.end(), k.begin() + (h * seqLen + t) * kDim, k.begin() + (h * seqLen + t + 1) * kDim);
+        }
+        for (int h = 0; h < heads; h++) {
+            vt.insert(vt.end(), v.begin() + (h * seqLen + t) * vDim, v.begin() + (h * seqLen + t + 1) * vDim);
+            gt.push_back(g[h * seqLen + t]);
+            bt.push_back(b[h * seqLen + t]);
+        }
+        fastllm::Data qd = fastllm::Data(fastllm::DataType::FLOAT32, {1, kHeads, 1, kDim}, qt);
+        fastllm::Data kd = fastllm::Data(fastllm::DataType::FLOAT32, {1, kHeads, 1, kDim}, kt);
+        fastllm::Data vd = fastllm::Data(fastllm::DataType::FLOAT32, {1, heads, 1, vDim}, vt);
+        fastllm::Data gd = fastllm::Data(fastllm::DataType::FLOAT32, {1, heads, 1}, gt);
+        fastllm::Data bd = fastllm::Data(fastllm::DataType::FLOAT32, {1, heads, 1}, bt);
+        fastllm::Data out;
+        fastllm::RecurrentGatedDeltaRule(qd, kd, vd, gd, bd, state0, out);
+        for (int h = 0; h < heads; h++) {
+            for (int d = 0; d < vDim; d++) {
+                output0[(h * seqLen + t) * vDim + d] = ((float*)out.cpuData)[h * vDim + d];
+            }
+        }
+    }
+
+    if (!fastllm::CanRunChunkGatedDeltaRule()) {
+        printf("ChunkGatedDeltaRule can't run.\n");
+        return;
+    }
+    fastllm::Data qd = fastllm::Data(fastllm::DataType::FLOAT32, {1, kHeads, seqLen, kDim}, q);
+    fastllm::Data kd = fastllm::Data(fastllm::DataType::FLOAT32, {1, kHeads, seqLen, kDim}, k);
+    fastllm::Data vd = fastllm::Data(fastllm::DataType::FLOAT32, {1, heads, seqLen, vDim}, v);
+    fastllm::Data gd = fastllm::Data(fastllm::DataType::FLOAT32, {1, heads, seqLen}, g);
+    fastllm::Data bd = fastllm::Data(fastllm::DataType::FLOAT32, {1, heads, seqLen}, b);
+    fastllm::Data state1 = fastllm::Data(fastllm::DataType::FLOAT32, {1, heads, kDim, vDim});
+    state1.Allocate(0.0f);
+    fastllm::Data output1;
+    fastllm::ChunkGatedDeltaRule(qd, kd, vd, gd, bd, state1, output1, chunkSize);
+    output1.ToDevice(fastllm::DataDevice::CPU);
+    state1.ToDevice(fastllm::DataDevice::CPU);
+    state0.ToDevice(fastllm::DataDevice::CPU);
+
+    float maxDiff = 0.0f;
+    for (int i = 0; i < heads * seqLen * vDim; i++) {
+        maxDiff = std::max(maxDiff, std::fabs(output0[i] - ((float*)output1.cpuData)[i]));
+    }
+    for (int i = 0; i < heads * kDim * vDim; i++) {
+        maxDiff = std::max(maxDiff, std::fabs(((float*)state0.cpuData)[i] - ((float*)state1.cpuData)[i]));
+    }
+    printf("ChunkGatedDeltaRule max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-3) {
+        printf("ChunkGatedDeltaRule error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callAttentionVarlenOp(){
+    std::vector <int> seqLens = {3, 17, 1, 9};
+    int heads = 4, kvHeads = 2, dim = 8, total = 30;
+    float scale = 1.0f / sqrt(dim);
+    std::vector <float> q, k, v;
+    for (int i = 0; i < total * heads * dim; i++) {
+        q.push_back(sin(i * 0.37f));
+    }
+    for (int i = 0; i < total * kvHeads * dim; i++) {
+        k.push_back(cos(i * 0.21f));
+        v.push_back(sin(i * 0.13f));
+    }
+    if (!fastllm::CanRunAttentionVarlen()) {
+        printf("AttentionVarlen can't run.\n");
+        return;
+    }
+    fastllm::Data qd = fastllm::Data(fastllm::DataType::FLOAT32, {total, heads, dim}, q);
+    fastllm::Data kd = fastllm::Data(fastllm::DataType::FLOAT32, {total, kvHeads, dim}, k);
+    fastllm::Data vd = fastllm::Data(fastllm::DataType::FLOAT32, {total, kvHeads, dim}, v);
+    fastllm::Data output;
+    fastllm::AttentionVarlen(qd, kd, vd, seqLens, output, scale);
+    output.ToDevice(fastllm::DataDevice::CPU);
+
+    // 每个序列单独用全0的mask做Attention作为参考
+    float maxDiff = 0.0f;
+    for (int b = 0, off = 0; b < seqLens.size(); off += seqLens[b], b++) {
+        int len = seqLens[b];
+        std::vector <float> sq, sk, sv;
+        for (int h = 0; h < heads; h++) {
+            for (int i = 0; i < len; i++) {
+                sq.insert(sq.end(), q.begin() + ((off + i) * heads + h) * dim, q.begin() + ((off + i) * heads + h + 1) * dim);
+            }
+        }
+        for (int h = 0; h < kvHeads; h++) {
+            for (int i = 0; i < len; i++) {
+                sk.insert(sk.end(), k.begin() + ((off + i) * kvHeads + h) * dim, k.begin() + ((off + i) * kvHeads + h + 1) * dim);
+                sv.insert(sv.end(), v.begin() + ((off + i) * kvHeads + h) * dim, v.begin() + ((off + i) * kvHeads + h + 1) * dim);
+            }
+        }
+        fastllm::Data sqd = fastllm::Data(fastllm::DataType::FLOAT32, {heads, len, dim}, sq);
+        fastllm::Data skd = fastllm::Data(fastllm::DataType::FLOAT32, {kvHeads, len, dim}, sk);
+        fastllm::Data svd = fastllm::Data(fastllm::DataType::FLOAT32, {kvHeads, len, dim}, sv);
+        fastllm::Data mask = fastllm::Data(fastllm::DataType::FLOAT32, {len, len}, std::vector <float> (len * len, 0.0f));
+        fastllm::Data ref;
+        fastllm::Attention(sqd, skd, svd, mask, ref, heads / kvHeads, scale, 1);
+        ref.ToDevice(fastllm::DataDevice::CPU);
+        for (int h = 0; h < heads; h++) {
+            for (int i = 0; i < len; i++) {
+                for (int d = 0; d < dim; d++) {
+                    float a = ((float*)ref.cpuData)[(h * len + i) * dim + d];
+                    float c = ((float*)output.cpuData)[((off + i) * heads + h) * dim + d];
+                    maxDiff = std::max(maxDiff, std::fabs(a - c));
+                }
+            }
+        }
+    }
+    printf("AttentionVarlen max diff = %f\n", maxDiff);
+    if (maxDiff > 1e-4) {
+        printf("AttentionVarlen error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callRingKVCacheOp(){
+    // 分段写入环形KV Cache (包括单token decode, 跨过窗口边界的分段, 比窗口更长的分段), 每段的attention结果
+    // 要和在完整KV Cache上使用滑动窗口mask的结果一致
+    int heads = 2, headDim = 8, window = 8;
+    std::vector <int> chunks = {5, 1, 1, 1, 1, 1, 1, 1, 1, 6, 1, 1, 1, 10, 1, 1};
+    int total = 0;
+    for (int len : chunks) {
+        total += len;
+    }
+    auto make = [&](int seed, int st, int len) {
+        std::vector <float> v;
+        for (int h = 0; h < heads; h++) {
+            for (int p = st; p < st + len; p++) {
+                for (int d = 0; d < headDim; d++) {
+                    v.push_back(sin((h * total + p) * headDim * 0.31f + d * 0.7f + seed));
+                }
+            }
+        }
+        return fastllm::Data(fastllm::DataType::FLOAT32, {heads, len, headDim}, v);
+    };
+    auto attend = [&](fastllm::Data &q, fastllm::Data &k, fastllm::Data &v, const fastllm::Data &mask, fastllm::Data &output) {
+        fastllm::Data weights;
+        fastllm::MatMulTransB(q, k, weights, 1.0 / sqrt(headDim), 1);
+        weights.Reshape({1, weights.dims[0], weights.dims[1], weights.dims[2]});
+        if (mask.dims.size() > 0) {
+            fastllm::AttentionMask(weights, mask, -10000);
+        }
+        fastllm::Softmax(weights, weights, -1);
+        fastllm::MatMul(weights, v, output, 1.0f, 1);
+    };
+
+    fastllm::Data ringKey, ringValue;
+    ringKey.SetKVCache();
+    ringValue.SetKVCache();
+    float maxDiff = 0.0f;
+    int pos = 0;
+    for (int len : chunks) {
+        fastllm::Data q = make(0, pos, len), k = make(1, pos, len), v = make(2, pos, len);
+        // 环形cache: 和gpt_oss的滑动窗口层一样, 多token时和cache拼接后计算, 单token时写入cache后直接计算
+        int cacheLen = ringKey.dims.size() > 0 ? ringKey.dims[1] : 0;
+        fastllm::Data catKey, catValue, ringMask, ringOutput;
+        if (len > 1) {
+            fastllm::Cat(ringKey, k, 1, catKey);
+            fastllm::Cat(ringValue, v, 1, catValue);
+            ringMask.CopyFrom(fastllm::SlidingWindowMask(pos, cacheLen, len, window));
+        }
+        fastllm::RingKVCacheWrite(ringKey, k, pos, window);
+        fastllm::RingKVCacheWrite(ringValue, v, pos, window);
+        attend(q, len > 1 ? catKey : ringKey, len > 1 ? catValue : ringValue, ringMask, ringOutput);
+
+        // 完整的cache: 位置pos + i只能看到 (pos + i - window, pos + i] 中的token
+        fastllm::Data fullKey = make(1, 0, pos + len), fullValue = make(2, 0, pos + len), fullOutput;
+        std::vector <float> mask((long long)len * (pos + len), 0.0f);
+        for (int i = 0; i < len; i++) {
+            for (int j = 0; j < pos + len; j++) {
+                mask[i * (pos + len) + j] = (j > pos + i || j <= pos + i - window) ? 1.0f : 0.0f;
+            }
+        }
+        attend(q, fullKey, fullValue, fastllm::Data(fastllm::DataType::FLOAT32, {len, pos + len}, mask), fullOutput);
+
+        for (int i = 0; i < fullOutput.Count(0); i++) {
+            maxDiff = std::max(maxDiff, std::fabs(((float*)ringOutput.cpuData)[i] - ((float*)fullOutput.cpuData)[i]));
+        }
+        pos += len;
+    }
+    printf("RingKVCache: %d tokens with window %d, cache len = %d, max diff = %f\n", total, window, ringKey.dims[1], maxDiff);
+    if (maxDiff > 1e-5 || ringKey.dims[1] != window) {
+        printf("RingKVCache error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callOpStreams(){
+    // 两个stream分到的线程区间不相交, 并且各自在自己的区间上完成计算
+    fastllm::AliveThreadPool *pool = fastllm::GetAlivePool();
+    std::vector <std::pair <int, int> > intervals(2);
+    std::vector <float> sums(2, 0.0f);
+    std::vector <std::function <void ()> > streams;
+    for (int s = 0; s < 2; s++) {
+        streams.push_back([&, s]() {
+            intervals[s] = pool->GetActivateThreadInterval();
+            std::vector <float> input(64, s + 1.0f), output(64, 0.0f);
+            float *inputs[1] = {input.data()};
+            float values[1] = {1.0f};
+            fastllm::RunMultiThreadReduce(1, inputs, values, output.data(), nullptr, 64, pool);
+            for (float v : output) {
+                sums[s] += v;
+            }
+        });
+    }
+    fastllm::RunMultiThreadStreams(streams, {3.0f, 1.0f}, pool);
+    printf("stream intervals: [%d, %d) [%d, %d)\n", intervals[0].first, intervals[0].second, intervals[1].first, intervals[1].second);
+    if (sums[0] != 64.0f || sums[1] != 128.0f || 
+        (pool->threads.size() >= 2 && intervals[0].second > intervals[1].first)) {
+        printf("OpStreams error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+// 随机权重的小llama模型, 用来测试调度循环中的解码流程; 不会生成结束符, 每个请求都生成到output_token_limit
+fastllm::LlamaModel *CreateTinyLlama(int vocab = 32, int hidden = 64, int heads = 4, int layers = 2) {
+    fastllm::LlamaModel *model = new fastllm::LlamaModel();
+    model->weight.dicts["num_hidden_layers"] = std::to_string(layers);
+    model->weight.dicts["hidden_size"] = std::to_string(hidden);
+    model->weight.dicts["num_attention_heads"] = std::to_string(heads);
+    model->weight.dicts["max_position_embeddings"] = "1024";
+    model->InitParams();
+    model->eos_token_id = -1;
+    int seed = 0;
+    auto add = [&](const std::string &name, const std::vector <int> &dims, float base, float scale) {
+        std::vector <float> v(dims[0] * (dims.size() > 1 ? dims[1] : 1));
+        for (int i = 0; i < v.size(); i++) {
+            v[i] = base + scale * sin(i * 0.37f + seed * 1.71f) * cos(i * 0.013f + seed);
+        }
+        seed++;
+        model->weight[name].CopyFrom(fastllm::Data(fastllm::DataType::FLOAT32, dims, v));
+    };
+    add("model.embed_tokens.weight", {vocab, hidden}, 0.0f, 1.0f);
+    for (int i = 0; i < layers; i++) {
+        std::string pre = "model.layers." + std::to_string(i);
+        add(pre + ".input_layernorm.weight", {hidden}, 1.0f, 0.1f);
+        add(pre + ".post_attention_layernorm.weight", {hidden}, 1.0f, 0.1f);
+        for (std::string proj : {"q_proj", "k_proj", "v_proj", "o_proj"}) {
+            add(pre + ".self_attn." + proj + ".weight", {hidden, hidden}, 0.0f, 0.2f);
+        }
+        add(pre + ".mlp.gate_proj.weight", {hidden * 2, hidden}, 0.0f, 0.2f);
+        add(pre + ".mlp.up_proj.weight", {hidden * 2, hidden}, 0.0f, 0.2f);
+        add(pre + ".mlp.down_proj.weight", {hidden, hidden * 2}, 0.0f, 0.2f);
+    }
+    add("model.norm.weight", {hidden}, 1.0f, 0.1f);
+    add("lm_head.weight", {vocab, hidden}, 0.0f, 1.0f);
+    return model;
+}
+
+std::vector <int> GenerateTokens(fastllm::basellm *model, const std::vector <int> &prompt, int maxLen) {
+    fastllm::GenerationConfig config;
+    config.output_token_limit = maxLen;
+    int handle = model->LaunchResponseTokens(prompt, config);
+    std::vector <int> ret;
+    for (int token = model->FetchResponseTokens(handle); token >= 0; token = model->FetchResponseTokens(handle)) {
+        ret.push_back(token);
+    }
+    return ret;
+}
+
+void callSamplingProbsOp(){
+    // LLMSamplingProbs给出的分布要和LLMSampling实际采样的频率一致 (重复惩罚, temperature, top_k, top_p都生效)
+    int vocab = 16, rounds = 20000;
+    std::vector <float> logits;
+    for (int i = 0; i < vocab; i++) {
+        logits.push_back(2.0f * sin(i * 1.3f));
+    }
+    fastllm::GenerationConfig config;
+    config.top_k = 6;
+    config.top_p = 0.9f;
+    config.temperature = 0.7f;
+    config.repeat_penalty = 1.3f;
+    fastllm::LastTokensUnit tokens(config.last_n);
+    tokens.Push(1);
+    tokens.Push(5);
+    std::vector <std::pair <int, float> > probs;
+    fastllm::LLMSamplingProbs(logits.data(), vocab, config, tokens, probs);
+
+    std::vector <float> freq(vocab, 0.0f), expect(vocab, 0.0f);
+    for (auto &it : probs) {
+        expect[it.first] = it.second;
+    }
+    for (int i = 0; i < rounds; i++) {
+        // LLMSampling会在logits上原地做重复惩罚, 每次使用新的logits
+        fastllm::Data cur = fastllm::Data(fastllm::DataType::FLOAT32, {1, vocab}, logits);
+        freq[fastllm::LLMSampling(cur, 0, config, tokens)] += 1.0f / rounds;
+    }
+    float maxDiff = 0.0f;
+    for (int i = 0; i < vocab; i++) {
+        maxDiff = std::max(maxDiff, std::fabs(freq[i] - expect[i]));
+    }
+    printf("SamplingProbs: %d tokens, max diff = %f\n", (int)probs.size(), maxDiff);
+    if (probs.size() < 2 || maxDiff > 0.02f) {
+        printf("SamplingProbs error: distribution mismatch.\n");
+        exit(1);
+    }
+}
+
+void callSpeculativeAcceptOp(){
+    // 从草稿分布q采样, 再经过SpeculativeAccept的接受 / 重新采样, 最终的分布要等于目标分布p
+    std::vector <std::pair <int, float> > target = {{0, 0.5f}, {1, 0.3f}, {2, 0.2f}};
+    std::vector <std::pair <int, float> > draft = {{0, 0.2f}, {1, 0.2f}, {3, 0.6f}};
+    int rounds = 20000;
+    std::vector <float> freq(4, 0.0f);
+    for (int i = 0; i < rounds; i++) {
+        int token = fastllm::SamplingFromProbs(draft);
+        int ret = fastllm::SpeculativeAccept(token, target, draft);
+        freq[ret == -1 ? token : ret] += 1.0f / rounds;
+    }
+    float maxDiff = std::fabs(freq[3]);
+    for (auto &it : target) {
+        maxDiff = std::max(maxDiff, std::fabs(freq[it.first] - it.second));
+    }
+    printf("SpeculativeAccept max diff = %f\n", maxDiff);
+    if (maxDiff > 0.02f) {
+        printf("SpeculativeAccept error: distribution mismatch.\n");
+        exit(1);
+    }
+}
+
+void callDraftModelDecodeOp(){
+    // 草稿模型提出的token由目标模型一次forward验证, 贪婪解码的结果要和不使用草稿模型时一致
+    fastllm::LlamaModel *model = CreateTinyLlama();
+    fastllm::LlamaModel *draft = CreateTinyLlama(32, 64, 4, 1);
+    std::vector <int> prompt = {3, 1, 4, 1, 5, 9, 2, 6};
+    std::vector <int> ref = GenerateTokens(model, prompt, 48);
+    model->SetDraftModel(draft, 4);
+    std::vector <int> speculative = GenerateTokens(model, prompt, 48);
+    long long draftTokens = model->metrics.draftTokens, accepted = model->metrics.acceptedDraftTokens;
+    printf("DraftModelDecode: %lld draft tokens, %lld accepted.\n", draftTokens, accepted);
+    if (ref.size() != 48 || speculative != ref || draftTokens == 0) {
+        printf("DraftModelDecode error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callPromptLookupOp(){
+    // 优先匹配最长的n-gram, 取最近一次出现之后的token, 提议不超过序列末尾; 索引随序列追加增量更新
+    auto propose = [](fastllm::PromptLookupIndex &index, const std::vector <int> &tokens, int k) {
+        index.Update(tokens);
+        return index.Propose(tokens, k);
+    };
+    fastllm::PromptLookupIndex index, longest, recent, none;
+    std::vector <int> tokens = {1, 2, 3, 4, 9, 1, 2, 3};
+    bool ok = (propose(index, tokens, 3) == std::vector <int> {4, 9, 1});
+    tokens.push_back(4);
+    ok &= (propose(index, tokens, 3) == std::vector <int> {9, 1, 2});
+    ok &= (propose(longest, {5, 3, 7, 8, 6, 3, 9, 5, 3}, 3) == std::vector <int> {7, 8, 6});
+    ok &= (propose(recent, {1, 2, 1, 3, 1}, 3) == std::vector <int> {3, 1});
+    ok &= propose(none, {1, 2, 3}, 3).empty();
+    printf("PromptLookup: %s\n", ok ? "ok" : "wrong proposals");
+    if (!ok) {
+        printf("PromptLookup error: wrong proposals.\n");
+        exit(1);
+    }
+}
+
+void callMultiTokenDecodeOp(){
+    // prompt lookup把草稿token接在当前token之后做多token的decode, 贪婪解码的结果要和逐token解码一致
+    fastllm::LlamaModel *model = CreateTinyLlama();
+    std::vector <int> prompt = {1, 2, 3, 4, 5, 1, 2, 3, 4, 5, 1, 2, 3};
+    std::vector <int> ref = GenerateTokens(model, prompt, 48);
+    model->SetPromptLookup(4);
+    std::vector <int> lookup = GenerateTokens(model, prompt, 48);
+    long long draftTokens = model->metrics.draftTokens, accepted = model->metrics.acceptedDraftTokens;
+    printf("MultiTokenDecode: %lld draft tokens, %lld accepted.\n", draftTokens, accepted);
+    if (ref.size() != 48 || lookup != ref || draftTokens == 0) {
+        printf("MultiTokenDecode error: result mismatch.\n");
+        exit(1);
+    }
+}
+
+void callTruncateKVOp(){
+    // 生成过程中回滚到prompt之后的第3个token, 之后的输出从第3个token重新生成, 贪婪解码时和不回滚的结果一致
+    fastllm::LlamaModel *model = CreateTinyLlama();
+    std::vector <int> prompt = {7, 3, 9, 11, 4, 2};
+    int maxLen = 200;
+    std::vector <int> ref = GenerateTokens(model, prompt, maxLen);
+
+    fastllm::GenerationConfig config;
+    config.output_token_limit = maxLen;
+    int handle = model->LaunchResponseTokens(prompt, config);
+    std::vector <int> tokens;
+    while (tokens.size() < 5) {
+        tokens.push_back(model->FetchResponseTokens(handle));
+    }
+    model->TruncateKV(handle, prompt.size() + 3);
+    for (int token = model->FetchResponseTokens(handle); token >= 0; token = model->FetchResponseTokens(handle)) {
+        tokens.push_back(token);
+    }
+    std::vector <int> expect = std::vector <int> (ref.begin(), ref.begin() + 5);
+    expect.insert(expect.end(), ref.begin() + 3, ref.end());
+    printf("TruncateKV: %d tokens fetched after truncation.\n", (int)tokens.size() - 5);
+    if (ref.size() != maxLen || tokens != expect) {
+        printf("TruncateKV error: result mismatch.\n");
+        exit(1);
+    }
+}
+
 void testBase(){
     printf("testing BaseOp...\n");
     for (int i=0;i<6;i++){
         callBaseOp(i);
     }
+    callOpStreams();
+    callEmbeddingOp(fastllm::DataType::INT8);
+    callEmbeddingOp(fastllm::DataType::INT4_GROUP);
+    callEmbeddingOp(fastllm::DataType::DATA_GGUF_FORMAT, GGML_TYPE_Q8_0);
     printf("test BaseOp finished!\n");
 }
 
@@ -120,12 +1186,27 @@ void testActivation(){
 void testAttention(){
     printf("testing AttentionOp...\n");
     callAttentionOp();
+    callChunkGatedDeltaRuleOp();
+    callAttentionVarlenOp();
+    callRingKVCacheOp();
     printf("test AttentionOp finished!\n");
 }
 
 void testLinaer(){
     printf("testing LinearOp...\n");
     callLinearOp();
+    callSegmentLoraOp();
+    callLinearHalfBlockedOp();
+    callLinearInt4GroupTiledOp();
+    callQuantizationAllOp();
+    callLinearLowBitOp(fastllm::DataType::INT2_GROUP);
+    callLinearLowBitOp(fastllm::DataType::BASE3_GROUP);
+    callMergeMOEOp();
+    callCalibratedQuantOp(4);
+    callCalibratedQuantOp(2);
+    callDtypePlanOp();
+    callLMHeadShortlistOp();
+    callLinearTunerOp();
     printf("test LinearOp finished!\n");
 }
 
@@ -134,15 +1215,29 @@ void testNorm(){
     for (int i=0;i<2;i++){
         callNormOp(i);
     }
+    callFusedNormOp(fastllm::DataType::INT8);
+    callFusedNormOp(fastllm::DataType::INT4_GROUP);
     printf("test NormOp finished!\n");
 }
 
+void testDecode(){
+    printf("testing DecodeOp...\n");
+    callSamplingProbsOp();
+    callSpeculativeAcceptOp();
+    callDraftModelDecodeOp();
+    callPromptLookupOp();
+    callMultiTokenDecodeOp();
+    callTruncateKVOp();
+    printf("test DecodeOp finished!\n");
+}
+
 void testAll(){
     testBase();
     testActivation();
     testAttention();
     testNorm();
     testLinaer();
+    testDecode();
 }
 
 
@@ -32,8 +32,7 @@ namespace fastllm {
                     ),
                     GGUFWeightReplaceRule (
                         std::regex(R"(token_embd.weight)"),
-                        "model.embed_tokens.weight", 
-                        GGUFWeightReplaceRule::GGUFWeightReplaceForceFP32
+                        "model.embed_tokens.weight" // Embedding可以直接从gguf格式中按行反量化, 不再转成FP32
                     ),
                     GGUFWeightReplaceRule (
                         std::regex(R"(output.weight)"),
@@ -84,8 +83,7 @@ namespace fastllm {
                     ),
                     GGUFWeightReplaceRule (
                         std::regex(R"(token_embd.weight)"),
-                        "model.embed_tokens.weight", 
-                        GGUFWeightReplaceRule::GGUFWeightReplaceForceFP32
+                        "model.embed_tokens.weight"
                     ),
                     GGUFWeightReplaceRule (
                         std::regex(R"(output.weight)"),
@@ -155,8 +153,7 @@ namespace fastllm {
                     ),
                     GGUFWeightReplaceRule (
                         std::regex(R"(token_embd.weight)"),
-                        "model.embed_tokens.weight", 
-                        GGUFWeightReplaceRule::GGUFWeightReplaceForceFP32
+                        "model.embed_tokens.weight"
                     ),
                     GGUFWeightReplaceRule (
                         std::regex(R"(output.weight)"),
@@ -235,8 +232,7 @@ namespace fastllm {
                     ),
                     GGUFWeightReplaceRule (
                         std::regex(R"(token_embd.weight)"),
-                        "model.embed_tokens.weight", 
-                        GGUFWeightReplaceRule::GGUFWeightReplaceForceFP32
+                        "model.embed_tokens.weight"
                     ),
                     GGUFWeightReplaceRule (
                         std::regex(R"(output.weight)"),
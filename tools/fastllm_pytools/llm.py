@@ -73,6 +73,18 @@ fastllm_lib.launch_response_llm_model.argtypes = [ctypes.c_int, ctypes.c_int, ct
                                                   ctypes.c_int, ctypes.POINTER(ctypes.c_int)]
 fastllm_lib.launch_response_llm_model.restype = ctypes.c_int
 
+fastllm_lib.launch_response_llm_model_with_adapter.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_void_p,
+                                                  ctypes.c_int, ctypes.c_int, ctypes.c_bool, ctypes.c_float, ctypes.c_int,
+                                                  ctypes.c_float, ctypes.c_float, ctypes.c_bool,
+                                                  ctypes.c_int, ctypes.POINTER(ctypes.c_int), ctypes.c_char_p,
+                                                  ctypes.c_int, ctypes.POINTER(ctypes.c_int)]
+fastllm_lib.launch_response_llm_model_with_adapter.restype = ctypes.c_int
+
+fastllm_lib.add_lora_adapter.argtypes = [ctypes.c_int, ctypes.c_char_p, ctypes.c_char_p]
+
+fastllm_lib.support_allowed_token_ids_llm_model.argtypes = [ctypes.c_int]
+fastllm_lib.support_allowed_token_ids_llm_model.restype = ctypes.c_bool
+
 fastllm_lib.launch_response_llm_model_multimodal.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_void_p,
                                                             ctypes.c_char_p, ctypes.c_void_p, 
                                                             ctypes.c_int, ctypes.c_int, ctypes.c_bool, ctypes.c_float, ctypes.c_int,
@@ -130,6 +142,20 @@ fastllm_lib.set_max_batch_llm_model.argtypes = [ctypes.c_int, ctypes.c_int]
 
 fastllm_lib.set_verbose_llm_model.argtypes = [ctypes.c_int, ctypes.c_bool]
 
+fastllm_lib.set_draft_model_llm_model.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_int]
+fastllm_lib.set_prompt_lookup_llm_model.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_int]
+fastllm_lib.set_lm_head_shortlist_llm_model.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_int]
+fastllm_lib.truncate_kv_llm_model.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_int]
+
+fastllm_lib.set_prefix_checkpoint_interval.argtypes = [ctypes.c_int, ctypes.c_int]
+
+fastllm_lib.get_metrics_llm_model.argtypes = [ctypes.c_int]
+fastllm_lib.get_metrics_llm_model.restype = ctypes.c_char_p
+
+fastllm_lib.set_trace.argtypes = [ctypes.c_bool]
+fastllm_lib.export_trace.argtypes = [ctypes.c_char_p]
+fastllm_lib.export_trace.restype = ctypes.c_bool
+
 fastllm_lib.get_max_input_len_llm_model.argtypes = [ctypes.c_int]
 fastllm_lib.get_max_input_len_llm_model.restype = ctypes.c_int
 
@@ -148,6 +174,8 @@ fastllm_lib.embedding_tokens.restype = ctypes.POINTER(ctypes.c_float)
 fastllm_lib.reranker_compute_score.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int)]
 fastllm_lib.reranker_compute_score.restype = ctypes.POINTER(ctypes.c_float)
 
+fastllm_lib.set_embedding_batch_wait.argtypes = [ctypes.c_int, ctypes.c_int]
+
 fastllm_lib.t2s_decode.argtypes = [ctypes.c_char_p,
     ctypes.c_int, ctypes.c_int, ctypes.c_void_p, 
     ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_void_p), 
@@ -259,6 +287,16 @@ def set_cpu_low_mem(low_mem):
 def get_cpu_low_mem():
     return fastllm_lib.get_cpu_low_mem();
 
+def set_trace(enable):
+    fastllm_lib.set_trace(ctypes.c_bool(enable));
+
+def clear_trace():
+    fastllm_lib.clear_trace();
+
+def export_trace(path: str) -> bool:
+    # 导出为Chrome trace json, 可以用 chrome://tracing 或 ui.perfetto.dev 打开
+    return fastllm_lib.export_trace(path.encode());
+
 def set_device_map(device_map, is_moe = False):
     devices = [];
     values = [];
@@ -666,6 +704,7 @@ class model:
             use_moe_dtype = True
         
         self.save_history = False
+        self.lora_adapters = set()
         self.tokenizer_cache = TokenizerCache()
         self.current_tokenizer_cache = dict()
         
@@ -885,6 +924,13 @@ class model:
             return 0, None
         else:
             return ctypes.c_int(len(stop_token_ids)), (ctypes.c_int * len(stop_token_ids))(*stop_token_ids)
+
+    def allowed_token_ctypes(self, allowed_token_ids):
+        if allowed_token_ids is None or len(allowed_token_ids) == 0:
+            return 0, None
+        if (not(fastllm_lib.support_allowed_token_ids_llm_model(self.model))):
+            raise ValueError("allowed_token_ids isn't supported by model " + self.get_struct())
+        return ctypes.c_int(len(allowed_token_ids)), (ctypes.c_int * len(allowed_token_ids))(*allowed_token_ids)
     
     def trans_conversation(self, conversation: List[Dict[str, str]]) -> List[Dict[str, str]]:
         if (self.get_struct() in ["minimax"]):
@@ -1124,7 +1170,8 @@ class model:
                         max_length: int = 8192, min_length: int = 0, do_sample = True, 
                         top_p = 0.8, top_k = 1, temperature = 1.0, repeat_penalty = 1.0,
                         one_by_one = True, stop_token_ids: List[int] = None, add_generation_prompt = True, 
-                        images: List = None, tools: List = None):
+                        images: List = None, tools: List = None, adapter_name: str = "",
+                        allowed_token_ids: List[int] = None):
         conversation = None
         if (isinstance(query, List)):
             conversation = query
@@ -1173,6 +1220,8 @@ class model:
             else:
                 prompt = query if self.direct_query else self.get_prompt(query, history)
             input = tokenizer.encode(prompt, add_special_tokens = True)
+            if (allowed_token_ids is not None):
+                raise ValueError("allowed_token_ids can't be used with images.")
             stop_token_len, stop_token_list = self.stop_token_ctypes(stop_token_ids)
             handle = fastllm_lib.launch_response_llm_model_multimodal(self.model, len(input), (ctypes.c_int * len(input))(*input),
                                                         des.encode(), (ctypes.c_float * len(image))(*image),
@@ -1206,9 +1255,11 @@ class model:
                 #print("input", input[:100])
 
             stop_token_len, stop_token_list = self.stop_token_ctypes(stop_token_ids)
-            handle = fastllm_lib.launch_response_llm_model(self.model, len(input), (ctypes.c_int * len(input))(*input),
+            allowed_token_len, allowed_token_list = self.allowed_token_ctypes(allowed_token_ids)
+            handle = fastllm_lib.launch_response_llm_model_with_adapter(self.model, len(input), (ctypes.c_int * len(input))(*input),
                                                         max_length, min_length, do_sample, top_p, top_k, temperature, repeat_penalty,
-                                                        False, stop_token_len, stop_token_list)
+                                                        False, stop_token_len, stop_token_list, self.check_lora_adapter(adapter_name),
+                                                        allowed_token_len, allowed_token_list)
             if (self.save_history):
                 self.current_tokenizer_cache[handle] = [[prompt], [input]]
             return handle
@@ -1219,6 +1270,14 @@ class model:
             else:
                 prompt = query if self.direct_query else self.get_prompt(query, history)
             stop_token_len, stop_token_list = self.stop_token_ctypes(stop_token_ids)
+            if (allowed_token_ids is not None):
+                # 按token启动的接口才能传allowed_token_ids
+                input = self.encode(prompt)
+                allowed_token_len, allowed_token_list = self.allowed_token_ctypes(allowed_token_ids)
+                return fastllm_lib.launch_response_llm_model_with_adapter(self.model, len(input), (ctypes.c_int * len(input))(*input),
+                                                        max_length, min_length, do_sample, top_p, top_k, temperature, repeat_penalty,
+                                                        False, stop_token_len, stop_token_list, self.check_lora_adapter(adapter_name),
+                                                        allowed_token_len, allowed_token_list)
             handle = fastllm_lib.launch_response_str_llm_model(self.model, prompt.encode(),
                                                             ctypes.c_int(max_length), ctypes.c_int(min_length), ctypes.c_bool(do_sample), ctypes.c_float(top_p), ctypes.c_int(top_k),
                                                             ctypes.c_float(temperature), ctypes.c_float(repeat_penalty), ctypes.c_bool(False),
@@ -1359,14 +1418,18 @@ class model:
                             input_tokens: List[int],
                             max_length: int = 8192, do_sample = True, top_p = 0.8, top_k = 1, temperature = 1.0, repeat_penalty = 1.0,
                             one_by_one = True,
-                            stop_token_ids: List[int] = None
+                            stop_token_ids: List[int] = None,
+                            adapter_name: str = "",
+                            allowed_token_ids: List[int] = None
                             ):
         stop_token_len, stop_token_list = self.stop_token_ctypes(stop_token_ids)
-        handle = fastllm_lib.launch_response_llm_model(self.model, len(input_tokens),
+        allowed_token_len, allowed_token_list = self.allowed_token_ctypes(allowed_token_ids)
+        handle = fastllm_lib.launch_response_llm_model_with_adapter(self.model, len(input_tokens),
                                                        (ctypes.c_int * len(input_tokens))(*input_tokens),
                                                        ctypes.c_int(max_length), ctypes.c_int(0), ctypes.c_bool(do_sample), ctypes.c_float(top_p), ctypes.c_int(top_k),
                                                        ctypes.c_float(temperature), ctypes.c_float(repeat_penalty), ctypes.c_bool(False),
-                                                       stop_token_len, stop_token_list)
+                                                       stop_token_len, stop_token_list, self.check_lora_adapter(adapter_name),
+                                                       allowed_token_len, allowed_token_list)
 
         # 可能遇到长尾char需要多个token才能够生成，所以只返回bytes，string.decode策略交给外部
         # 方便统计输出token数量，和控制不完整utf8时候解码的逻辑
@@ -1450,6 +1513,17 @@ class model:
     
     def disable_adapter(self):
         fastllm_lib.disable_adapter(self.model)
+
+    def add_lora_adapter(self, name: str, path: str):
+        # 加载peft格式的LoRA adapter, 之后的请求可以通过adapter_name参数选择, 同一个batch中的请求可以使用不同的adapter
+        fastllm_lib.add_lora_adapter(self.model, str(name).encode(), str(path).encode())
+        self.lora_adapters.add(str(name))
+
+    def check_lora_adapter(self, name: str):
+        name = "" if name is None else str(name)
+        if (name != "" and name not in self.lora_adapters):
+            raise ValueError("Can't find lora adapter: " + name)
+        return name.encode()
     
     def release_memory(self):
         fastllm_lib.release_memory(self.model)
@@ -1458,6 +1532,10 @@ class model:
         self.save_history = True
         fastllm_lib.set_save_history(self.model, save)
 
+    def set_prefix_checkpoint_interval(self, interval: int):
+        # 线性attention模型(如qwen3_next)prefill时每隔interval个token保存一次状态快照, 部分前缀命中时从最近的快照恢复, 0代表关闭
+        fastllm_lib.set_prefix_checkpoint_interval(self.model, interval)
+
     def set_atype(self, atype: str):
         fastllm_lib.set_model_atype(self.model, str(atype).encode())
 
@@ -1489,6 +1567,31 @@ class model:
     
     def set_verbose(self, verbose: int):
         fastllm_lib.set_verbose_llm_model(self.model, verbose)
+
+    def set_draft_model(self, draft, tokens: int = 4):
+        # 投机解码, draft为草稿模型 (需要和当前模型使用同一个tokenizer), None代表关闭
+        self.draft_model = draft
+        fastllm_lib.set_draft_model_llm_model(self.model, -1 if draft is None else draft.model, tokens)
+
+    def set_prompt_lookup(self, tokens: int = 8, max_ngram: int = 3):
+        # prompt lookup投机解码, 从prompt和已生成的内容中复制后续token, tokens = 0代表关闭
+        fastllm_lib.set_prompt_lookup_llm_model(self.model, tokens, max_ngram)
+
+    def set_lm_head_shortlist(self, candidates: int = 256, dtype: str = "int4g"):
+        # 两阶段lm_head, 先用dtype类型的lm_head选出candidates个候选token, 再计算候选token的精确logits, candidates = 0代表关闭
+        # 只对贪婪和top_k <= candidates的采样生效, 适合lm_head为float16 / bfloat16的大词表模型
+        if (dtype not in ["int8", "int4", "int4g", "int2g"]):
+            print("lm_head shortlist dtype should be one of ", ["int8", "int4", "int4g", "int2g"])
+            exit(0)
+        fastllm_lib.set_lm_head_shortlist_llm_model(self.model, candidates, fastllm_data_type_dict[dtype])
+
+    def truncate_kv(self, handle_id: int, len: int):
+        # 把请求回滚到前len个token (不能短于prompt), 之后生成的token都会丢弃, 下一步开始重新生成
+        fastllm_lib.truncate_kv_llm_model(self.model, handle_id, len)
+
+    def get_metrics(self) -> str:
+        # Prometheus文本格式的调度统计信息
+        return fastllm_lib.get_metrics_llm_model(self.model).decode()
     
     def get_max_input_len(self):
         return fastllm_lib.get_max_input_len_llm_model(self.model)
@@ -1512,6 +1615,10 @@ class model:
             #print("{:.7f}".format(embedding[i]), end=" ")
         return embedding
     
+    def set_embedding_batch_wait(self, ms: int):
+        # 并发的embedding / rerank请求会被合并成batch推理, ms为凑batch的最长等待时间, 0代表不等待
+        fastllm_lib.set_embedding_batch_wait(self.model, ms)
+
     def reranker_compute_score(self, pairs: List):
         batch = len(pairs)
         seq_lens = []
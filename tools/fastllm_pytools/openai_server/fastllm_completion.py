@@ -151,10 +151,14 @@ class FastLLmCompletion:
       # print("tools", tools)
 
       # from request.tools
-      handle = self.model.launch_stream_response(messages,
-                        max_length = max_length, min_length = min_length, do_sample = True,
-                        top_p = request.top_p, top_k = request.top_k, temperature = request.temperature,
-                        repeat_penalty = frequency_penalty, tools = tools, one_by_one = True)
+      try:
+          handle = self.model.launch_stream_response(messages,
+                            max_length = max_length, min_length = min_length, do_sample = True,
+                            top_p = request.top_p, top_k = request.top_k, temperature = request.temperature,
+                            repeat_penalty = frequency_penalty, tools = tools, one_by_one = True,
+                            allowed_token_ids = request.allowed_token_ids)
+      except ValueError as e:
+          return self.create_error_response(str(e))
       # Store the mapping between conversation ID and handle
       self.conversation_handles[request_id] = handle
       logging.info(f"Created conversation: {request_id}, handle: {handle}")
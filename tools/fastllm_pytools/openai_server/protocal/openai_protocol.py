@@ -96,6 +96,7 @@ class ChatCompletionRequest(BaseModel):
     presence_penalty: Optional[float] = 0.0
     frequency_penalty: Optional[float] = 0.0
     user: Optional[str] = None
+    allowed_token_ids: Optional[List[int]] = None # 非空时只允许生成其中的token
     tools: Optional[list[ChatCompletionToolsParam]] = None
     tool_choice: Optional[Union[
         Literal["none"],
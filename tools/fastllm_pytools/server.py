@@ -4,7 +4,8 @@ import logging
 import sys
 import uvicorn
 from fastapi import Request
-from fastapi.responses import JSONResponse, StreamingResponse
+from fastapi.concurrency import run_in_threadpool
+from fastapi.responses import JSONResponse, StreamingResponse, PlainTextResponse
 from fastapi.middleware.cors import CORSMiddleware
 
 from .openai_server.protocal.openai_protocol import *
@@ -59,14 +60,15 @@ async def create_chat_completion(request: ChatCompletionRequest,
 @app.post("/v1/embed")
 async def create_embed(request: EmbedRequest,
                        raw_request: Request):
-    embedding = fastllm_embed.embedding_sentence(request, raw_request)
+    # 在线程池中执行, 并发的请求由模型的批处理循环合并推理
+    embedding = await run_in_threadpool(fastllm_embed.embedding_sentence, request, raw_request)
     return JSONResponse(embedding)
 
 @app.post("/v1/rerank")
 async def create_rerank(request: RerankRequest,
                        raw_request: Request):
     print(request)
-    scores = fastllm_reranker.rerank(request, raw_request)    
+    scores = await run_in_threadpool(fastllm_reranker.rerank, request, raw_request)
     return JSONResponse(scores)
 
 
@@ -75,6 +77,12 @@ async def list_models():
     model_response = fastllm_model.response
     return JSONResponse(content = model_response)
 
+@app.get("/metrics")
+async def get_metrics():
+    # Prometheus格式的调度统计信息
+    return PlainTextResponse(content = fastllm_completion.model.get_metrics(),
+                             media_type = "text/plain; version=0.0.4")
+
 @app.post("/v1/cancel")
 async def cancel_generation(request: Request):
     # Check if development mode is enabled
@@ -27,6 +27,10 @@ def make_normal_parser(des: str, add_help = True) -> argparse.ArgumentParser:
     parser.add_argument('--cache_dir', type = str, default = "", help = '指定缓存模型文件的路径')
     parser.add_argument('--dtype_config', type = str, default = "", help = '指定权重类型配置文件')
     parser.add_argument('--ori', type = str, default = "", help = '原始模型权重，读取GGUF文件时可以使用')
+    parser.add_argument('--draft', type = str, default = "", help = '投机解码使用的草稿模型路径')
+    parser.add_argument('--draft_tokens', type = int, default = 4, help = '投机解码每步草稿模型提出的token数')
+    parser.add_argument('--prompt_lookup', type = int, default = 0, help = 'prompt lookup投机解码每步最多提出的token数, 0代表关闭')
+    parser.add_argument('--lm_head_shortlist', type = int, default = 0, help = '两阶段lm_head每个位置的候选token数, 0代表关闭')
 
     parser.add_argument('--tool_call_parser', type = str, default = "auto", help = '使用的tool_call_parser类型')
     parser.add_argument('--chat_template', type = str, default = "", help = '使用的chat_template文件')
@@ -209,6 +213,14 @@ def make_normal_llm_model(args):
         model.set_max_batch(args.max_batch)
     if (args.kv_cache_limit != "" and args.kv_cache_limit != "auto"):
         model.set_kv_cache_limit(args.kv_cache_limit)
+    if (args.draft != ""):
+        draft = llm.model(args.draft, dtype = args.dtype, tokenizer_type = "auto")
+        draft.set_atype(args.atype)
+        model.set_draft_model(draft, args.draft_tokens)
+    elif (args.prompt_lookup > 0):
+        model.set_prompt_lookup(args.prompt_lookup)
+    if (args.lm_head_shortlist > 0):
+        model.set_lm_head_shortlist(args.lm_head_shortlist)
     return model
 
 def make_download_parser(add_help = True):
@@ -3,6 +3,7 @@
 //
 
 #include "model.h"
+#include "trace.h"
 
 #include <cstring>
 #include <csignal>
@@ -73,6 +74,18 @@ extern "C" {
         return fastllm::GetHistoryCacheInCPU();
     }
 
+    DLL_EXPORT void set_trace(bool enable) {
+        fastllm::SetTraceEnable(enable);
+    }
+
+    DLL_EXPORT void clear_trace() {
+        fastllm::ClearTrace();
+    }
+
+    DLL_EXPORT bool export_trace(char *path) {
+        return fastllm::ExportTrace(path);
+    }
+
     DLL_EXPORT void set_device_map(int device_cnt, int *lens, char *devices, int *values) {
         std::map <std::string, int> deviceMap;
         int cur = 0;
@@ -275,6 +288,17 @@ extern "C" {
         return;
     }
 
+    DLL_EXPORT void add_lora_adapter(int modelId, char *name, char *path) {
+        auto model = models.GetModel(modelId);
+        fastllm::AddLoraAdapterFromHF(model, name, path);
+        return;
+    }
+
+    DLL_EXPORT bool support_allowed_token_ids_llm_model(int modelId) {
+        auto model = models.GetModel(modelId);
+        return model->SupportAllowedTokenIds();
+    }
+
     DLL_EXPORT void release_memory(int modelId) {
         auto model = models.GetModel(modelId);
         model->weight.ReleaseWeight();
@@ -287,6 +311,12 @@ extern "C" {
         return;
     }
 
+    DLL_EXPORT void set_prefix_checkpoint_interval(int modelId, int interval) {
+        auto model = models.GetModel(modelId);
+        model->pastKVCacheManager.SetCheckpointInterval(interval);
+        return;
+    }
+
     DLL_EXPORT void set_moe_experts(int modelId, int moe_experts) {
         auto model = models.GetModel(modelId);
         model->SetMoeExperts(moe_experts);
@@ -454,10 +484,11 @@ extern "C" {
         return string_to_chars(s);
     }
 
-    DLL_EXPORT int launch_response_llm_model(int modelId, int len, int *values,
+    DLL_EXPORT int launch_response_llm_model_with_adapter(int modelId, int len, int *values,
                                   int max_length, int min_length, bool do_sample, float top_p, int top_k,
                                   float temperature, float repeat_penalty, bool output_logits,
-                                  int stop_token_len, int * stop_token_ids) {
+                                  int stop_token_len, int * stop_token_ids, char *adapter_name,
+                                  int allowed_token_len, int *allowed_token_ids) {
         std::vector <int> input;
         for (int i = 0; i < len; i++) {
             input.push_back(values[i]);
@@ -468,10 +499,22 @@ extern "C" {
             config.stop_token_ids.insert(stop_token_ids[i]);
         }
         config.input_token_length = input.size();
+        config.adapter_name = adapter_name;
+        for (int i = 0; i < allowed_token_len; i++) {
+            config.allowed_token_ids.insert(allowed_token_ids[i]);
+        }
         auto model = models.GetModel(modelId);
         return model->LaunchResponseTokens(input, config);
     }
 
+    DLL_EXPORT int launch_response_llm_model(int modelId, int len, int *values,
+                                  int max_length, int min_length, bool do_sample, float top_p, int top_k,
+                                  float temperature, float repeat_penalty, bool output_logits,
+                                  int stop_token_len, int * stop_token_ids) {
+        return launch_response_llm_model_with_adapter(modelId, len, values, max_length, min_length, do_sample, top_p, top_k,
+                                                      temperature, repeat_penalty, output_logits, stop_token_len, stop_token_ids, (char*)"", 0, nullptr);
+    }
+
     DLL_EXPORT int launch_response_llm_model_multimodal(int modelId, int len, int *values, 
                                   char *multimodal_json, float *multimodal_data,
                                   int max_length, int min_length, bool do_sample, float top_p, int top_k,
@@ -540,11 +583,36 @@ extern "C" {
         model->maxBatch = batch;
     }
 
+    DLL_EXPORT void set_draft_model_llm_model(int modelId, int draftId, int tokens) {
+        auto model = models.GetModel(modelId);
+        model->SetDraftModel(draftId < 0 ? nullptr : models.GetModel(draftId), tokens);
+    }
+
+    DLL_EXPORT void set_prompt_lookup_llm_model(int modelId, int tokens, int maxNgram) {
+        auto model = models.GetModel(modelId);
+        model->SetPromptLookup(tokens, maxNgram);
+    }
+
+    DLL_EXPORT void set_lm_head_shortlist_llm_model(int modelId, int candidates, int proxyDataType) {
+        auto model = models.GetModel(modelId);
+        model->SetLMHeadShortlist(candidates, (fastllm::DataType)proxyDataType);
+    }
+
+    DLL_EXPORT void truncate_kv_llm_model(int modelId, int handleId, int len) {
+        auto model = models.GetModel(modelId);
+        model->TruncateKV(handleId, len);
+    }
+
     DLL_EXPORT void set_verbose_llm_model(int modelId, bool verbose) {
         auto model = models.GetModel(modelId);
         model->verbose = verbose;
     }
 
+    DLL_EXPORT char *get_metrics_llm_model(int modelId) {
+        auto model = models.GetModel(modelId);
+        return string_to_chars(model->GetMetrics());
+    }
+
     DLL_EXPORT int get_max_input_len_llm_model(int modelId) {
         auto model = models.GetModel(modelId);
         return model->max_positions;
@@ -585,6 +653,11 @@ extern "C" {
         return fvalue;
     }
 
+    DLL_EXPORT void set_embedding_batch_wait(int modelId, int ms) {
+        fastllm::BertModel *model = (fastllm::BertModel*)models.GetModel(modelId);
+        model->SetEmbeddingBatchWait(ms);
+    }
+
     DLL_EXPORT float* reranker_compute_score(int modelId, int batch, int *seqLens, int *tokens) {
         fastllm::BertModel *model = (fastllm::BertModel*)models.GetModel(modelId);
         std::vector <std::vector <int> > inputIds;
@@ -2,21 +2,37 @@
 // Created by huangyuyang on 5/13/23.
 //
 
+#include <fstream>
 #include <iostream>
 #include "model.h"
+#include "calibration.h"
 
 struct QuantConfig {
     std::string path; // 模型文件路径
     std::string output; // 输出文件路径
     int bits; // 量化位数
+    int groupCnt = -1; // 分组量化的组大小, <= 0代表按通道量化
+    std::string calibPath; // 校准文本路径, 每行一条
+    int calibSamples = 128; // 最多使用的校准文本条数
+    std::string planPath; // 输出混合精度dtype config的路径
+    std::string planDtypes = "int4g,int8,float16"; // 混合精度的候选类型
+    float budgetMemory = -1; // 线性层总大小的上限 (GB)
+    float budgetLatency = -1; // 线性层单token总耗时的上限 (ms)
 };
 
 void Usage() {
     std::cout << "Usage:" << std::endl;
     std::cout << "[-h|--help]:                      显示帮助" << std::endl;
     std::cout << "<-p|--path> <args>:               模型文件的路径" << std::endl;
-    std::cout << "<-b|--bits> <args>:               量化位数, 4 = int4, 8 = int8, 16 = fp16" << std::endl;
+    std::cout << "<-b|--bits> <args>:               量化位数, 2 = int2 (需要分组), 4 = int4, 8 = int8, 16 = fp16" << std::endl;
     std::cout << "<-o|--output> <args>:             输出文件路径" << std::endl;
+    std::cout << "<-g|--group> <args>:              分组量化的组大小, 设置后int4 / int2权重存为INT4_GROUP / INT2_GROUP (int2默认128)" << std::endl;
+    std::cout << "<-c|--calib> <args>:              校准文本路径, 每行一条, 分组量化时按校准激活做截断搜索和GPTQ误差补偿" << std::endl;
+    std::cout << "<--calib_samples> <args>:         最多使用的校准文本条数, 默认128" << std::endl;
+    std::cout << "<--plan> <args>:                  按校准文本测量每个线性层在各候选类型下的误差和耗时, 输出满足预算的dtype config (需要--calib)" << std::endl;
+    std::cout << "<--plan_dtypes> <args>:           混合精度的候选类型, 默认int4g,int8,float16" << std::endl;
+    std::cout << "<--budget_memory> <args>:         线性层总大小的上限 (GB)" << std::endl;
+    std::cout << "<--budget_latency> <args>:        线性层单token总耗时的上限 (ms)" << std::endl;
 }
 
 void ParseArgs(int argc, char **argv, QuantConfig &config) {
@@ -34,6 +50,20 @@ void ParseArgs(int argc, char **argv, QuantConfig &config) {
 			config.bits = atoi(sargv[++i].c_str());
 		} else if (sargv[i] == "-o" || sargv[i] == "--output") {
 			config.output = sargv[++i];
+		} else if (sargv[i] == "-g" || sargv[i] == "--group") {
+			config.groupCnt = atoi(sargv[++i].c_str());
+		} else if (sargv[i] == "-c" || sargv[i] == "--calib") {
+			config.calibPath = sargv[++i];
+		} else if (sargv[i] == "--calib_samples") {
+			config.calibSamples = atoi(sargv[++i].c_str());
+		} else if (sargv[i] == "--plan") {
+			config.planPath = sargv[++i];
+		} else if (sargv[i] == "--plan_dtypes") {
+			config.planDtypes = sargv[++i];
+		} else if (sargv[i] == "--budget_memory") {
+			config.budgetMemory = atof(sargv[++i].c_str());
+		} else if (sargv[i] == "--budget_latency") {
+			config.budgetLatency = atof(sargv[++i].c_str());
 		} else if (sargv[i] == "-m" || sargv[i] == "--model") {
             i++;
         } else {
@@ -43,10 +73,170 @@ void ParseArgs(int argc, char **argv, QuantConfig &config) {
 	}
 }
 
+// 只做prefill, 统计每个Linear的输入
+void RunCalibration(fastllm::basellm *model, QuantConfig &config, int groupCnt, int sampleRows) {
+    std::ifstream fi(config.calibPath);
+    if (!fi.good()) {
+        std::cout << "Can't open calibration file " << config.calibPath << std::endl;
+        exit(-1);
+    }
+    fastllm::GenerationConfig generationConfig;
+    generationConfig.output_token_limit = 1;
+    fastllm::StartCalibration(groupCnt, sampleRows);
+    std::string line;
+    int samples = 0;
+    while (samples < config.calibSamples && std::getline(fi, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        model->Response(line, nullptr, generationConfig);
+        printf("calibration (%d / %d)\r", ++samples, config.calibSamples);
+        fflush(stdout);
+    }
+    printf("\n");
+    fastllm::StopCalibration();
+}
+
+// 每组权重 (加载时会合并的权重为一组, 需要相同的类型) 测量各候选类型, 按预算选择后写成dtype config
+// loaderNames: 刚加载完时的权重名, 计划只能对这些权重 (和加载时合并前的各部分) 生成规则
+void WriteDtypePlan(fastllm::basellm *model, QuantConfig &config, const std::set <std::string> &loaderNames) {
+    std::vector <std::string> dtypes;
+    std::string cur = "";
+    for (char c : config.planDtypes + ",") {
+        if (c == ',') {
+            if (cur != "") {
+                dtypes.push_back(cur);
+            }
+            cur = "";
+        } else {
+            cur += c;
+        }
+    }
+
+    auto &weights = model->weight.weight;
+    auto isLinear = [&](const std::string &name) {
+        auto it = weights.find(name);
+        return it != weights.end() && it->second.weightType == fastllm::WeightType::LINEAR && it->second.dims.size() == 2 &&
+               fastllm::GetLinearCalibrationStats(name) != nullptr;
+    };
+    std::vector <std::vector <std::string> > units;
+    std::set <std::string> used;
+    for (auto &rule : model->weightMergeRules) {
+        for (auto &single : rule.rules) {
+            std::vector <std::string> unit;
+            for (auto &input : single.inputs) {
+                if (isLinear(input) && used.find(input) == used.end()) {
+                    unit.push_back(input);
+                }
+            }
+            if (unit.size() > 0) {
+                units.push_back(unit);
+                used.insert(unit.begin(), unit.end());
+            }
+        }
+    }
+    std::vector <std::string> names;
+    for (auto &it : weights) {
+        names.push_back(it.first);
+    }
+    std::sort(names.begin(), names.end());
+    for (auto &name : names) {
+        if (isLinear(name) && used.find(name) == used.end()) {
+            units.push_back({name});
+        }
+    }
+
+    std::vector <std::vector <fastllm::LinearDtypeProfile> > profiles;
+    for (int i = 0; i < units.size(); i++) {
+        std::vector <fastllm::LinearDtypeProfile> sum;
+        for (auto &name : units[i]) {
+            auto cur = fastllm::ProfileLinearDtypes(weights[name], dtypes);
+            if (sum.size() == 0) {
+                sum = cur;
+                continue;
+            }
+            // 只保留组内每个权重都能使用的类型
+            std::vector <fastllm::LinearDtypeProfile> merged;
+            for (auto &a : sum) {
+                for (auto &b : cur) {
+                    if (a.dtype == b.dtype) {
+                        merged.push_back(a);
+                        merged.back().bytes += b.bytes;
+                        merged.back().seconds += b.seconds;
+                        merged.back().error += b.error;
+                    }
+                }
+            }
+            sum = merged;
+        }
+        if (sum.size() == 0) {
+            std::cout << "Warning: no candidate dtype for " << units[i][0] << std::endl;
+            units.erase(units.begin() + i);
+            i--;
+            continue;
+        }
+        profiles.push_back(sum);
+        printf("profile (%d / %d)\r", i + 1, (int)units.size());
+        fflush(stdout);
+    }
+    printf("\n");
+
+    auto choice = fastllm::PlanLinearDtypes(profiles, config.budgetMemory * 1e9, config.budgetLatency * 1e-3);
+    double totalBytes = 0, totalSeconds = 0, totalError = 0;
+    std::vector <fastllm::DtypePlanEntry> entries;
+    for (int i = 0; i < units.size(); i++) {
+        auto &p = profiles[i][choice[i]];
+        totalBytes += p.bytes;
+        totalSeconds += p.seconds;
+        totalError += p.error;
+        char comment[256];
+        snprintf(comment, sizeof(comment), "error %.3e, %.3f MB, %.3f ms (group)", p.error, p.bytes / 1e6, p.seconds * 1e3);
+        entries.push_back(fastllm::DtypePlanEntry {units[i], p.dtype, comment});
+    }
+    std::vector <std::string> skipped;
+    std::string plan = fastllm::DtypePlanToConfig(entries, model->mergedWeightParts, loaderNames, skipped);
+    for (auto &name : skipped) {
+        std::cout << "Warning: " << name << " is created after loading, can't be set by dtype config." << std::endl;
+    }
+    FILE *fo = fopen(config.planPath.c_str(), "w");
+    if (fo == nullptr) {
+        std::cout << "Can't open " << config.planPath << std::endl;
+        exit(-1);
+    }
+    fprintf(fo, "%s", plan.c_str());
+    fclose(fo);
+    printf("linear weights: %.3f GB, %.3f ms / token, error sum %.3e\n", totalBytes / 1e9, totalSeconds * 1e3, totalError);
+}
+
 int main(int argc, char **argv) {
     QuantConfig config;
     ParseArgs(argc, argv, config);
+    if (config.bits == 2 && config.groupCnt <= 0) {
+        config.groupCnt = 128;
+    }
     auto model = fastllm::CreateLLMModelFromFile(config.path);
-    model->SaveLowBitModel(config.output, config.bits);
+    if (config.planPath != "") {
+        // 校准时的forward可能还会改写权重 (例如合并), 先记录加载器产生的权重名
+        std::set <std::string> loaderNames;
+        for (auto &it : model->weight.weight) {
+            loaderNames.insert(it.first);
+        }
+        if (config.calibPath == "") {
+            std::cout << "--plan needs calibration text (--calib)." << std::endl;
+            exit(-1);
+        }
+        RunCalibration(model.get(), config, config.groupCnt > 0 ? config.groupCnt : 128, 64);
+        WriteDtypePlan(model.get(), config, loaderNames);
+        return 0;
+    }
+    if (config.groupCnt <= 0) {
+        model->SaveLowBitModel(config.output, config.bits);
+        return 0;
+    }
+
+    if (config.calibPath != "") {
+        RunCalibration(model.get(), config, config.groupCnt, 0);
+    }
+    model->weight.SaveGroupLowBitModel(config.output, config.bits, config.groupCnt);
     return 0;
 }
\ No newline at end of file